@@ -36,15 +36,39 @@ struct acpi_madt {
     uint32_t flags;
 } __attribute__((packed));
 
+#define ACPI_MAX_CPUS 32
+#define ACPI_MAX_ISOS 16
+
+struct acpi_iso {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+};
+
+struct acpi_mcfg_entry {
+    uint64_t base;
+    uint16_t segment;
+    uint8_t start_bus;
+    uint8_t end_bus;
+    uint32_t reserved;
+} __attribute__((packed));
+
 struct acpi_state {
     uint64_t rsdp_phys;
     uint32_t lapic_addr;
     uint32_t ioapic_addr;
+    uint32_t ioapic_gsi_base;
     uint8_t ioapic_id;
     uint8_t cpu_count;
     uint8_t ioapic_count;
     uint8_t iso_count;
     uint8_t ready;
+    uint64_t mcfg_base;
+    uint8_t mcfg_start_bus;
+    uint8_t mcfg_end_bus;
+    uint8_t mcfg_present;
+    uint8_t cpu_apic_ids[ACPI_MAX_CPUS];
+    struct acpi_iso isos[ACPI_MAX_ISOS];
 };
 
 static struct acpi_state acpi;
@@ -130,19 +154,50 @@ static void acpi_parse_madt(const struct acpi_madt *madt)
         if (type == 0 && len >= 8) {
             uint32_t flags = *(const uint32_t *)(ptr + 4);
             if (flags & 0x1) {
+                if (acpi.cpu_count < ACPI_MAX_CPUS) {
+                    acpi.cpu_apic_ids[acpi.cpu_count] = ptr[3];
+                }
                 acpi.cpu_count++;
             }
         } else if (type == 1 && len >= 12) {
-            acpi.ioapic_id = ptr[2];
-            acpi.ioapic_addr = *(const uint32_t *)(ptr + 4);
+            /* Keep the first IOAPIC; it owns the ISA range on PC platforms. */
+            if (acpi.ioapic_count == 0) {
+                acpi.ioapic_id = ptr[2];
+                acpi.ioapic_addr = *(const uint32_t *)(ptr + 4);
+                acpi.ioapic_gsi_base = *(const uint32_t *)(ptr + 8);
+            }
             acpi.ioapic_count++;
         } else if (type == 2 && len >= 10) {
-            acpi.iso_count++;
+            if (acpi.iso_count < ACPI_MAX_ISOS) {
+                struct acpi_iso *iso = &acpi.isos[acpi.iso_count];
+                iso->source = ptr[3];
+                iso->gsi = *(const uint32_t *)(ptr + 4);
+                iso->flags = *(const uint16_t *)(ptr + 8);
+                acpi.iso_count++;
+            }
         }
         ptr += len;
     }
 }
 
+static void acpi_parse_mcfg(const struct acpi_sdt *mcfg)
+{
+    /* 8 reserved bytes follow the header, then one entry per segment range. */
+    const uint8_t *ptr = (const uint8_t *)mcfg + sizeof(*mcfg) + 8;
+    const uint8_t *end = (const uint8_t *)mcfg + mcfg->length;
+    while (ptr + sizeof(struct acpi_mcfg_entry) <= end) {
+        const struct acpi_mcfg_entry *entry = (const struct acpi_mcfg_entry *)ptr;
+        if (entry->segment == 0 && entry->base) {
+            acpi.mcfg_base = entry->base;
+            acpi.mcfg_start_bus = entry->start_bus;
+            acpi.mcfg_end_bus = entry->end_bus;
+            acpi.mcfg_present = 1;
+            return;
+        }
+        ptr += sizeof(struct acpi_mcfg_entry);
+    }
+}
+
 void acpi_init(void)
 {
     acpi = (struct acpi_state){0};
@@ -161,10 +216,68 @@ void acpi_init(void)
     if (madt_hdr) {
         acpi_parse_madt((const struct acpi_madt *)madt_hdr);
     }
+    const struct acpi_sdt *mcfg_hdr = acpi_find_table(rsdp, "MCFG");
+    if (mcfg_hdr && checksum_ok((const uint8_t *)mcfg_hdr, mcfg_hdr->length)) {
+        acpi_parse_mcfg(mcfg_hdr);
+    }
     acpi.ready = 1;
     log_info("ACPI tables discovered");
 }
 
+uint32_t acpi_lapic_addr(void)
+{
+    return acpi.ready ? acpi.lapic_addr : 0;
+}
+
+int acpi_ioapic_info(uint32_t *addr, uint8_t *id, uint32_t *gsi_base)
+{
+    if (!acpi.ready || acpi.ioapic_count == 0) {
+        return -1;
+    }
+    if (addr) *addr = acpi.ioapic_addr;
+    if (id) *id = acpi.ioapic_id;
+    if (gsi_base) *gsi_base = acpi.ioapic_gsi_base;
+    return 0;
+}
+
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t *flags)
+{
+    for (uint8_t i = 0; i < acpi.iso_count; ++i) {
+        if (acpi.isos[i].source == irq) {
+            if (flags) *flags = acpi.isos[i].flags;
+            return acpi.isos[i].gsi;
+        }
+    }
+    /* No override: ISA IRQs are identity-mapped, edge-triggered, active high. */
+    if (flags) *flags = 0;
+    return irq;
+}
+
+int acpi_mcfg_info(uint64_t *base, uint8_t *start_bus, uint8_t *end_bus)
+{
+    if (!acpi.ready || !acpi.mcfg_present) {
+        return -1;
+    }
+    if (base) *base = acpi.mcfg_base;
+    if (start_bus) *start_bus = acpi.mcfg_start_bus;
+    if (end_bus) *end_bus = acpi.mcfg_end_bus;
+    return 0;
+}
+
+uint8_t acpi_cpu_count(void)
+{
+    uint8_t count = acpi.cpu_count;
+    return count > ACPI_MAX_CPUS ? ACPI_MAX_CPUS : count;
+}
+
+int acpi_cpu_apic_id(uint8_t cpu)
+{
+    if (cpu >= acpi_cpu_count()) {
+        return -1;
+    }
+    return acpi.cpu_apic_ids[cpu];
+}
+
 void acpi_dump(void)
 {
     console_write("ACPI:\n");
@@ -185,4 +298,22 @@ void acpi_dump(void)
     console_write(" ISO=");
     console_write_hex(acpi.iso_count);
     console_write("\n");
+    if (acpi.mcfg_present) {
+        console_write("  MCFG=");
+        console_write_hex(acpi.mcfg_base);
+        console_write(" buses=");
+        console_write_hex(acpi.mcfg_start_bus);
+        console_write("-");
+        console_write_hex(acpi.mcfg_end_bus);
+        console_write("\n");
+    }
+    for (uint8_t i = 0; i < acpi.iso_count; ++i) {
+        console_write("  ISO IRQ");
+        console_write_hex(acpi.isos[i].source);
+        console_write(" -> GSI");
+        console_write_hex(acpi.isos[i].gsi);
+        console_write(" flags=");
+        console_write_hex(acpi.isos[i].flags);
+        console_write("\n");
+    }
 }
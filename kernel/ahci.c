@@ -0,0 +1,650 @@
+#include "drivers/ahci.h"
+#include "kernel/block.h"
+#include "kernel/heap.h"
+#include "kernel/irq.h"
+#include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/pci.h"
+#include "kernel/spinlock.h"
+#include <arch/processor.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* HBA (generic host control) registers. */
+#define AHCI_CAP 0x00
+#define AHCI_GHC 0x04
+#define AHCI_IS  0x08
+#define AHCI_PI  0x0C
+
+#define AHCI_CAP_NCS_SHIFT 8
+#define AHCI_CAP_NCS_MASK 0x1F
+#define AHCI_CAP_SNCQ (1u << 30)
+#define AHCI_CAP_S64A (1u << 31)
+#define AHCI_GHC_IE (1u << 1)
+#define AHCI_GHC_AE (1u << 31)
+
+/* Port registers, relative to 0x100 + port * 0x80. */
+#define AHCI_PORT_BASE 0x100
+#define AHCI_PORT_STRIDE 0x80
+#define PX_CLB  0x00
+#define PX_CLBU 0x04
+#define PX_FB   0x08
+#define PX_FBU  0x0C
+#define PX_IS   0x10
+#define PX_IE   0x14
+#define PX_CMD  0x18
+#define PX_TFD  0x20
+#define PX_SIG  0x24
+#define PX_SSTS 0x28
+#define PX_SERR 0x30
+#define PX_SACT 0x34
+#define PX_CI   0x38
+
+#define PX_CMD_ST  (1u << 0)
+#define PX_CMD_FRE (1u << 4)
+#define PX_CMD_FR  (1u << 14)
+#define PX_CMD_CR  (1u << 15)
+
+#define PX_IS_DHRS (1u << 0)
+#define PX_IS_PSS  (1u << 1)
+#define PX_IS_SDBS (1u << 3)
+#define PX_IS_OFS  (1u << 24)
+#define PX_IS_IFS  (1u << 27)
+#define PX_IS_HBDS (1u << 28)
+#define PX_IS_HBFS (1u << 29)
+#define PX_IS_TFES (1u << 30)
+#define PX_IS_ERROR (PX_IS_OFS | PX_IS_IFS | PX_IS_HBDS | PX_IS_HBFS | PX_IS_TFES)
+
+#define PX_TFD_ERR 0x01
+#define PX_TFD_DRQ 0x08
+#define PX_TFD_BSY 0x80
+
+#define PX_SSTS_DET_PRESENT 0x3
+#define PX_SSTS_IPM_ACTIVE 0x1
+#define AHCI_SIG_ATA 0x00000101u
+
+#define FIS_TYPE_REG_H2D 0x27
+#define FIS_H2D_COMMAND 0x80
+
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_FPDMA 0x60
+#define ATA_CMD_WRITE_FPDMA 0x61
+#define ATA_CMD_IDENTIFY 0xEC
+#define ATA_CMD_FLUSH_EXT 0xEA
+#define ATA_DEVICE_LBA 0x40
+
+#define AHCI_MAX_PORTS 32
+#define AHCI_CMD_SLOTS 32
+/* A command table is exactly one page: 128-byte header plus 248 PRD entries. */
+#define AHCI_PRDT_ENTRIES 248
+/* A sector buffer may straddle a page, so allow two PRD entries per sector. */
+#define AHCI_MAX_SECTORS 120
+#define AHCI_PRD_MAX_BYTES (4ULL * 1024 * 1024)
+#define AHCI_FIS_OFFSET 0x400
+#define AHCI_SPIN_TIMEOUT 10000000
+
+struct ahci_cmd_header {
+    uint16_t flags;      /* CFL in bits 0-4, W = bit 6 */
+    uint16_t prdtl;
+    volatile uint32_t prdbc;
+    uint32_t ctba;
+    uint32_t ctbau;
+    uint32_t reserved[4];
+};
+
+#define AHCI_HDR_WRITE (1u << 6)
+
+struct ahci_prd {
+    uint32_t dba;
+    uint32_t dbau;
+    uint32_t reserved;
+    uint32_t dbc; /* byte count - 1, bit 31 = interrupt on completion */
+};
+
+struct ahci_cmd_table {
+    uint8_t cfis[64];
+    uint8_t acmd[16];
+    uint8_t reserved[48];
+    struct ahci_prd prdt[AHCI_PRDT_ENTRIES];
+};
+
+_Static_assert(sizeof(struct ahci_cmd_table) == 4096, "AHCI command table must be one page");
+
+struct ahci_port {
+    struct block_device dev; /* first: block callbacks cast back to the port */
+    volatile uint32_t *regs;
+    uint32_t index;
+    char name[8];
+    struct ahci_cmd_header *cmd_list;
+    struct ahci_cmd_table *tables[AHCI_CMD_SLOTS];
+    uint32_t slot_mask;      /* slots this port may use */
+    uint32_t busy;           /* slots owned by a request */
+    uint32_t issued;         /* subset of busy already handed to the HBA */
+    struct block_request *slot_rq[AHCI_CMD_SLOTS];
+    int ncq;
+    uint32_t max_depth;
+    spinlock_t lock;
+};
+
+struct ahci_hba {
+    struct pci_device *pci;
+    volatile uint8_t *abar;
+    uint32_t cap;
+    int s64;
+    int irq_mode;
+    int vector;
+    struct ahci_port *ports[AHCI_MAX_PORTS];
+};
+
+static struct ahci_hba ahci;
+static int ahci_disk_count;
+
+static inline uint32_t hba_read(uint32_t reg)
+{
+    return *(volatile uint32_t *)(ahci.abar + reg);
+}
+
+static inline void hba_write(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t *)(ahci.abar + reg) = value;
+}
+
+static inline uint32_t port_read(const struct ahci_port *p, uint32_t reg)
+{
+    return p->regs[reg / 4];
+}
+
+static inline void port_write(struct ahci_port *p, uint32_t reg, uint32_t value)
+{
+    p->regs[reg / 4] = value;
+}
+
+static int ahci_wait_clear(struct ahci_port *p, uint32_t reg, uint32_t bits)
+{
+    for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i) {
+        if (!(port_read(p, reg) & bits)) {
+            return 0;
+        }
+        arch_cpu_relax();
+    }
+    return -1;
+}
+
+/* Zeroed DMA page; without S64A the HBA can only reach the low 4 GiB. */
+static void *ahci_alloc_page(uint64_t *phys_out)
+{
+    uint64_t phys = pmm_alloc_page();
+    if (!phys) {
+        return NULL;
+    }
+    if (!ahci.s64 && phys >= 0x100000000ULL) {
+        pmm_free_page(phys);
+        return NULL;
+    }
+    uint64_t *page = (uint64_t *)phys_to_hhdm(phys);
+    for (uint32_t i = 0; i < 512; ++i) {
+        page[i] = 0;
+    }
+    *phys_out = phys;
+    return page;
+}
+
+static int ahci_port_stop(struct ahci_port *p)
+{
+    port_write(p, PX_CMD, port_read(p, PX_CMD) & ~PX_CMD_ST);
+    if (ahci_wait_clear(p, PX_CMD, PX_CMD_CR) != 0) {
+        return -1;
+    }
+    port_write(p, PX_CMD, port_read(p, PX_CMD) & ~PX_CMD_FRE);
+    return ahci_wait_clear(p, PX_CMD, PX_CMD_FR);
+}
+
+static int ahci_port_start(struct ahci_port *p)
+{
+    if (ahci_wait_clear(p, PX_TFD, PX_TFD_BSY | PX_TFD_DRQ) != 0) {
+        return -1;
+    }
+    port_write(p, PX_CMD, port_read(p, PX_CMD) | PX_CMD_FRE);
+    port_write(p, PX_CMD, port_read(p, PX_CMD) | PX_CMD_ST);
+    return 0;
+}
+
+/* Append a buffer to a command's PRDT, splitting at pages and merging contiguous runs. */
+static int ahci_prd_add(struct ahci_cmd_table *t, uint32_t *n, const uint8_t *virt, uint64_t len)
+{
+    while (len) {
+        uint64_t phys = 0;
+        if (mmu_translate((uint64_t)virt, &phys) != 0) {
+            return -1;
+        }
+        uint64_t chunk = 0x1000 - ((uint64_t)virt & 0xFFF);
+        if (chunk > len) {
+            chunk = len;
+        }
+        if ((phys & 1) || (!ahci.s64 && phys + chunk > 0x100000000ULL)) {
+            return -1;
+        }
+        struct ahci_prd *last = *n ? &t->prdt[*n - 1] : NULL;
+        uint64_t last_addr = last ? ((uint64_t)last->dbau << 32 | last->dba) : 0;
+        uint64_t last_len = last ? (uint64_t)(last->dbc & 0x3FFFFF) + 1 : 0;
+        if (last && last_addr + last_len == phys && last_len + chunk <= AHCI_PRD_MAX_BYTES) {
+            last->dbc = (uint32_t)(last_len + chunk - 1);
+        } else {
+            if (*n >= AHCI_PRDT_ENTRIES) {
+                return -1;
+            }
+            t->prdt[*n].dba = (uint32_t)phys;
+            t->prdt[*n].dbau = (uint32_t)(phys >> 32);
+            t->prdt[*n].reserved = 0;
+            t->prdt[*n].dbc = (uint32_t)(chunk - 1);
+            ++*n;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static void ahci_build_fis(uint8_t *fis, uint8_t command, uint64_t lba, uint16_t count,
+                           uint16_t features, uint8_t device)
+{
+    for (int i = 0; i < 20; ++i) {
+        fis[i] = 0;
+    }
+    fis[0] = FIS_TYPE_REG_H2D;
+    fis[1] = FIS_H2D_COMMAND;
+    fis[2] = command;
+    fis[3] = (uint8_t)features;
+    fis[4] = (uint8_t)lba;
+    fis[5] = (uint8_t)(lba >> 8);
+    fis[6] = (uint8_t)(lba >> 16);
+    fis[7] = device;
+    fis[8] = (uint8_t)(lba >> 24);
+    fis[9] = (uint8_t)(lba >> 32);
+    fis[10] = (uint8_t)(lba >> 40);
+    fis[11] = (uint8_t)(features >> 8);
+    fis[12] = (uint8_t)count;
+    fis[13] = (uint8_t)(count >> 8);
+}
+
+static void ahci_fill_header(struct ahci_port *p, uint32_t slot, uint32_t prdtl, int write)
+{
+    struct ahci_cmd_header *h = &p->cmd_list[slot];
+    h->flags = (uint16_t)(5 | (write ? AHCI_HDR_WRITE : 0)); /* CFL: 5 dwords */
+    h->prdtl = (uint16_t)prdtl;
+    h->prdbc = 0;
+}
+
+static void ahci_port_recover(struct ahci_port *p)
+{
+    log_info_hex("AHCI: port error, TFD", port_read(p, PX_TFD));
+    (void)ahci_port_stop(p);
+    port_write(p, PX_SERR, 0xFFFFFFFFu);
+    port_write(p, PX_IS, 0xFFFFFFFFu);
+    (void)ahci_port_start(p);
+}
+
+/*
+ * Retire every slot the HBA has finished. On a task-file error the port is
+ * restarted and everything still outstanding fails, since the device aborts
+ * the whole NCQ queue anyway.
+ */
+static void ahci_port_complete(struct ahci_port *p)
+{
+    struct block_request *done_rq[AHCI_CMD_SLOTS];
+    int done_status[AHCI_CMD_SLOTS];
+    uint32_t ndone = 0;
+
+    uint32_t is = port_read(p, PX_IS);
+    port_write(p, PX_IS, is);
+
+    arch_flags_t flags = spinlock_acquire_irqsave(&p->lock);
+    uint32_t active = port_read(p, PX_CI) | port_read(p, PX_SACT);
+    uint32_t finished = p->issued & ~active;
+    uint32_t failed = 0;
+    if (is & PX_IS_ERROR) {
+        failed = p->issued & active;
+        ahci_port_recover(p);
+    }
+    for (uint32_t slot = 0; slot < AHCI_CMD_SLOTS; ++slot) {
+        uint32_t bit = 1u << slot;
+        if (!((finished | failed) & bit)) {
+            continue;
+        }
+        done_rq[ndone] = p->slot_rq[slot];
+        done_status[ndone] = (failed & bit) ? -1 : 0;
+        ++ndone;
+        p->slot_rq[slot] = NULL;
+    }
+    p->busy &= ~(finished | failed);
+    p->issued &= ~(finished | failed);
+    spinlock_release_irqrestore(&p->lock, flags);
+
+    for (uint32_t i = 0; i < ndone; ++i) {
+        block_request_done(&p->dev, done_rq[i], done_status[i]);
+    }
+}
+
+static void ahci_irq(void *ctx)
+{
+    (void)ctx;
+    uint32_t pending = hba_read(AHCI_IS);
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; ++i) {
+        if ((pending & (1u << i)) && ahci.ports[i]) {
+            ahci_port_complete(ahci.ports[i]);
+        }
+    }
+    hba_write(AHCI_IS, pending);
+}
+
+static int ahci_queue_rq(struct block_device *bdev, struct block_request *rq)
+{
+    struct ahci_port *p = (struct ahci_port *)bdev;
+    int write = rq->op == BLOCK_OP_WRITE;
+    int queued = p->ncq && rq->op != BLOCK_OP_FLUSH;
+
+    arch_flags_t flags = spinlock_acquire_irqsave(&p->lock);
+    uint32_t free_slots = p->slot_mask & ~p->busy;
+    /* Non-queued commands may not overlap NCQ ones. */
+    if (!free_slots || (!queued && p->ncq && p->busy)) {
+        spinlock_release_irqrestore(&p->lock, flags);
+        return BLOCK_QUEUE_BUSY;
+    }
+    uint32_t slot = (uint32_t)__builtin_ctz(free_slots);
+    p->busy |= 1u << slot;
+    p->slot_rq[slot] = rq;
+    uint32_t depth = (uint32_t)__builtin_popcount(p->busy);
+    if (depth > p->max_depth) {
+        p->max_depth = depth;
+    }
+    spinlock_release_irqrestore(&p->lock, flags);
+
+    struct ahci_cmd_table *t = p->tables[slot];
+    uint32_t prdtl = 0;
+    if (rq->op != BLOCK_OP_FLUSH) {
+        for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+            for (uint32_t i = 0; i < bio->vcnt; ++i) {
+                if (ahci_prd_add(t, &prdtl, (const uint8_t *)bio->vecs[i].buf, bio->vecs[i].len) != 0) {
+                    flags = spinlock_acquire_irqsave(&p->lock);
+                    p->busy &= ~(1u << slot);
+                    p->slot_rq[slot] = NULL;
+                    spinlock_release_irqrestore(&p->lock, flags);
+                    return -1;
+                }
+            }
+        }
+    }
+
+    if (rq->op == BLOCK_OP_FLUSH) {
+        ahci_build_fis(t->cfis, ATA_CMD_FLUSH_EXT, 0, 0, 0, 0);
+    } else if (queued) {
+        /* FPDMA: sector count travels in FEATURES, the tag in COUNT[7:3]. */
+        ahci_build_fis(t->cfis, write ? ATA_CMD_WRITE_FPDMA : ATA_CMD_READ_FPDMA, rq->lba,
+                       (uint16_t)(slot << 3), (uint16_t)rq->sectors, ATA_DEVICE_LBA);
+    } else {
+        ahci_build_fis(t->cfis, write ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_READ_DMA_EXT, rq->lba,
+                       (uint16_t)rq->sectors, 0, ATA_DEVICE_LBA);
+    }
+    ahci_fill_header(p, slot, prdtl, write);
+
+    /* Issue under the lock so a completion never sees a slot before the HBA does. */
+    flags = spinlock_acquire_irqsave(&p->lock);
+    if (queued) {
+        port_write(p, PX_SACT, 1u << slot);
+    }
+    port_write(p, PX_CI, 1u << slot);
+    p->issued |= 1u << slot;
+    spinlock_release_irqrestore(&p->lock, flags);
+
+    if (!ahci.irq_mode) {
+        for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT && (p->busy & (1u << slot)); ++i) {
+            ahci_port_complete(p);
+            arch_cpu_relax();
+        }
+        if (p->busy & (1u << slot)) {
+            log_warn("AHCI: polled command timed out");
+            port_write(p, PX_IS, PX_IS_TFES);
+            ahci_port_complete(p);
+        }
+    }
+    return 0;
+}
+
+/* Issue a single non-queued command on slot 0 and poll for it; used before the port is live. */
+static int ahci_exec_polled(struct ahci_port *p, uint8_t command, uint64_t buf_phys, uint32_t bytes)
+{
+    struct ahci_cmd_table *t = p->tables[0];
+    ahci_build_fis(t->cfis, command, 0, 0, 0, 0);
+    uint32_t prdtl = 0;
+    if (bytes) {
+        t->prdt[0].dba = (uint32_t)buf_phys;
+        t->prdt[0].dbau = (uint32_t)(buf_phys >> 32);
+        t->prdt[0].dbc = bytes - 1;
+        prdtl = 1;
+    }
+    ahci_fill_header(p, 0, prdtl, 0);
+    port_write(p, PX_IS, 0xFFFFFFFFu);
+    port_write(p, PX_CI, 1);
+    for (uint32_t i = 0; i < AHCI_SPIN_TIMEOUT; ++i) {
+        if (port_read(p, PX_IS) & PX_IS_TFES) {
+            return -1;
+        }
+        if (!(port_read(p, PX_CI) & 1)) {
+            return (port_read(p, PX_TFD) & PX_TFD_ERR) ? -1 : 0;
+        }
+        arch_cpu_relax();
+    }
+    return -1;
+}
+
+static int ahci_identify(struct ahci_port *p)
+{
+    uint64_t phys = 0;
+    uint16_t *id = (uint16_t *)ahci_alloc_page(&phys);
+    if (!id) {
+        return -1;
+    }
+    int rc = ahci_exec_polled(p, ATA_CMD_IDENTIFY, phys, 512);
+    if (rc == 0) {
+        uint64_t sectors = (uint64_t)id[60] | ((uint64_t)id[61] << 16);
+        if (id[83] & (1u << 10)) {
+            uint64_t sectors48 = 0;
+            for (int i = 3; i >= 0; --i) {
+                sectors48 = (sectors48 << 16) | id[100 + i];
+            }
+            sectors = sectors48;
+        }
+        p->dev.sectors = sectors;
+        /* Word 76 bit 8: NCQ; word 75: queue depth - 1. */
+        if ((ahci.cap & AHCI_CAP_SNCQ) && (id[76] & (1u << 8))) {
+            uint32_t depth = (id[75] & 0x1F) + 1;
+            p->ncq = 1;
+            p->slot_mask &= (depth >= 32) ? 0xFFFFFFFFu : ((1u << depth) - 1);
+        }
+        if (sectors == 0) {
+            rc = -1;
+        }
+    }
+    pmm_free_page(phys);
+    return rc;
+}
+
+/* Undo ahci_port_init once the command list exists: detach the port's DMA areas and free them. */
+static void ahci_port_release(struct ahci_port *p)
+{
+    (void)ahci_port_stop(p);
+    port_write(p, PX_CLB, 0);
+    port_write(p, PX_CLBU, 0);
+    port_write(p, PX_FB, 0);
+    port_write(p, PX_FBU, 0);
+    for (uint32_t slot = 0; slot < AHCI_CMD_SLOTS; ++slot) {
+        if (p->tables[slot]) {
+            pmm_free_page(hhdm_to_phys((uint64_t)p->tables[slot]));
+        }
+    }
+    pmm_free_page(hhdm_to_phys((uint64_t)p->cmd_list));
+    kfree(p);
+}
+
+static int ahci_port_init(uint32_t index)
+{
+    struct ahci_port *p = (struct ahci_port *)kalloc_zero(sizeof(*p), 16);
+    if (!p) {
+        return -1;
+    }
+    p->index = index;
+    p->regs = (volatile uint32_t *)(ahci.abar + AHCI_PORT_BASE + index * AHCI_PORT_STRIDE);
+    spinlock_init(&p->lock);
+
+    uint32_t ssts = port_read(p, PX_SSTS);
+    if ((ssts & 0xF) != PX_SSTS_DET_PRESENT || ((ssts >> 8) & 0xF) != PX_SSTS_IPM_ACTIVE ||
+        port_read(p, PX_SIG) != AHCI_SIG_ATA) {
+        kfree(p);
+        return -1;
+    }
+    if (ahci_port_stop(p) != 0) {
+        log_warn("AHCI: port did not stop");
+        kfree(p);
+        return -1;
+    }
+
+    /* Command list (1 KiB) and received-FIS area (256 B) share one page. */
+    uint64_t list_phys = 0;
+    uint8_t *list = (uint8_t *)ahci_alloc_page(&list_phys);
+    if (!list) {
+        kfree(p);
+        return -1;
+    }
+    p->cmd_list = (struct ahci_cmd_header *)list;
+    uint32_t ncs = ((ahci.cap >> AHCI_CAP_NCS_SHIFT) & AHCI_CAP_NCS_MASK) + 1;
+    p->slot_mask = (ncs >= 32) ? 0xFFFFFFFFu : ((1u << ncs) - 1);
+    for (uint32_t slot = 0; slot < ncs; ++slot) {
+        uint64_t table_phys = 0;
+        p->tables[slot] = (struct ahci_cmd_table *)ahci_alloc_page(&table_phys);
+        if (!p->tables[slot]) {
+            p->slot_mask &= (1u << slot) - 1;
+            break;
+        }
+        p->cmd_list[slot].ctba = (uint32_t)table_phys;
+        p->cmd_list[slot].ctbau = (uint32_t)(table_phys >> 32);
+    }
+    if (!p->slot_mask) {
+        ahci_port_release(p);
+        return -1;
+    }
+
+    port_write(p, PX_CLB, (uint32_t)list_phys);
+    port_write(p, PX_CLBU, (uint32_t)(list_phys >> 32));
+    port_write(p, PX_FB, (uint32_t)(list_phys + AHCI_FIS_OFFSET));
+    port_write(p, PX_FBU, (uint32_t)((list_phys + AHCI_FIS_OFFSET) >> 32));
+    port_write(p, PX_SERR, 0xFFFFFFFFu);
+    port_write(p, PX_IS, 0xFFFFFFFFu);
+    if (ahci_port_start(p) != 0 || ahci_identify(p) != 0) {
+        log_warn("AHCI: IDENTIFY failed");
+        ahci_port_release(p);
+        return -1;
+    }
+
+    p->name[0] = 'a';
+    p->name[1] = 'h';
+    p->name[2] = 'c';
+    p->name[3] = 'i';
+    p->name[4] = (char)('0' + ahci_disk_count % 10);
+    p->name[5] = '\0';
+    p->dev.name = p->name;
+    p->dev.sector_size = 512;
+    p->dev.max_sectors = AHCI_MAX_SECTORS;
+    p->dev.queue_rq = ahci_queue_rq;
+    ahci.ports[index] = p;
+    ++ahci_disk_count;
+
+    if (ahci.irq_mode) {
+        port_write(p, PX_IE, PX_IS_DHRS | PX_IS_PSS | PX_IS_SDBS | PX_IS_ERROR);
+    }
+
+    log_info_hex("AHCI: disk on port", index);
+    log_info_hex("AHCI: sectors", p->dev.sectors);
+    log_info_hex(p->ncq ? "AHCI: NCQ slots" : "AHCI: command slots",
+                 (uint64_t)__builtin_popcount(p->slot_mask));
+
+    if (block_get_default() == block_get_ramdisk()) {
+        block_set_default(&p->dev);
+    }
+    return 0;
+}
+
+static int ahci_probe(struct pci_device *dev, const struct pci_device_id *id)
+{
+    (void)id;
+    if (ahci.pci) {
+        return -1; /* one controller is enough */
+    }
+    ahci.abar = (volatile uint8_t *)pci_map_bar(dev, 5);
+    if (!ahci.abar) {
+        log_warn("AHCI: ABAR (BAR5) not mapped");
+        return -1;
+    }
+    ahci.pci = dev;
+    ahci.vector = -1;
+    pci_enable_device(dev, 1);
+
+    hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_AE);
+    ahci.cap = hba_read(AHCI_CAP);
+    ahci.s64 = (ahci.cap & AHCI_CAP_S64A) != 0;
+
+    int vector = irq_alloc_vector(ahci_irq, &ahci);
+    if (vector >= 0 && pci_enable_msi(dev, (uint8_t)vector) == 0) {
+        ahci.vector = vector;
+        ahci.irq_mode = 1;
+    } else {
+        if (vector >= 0) {
+            irq_free_vector(vector);
+        }
+        log_warn("AHCI: MSI unavailable, completing by polling");
+    }
+
+    uint32_t implemented = hba_read(AHCI_PI);
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; ++i) {
+        if (implemented & (1u << i)) {
+            (void)ahci_port_init(i);
+        }
+    }
+    hba_write(AHCI_IS, 0xFFFFFFFFu);
+    if (ahci.irq_mode) {
+        hba_write(AHCI_GHC, hba_read(AHCI_GHC) | AHCI_GHC_IE);
+    }
+    dev->driver_data = &ahci;
+    return 0;
+}
+
+static const struct pci_device_id ahci_ids[] = {
+    { PCI_ANY_ID, PCI_ANY_ID, 0x01, 0x06 }, /* SATA controller */
+    { 0, 0, 0, 0 },
+};
+
+static struct pci_driver ahci_driver = {
+    .name = "ahci",
+    .ids = ahci_ids,
+    .probe = ahci_probe,
+};
+
+void ahci_driver_init(void)
+{
+    pci_register_driver(&ahci_driver);
+}
+
+void ahci_dump(void)
+{
+    for (uint32_t i = 0; i < AHCI_MAX_PORTS; ++i) {
+        struct ahci_port *p = ahci.ports[i];
+        if (!p) {
+            continue;
+        }
+        log_info(p->name);
+        log_info_hex("  port", p->index);
+        log_info_hex("  max queue depth seen", p->max_depth);
+    }
+}
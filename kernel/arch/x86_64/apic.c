@@ -0,0 +1,266 @@
+#include "kernel/apic.h"
+#include "kernel/acpi.h"
+#include "kernel/console.h"
+#include "kernel/io.h"
+#include "kernel/log.h"
+#include "kernel/mmu.h"
+#include "kernel/pic.h"
+#include "kernel/spinlock.h"
+#include <arch/processor.h>
+
+#include <stdint.h>
+
+#define IA32_APIC_BASE_MSR 0x1B
+#define IA32_APIC_BASE_ENABLE (1ULL << 11)
+
+#define LAPIC_REG_ID  0x020
+#define LAPIC_REG_TPR 0x080
+#define LAPIC_REG_EOI 0x0B0
+#define LAPIC_REG_SVR 0x0F0
+#define LAPIC_SVR_ENABLE 0x100
+
+#define MSI_ADDRESS_BASE 0xFEE00000u
+
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_REG_VER 0x01
+#define IOAPIC_REG_REDTBL(n) (0x10 + 2 * (n))
+
+#define IOAPIC_RTE_POLARITY_LOW  (1u << 13)
+#define IOAPIC_RTE_TRIGGER_LEVEL (1u << 15)
+#define IOAPIC_RTE_MASKED        (1u << 16)
+
+static volatile uint32_t *lapic_base;
+static volatile uint32_t *ioapic_base;
+static uint32_t ioapic_gsi_base;
+static uint32_t ioapic_entries;
+static int apic_active;
+
+/* IOREGSEL/IOWIN is an index/data pair, so every access must be atomic. */
+static spinlock_t ioapic_lock;
+
+static inline uint32_t lapic_read(uint32_t reg)
+{
+    return lapic_base[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value)
+{
+    lapic_base[reg / 4] = value;
+}
+
+static uint32_t ioapic_read(uint32_t reg)
+{
+    ioapic_base[IOAPIC_REGSEL / 4] = reg;
+    return ioapic_base[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value)
+{
+    ioapic_base[IOAPIC_REGSEL / 4] = reg;
+    ioapic_base[IOAPIC_WINDOW / 4] = value;
+}
+
+static int gsi_to_pin(uint32_t gsi)
+{
+    if (!ioapic_base || gsi < ioapic_gsi_base || gsi - ioapic_gsi_base >= ioapic_entries) {
+        return -1;
+    }
+    return (int)(gsi - ioapic_gsi_base);
+}
+
+static uint8_t cpu_to_apic_id(uint8_t cpu)
+{
+    int id = acpi_cpu_apic_id(cpu);
+    if (id < 0) {
+        return (uint8_t)lapic_id();
+    }
+    return (uint8_t)id;
+}
+
+uint32_t lapic_id(void)
+{
+    if (!lapic_base) {
+        return 0;
+    }
+    return lapic_read(LAPIC_REG_ID) >> 24;
+}
+
+void lapic_eoi(void)
+{
+    lapic_write(LAPIC_REG_EOI, 0);
+}
+
+int apic_enabled(void)
+{
+    return apic_active;
+}
+
+void irq_send_eoi(uint8_t irq)
+{
+    if (apic_active) {
+        lapic_eoi();
+    } else {
+        pic_send_eoi(irq);
+    }
+}
+
+static void lapic_init(uint64_t phys)
+{
+    uint64_t base_msr = arch_rdmsr(IA32_APIC_BASE_MSR);
+    if (!phys) {
+        phys = base_msr & ~0xFFFULL;
+    }
+    arch_wrmsr(IA32_APIC_BASE_MSR, base_msr | IA32_APIC_BASE_ENABLE);
+
+    lapic_base = (volatile uint32_t *)mmu_map_mmio(phys, 0x1000);
+    lapic_write(LAPIC_REG_TPR, 0);
+    lapic_write(LAPIC_REG_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+int apic_init(void)
+{
+    uint32_t ioapic_phys = 0;
+    uint8_t ioapic_id = 0;
+    if (acpi_ioapic_info(&ioapic_phys, &ioapic_id, &ioapic_gsi_base) != 0 || !ioapic_phys) {
+        log_warn("APIC: no IOAPIC in MADT, staying on 8259 PIC");
+        return -1;
+    }
+
+    spinlock_init(&ioapic_lock);
+    lapic_init(acpi_lapic_addr());
+
+    ioapic_base = (volatile uint32_t *)mmu_map_mmio(ioapic_phys, 0x20);
+    ioapic_entries = ((ioapic_read(IOAPIC_REG_VER) >> 16) & 0xFF) + 1;
+
+    /* Start with every pin masked; drivers route what they need. */
+    for (uint32_t pin = 0; pin < ioapic_entries; ++pin) {
+        ioapic_write(IOAPIC_REG_REDTBL(pin), IOAPIC_RTE_MASKED);
+        ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, 0);
+    }
+
+    /* The 8259 stays remapped so a stray interrupt lands on a known vector. */
+    pic_disable();
+    apic_active = 1;
+
+    log_info_hex("APIC: LAPIC id", lapic_id());
+    log_info_hex("APIC: IOAPIC id", ioapic_id);
+    log_info_hex("APIC: IOAPIC pins", ioapic_entries);
+    return 0;
+}
+
+int ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint16_t flags, uint8_t cpu)
+{
+    int pin = gsi_to_pin(gsi);
+    if (pin < 0 || vector < 0x20) {
+        return -1;
+    }
+
+    uint32_t low = vector;
+    if ((flags & ACPI_ISO_POLARITY_MASK) == ACPI_ISO_POLARITY_LOW) {
+        low |= IOAPIC_RTE_POLARITY_LOW;
+    }
+    if ((flags & ACPI_ISO_TRIGGER_MASK) == ACPI_ISO_TRIGGER_LEVEL) {
+        low |= IOAPIC_RTE_TRIGGER_LEVEL;
+    }
+    uint32_t high = (uint32_t)cpu_to_apic_id(cpu) << 24;
+
+    arch_flags_t irq_flags = spinlock_acquire_irqsave(&ioapic_lock);
+    /* Write the destination first so the entry never fires at the wrong CPU. */
+    ioapic_write(IOAPIC_REG_REDTBL(pin), IOAPIC_RTE_MASKED);
+    ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, high);
+    ioapic_write(IOAPIC_REG_REDTBL(pin), low);
+    spinlock_release_irqrestore(&ioapic_lock, irq_flags);
+    return 0;
+}
+
+int ioapic_route_isa_irq(uint8_t irq, uint8_t vector, uint8_t cpu)
+{
+    uint16_t flags = 0;
+    uint32_t gsi = acpi_isa_irq_to_gsi(irq, &flags);
+    return ioapic_route_gsi(gsi, vector, flags, cpu);
+}
+
+int ioapic_set_affinity(uint32_t gsi, uint8_t cpu)
+{
+    int pin = gsi_to_pin(gsi);
+    if (pin < 0) {
+        return -1;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&ioapic_lock);
+    ioapic_write(IOAPIC_REG_REDTBL(pin) + 1, (uint32_t)cpu_to_apic_id(cpu) << 24);
+    spinlock_release_irqrestore(&ioapic_lock, flags);
+    return 0;
+}
+
+uint64_t apic_msi_address(uint8_t cpu)
+{
+    /* Physical destination mode, no redirection hint. */
+    return MSI_ADDRESS_BASE | ((uint32_t)cpu_to_apic_id(cpu) << 12);
+}
+
+uint32_t apic_msi_data(uint8_t vector)
+{
+    /* Fixed delivery, edge-triggered. */
+    return vector;
+}
+
+static void ioapic_update_mask(uint32_t gsi, int masked)
+{
+    int pin = gsi_to_pin(gsi);
+    if (pin < 0) {
+        return;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&ioapic_lock);
+    uint32_t low = ioapic_read(IOAPIC_REG_REDTBL(pin));
+    if (masked) {
+        low |= IOAPIC_RTE_MASKED;
+    } else {
+        low &= ~IOAPIC_RTE_MASKED;
+    }
+    ioapic_write(IOAPIC_REG_REDTBL(pin), low);
+    spinlock_release_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_mask_gsi(uint32_t gsi)
+{
+    ioapic_update_mask(gsi, 1);
+}
+
+void ioapic_unmask_gsi(uint32_t gsi)
+{
+    ioapic_update_mask(gsi, 0);
+}
+
+void apic_dump(void)
+{
+    console_write("APIC:\n");
+    if (!apic_active) {
+        console_write("  inactive (8259 PIC)\n");
+        return;
+    }
+    console_write("  LAPIC id=");
+    console_write_hex(lapic_id());
+    console_write(" IOAPIC GSI base=");
+    console_write_hex(ioapic_gsi_base);
+    console_write(" pins=");
+    console_write_hex(ioapic_entries);
+    console_write("\n");
+    for (uint32_t pin = 0; pin < ioapic_entries; ++pin) {
+        arch_flags_t flags = spinlock_acquire_irqsave(&ioapic_lock);
+        uint32_t low = ioapic_read(IOAPIC_REG_REDTBL(pin));
+        uint32_t high = ioapic_read(IOAPIC_REG_REDTBL(pin) + 1);
+        spinlock_release_irqrestore(&ioapic_lock, flags);
+        if (low & IOAPIC_RTE_MASKED) {
+            continue;
+        }
+        console_write("  GSI");
+        console_write_hex(ioapic_gsi_base + pin);
+        console_write(" vec=");
+        console_write_hex(low & 0xFF);
+        console_write(" dest=");
+        console_write_hex(high >> 24);
+        console_write((low & IOAPIC_RTE_TRIGGER_LEVEL) ? " level" : " edge");
+        console_write((low & IOAPIC_RTE_POLARITY_LOW) ? " low\n" : " high\n");
+    }
+}
@@ -6,6 +6,7 @@
 #include "kernel/serial.h"
 #include "kernel/mmu.h"
 #include "kernel/pic.h"
+#include "kernel/apic.h"
 #include "kernel/timer.h"
 #include "kernel/io.h"
 #include "kernel/irq.h"
@@ -457,7 +458,7 @@ extern void isr_syscall(void);
 __attribute__((interrupt)) static void isr_irq0(struct interrupt_frame *frame)
 {
     timer_on_tick();
-    pic_send_eoi(0);
+    irq_send_eoi(0);
     sched_request_preempt(frame);
 }
 
@@ -465,14 +466,14 @@ __attribute__((interrupt)) static void isr_irq1(struct interrupt_frame *frame)
 {
     (void)frame;
     irq_dispatch(IRQ_KEYBOARD);
-    pic_send_eoi(1);
+    irq_send_eoi(1);
 }
 
 __attribute__((interrupt)) static void isr_irq4(struct interrupt_frame *frame)
 {
     (void)frame;
     irq_dispatch(IRQ_SERIAL_COM1);
-    pic_send_eoi(4);
+    irq_send_eoi(4);
 }
 
 uint64_t idt_get_timer_ticks(void)
@@ -493,6 +494,39 @@ __attribute__((interrupt)) static void isr_spurious_slave(struct interrupt_frame
     outb(0x20, 0x20);
 }
 
+__attribute__((interrupt)) static void isr_spurious_lapic(struct interrupt_frame *frame)
+{
+    (void)frame;
+    /* LAPIC spurious vector: the in-service bit is not set, so no EOI. */
+}
+
+/* Stubs for dynamically allocated vectors; message interrupts always EOI at the LAPIC. */
+#define VECTOR_STUB(n) \
+    __attribute__((interrupt)) static void isr_vector_##n(struct interrupt_frame *frame) { \
+        (void)frame; \
+        irq_dispatch_vector(IRQ_VECTOR_BASE + n); \
+        lapic_eoi(); }
+
+VECTOR_STUB(0)  VECTOR_STUB(1)  VECTOR_STUB(2)  VECTOR_STUB(3)
+VECTOR_STUB(4)  VECTOR_STUB(5)  VECTOR_STUB(6)  VECTOR_STUB(7)
+VECTOR_STUB(8)  VECTOR_STUB(9)  VECTOR_STUB(10) VECTOR_STUB(11)
+VECTOR_STUB(12) VECTOR_STUB(13) VECTOR_STUB(14) VECTOR_STUB(15)
+VECTOR_STUB(16) VECTOR_STUB(17) VECTOR_STUB(18) VECTOR_STUB(19)
+VECTOR_STUB(20) VECTOR_STUB(21) VECTOR_STUB(22) VECTOR_STUB(23)
+VECTOR_STUB(24) VECTOR_STUB(25) VECTOR_STUB(26) VECTOR_STUB(27)
+VECTOR_STUB(28) VECTOR_STUB(29) VECTOR_STUB(30) VECTOR_STUB(31)
+
+static void (*const vector_stubs[IRQ_VECTOR_COUNT])(struct interrupt_frame *) = {
+    isr_vector_0,  isr_vector_1,  isr_vector_2,  isr_vector_3,
+    isr_vector_4,  isr_vector_5,  isr_vector_6,  isr_vector_7,
+    isr_vector_8,  isr_vector_9,  isr_vector_10, isr_vector_11,
+    isr_vector_12, isr_vector_13, isr_vector_14, isr_vector_15,
+    isr_vector_16, isr_vector_17, isr_vector_18, isr_vector_19,
+    isr_vector_20, isr_vector_21, isr_vector_22, isr_vector_23,
+    isr_vector_24, isr_vector_25, isr_vector_26, isr_vector_27,
+    isr_vector_28, isr_vector_29, isr_vector_30, isr_vector_31,
+};
+
 static void idt_build(void)
 {
     for (uint16_t i = 0; i < 256; ++i) {
@@ -523,6 +557,10 @@ static void idt_build(void)
     set_gate(36, (uint64_t)isr_irq4, 1);
     set_gate(0x27, (uint64_t)isr_spurious_master, 0);
     set_gate(0x2F, (uint64_t)isr_spurious_slave, 0);
+    set_gate(APIC_SPURIOUS_VECTOR, (uint64_t)isr_spurious_lapic, 0);
+    for (int i = 0; i < IRQ_VECTOR_COUNT; ++i) {
+        set_gate((uint8_t)(IRQ_VECTOR_BASE + i), (uint64_t)vector_stubs[i], 1);
+    }
     set_gate_user(0x80, (uint64_t)isr_syscall, 0);
 }
 
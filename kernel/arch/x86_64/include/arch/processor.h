@@ -43,6 +43,13 @@ static inline void arch_irq_restore(arch_flags_t flags)
     }
 }
 
+static inline uint64_t arch_read_cycles(void)
+{
+    uint32_t low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((uint64_t)high << 32) | low;
+}
+
 static inline void arch_wrmsr(uint32_t msr, uint64_t val)
 {
     uint32_t low = val & 0xFFFFFFFF;
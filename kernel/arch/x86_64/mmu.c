@@ -12,6 +12,8 @@ extern uint64_t pml4_table[];
 #define PTE_PRESENT 0x1ULL
 #define PTE_RW 0x2ULL
 #define PTE_USER 0x4ULL
+#define PTE_PWT 0x8ULL
+#define PTE_PCD 0x10ULL
 #define PTE_PS 0x80ULL
 #define PTE_COW (1ULL << 9)
 
@@ -205,6 +207,9 @@ void mmu_map_page(uint64_t virt, uint64_t phys, uint64_t flags)
     if (flags & MMU_FLAG_NOEXEC) {
         entry |= (1ULL << 63);
     }
+    if (flags & MMU_FLAG_DEVICE) {
+        entry |= PTE_PCD | PTE_PWT;
+    }
 
     pt[pt_index] = entry;
     arch_invlpg(virt);
@@ -250,6 +255,9 @@ int mmu_map_page_in(uint64_t pml4_phys, uint64_t virt, uint64_t phys, uint64_t f
     if (flags & MMU_FLAG_NOEXEC) {
         entry |= (1ULL << 63);
     }
+    if (flags & MMU_FLAG_DEVICE) {
+        entry |= PTE_PCD | PTE_PWT;
+    }
 
     pt[pt_index] = entry;
     return 0;
@@ -294,6 +302,40 @@ void mmu_unmap_page(uint64_t virt)
     arch_invlpg(virt);
 }
 
+int mmu_translate(uint64_t virt, uint64_t *phys_out)
+{
+    uint64_t *pml4 = pml4_high();
+    uint64_t entry = pml4[(virt >> 39) & 0x1FF];
+    if (!(entry & PTE_PRESENT)) {
+        return -1;
+    }
+    uint64_t *pdpt = (uint64_t *)table_ptr(entry & 0x000FFFFFFFFFF000ULL);
+    entry = pdpt[(virt >> 30) & 0x1FF];
+    if (!(entry & PTE_PRESENT)) {
+        return -1;
+    }
+    if (entry & PTE_PS) {
+        *phys_out = (entry & 0x000FFFFFC0000000ULL) | (virt & 0x3FFFFFFFULL);
+        return 0;
+    }
+    uint64_t *pd = (uint64_t *)table_ptr(entry & 0x000FFFFFFFFFF000ULL);
+    entry = pd[(virt >> 21) & 0x1FF];
+    if (!(entry & PTE_PRESENT)) {
+        return -1;
+    }
+    if (entry & PTE_PS) {
+        *phys_out = (entry & 0x000FFFFFFFE00000ULL) | (virt & 0x1FFFFFULL);
+        return 0;
+    }
+    uint64_t *pt = (uint64_t *)table_ptr(entry & 0x000FFFFFFFFFF000ULL);
+    entry = pt[(virt >> 12) & 0x1FF];
+    if (!(entry & PTE_PRESENT)) {
+        return -1;
+    }
+    *phys_out = (entry & 0x000FFFFFFFFFF000ULL) | (virt & 0xFFFULL);
+    return 0;
+}
+
 static inline uint64_t align_down_4k(uint64_t value) { return value & ~0xFFFULL; }
 static inline uint64_t align_up_4k(uint64_t value) { return (value + 0xFFFULL) & ~0xFFFULL; }
 
@@ -52,6 +52,13 @@ void pic_disable_irq(uint8_t irq)
     outb(port, value);
 }
 
+void pic_disable(void)
+{
+    /* Mask every line; used once the IOAPIC takes over routing. */
+    outb(PIC1_DATA, 0xFF);
+    outb(PIC2_DATA, 0xFF);
+}
+
 void pic_send_eoi(uint8_t irq)
 {
     /* Send EOI to slave first if the IRQ originated there. */
@@ -40,21 +40,21 @@ void serial_init(void)
 
 void serial_write_char(char c)
 {
-    spinlock_acquire_irqsave(&serial_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&serial_lock);
     (void)serial_write_char_unlocked(c);
-    spinlock_release_irqrestore(&serial_lock);
+    spinlock_release_irqrestore(&serial_lock, flags);
 }
 
 void serial_write(const char *msg)
 {
-    spinlock_acquire_irqsave(&serial_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&serial_lock);
     for (size_t i = 0; msg[i] != '\0'; ++i) {
         if (msg[i] == '\n') {
             serial_write_char_unlocked('\r');
         }
         serial_write_char_unlocked(msg[i]);
     }
-    spinlock_release_irqrestore(&serial_lock);
+    spinlock_release_irqrestore(&serial_lock, flags);
 }
 
 void serial_write_len(const char *msg, uint64_t len)
@@ -62,14 +62,14 @@ void serial_write_len(const char *msg, uint64_t len)
     if (!msg || len == 0) {
         return;
     }
-    spinlock_acquire_irqsave(&serial_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&serial_lock);
     for (uint64_t i = 0; i < len; ++i) {
         if (msg[i] == '\n') {
             serial_write_char_unlocked('\r');
         }
         serial_write_char_unlocked(msg[i]);
     }
-    spinlock_release_irqrestore(&serial_lock);
+    spinlock_release_irqrestore(&serial_lock, flags);
 }
 
 static char hex_digit(uint8_t value)
@@ -79,12 +79,12 @@ static char hex_digit(uint8_t value)
 
 void serial_write_hex(uint64_t value)
 {
-    spinlock_acquire_irqsave(&serial_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&serial_lock);
     serial_write_char_unlocked('0');
     serial_write_char_unlocked('x');
     for (int shift = 60; shift >= 0; shift -= 4) {
         uint8_t nibble = (value >> shift) & 0xF;
         serial_write_char_unlocked(hex_digit(nibble));
     }
-    spinlock_release_irqrestore(&serial_lock);
+    spinlock_release_irqrestore(&serial_lock, flags);
 }
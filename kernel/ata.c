@@ -1,37 +1,116 @@
 #include "kernel/ata.h"
+#include "kernel/apic.h"
 #include "kernel/block.h"
 #include "kernel/io.h"
+#include "kernel/irq.h"
 #include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/pci.h"
+#include "kernel/sched.h"
+#include "kernel/timer.h"
+#include <arch/processor.h>
 
 #include <stddef.h>
 #include <stdint.h>
 
 #define ATA_PRIMARY_IO 0x1F0
 #define ATA_PRIMARY_CTRL 0x3F6
+#define ATA_PRIMARY_IRQ 14
 
 #define ATA_SR_ERR 0x01
 #define ATA_SR_DRQ 0x08
 #define ATA_SR_DF 0x20
 #define ATA_SR_BSY 0x80
 
+#define ATA_CTRL_NIEN 0x02
+
 #define ATA_CMD_IDENTIFY 0xEC
 #define ATA_CMD_READ 0x20
+#define ATA_CMD_READ_EXT 0x24
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_READ_MULTIPLE_EXT 0x29
 #define ATA_CMD_WRITE 0x30
+#define ATA_CMD_WRITE_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_WRITE_MULTIPLE_EXT 0x39
+#define ATA_CMD_READ_MULTIPLE 0xC4
+#define ATA_CMD_WRITE_MULTIPLE 0xC5
+#define ATA_CMD_SET_MULTIPLE 0xC6
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
 #define ATA_CMD_FLUSH 0xE7
+#define ATA_CMD_FLUSH_EXT 0xEA
+
+/* IDENTIFY words. */
+#define ATA_ID_MULTIPLE_MAX 47
+#define ATA_ID_LBA28_SECTORS 60
+#define ATA_ID_COMMAND_SET2 83
+#define ATA_ID_LBA48_SECTORS 100
+#define ATA_ID_CMDSET2_LBA48 (1u << 10)
+
+/* LBA28 commands take a one-byte count where 0 means 256; LBA48 a 16-bit one. */
+#define ATA_MAX_SECTORS 256
+#define ATA_MAX_SECTORS_EXT 65536
+#define ATA_LBA28_LIMIT (1ULL << 28)
+
+/* PIIX bus-master IDE registers, primary channel, relative to BAR4. */
+#define BM_REG_CMD 0x00
+#define BM_REG_STATUS 0x02
+#define BM_REG_PRDT 0x04
+#define BM_CMD_START 0x01
+#define BM_CMD_TO_MEMORY 0x08
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+/* PRD entries: 32-bit address, byte count (0 = 64 KiB), EOT flag; no entry may cross 64 KiB. */
+#define PRD_EOT 0x8000
+#define PRD_MAX_ENTRIES 512
+#define PRD_BOUNDARY 0x10000ULL
+
+#define ATA_IRQ_TIMEOUT_TICKS 500
+#define ATA_POLL_SPINS 100000
+
+struct ata_prd {
+    uint32_t addr;
+    uint16_t count;
+    uint16_t flags;
+} __attribute__((packed));
 
 struct ata_device {
     uint16_t io;
     uint16_t ctrl;
     uint8_t drive;
-    uint32_t sectors;
+    uint64_t sectors;
+    int lba48;
+    uint16_t multiple; /* sectors per DRQ block under READ/WRITE MULTIPLE, 0 if off */
     struct block_device dev;
+
+    /* Set up by the PCI probe once interrupts are live. */
+    int irq_mode;
+    int vector;
+    uint16_t bmide;
+    struct ata_prd *prdt;
+    uint64_t prdt_phys;
+    volatile uint32_t irq_count;
+    volatile uint8_t irq_status;
+    volatile uint8_t bm_status;
+    volatile uint64_t deadline;
+    wait_queue_t wq;
 };
 
+/* Commands are serialised by the block request queue, which has one dispatcher. */
 static struct ata_device ata;
 
+static uint8_t ata_ctrl_bits(void)
+{
+    return ata.irq_mode ? 0 : ATA_CTRL_NIEN;
+}
+
 static int ata_wait_not_bsy(uint16_t io)
 {
-    for (uint32_t i = 0; i < 100000; ++i) {
+    for (uint32_t i = 0; i < ATA_POLL_SPINS; ++i) {
         if (!(inb(io + 7) & ATA_SR_BSY)) {
             return 0;
         }
@@ -42,7 +121,7 @@ static int ata_wait_not_bsy(uint16_t io)
 static int ata_poll(uint16_t io)
 {
     uint8_t status = 0;
-    for (uint32_t i = 0; i < 100000; ++i) {
+    for (uint32_t i = 0; i < ATA_POLL_SPINS; ++i) {
         status = inb(io + 7);
         if (!(status & ATA_SR_BSY)) {
             break;
@@ -51,7 +130,7 @@ static int ata_poll(uint16_t io)
     if (status & (ATA_SR_ERR | ATA_SR_DF)) {
         return -1;
     }
-    for (uint32_t i = 0; i < 100000; ++i) {
+    for (uint32_t i = 0; i < ATA_POLL_SPINS; ++i) {
         status = inb(io + 7);
         if (status & ATA_SR_DRQ) {
             return 0;
@@ -63,13 +142,114 @@ static int ata_poll(uint16_t io)
     return -1;
 }
 
+static void ata_irq(void *ctx)
+{
+    struct ata_device *dev = (struct ata_device *)ctx;
+    if (dev->bmide) {
+        uint8_t bm = inb(dev->bmide + BM_REG_STATUS);
+        dev->bm_status = bm;
+        outb(dev->bmide + BM_REG_STATUS, bm & (BM_STATUS_IRQ | BM_STATUS_ERR));
+    }
+    /* Reading the status register deasserts INTRQ. */
+    dev->irq_status = inb(dev->io + 7);
+    dev->irq_count = dev->irq_count + 1;
+    sched_wake_all(&dev->wq);
+}
+
+/* A lost interrupt must not leave the caller asleep forever. */
+static void ata_watchdog(uint64_t ticks, void *user)
+{
+    struct ata_device *dev = (struct ata_device *)user;
+    if (dev->deadline && ticks >= dev->deadline) {
+        sched_wake_all(&dev->wq);
+    }
+}
+
+static int ata_irq_arrived(void *arg)
+{
+    return ata.irq_count != *(uint32_t *)arg || (ata.deadline && timer_get_ticks() >= ata.deadline);
+}
+
+/* Sleep until the IRQ after snapshot seen; returns the status the handler read. */
+static int ata_wait_irq(uint32_t seen, uint8_t *status)
+{
+    ata.deadline = timer_get_ticks() + ATA_IRQ_TIMEOUT_TICKS;
+    while (ata.irq_count == seen) {
+        if (timer_get_ticks() >= ata.deadline) {
+            ata.deadline = 0;
+            log_warn("ATA: interrupt timeout");
+            return -1;
+        }
+        sched_sleep_until(&ata.wq, ata_irq_arrived, &seen);
+        arch_cpu_relax();
+    }
+    ata.deadline = 0;
+    if (status) {
+        *status = ata.irq_status;
+    }
+    return 0;
+}
+
+enum ata_xfer {
+    ATA_XFER_PIO = 0,
+    ATA_XFER_MULTIPLE,
+    ATA_XFER_DMA,
+};
+
+/* [ext][xfer][write] */
+static const uint8_t ata_commands[2][3][2] = {
+    {
+        { ATA_CMD_READ, ATA_CMD_WRITE },
+        { ATA_CMD_READ_MULTIPLE, ATA_CMD_WRITE_MULTIPLE },
+        { ATA_CMD_READ_DMA, ATA_CMD_WRITE_DMA },
+    },
+    {
+        { ATA_CMD_READ_EXT, ATA_CMD_WRITE_EXT },
+        { ATA_CMD_READ_MULTIPLE_EXT, ATA_CMD_WRITE_MULTIPLE_EXT },
+        { ATA_CMD_READ_DMA_EXT, ATA_CMD_WRITE_DMA_EXT },
+    },
+};
+
+/* 28-bit commands need fewer register writes, so use them whenever they reach. */
+static int ata_needs_ext(uint64_t lba, uint64_t count)
+{
+    return lba + count > ATA_LBA28_LIMIT || count > ATA_MAX_SECTORS;
+}
+
+static uint64_t ata_max_chunk(void)
+{
+    return ata.lba48 ? ATA_MAX_SECTORS_EXT : ATA_MAX_SECTORS;
+}
+
+static void ata_issue(uint64_t lba, uint64_t count, enum ata_xfer xfer, int write)
+{
+    uint16_t io = ata.io;
+    int ext = ata_needs_ext(lba, count);
+    outb(ata.ctrl, ata_ctrl_bits());
+    if (ext) {
+        /* LBA48: each register is a two-deep FIFO, high-order byte first. */
+        outb(io + 6, (uint8_t)(0x40 | (ata.drive << 4)));
+        outb(io + 2, (uint8_t)((count >> 8) & 0xFF)); /* 65536 encodes as 0 */
+        outb(io + 3, (uint8_t)((lba >> 24) & 0xFF));
+        outb(io + 4, (uint8_t)((lba >> 32) & 0xFF));
+        outb(io + 5, (uint8_t)((lba >> 40) & 0xFF));
+    } else {
+        outb(io + 6, (uint8_t)(0xE0 | (ata.drive << 4) | ((lba >> 24) & 0x0F)));
+    }
+    outb(io + 2, (uint8_t)(count & 0xFF)); /* 256 encodes as 0 */
+    outb(io + 3, (uint8_t)(lba & 0xFF));
+    outb(io + 4, (uint8_t)((lba >> 8) & 0xFF));
+    outb(io + 5, (uint8_t)((lba >> 16) & 0xFF));
+    outb(io + 7, ata_commands[ext][xfer][write]);
+}
+
 static int ata_identify(struct ata_device *dev)
 {
     uint16_t io = dev->io;
     uint16_t ctrl = dev->ctrl;
     uint8_t drive = dev->drive;
 
-    outb(ctrl, 0x02);
+    outb(ctrl, ATA_CTRL_NIEN);
     outb(io + 6, (uint8_t)(0xA0 | (drive << 4)));
     outb(io + 2, 0);
     outb(io + 3, 0);
@@ -94,49 +274,133 @@ static int ata_identify(struct ata_device *dev)
     }
 
     uint16_t data[256];
-    for (uint32_t i = 0; i < 256; ++i) {
-        data[i] = inw(io);
+    insw(io, data, 256);
+    uint64_t sectors = (uint64_t)data[ATA_ID_LBA28_SECTORS] |
+                       ((uint64_t)data[ATA_ID_LBA28_SECTORS + 1] << 16);
+    if (data[ATA_ID_COMMAND_SET2] & ATA_ID_CMDSET2_LBA48) {
+        uint64_t sectors48 = 0;
+        for (int i = 3; i >= 0; --i) {
+            sectors48 = (sectors48 << 16) | data[ATA_ID_LBA48_SECTORS + i];
+        }
+        if (sectors48 > sectors) {
+            sectors = sectors48;
+        }
+        dev->lba48 = 1;
     }
-    uint32_t sectors = (uint32_t)data[60] | ((uint32_t)data[61] << 16);
     if (sectors == 0) {
         return -1;
     }
     dev->sectors = sectors;
+    dev->multiple = data[ATA_ID_MULTIPLE_MAX] & 0xFF;
     return 0;
 }
 
-static int ata_read(struct block_device *bdev, uint64_t lba, uint64_t count, void *buf)
+/* Program the DRQ block size for READ/WRITE MULTIPLE; drop to 0 if refused. */
+static void ata_set_multiple(struct ata_device *dev)
 {
-    if (!bdev || !buf || count == 0) {
-        return -1;
+    if (dev->multiple <= 1) {
+        dev->multiple = 0;
+        return;
     }
-    struct ata_device *dev = (struct ata_device *)bdev;
-    if (lba >= dev->sectors || count > dev->sectors - lba) {
-        return -1;
+    outb(dev->ctrl, ATA_CTRL_NIEN);
+    outb(dev->io + 6, (uint8_t)(0xA0 | (dev->drive << 4)));
+    outb(dev->io + 2, (uint8_t)dev->multiple);
+    outb(dev->io + 7, ATA_CMD_SET_MULTIPLE);
+    if (ata_wait_not_bsy(dev->io) != 0 || (inb(dev->io + 7) & (ATA_SR_ERR | ATA_SR_DF))) {
+        dev->multiple = 0;
     }
-    uint8_t *dst = (uint8_t *)buf;
-    uint16_t io = dev->io;
-    uint16_t ctrl = dev->ctrl;
+}
+
+/* Only reached through block_flush(): a barrier, not part of every write. */
+static int ata_flush(struct block_device *bdev)
+{
+    (void)bdev;
+    uint32_t seen = ata.irq_count;
+    outb(ata.ctrl, ata_ctrl_bits());
+    outb(ata.io + 7, ata.lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+    if (ata.irq_mode) {
+        uint8_t status = 0;
+        if (ata_wait_irq(seen, &status) != 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+            return -1;
+        }
+        return 0;
+    }
+    return ata_wait_not_bsy(ata.io);
+}
+
+/* Wait for the device to want the next sector: by interrupt if enabled, else by polling. */
+static int ata_pio_ready(uint32_t *seen)
+{
+    if (ata.irq_mode) {
+        uint8_t status = 0;
+        if (ata_wait_irq(*seen, &status) != 0) {
+            return -1;
+        }
+        *seen = ata.irq_count;
+        if (status & (ATA_SR_ERR | ATA_SR_DF)) {
+            return -1;
+        }
+    }
+    return ata_poll(ata.io);
+}
 
+/* With MULTIPLE the device raises DRQ (and an interrupt) once per block, not per sector. */
+static uint64_t ata_drq_block(void)
+{
+    return ata.multiple ? ata.multiple : 1;
+}
+
+static int ata_pio_read(uint64_t lba, uint64_t count, uint8_t *dst)
+{
+    enum ata_xfer xfer = ata.multiple ? ATA_XFER_MULTIPLE : ATA_XFER_PIO;
     while (count) {
-        uint8_t chunk = (count > 255) ? 255 : (uint8_t)count;
-        outb(ctrl, 0x02);
-        outb(io + 6, (uint8_t)(0xE0 | (dev->drive << 4) | ((lba >> 24) & 0x0F)));
-        outb(io + 2, chunk);
-        outb(io + 3, (uint8_t)(lba & 0xFF));
-        outb(io + 4, (uint8_t)((lba >> 8) & 0xFF));
-        outb(io + 5, (uint8_t)((lba >> 16) & 0xFF));
-        outb(io + 7, ATA_CMD_READ);
-
-        for (uint32_t s = 0; s < chunk; ++s) {
-            if (ata_poll(io) != 0) {
+        uint64_t max = ata_max_chunk();
+        uint64_t chunk = (count > max) ? max : count;
+        uint32_t seen = ata.irq_count;
+        ata_issue(lba, chunk, xfer, 0);
+        for (uint64_t done = 0; done < chunk;) {
+            uint64_t block = chunk - done < ata_drq_block() ? chunk - done : ata_drq_block();
+            if (ata_pio_ready(&seen) != 0) {
                 return -1;
             }
-            uint16_t *out = (uint16_t *)dst;
-            for (uint32_t i = 0; i < 256; ++i) {
-                out[i] = inw(io);
+            insw(ata.io, dst, (uint32_t)(block * 256));
+            dst += block * 512;
+            done += block;
+        }
+        lba += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+static int ata_pio_write(uint64_t lba, uint64_t count, const uint8_t *src)
+{
+    enum ata_xfer xfer = ata.multiple ? ATA_XFER_MULTIPLE : ATA_XFER_PIO;
+    while (count) {
+        uint64_t max = ata_max_chunk();
+        uint64_t chunk = (count > max) ? max : count;
+        uint32_t seen = ata.irq_count;
+        ata_issue(lba, chunk, xfer, 1);
+        /* The first block is requested by DRQ alone; each later one by an interrupt. */
+        if (ata_poll(ata.io) != 0) {
+            return -1;
+        }
+        for (uint64_t done = 0; done < chunk;) {
+            uint64_t block = chunk - done < ata_drq_block() ? chunk - done : ata_drq_block();
+            if (done > 0 && ata_pio_ready(&seen) != 0) {
+                return -1;
             }
-            dst += 512;
+            outsw(ata.io, src, (uint32_t)(block * 256));
+            src += block * 512;
+            done += block;
+        }
+        if (ata.irq_mode) {
+            uint8_t status = 0;
+            if (ata_wait_irq(seen, &status) != 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+                return -1;
+            }
+        } else if (ata_wait_not_bsy(ata.io) != 0 || (inb(ata.io + 7) & (ATA_SR_ERR | ATA_SR_DF))) {
+            return -1;
         }
         lba += chunk;
         count -= chunk;
@@ -144,43 +408,142 @@ static int ata_read(struct block_device *bdev, uint64_t lba, uint64_t count, voi
     return 0;
 }
 
+static int ata_read(struct block_device *bdev, uint64_t lba, uint64_t count, void *buf)
+{
+    if (!bdev || !buf || count == 0) {
+        return -1;
+    }
+    if (lba >= ata.sectors || count > ata.sectors - lba) {
+        return -1;
+    }
+    return ata_pio_read(lba, count, (uint8_t *)buf);
+}
+
 static int ata_write(struct block_device *bdev, uint64_t lba, uint64_t count, const void *buf)
 {
     if (!bdev || !buf || count == 0) {
         return -1;
     }
-    struct ata_device *dev = (struct ata_device *)bdev;
-    if (lba >= dev->sectors || count > dev->sectors - lba) {
+    if (lba >= ata.sectors || count > ata.sectors - lba) {
         return -1;
     }
-    const uint8_t *src = (const uint8_t *)buf;
-    uint16_t io = dev->io;
-    uint16_t ctrl = dev->ctrl;
+    return ata_pio_write(lba, count, (const uint8_t *)buf);
+}
 
-    while (count) {
-        uint8_t chunk = (count > 255) ? 255 : (uint8_t)count;
-        outb(ctrl, 0x02);
-        outb(io + 6, (uint8_t)(0xE0 | (dev->drive << 4) | ((lba >> 24) & 0x0F)));
-        outb(io + 2, chunk);
-        outb(io + 3, (uint8_t)(lba & 0xFF));
-        outb(io + 4, (uint8_t)((lba >> 8) & 0xFF));
-        outb(io + 5, (uint8_t)((lba >> 16) & 0xFF));
-        outb(io + 7, ATA_CMD_WRITE);
-
-        for (uint32_t s = 0; s < chunk; ++s) {
-            if (ata_poll(io) != 0) {
+/* Append [virt, virt+len) to the PRD table, splitting at pages and 64 KiB lines. */
+static int ata_prd_add(uint32_t *n, const uint8_t *virt, uint64_t len)
+{
+    while (len) {
+        uint64_t phys = 0;
+        if (mmu_translate((uint64_t)virt, &phys) != 0) {
+            return -1;
+        }
+        uint64_t chunk = 0x1000 - ((uint64_t)virt & 0xFFF);
+        if (chunk > len) {
+            chunk = len;
+        }
+        if ((phys & 1) || (chunk & 1) || phys + chunk > 0x100000000ULL) {
+            return -1;
+        }
+        struct ata_prd *last = *n ? &ata.prdt[*n - 1] : NULL;
+        uint64_t last_len = last ? (last->count ? last->count : PRD_BOUNDARY) : 0;
+        if (last && last->addr + last_len == phys &&
+            (last->addr & ~(PRD_BOUNDARY - 1)) == ((phys + chunk - 1) & ~(PRD_BOUNDARY - 1))) {
+            last->count = (uint16_t)(last_len + chunk);
+        } else {
+            if (*n >= PRD_MAX_ENTRIES) {
                 return -1;
             }
-            const uint16_t *in = (const uint16_t *)src;
-            for (uint32_t i = 0; i < 256; ++i) {
-                outw(io, in[i]);
+            ata.prdt[*n].addr = (uint32_t)phys;
+            ata.prdt[*n].count = (uint16_t)chunk;
+            ata.prdt[*n].flags = 0;
+            ++*n;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static int ata_build_prdt(struct block_request *rq)
+{
+    uint32_t n = 0;
+    for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt; ++i) {
+            if (ata_prd_add(&n, (const uint8_t *)bio->vecs[i].buf, bio->vecs[i].len) != 0) {
+                return -1;
             }
-            src += 512;
         }
-        outb(io + 7, ATA_CMD_FLUSH);
-        (void)ata_wait_not_bsy(io);
-        lba += chunk;
-        count -= chunk;
+    }
+    if (n == 0) {
+        return -1;
+    }
+    ata.prdt[n - 1].flags = PRD_EOT;
+    return 0;
+}
+
+static int ata_dma_wait(uint32_t seen)
+{
+    if (ata.irq_mode) {
+        return ata_wait_irq(seen, NULL);
+    }
+    for (uint32_t i = 0; i < ATA_POLL_SPINS * 10; ++i) {
+        uint8_t bm = inb(ata.bmide + BM_REG_STATUS);
+        if ((bm & BM_STATUS_IRQ) || !(bm & BM_STATUS_ACTIVE)) {
+            ata.bm_status = bm;
+            outb(ata.bmide + BM_REG_STATUS, bm & (BM_STATUS_IRQ | BM_STATUS_ERR));
+            return 0;
+        }
+        arch_cpu_relax();
+    }
+    return -1;
+}
+
+static int ata_dma_transfer(struct block_request *rq)
+{
+    int write = rq->op == BLOCK_OP_WRITE;
+    uint16_t bm = ata.bmide;
+
+    outb(bm + BM_REG_CMD, 0);
+    outb(bm + BM_REG_STATUS, BM_STATUS_IRQ | BM_STATUS_ERR);
+    outl(bm + BM_REG_PRDT, (uint32_t)ata.prdt_phys);
+    uint8_t dir = write ? 0 : BM_CMD_TO_MEMORY;
+    outb(bm + BM_REG_CMD, dir);
+
+    uint32_t seen = ata.irq_count;
+    ata_issue(rq->lba, rq->sectors, ATA_XFER_DMA, write);
+    outb(bm + BM_REG_CMD, dir | BM_CMD_START);
+
+    int rc = ata_dma_wait(seen);
+    outb(bm + BM_REG_CMD, 0);
+    uint8_t status = inb(ata.io + 7);
+    if (rc != 0 || (ata.bm_status & BM_STATUS_ERR) || (status & (ATA_SR_ERR | ATA_SR_DF))) {
+        log_info_hex("ATA: DMA error, status", ((uint64_t)ata.bm_status << 8) | status);
+        return -1;
+    }
+    return 0;
+}
+
+static int ata_submit(struct block_device *bdev, struct block_request *rq)
+{
+    (void)bdev;
+    if (ata_build_prdt(rq) == 0) {
+        return ata_dma_transfer(rq);
+    }
+
+    /* Not DMA-able (above 4 GiB or unmapped): fall back to PIO one vec at a time. */
+    uint64_t lba = rq->lba;
+    for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt; ++i) {
+            uint64_t count = bio->vecs[i].len / 512;
+            int rc = (rq->op == BLOCK_OP_WRITE)
+                ? ata_pio_write(lba, count, (const uint8_t *)bio->vecs[i].buf)
+                : ata_pio_read(lba, count, (uint8_t *)bio->vecs[i].buf);
+            if (rc != 0) {
+                return rc;
+            }
+            lba += count;
+        }
     }
     return 0;
 }
@@ -191,17 +554,96 @@ struct block_device *ata_init(void)
     ata.ctrl = ATA_PRIMARY_CTRL;
     ata.drive = 0;
     ata.sectors = 0;
+    ata.vector = -1;
+    wait_queue_init(&ata.wq);
     ata.dev.name = "ata0";
     ata.dev.sector_size = 512;
     ata.dev.sectors = 0;
+    ata.dev.max_sectors = ATA_MAX_SECTORS;
     ata.dev.read = ata_read;
     ata.dev.write = ata_write;
+    ata.dev.flush = ata_flush;
 
     if (ata_identify(&ata) != 0) {
         return NULL;
     }
+    ata_set_multiple(&ata);
+    if (ata.lba48) {
+        /* One PRD entry per sector in the worst case keeps a request DMA-able. */
+        ata.dev.max_sectors = PRD_MAX_ENTRIES;
+    }
 
     ata.dev.sectors = ata.sectors;
     log_info("ATA PIO disk detected");
+    log_info_hex("ATA: sectors", ata.sectors);
+    if (ata.lba48) {
+        log_info("ATA: LBA48 addressing");
+    }
+    if (ata.multiple) {
+        log_info_hex("ATA: READ/WRITE MULTIPLE block", ata.multiple);
+    }
     return &ata.dev;
 }
+
+static int ata_pci_probe(struct pci_device *dev, const struct pci_device_id *id)
+{
+    (void)id;
+    if (!ata.sectors) {
+        return -1;
+    }
+    /* prog-if bit 0 clear: primary channel in compatibility mode (0x1F0, IRQ14). */
+    if (dev->prog_if & 0x01) {
+        return -1;
+    }
+
+    if (apic_enabled()) {
+        int vector = irq_alloc_vector(ata_irq, &ata);
+        if (vector >= 0 && ioapic_route_isa_irq(ATA_PRIMARY_IRQ, (uint8_t)vector, 0) == 0 &&
+            timer_register_callback(ata_watchdog, &ata) == 0) {
+            ata.vector = vector;
+            ata.irq_mode = 1;
+            outb(ata.ctrl, 0);
+            log_info_hex("ATA: IRQ14 on vector", (uint64_t)vector);
+        } else if (vector >= 0) {
+            irq_free_vector(vector);
+        }
+    }
+
+    struct pci_bar *bar = &dev->bars[4];
+    if (!(dev->prog_if & 0x80) || bar->type != PCI_BAR_IO || !bar->base) {
+        log_info("ATA: no bus-master IDE, using PIO");
+        return 0;
+    }
+    uint64_t prdt_phys = pmm_alloc_page();
+    if (!prdt_phys || prdt_phys >= 0x100000000ULL) {
+        if (prdt_phys) {
+            pmm_free_page(prdt_phys);
+        }
+        log_warn("ATA: no PRD page below 4 GiB, using PIO");
+        return 0;
+    }
+    pci_enable_device(dev, 1);
+    ata.bmide = (uint16_t)bar->base;
+    ata.prdt_phys = prdt_phys;
+    ata.prdt = (struct ata_prd *)phys_to_hhdm(prdt_phys);
+    ata.dev.submit = ata_submit;
+    dev->driver_data = &ata;
+    log_info_hex("ATA: bus-master DMA at", ata.bmide);
+    return 0;
+}
+
+static const struct pci_device_id ata_pci_ids[] = {
+    { PCI_ANY_ID, PCI_ANY_ID, 0x01, 0x01 }, /* IDE controller */
+    { 0, 0, 0, 0 },
+};
+
+static struct pci_driver ata_pci_driver = {
+    .name = "ata-piix",
+    .ids = ata_pci_ids,
+    .probe = ata_pci_probe,
+};
+
+void ata_driver_init(void)
+{
+    pci_register_driver(&ata_pci_driver);
+}
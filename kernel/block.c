@@ -1,56 +1,333 @@
 #include "kernel/block.h"
 #include "kernel/ata.h"
+#include "kernel/console.h"
+#include "kernel/heap.h"
+#include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/sched.h"
 
 #include <stddef.h>
 #include <stdint.h>
 
 #define RAMDISK_SECTORS 8192
 #define RAMDISK_SECTOR_SIZE 512
-#define BLOCK_CACHE_ENTRIES 16
+
+/* Buffer cache: one RAM-proportional pool of sector buffers, hashed by (dev, lba). */
+#define BLOCK_CACHE_BLOCK_SIZE 512
+#define BLOCK_CACHE_RAM_SHIFT 6 /* use 1/64 of RAM */
+#define BLOCK_CACHE_MIN_BYTES (256ULL * 1024)
+#define BLOCK_CACHE_MAX_BYTES (8ULL * 1024 * 1024)
+#define BLOCK_FLUSH_BATCH 128 /* dirty buffers submitted per plug */
+#define BLOCK_READAHEAD_SLOTS 4 /* readahead bios in flight at once */
+#define BLOCK_READAHEAD_MAX 256 /* sectors per readahead bio */
+#define BLOCK_SYNC_MAX_DEVICES 16 /* devices block_sync(NULL) flushes one by one */
 
 static uint8_t ramdisk_data[RAMDISK_SECTORS * RAMDISK_SECTOR_SIZE];
 static struct block_device ramdisk_dev;
 static struct block_device *default_dev = NULL;
 
-struct block_cache_entry {
+struct block_buf {
     struct block_device *dev;
     uint64_t lba;
-    uint8_t data[RAMDISK_SECTOR_SIZE];
+    uint8_t *data;
+    struct block_buf *hash_next;
+    struct bio *loading; /* readahead still filling data */
     uint8_t valid;
+    uint8_t dirty;
+    uint8_t referenced;
+};
+
+struct block_cache {
+    struct block_buf *bufs;
+    struct block_buf **hash;
+    uint64_t nbufs;
+    uint64_t hash_mask;
+    uint64_t clock_hand;
+    uint64_t dirty_count;
+    struct block_cache_stats stats;
+    int ready;
 };
 
-static struct block_cache_entry block_cache[BLOCK_CACHE_ENTRIES];
+static struct block_cache bcache;
 
-static void block_cache_reset(void)
+/* Sleeping lock: cache users may block in driver I/O while holding it. */
+static volatile int bcache_busy = 0;
+static wait_queue_t bcache_wq;
+
+static int bcache_idle(void)
 {
-    for (uint64_t i = 0; i < BLOCK_CACHE_ENTRIES; ++i) {
-        block_cache[i].dev = NULL;
-        block_cache[i].lba = 0;
-        block_cache[i].valid = 0;
+    return !bcache_busy;
+}
+
+static void bcache_lock(void)
+{
+    while (__atomic_exchange_n(&bcache_busy, 1, __ATOMIC_ACQUIRE)) {
+        sched_sleep_cond(&bcache_wq, bcache_idle);
     }
 }
 
-static struct block_cache_entry *block_cache_lookup(struct block_device *dev, uint64_t lba)
+static void bcache_unlock(void)
+{
+    __atomic_store_n(&bcache_busy, 0, __ATOMIC_RELEASE);
+    sched_wake_one(&bcache_wq);
+}
+
+static uint64_t bcache_hash(const struct block_device *dev, uint64_t lba)
+{
+    uint64_t key = lba ^ ((uint64_t)(uintptr_t)dev >> 4);
+    return (key * 0x9E3779B97F4A7C15ULL) >> 20 & bcache.hash_mask;
+}
+
+static void bcache_init(void)
 {
-    uint64_t idx = lba % BLOCK_CACHE_ENTRIES;
-    struct block_cache_entry *entry = &block_cache[idx];
-    if (entry->valid && entry->dev == dev && entry->lba == lba) {
-        return entry;
+    wait_queue_init(&bcache_wq);
+    uint64_t bytes = pmm_total_bytes() >> BLOCK_CACHE_RAM_SHIFT;
+    if (bytes < BLOCK_CACHE_MIN_BYTES) {
+        bytes = BLOCK_CACHE_MIN_BYTES;
+    }
+    if (bytes > BLOCK_CACHE_MAX_BYTES) {
+        bytes = BLOCK_CACHE_MAX_BYTES;
+    }
+    uint64_t per_page = 4096 / BLOCK_CACHE_BLOCK_SIZE;
+    uint64_t nbufs = (bytes / BLOCK_CACHE_BLOCK_SIZE) & ~(per_page - 1);
+    uint64_t buckets = 1;
+    while (buckets < nbufs / 2) {
+        buckets <<= 1;
+    }
+
+    bcache.bufs = (struct block_buf *)kalloc_zero(nbufs * sizeof(struct block_buf), 16);
+    bcache.hash = (struct block_buf **)kalloc_zero(buckets * sizeof(struct block_buf *), 16);
+    if (!bcache.bufs || !bcache.hash) {
+        log_warn("block: buffer cache allocation failed, caching disabled");
+        return;
+    }
+
+    uint64_t made = 0;
+    while (made < nbufs) {
+        uint64_t phys = pmm_alloc_page();
+        if (!phys) {
+            break;
+        }
+        uint8_t *page = (uint8_t *)phys_to_hhdm(phys);
+        for (uint64_t i = 0; i < per_page; ++i) {
+            bcache.bufs[made++].data = page + i * BLOCK_CACHE_BLOCK_SIZE;
+        }
+    }
+    if (made == 0) {
+        log_warn("block: no pages for buffer cache, caching disabled");
+        return;
+    }
+    bcache.nbufs = made;
+    bcache.hash_mask = buckets - 1;
+    bcache.ready = 1;
+    log_info_hex("block: buffer cache sectors", made);
+}
+
+static int bcache_usable(const struct block_device *dev)
+{
+    return bcache.ready && dev->sector_size == BLOCK_CACHE_BLOCK_SIZE;
+}
+
+static struct block_buf *bcache_lookup(struct block_device *dev, uint64_t lba)
+{
+    struct block_buf *b = bcache.hash[bcache_hash(dev, lba)];
+    while (b) {
+        if (b->dev == dev && b->lba == lba) {
+            return b;
+        }
+        b = b->hash_next;
     }
     return NULL;
 }
 
-static void block_cache_store(struct block_device *dev, uint64_t lba, const void *buf)
+static void bcache_unhash(struct block_buf *buf)
 {
-    uint64_t idx = lba % BLOCK_CACHE_ENTRIES;
-    struct block_cache_entry *entry = &block_cache[idx];
-    const uint8_t *src = (const uint8_t *)buf;
-    for (uint64_t i = 0; i < RAMDISK_SECTOR_SIZE; ++i) {
-        entry->data[i] = src[i];
+    struct block_buf **link = &bcache.hash[bcache_hash(buf->dev, buf->lba)];
+    while (*link) {
+        if (*link == buf) {
+            *link = buf->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    buf->hash_next = NULL;
+    buf->valid = 0;
+}
+
+/* Write-back batch; only touched with the cache lock held. */
+static struct bio flush_bios[BLOCK_FLUSH_BATCH];
+static struct bio_vec flush_vecs[BLOCK_FLUSH_BATCH];
+static struct block_buf *flush_bufs[BLOCK_FLUSH_BATCH];
+
+/*
+ * Submit each dirty buffer as its own single-sector bio under one plug and
+ * let the elevator merge adjacent sectors into large writes.
+ */
+static int bcache_flush_batch(struct block_device *dev, uint64_t *cursor)
+{
+    uint64_t n = 0;
+    while (*cursor < bcache.nbufs && n < BLOCK_FLUSH_BATCH) {
+        struct block_buf *b = &bcache.bufs[(*cursor)++];
+        if (b->valid && b->dirty && (!dev || b->dev == dev)) {
+            flush_bufs[n++] = b;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    struct block_device *plugged = NULL;
+    for (uint64_t i = 0; i < n; ++i) {
+        struct block_buf *b = flush_bufs[i];
+        if (b->dev != plugged) {
+            if (plugged) {
+                block_unplug(plugged);
+            }
+            plugged = b->dev;
+            block_plug(plugged);
+        }
+        flush_vecs[i].buf = b->data;
+        flush_vecs[i].len = BLOCK_CACHE_BLOCK_SIZE;
+        struct bio *bio = &flush_bios[i];
+        bio->dev = b->dev;
+        bio->op = BLOCK_OP_WRITE;
+        bio->lba = b->lba;
+        bio->vecs = &flush_vecs[i];
+        bio->vcnt = 1;
+        bio->end_io = NULL;
+        block_submit_bio(bio);
+    }
+    if (plugged) {
+        block_unplug(plugged);
+    }
+
+    int rc = 0;
+    for (uint64_t i = 0; i < n; ++i) {
+        if (block_wait(&flush_bios[i]) != 0) {
+            rc = -1;
+            continue;
+        }
+        flush_bufs[i]->dirty = 0;
+        bcache.dirty_count--;
+        bcache.stats.writebacks++;
+    }
+    return rc;
+}
+
+static int bcache_flush_locked(struct block_device *dev)
+{
+    int rc = 0;
+    uint64_t cursor = 0;
+    while (cursor < bcache.nbufs && bcache.dirty_count) {
+        if (bcache_flush_batch(dev, &cursor) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/*
+ * Readahead: buffers are hashed up front and filled by a bio submitted
+ * without waiting. Anyone who needs such a buffer first waits for the bio
+ * through bcache_settle(). Only touched with the cache lock held.
+ */
+struct readahead_slot {
+    struct bio bio;
+    struct bio_vec vecs[BLOCK_READAHEAD_MAX];
+    struct block_buf *bufs[BLOCK_READAHEAD_MAX];
+    int busy;
+};
+
+static struct readahead_slot ra_slots[BLOCK_READAHEAD_SLOTS];
+
+/* Retire a finished readahead slot; failed sectors simply drop out of the cache. */
+static void readahead_reap(struct readahead_slot *slot)
+{
+    for (uint32_t i = 0; i < slot->bio.vcnt; ++i) {
+        struct block_buf *b = slot->bufs[i];
+        b->loading = NULL;
+        if (slot->bio.status != 0) {
+            bcache_unhash(b);
+        }
+    }
+    slot->busy = 0;
+}
+
+static void readahead_reap_done(void)
+{
+    for (uint32_t i = 0; i < BLOCK_READAHEAD_SLOTS; ++i) {
+        struct readahead_slot *slot = &ra_slots[i];
+        if (slot->busy && __atomic_load_n(&slot->bio.done, __ATOMIC_ACQUIRE)) {
+            readahead_reap(slot);
+        }
+    }
+}
+
+/* Wait out a readahead into b; returns 0 if b still holds valid data. */
+static int bcache_settle(struct block_buf *b)
+{
+    if (b->loading) {
+        struct readahead_slot *slot = (struct readahead_slot *)b->loading->private;
+        (void)block_wait(&slot->bio);
+        readahead_reap(slot);
+    }
+    return b->valid ? 0 : -1;
+}
+
+/* CLOCK: sweep for a buffer whose referenced bit is clear, writing it back if dirty. */
+static struct block_buf *bcache_evict(void)
+{
+    for (uint64_t scanned = 0; scanned < bcache.nbufs * 2; ++scanned) {
+        struct block_buf *b = &bcache.bufs[bcache.clock_hand];
+        bcache.clock_hand = (bcache.clock_hand + 1) % bcache.nbufs;
+        if (!b->valid) {
+            return b;
+        }
+        if (b->loading) {
+            continue;
+        }
+        if (b->referenced) {
+            b->referenced = 0;
+            continue;
+        }
+        if (b->dirty) {
+            /* Clean the whole device at once so the victim's neighbours go out together. */
+            (void)bcache_flush_locked(b->dev);
+            if (b->dirty) {
+                continue;
+            }
+        }
+        bcache_unhash(b);
+        bcache.stats.evictions++;
+        return b;
+    }
+    return NULL;
+}
+
+static struct block_buf *bcache_insert(struct block_device *dev, uint64_t lba)
+{
+    struct block_buf *b = bcache_evict();
+    if (!b) {
+        return NULL;
+    }
+    uint64_t bucket = bcache_hash(dev, lba);
+    b->dev = dev;
+    b->lba = lba;
+    b->valid = 1;
+    b->dirty = 0;
+    b->referenced = 1;
+    b->loading = NULL;
+    b->hash_next = bcache.hash[bucket];
+    bcache.hash[bucket] = b;
+    return b;
+}
+
+static void copy_block(uint8_t *dst, const uint8_t *src)
+{
+    for (uint64_t i = 0; i < BLOCK_CACHE_BLOCK_SIZE; ++i) {
+        dst[i] = src[i];
     }
-    entry->dev = dev;
-    entry->lba = lba;
-    entry->valid = 1;
 }
 
 static void ramdisk_seed_fat16(void)
@@ -186,6 +463,27 @@ static int ramdisk_write(struct block_device *dev, uint64_t lba, uint64_t count,
     return 0;
 }
 
+/* Scatter-gather path: copy each vec directly, no bounce needed. */
+static int ramdisk_submit(struct block_device *dev, struct block_request *rq)
+{
+    uint8_t *disk = ramdisk_data + rq->lba * dev->sector_size;
+    for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt; ++i) {
+            uint8_t *buf = (uint8_t *)bio->vecs[i].buf;
+            uint64_t len = bio->vecs[i].len;
+            for (uint64_t b = 0; b < len; ++b) {
+                if (rq->op == BLOCK_OP_WRITE) {
+                    disk[b] = buf[b];
+                } else {
+                    buf[b] = disk[b];
+                }
+            }
+            disk += len;
+        }
+    }
+    return 0;
+}
+
 void block_init(void)
 {
     ramdisk_dev.name = "ramdisk0";
@@ -193,14 +491,14 @@ void block_init(void)
     ramdisk_dev.sectors = RAMDISK_SECTORS;
     ramdisk_dev.read = ramdisk_read;
     ramdisk_dev.write = ramdisk_write;
+    ramdisk_dev.submit = ramdisk_submit;
     ramdisk_seed_fat16();
     default_dev = &ramdisk_dev;
-    block_cache_reset();
+    bcache_init();
 
     struct block_device *ata = ata_init();
     if (ata) {
         default_dev = ata;
-        block_cache_reset();
     }
 }
 
@@ -218,40 +516,290 @@ void block_set_default(struct block_device *dev)
 {
     if (dev) {
         default_dev = dev;
-        block_cache_reset();
     }
 }
 
 int block_read(struct block_device *dev, uint64_t lba, uint64_t count, void *buf)
 {
-    if (!dev || !dev->read) {
+    if (!dev || (!dev->read && !dev->queue_rq) || !buf) {
+        return -1;
+    }
+    if (!bcache_usable(dev)) {
+        return block_io(dev, BLOCK_OP_READ, lba, count, buf);
+    }
+    if (lba >= dev->sectors || count > dev->sectors - lba) {
         return -1;
     }
-    if (count == 1 && buf) {
-        struct block_cache_entry *cached = block_cache_lookup(dev, lba);
-        if (cached) {
-            uint8_t *dst = (uint8_t *)buf;
-            for (uint64_t i = 0; i < RAMDISK_SECTOR_SIZE; ++i) {
-                dst[i] = cached->data[i];
+
+    uint8_t *dst = (uint8_t *)buf;
+    int rc = 0;
+    bcache_lock();
+    readahead_reap_done();
+    uint64_t i = 0;
+    while (i < count) {
+        struct block_buf *b = bcache_lookup(dev, lba + i);
+        if (b && bcache_settle(b) != 0) {
+            b = NULL;
+        }
+        if (b) {
+            copy_block(dst + i * BLOCK_CACHE_BLOCK_SIZE, b->data);
+            b->referenced = 1;
+            bcache.stats.hits++;
+            ++i;
+            continue;
+        }
+        /* Read the whole run of missing sectors in one request, straight into buf. */
+        uint64_t run = 1;
+        while (i + run < count && !bcache_lookup(dev, lba + i + run)) {
+            ++run;
+        }
+        bcache.stats.misses += run;
+        rc = block_io(dev, BLOCK_OP_READ, lba + i, run, dst + i * BLOCK_CACHE_BLOCK_SIZE);
+        if (rc != 0) {
+            break;
+        }
+        for (uint64_t j = 0; j < run; ++j) {
+            struct block_buf *nb = bcache_insert(dev, lba + i + j);
+            if (nb) {
+                copy_block(nb->data, dst + (i + j) * BLOCK_CACHE_BLOCK_SIZE);
             }
-            return 0;
         }
+        i += run;
     }
-    int rc = dev->read(dev, lba, count, buf);
-    if (rc == 0 && count == 1 && buf) {
-        block_cache_store(dev, lba, buf);
-    }
+    bcache_unlock();
     return rc;
 }
 
 int block_write(struct block_device *dev, uint64_t lba, uint64_t count, const void *buf)
 {
-    if (!dev || !dev->write) {
+    if (!dev || (!dev->write && !dev->queue_rq) || !buf) {
+        return -1;
+    }
+    if (!bcache_usable(dev)) {
+        return block_io(dev, BLOCK_OP_WRITE, lba, count, (void *)buf);
+    }
+    if (lba >= dev->sectors || count > dev->sectors - lba) {
         return -1;
     }
-    int rc = dev->write(dev, lba, count, buf);
-    if (rc == 0 && count == 1 && buf) {
-        block_cache_store(dev, lba, buf);
+
+    const uint8_t *src = (const uint8_t *)buf;
+    int rc = 0;
+    bcache_lock();
+    readahead_reap_done();
+    for (uint64_t i = 0; i < count; ++i) {
+        struct block_buf *b = bcache_lookup(dev, lba + i);
+        if (b && bcache_settle(b) != 0) {
+            b = NULL;
+        }
+        if (!b) {
+            b = bcache_insert(dev, lba + i);
+        }
+        if (!b) {
+            /* Every buffer is dirty and unwritable: fall back to write-through. */
+            rc = block_io(dev, BLOCK_OP_WRITE, lba + i, 1, (void *)(src + i * BLOCK_CACHE_BLOCK_SIZE));
+            if (rc != 0) {
+                break;
+            }
+            continue;
+        }
+        copy_block(b->data, src + i * BLOCK_CACHE_BLOCK_SIZE);
+        b->referenced = 1;
+        if (!b->dirty) {
+            b->dirty = 1;
+            bcache.dirty_count++;
+        }
+    }
+    /* Bound the amount of unwritten data so eviction never stalls on it. */
+    if (rc == 0 && bcache.dirty_count > bcache.nbufs / 2) {
+        rc = bcache_flush_locked(NULL);
+    }
+    bcache_unlock();
+    return rc;
+}
+
+void block_readahead(struct block_device *dev, uint64_t lba, uint64_t count)
+{
+    if (!dev || (!dev->read && !dev->queue_rq) || !bcache_usable(dev)) {
+        return;
+    }
+    if (lba >= dev->sectors) {
+        return;
+    }
+    if (count > dev->sectors - lba) {
+        count = dev->sectors - lba;
+    }
+    /* Bios are never split on the way down, so keep each within one request. */
+    uint64_t per_bio = dev->max_sectors ? dev->max_sectors : BLOCK_DEFAULT_MAX_SECTORS;
+    if (per_bio > BLOCK_READAHEAD_MAX) {
+        per_bio = BLOCK_READAHEAD_MAX;
+    }
+    bcache_lock();
+    readahead_reap_done();
+    block_plug(dev);
+    uint64_t i = 0;
+    while (i < count) {
+        if (bcache_lookup(dev, lba + i)) {
+            ++i;
+            continue;
+        }
+        struct readahead_slot *slot = NULL;
+        for (uint32_t s = 0; s < BLOCK_READAHEAD_SLOTS && !slot; ++s) {
+            if (!ra_slots[s].busy) {
+                slot = &ra_slots[s];
+            }
+        }
+        if (!slot) {
+            break; /* enough already in flight; this is only a hint */
+        }
+        /* One bio per run of uncached sectors, each landing in its own buffer. */
+        uint32_t n = 0;
+        while (i < count && n < per_bio && !bcache_lookup(dev, lba + i)) {
+            struct block_buf *b = bcache_insert(dev, lba + i);
+            if (!b) {
+                break;
+            }
+            b->referenced = 0; /* not used yet: first in line if never read */
+            b->loading = &slot->bio; /* also keeps the rest of this run from evicting it */
+            slot->bufs[n] = b;
+            slot->vecs[n].buf = b->data;
+            slot->vecs[n].len = BLOCK_CACHE_BLOCK_SIZE;
+            ++n;
+            ++i;
+        }
+        if (n == 0) {
+            break;
+        }
+        struct bio *bio = &slot->bio;
+        bio->dev = dev;
+        bio->op = BLOCK_OP_READ;
+        bio->lba = slot->bufs[0]->lba;
+        bio->vecs = slot->vecs;
+        bio->vcnt = n;
+        bio->end_io = NULL;
+        bio->private = slot;
+        bio->status = 0;
+        bio->done = 0;
+        slot->busy = 1;
+        bcache.stats.readahead += n;
+        block_submit_bio(bio);
+    }
+    block_unplug(dev);
+    bcache_unlock();
+}
+
+/* First device, not already in done, that still has dirty buffers; cache lock held. */
+static struct block_device *bcache_next_dirty_dev(struct block_device *const *done, uint32_t ndone)
+{
+    for (uint64_t i = 0; i < bcache.nbufs; ++i) {
+        const struct block_buf *b = &bcache.bufs[i];
+        if (!b->dirty) {
+            continue;
+        }
+        uint32_t j = 0;
+        while (j < ndone && done[j] != b->dev) {
+            ++j;
+        }
+        if (j == ndone) {
+            return b->dev;
+        }
+    }
+    return NULL;
+}
+
+int block_sync(struct block_device *dev)
+{
+    int rc = 0;
+    if (dev) {
+        if (bcache.ready) {
+            bcache_lock();
+            rc = bcache_flush_locked(dev);
+            bcache_unlock();
+        }
+        /* Barrier after the data so it is on media, not just in the drive's cache. */
+        if (block_flush(dev) != 0) {
+            rc = -1;
+        }
+        return rc;
+    }
+
+    /* Every device: write back and barrier each one that had dirty buffers. */
+    struct block_device *done[BLOCK_SYNC_MAX_DEVICES];
+    uint32_t ndone = 0;
+    while (bcache.ready && ndone < BLOCK_SYNC_MAX_DEVICES) {
+        bcache_lock();
+        struct block_device *next = bcache_next_dirty_dev(done, ndone);
+        if (next && bcache_flush_locked(next) != 0) {
+            rc = -1;
+        }
+        bcache_unlock();
+        if (!next) {
+            break;
+        }
+        if (block_flush(next) != 0) {
+            rc = -1;
+        }
+        done[ndone++] = next;
+    }
+    if (bcache.ready && ndone == BLOCK_SYNC_MAX_DEVICES) {
+        bcache_lock();
+        if (bcache_flush_locked(NULL) != 0) {
+            rc = -1;
+        }
+        bcache_unlock();
+    }
+    int flushed_default = 0;
+    for (uint32_t i = 0; i < ndone; ++i) {
+        flushed_default |= done[i] == default_dev;
+    }
+    if (default_dev && !flushed_default && block_flush(default_dev) != 0) {
+        rc = -1;
     }
     return rc;
 }
+
+void block_cache_get_stats(struct block_cache_stats *out)
+{
+    if (!out) {
+        return;
+    }
+    *out = bcache.stats;
+    out->buffers = bcache.nbufs;
+    out->dirty = bcache.dirty_count;
+}
+
+void block_cache_dump(void)
+{
+    struct block_cache_stats st;
+    block_cache_get_stats(&st);
+    console_write("Buffer cache:\n  buffers=");
+    console_write_hex(st.buffers);
+    console_write(" dirty=");
+    console_write_hex(st.dirty);
+    console_write("\n  hits=");
+    console_write_hex(st.hits);
+    console_write(" misses=");
+    console_write_hex(st.misses);
+    console_write("\n  writebacks=");
+    console_write_hex(st.writebacks);
+    console_write(" evictions=");
+    console_write_hex(st.evictions);
+    console_write("\n  readahead=");
+    console_write_hex(st.readahead);
+    console_write("\n");
+
+    struct block_queue_stats qs = {0};
+    block_queue_get_stats(default_dev, &qs);
+    console_write("Request queue (");
+    console_write(default_dev ? default_dev->name : "none");
+    console_write("):\n  bios=");
+    console_write_hex(qs.bios);
+    console_write(" requests=");
+    console_write_hex(qs.requests);
+    console_write(" merges=");
+    console_write_hex(qs.merges);
+    console_write(" sectors=");
+    console_write_hex(qs.sectors);
+    console_write(" flushes=");
+    console_write_hex(qs.flushes);
+    console_write("\n");
+}
@@ -0,0 +1,629 @@
+#include "kernel/block.h"
+#include "kernel/heap.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/sched.h"
+#include "kernel/spinlock.h"
+#include "kernel/timer.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-device request queue. Bios are sorted into a single LBA-ordered list
+ * and merged with neighbours of the same direction; the dispatcher serves
+ * them in C-LOOK order (ascending from the last position, then wrap).
+ *
+ * There is no worker thread: whichever thread finds the queue idle and
+ * unplugged runs it until empty, and everyone else just queues and returns.
+ * Overlapping I/O is not reordered against itself only if it starts at the
+ * same LBA; callers that need stronger ordering (the buffer cache) serialise.
+ *
+ * A flush is a full barrier: it waits for every pending and in-flight
+ * request, and bios submitted behind it are held in arrival order until it
+ * completes.
+ *
+ * Drivers with a queue_rq hook complete asynchronously (typically from their
+ * interrupt handler) through block_request_done(), so several requests can be
+ * in flight at once; completions re-kick the queue, and a dispatcher that hits
+ * BLOCK_QUEUE_BUSY parks the request until one does.
+ */
+
+static uint64_t queue_max_sectors(const struct block_device *dev)
+{
+    return dev->max_sectors ? dev->max_sectors : BLOCK_DEFAULT_MAX_SECTORS;
+}
+
+static struct block_request *request_alloc(struct block_queue *q)
+{
+    struct block_request *rq = q->free;
+    if (rq) {
+        q->free = rq->next;
+    } else {
+        rq = (struct block_request *)kalloc_zero(sizeof(*rq), 16);
+    }
+    return rq;
+}
+
+static void request_recycle(struct block_queue *q, struct block_request *rq)
+{
+    rq->bio_head = NULL;
+    rq->bio_tail = NULL;
+    rq->next = q->free;
+    q->free = rq;
+}
+
+static void queue_kick(struct block_device *dev, int force);
+
+static void bio_finish(struct block_queue *q, struct bio *bio, int status)
+{
+    bio->status = status;
+    if (bio->end_io) {
+        bio->end_io(bio);
+    }
+    __atomic_store_n(&bio->done, 1, __ATOMIC_RELEASE);
+    sched_wake_all(&q->done_wq);
+}
+
+/* Merge bio into a pending neighbour or insert it in LBA order. Called locked. */
+static int queue_insert(struct block_device *dev, struct bio *bio)
+{
+    struct block_queue *q = &dev->queue;
+    uint64_t max = queue_max_sectors(dev);
+    struct block_request *prev = NULL;
+    struct block_request *rq = q->pending;
+
+    while (rq && rq->lba <= bio->lba) {
+        if (rq->op == bio->op && rq->lba + rq->sectors == bio->lba &&
+            rq->sectors + bio->sectors <= max) {
+            rq->bio_tail->next = bio;
+            rq->bio_tail = bio;
+            rq->sectors += bio->sectors;
+            q->stats.merges++;
+
+            /* The new bio may have closed the gap to the next request. */
+            struct block_request *next = rq->next;
+            if (next && next->op == rq->op && rq->lba + rq->sectors == next->lba &&
+                rq->sectors + next->sectors <= max) {
+                rq->bio_tail->next = next->bio_head;
+                rq->bio_tail = next->bio_tail;
+                rq->sectors += next->sectors;
+                rq->next = next->next;
+                request_recycle(q, next);
+                q->stats.merges++;
+            }
+            return 0;
+        }
+        prev = rq;
+        rq = rq->next;
+    }
+
+    if (rq && rq->op == bio->op && bio->lba + bio->sectors == rq->lba &&
+        rq->sectors + bio->sectors <= max) {
+        bio->next = rq->bio_head;
+        rq->bio_head = bio;
+        rq->lba = bio->lba;
+        rq->sectors += bio->sectors;
+        q->stats.merges++;
+        return 0;
+    }
+
+    struct block_request *nrq = request_alloc(q);
+    if (!nrq) {
+        return -1;
+    }
+    nrq->op = bio->op;
+    nrq->lba = bio->lba;
+    nrq->sectors = bio->sectors;
+    nrq->bio_head = bio;
+    nrq->bio_tail = bio;
+    nrq->next = rq;
+    if (prev) {
+        prev->next = nrq;
+    } else {
+        q->pending = nrq;
+    }
+    return 0;
+}
+
+/* Put back a request the driver had no room for, ahead of everything else. Called locked. */
+static void queue_requeue(struct block_queue *q, struct block_request *rq)
+{
+    if (rq->op == BLOCK_OP_FLUSH) {
+        q->flush_issued = 0;
+        request_recycle(q, rq);
+        return;
+    }
+    struct block_request **link = &q->pending;
+    while (*link && (*link)->lba < rq->lba) {
+        link = &(*link)->next;
+    }
+    rq->next = *link;
+    *link = rq;
+    q->head_lba = rq->lba;
+}
+
+static void queue_hold(struct block_queue *q, struct bio *bio)
+{
+    bio->next = NULL;
+    if (q->held_tail) {
+        q->held_tail->next = bio;
+    } else {
+        q->held_head = bio;
+    }
+    q->held_tail = bio;
+}
+
+/* Route a bio into the sorted list, the barrier slot, or behind the barrier. Called locked. */
+static int queue_add(struct block_device *dev, struct bio *bio)
+{
+    struct block_queue *q = &dev->queue;
+    if (q->flush) {
+        queue_hold(q, bio);
+        return 0;
+    }
+    if (bio->op == BLOCK_OP_FLUSH) {
+        q->flush = bio;
+        return 0;
+    }
+    return queue_insert(dev, bio);
+}
+
+/* The barrier completed: replay held bios until the next barrier. Called locked. */
+static void queue_release_held(struct block_device *dev)
+{
+    struct block_queue *q = &dev->queue;
+    struct bio *bio = q->held_head;
+    q->held_head = NULL;
+    q->held_tail = NULL;
+    while (bio) {
+        struct bio *next = bio->next;
+        bio->next = NULL;
+        if (queue_add(dev, bio) != 0) {
+            /* Out of request memory: keep it held and retry on the next dispatch. */
+            queue_hold(q, bio);
+        }
+        bio = next;
+    }
+}
+
+/* C-LOOK: first request at or beyond the head position, else the lowest. */
+static struct block_request *queue_next(struct block_device *dev)
+{
+    struct block_queue *q = &dev->queue;
+    if (!q->pending && !q->flush && q->held_head) {
+        queue_release_held(dev);
+    }
+    struct block_request *prev = NULL;
+    struct block_request *rq = q->pending;
+    while (rq && rq->lba < q->head_lba) {
+        prev = rq;
+        rq = rq->next;
+    }
+    if (!rq) {
+        prev = NULL;
+        rq = q->pending;
+    }
+    if (!rq) {
+        /* Everything before the barrier has completed; now the barrier itself. */
+        if (!q->flush || q->flush_issued || q->inflight) {
+            return NULL;
+        }
+        rq = request_alloc(q);
+        if (!rq) {
+            return NULL;
+        }
+        rq->op = BLOCK_OP_FLUSH;
+        rq->lba = 0;
+        rq->sectors = 0;
+        rq->bio_head = q->flush;
+        rq->bio_tail = q->flush;
+        rq->next = NULL;
+        q->flush_issued = 1;
+        return rq;
+    }
+    if (prev) {
+        prev->next = rq->next;
+    } else {
+        q->pending = rq->next;
+    }
+    rq->next = NULL;
+    q->head_lba = rq->lba + rq->sectors;
+    return rq;
+}
+
+static int queue_bounce(struct block_device *dev, struct block_queue *q, uint64_t sectors)
+{
+    if (q->bounce && q->bounce_sectors >= sectors) {
+        return 0;
+    }
+    uint64_t max = queue_max_sectors(dev);
+    if (sectors > max) {
+        return -1;
+    }
+    uint64_t pages = (max * dev->sector_size + 4095) / 4096;
+    uint64_t phys = pmm_alloc_pages(pages);
+    if (!phys) {
+        return -1;
+    }
+    q->bounce = (uint8_t *)phys_to_hhdm(phys);
+    q->bounce_sectors = pages * 4096 / dev->sector_size;
+    return 0;
+}
+
+static int request_execute_vecs(struct block_device *dev, struct block_request *rq)
+{
+    uint64_t lba = rq->lba;
+    for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt; ++i) {
+            uint64_t count = bio->vecs[i].len / dev->sector_size;
+            int rc = (rq->op == BLOCK_OP_WRITE)
+                ? dev->write(dev, lba, count, bio->vecs[i].buf)
+                : dev->read(dev, lba, count, bio->vecs[i].buf);
+            if (rc != 0) {
+                return rc;
+            }
+            lba += count;
+        }
+        if (bio == rq->bio_tail) {
+            break;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Run one request against the driver. Drivers with a scatter-gather submit
+ * hook get the request as is; otherwise multi-piece requests are gathered
+ * into a bounce buffer so the device still sees a single command.
+ */
+static int request_execute(struct block_device *dev, struct block_queue *q, struct block_request *rq)
+{
+    if (rq->op == BLOCK_OP_FLUSH) {
+        return dev->flush ? dev->flush(dev) : 0;
+    }
+    if (dev->submit) {
+        return dev->submit(dev, rq);
+    }
+    struct bio *only = rq->bio_head;
+    if (only == rq->bio_tail && only->vcnt == 1) {
+        return (rq->op == BLOCK_OP_WRITE)
+            ? dev->write(dev, rq->lba, rq->sectors, only->vecs[0].buf)
+            : dev->read(dev, rq->lba, rq->sectors, only->vecs[0].buf);
+    }
+    if (queue_bounce(dev, q, rq->sectors) != 0) {
+        return request_execute_vecs(dev, rq);
+    }
+
+    uint8_t *bounce = q->bounce;
+    if (rq->op == BLOCK_OP_WRITE) {
+        uint64_t off = 0;
+        for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+            for (uint32_t i = 0; i < bio->vcnt; ++i) {
+                const uint8_t *src = (const uint8_t *)bio->vecs[i].buf;
+                for (uint64_t b = 0; b < bio->vecs[i].len; ++b) {
+                    bounce[off++] = src[b];
+                }
+            }
+            if (bio == rq->bio_tail) {
+                break;
+            }
+        }
+        return dev->write(dev, rq->lba, rq->sectors, bounce);
+    }
+
+    int rc = dev->read(dev, rq->lba, rq->sectors, bounce);
+    if (rc != 0) {
+        return rc;
+    }
+    uint64_t off = 0;
+    for (struct bio *bio = rq->bio_head; bio; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt; ++i) {
+            uint8_t *dst = (uint8_t *)bio->vecs[i].buf;
+            for (uint64_t b = 0; b < bio->vecs[i].len; ++b) {
+                dst[b] = bounce[off++];
+            }
+        }
+        if (bio == rq->bio_tail) {
+            break;
+        }
+    }
+    return 0;
+}
+
+static void request_complete(struct block_queue *q, struct block_request *rq, int status)
+{
+    struct bio *bio = rq->bio_head;
+    struct bio *last = rq->bio_tail;
+    while (bio) {
+        struct bio *next = (bio == last) ? NULL : bio->next;
+        bio->next = NULL;
+        bio_finish(q, bio, status);
+        bio = next;
+    }
+}
+
+void block_request_done(struct block_device *dev, struct block_request *rq, int status)
+{
+    struct block_queue *q = &dev->queue;
+    request_complete(q, rq, status);
+
+    arch_flags_t flags = spinlock_acquire_irqsave(&q->lock);
+    q->inflight--;
+    if (rq->op == BLOCK_OP_FLUSH) {
+        q->flush = NULL;
+        q->flush_issued = 0;
+        queue_release_held(dev);
+    }
+    request_recycle(q, rq);
+    spinlock_release_irqrestore(&q->lock, flags);
+    queue_kick(dev, 0);
+}
+
+static int request_dispatch(struct block_device *dev, struct block_queue *q, struct block_request *rq)
+{
+    if (dev->queue_rq) {
+        int rc = dev->queue_rq(dev, rq);
+        if (rc < 0) {
+            block_request_done(dev, rq, rc);
+            return 0;
+        }
+        return rc;
+    }
+    block_request_done(dev, rq, request_execute(dev, q, rq));
+    return 0;
+}
+
+static void queue_run(struct block_device *dev)
+{
+    struct block_queue *q = &dev->queue;
+    arch_flags_t flags = spinlock_acquire_irqsave(&q->lock);
+    for (;;) {
+        q->rerun = 0;
+        struct block_request *rq = queue_next(dev);
+        if (!rq) {
+            break;
+        }
+        if (rq->op == BLOCK_OP_FLUSH) {
+            q->stats.flushes++;
+        } else {
+            q->stats.requests++;
+            q->stats.sectors += rq->sectors;
+        }
+        q->inflight++;
+        spinlock_release_irqrestore(&q->lock, flags);
+
+        int rc = request_dispatch(dev, q, rq);
+
+        flags = spinlock_acquire_irqsave(&q->lock);
+        if (rc == BLOCK_QUEUE_BUSY) {
+            q->inflight--;
+            queue_requeue(q, rq);
+            /* Unless a completion raced with us, the next one will kick again. */
+            if (!q->rerun) {
+                break;
+            }
+        }
+    }
+    q->running = 0;
+    spinlock_release_irqrestore(&q->lock, flags);
+}
+
+/* Start dispatching unless another context already is (or the queue is plugged). */
+static void queue_kick(struct block_device *dev, int force)
+{
+    struct block_queue *q = &dev->queue;
+    arch_flags_t flags = spinlock_acquire_irqsave(&q->lock);
+    if (q->running) {
+        q->rerun = 1;
+        spinlock_release_irqrestore(&q->lock, flags);
+        return;
+    }
+    if ((!q->pending && !q->flush && !q->held_head) || (q->plugged && !force)) {
+        spinlock_release_irqrestore(&q->lock, flags);
+        return;
+    }
+    q->running = 1;
+    spinlock_release_irqrestore(&q->lock, flags);
+    queue_run(dev);
+}
+
+void block_submit_bio(struct bio *bio)
+{
+    if (!bio) {
+        return;
+    }
+    bio->done = 0;
+    bio->next = NULL;
+    struct block_device *dev = bio->dev;
+    uint64_t bytes = 0;
+    int flush = bio->op == BLOCK_OP_FLUSH;
+    int valid = dev && ((dev->read && dev->write) || dev->queue_rq) && (flush || bio->vcnt > 0) &&
+                (flush || bio->op == BLOCK_OP_READ || bio->op == BLOCK_OP_WRITE);
+    for (uint32_t i = 0; valid && !flush && i < bio->vcnt; ++i) {
+        if (!bio->vecs[i].buf || bio->vecs[i].len == 0 || bio->vecs[i].len % dev->sector_size) {
+            valid = 0;
+        }
+        bytes += bio->vecs[i].len;
+    }
+    if (valid && flush) {
+        bio->lba = 0;
+        bio->sectors = 0;
+    } else if (valid) {
+        bio->sectors = bytes / dev->sector_size;
+        valid = bio->lba < dev->sectors && bio->sectors <= dev->sectors - bio->lba;
+    }
+    if (!valid) {
+        if (dev) {
+            bio_finish(&dev->queue, bio, -1);
+        } else {
+            bio->status = -1;
+            bio->done = 1;
+        }
+        return;
+    }
+
+    struct block_queue *q = &dev->queue;
+    arch_flags_t flags = spinlock_acquire_irqsave(&q->lock);
+    q->stats.bios++;
+    int rc = queue_add(dev, bio);
+    spinlock_release_irqrestore(&q->lock, flags);
+    if (rc != 0) {
+        bio_finish(q, bio, -1);
+        return;
+    }
+    queue_kick(dev, 0);
+}
+
+static int bio_is_done(void *arg)
+{
+    return __atomic_load_n(&((struct bio *)arg)->done, __ATOMIC_ACQUIRE);
+}
+
+int block_wait(struct bio *bio)
+{
+    if (!bio) {
+        return -1;
+    }
+    while (!bio_is_done(bio)) {
+        if (!bio->dev) {
+            return -1;
+        }
+        /* Never wait on our own plug. */
+        queue_kick(bio->dev, 1);
+        sched_sleep_until(&bio->dev->queue.done_wq, bio_is_done, bio);
+    }
+    return bio->status;
+}
+
+void block_plug(struct block_device *dev)
+{
+    if (!dev) {
+        return;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&dev->queue.lock);
+    dev->queue.plugged++;
+    spinlock_release_irqrestore(&dev->queue.lock, flags);
+}
+
+void block_unplug(struct block_device *dev)
+{
+    if (!dev) {
+        return;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&dev->queue.lock);
+    if (dev->queue.plugged > 0) {
+        dev->queue.plugged--;
+    }
+    spinlock_release_irqrestore(&dev->queue.lock, flags);
+    queue_kick(dev, 0);
+}
+
+int block_io(struct block_device *dev, int op, uint64_t lba, uint64_t count, void *buf)
+{
+    if (!dev || !buf || count == 0) {
+        return -1;
+    }
+    struct bio_vec vec = { buf, count * dev->sector_size };
+    struct bio bio = {0};
+    bio.dev = dev;
+    bio.op = op;
+    bio.lba = lba;
+    bio.vecs = &vec;
+    bio.vcnt = 1;
+    block_submit_bio(&bio);
+    return block_wait(&bio);
+}
+
+int block_flush(struct block_device *dev)
+{
+    if (!dev) {
+        return -1;
+    }
+    struct bio bio = {0};
+    bio.dev = dev;
+    bio.op = BLOCK_OP_FLUSH;
+    block_submit_bio(&bio);
+    return block_wait(&bio);
+}
+
+void block_queue_get_stats(struct block_device *dev, struct block_queue_stats *out)
+{
+    if (!dev || !out) {
+        return;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&dev->queue.lock);
+    *out = dev->queue.stats;
+    spinlock_release_irqrestore(&dev->queue.lock, flags);
+}
+
+static void bench_submit(struct block_device *dev, struct bio *bio, uint64_t *seed, uint64_t span, uint64_t per)
+{
+    /* xorshift64: random 4 KiB-aligned offsets so the elevator has nothing to merge. */
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 7;
+    *seed ^= *seed << 17;
+    bio->dev = dev;
+    bio->op = BLOCK_OP_READ;
+    bio->lba = (*seed % span) * per;
+    bio->vcnt = 1;
+    block_submit_bio(bio);
+}
+
+int block_bench(struct block_device *dev, uint32_t depth, uint32_t ops, uint64_t *ticks_out)
+{
+    if (!dev || !ticks_out || depth == 0 || ops == 0 || dev->sector_size == 0 ||
+        dev->sector_size > 4096) {
+        return -1;
+    }
+    uint64_t per = 4096 / dev->sector_size;
+    uint64_t span = dev->sectors / per;
+    if (span == 0) {
+        return -1;
+    }
+    struct bio *bios = (struct bio *)kalloc_zero(sizeof(struct bio) * depth, 16);
+    struct bio_vec *vecs = (struct bio_vec *)kalloc_zero(sizeof(struct bio_vec) * depth, 16);
+    if (!bios || !vecs) {
+        return -1;
+    }
+    int rc = 0;
+    uint32_t pages = 0;
+    for (; pages < depth; ++pages) {
+        uint64_t phys = pmm_alloc_page();
+        if (!phys) {
+            rc = -1;
+            break;
+        }
+        vecs[pages].buf = (void *)phys_to_hhdm(phys);
+        vecs[pages].len = per * dev->sector_size;
+        bios[pages].vecs = &vecs[pages];
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ULL ^ timer_get_ticks();
+    uint64_t start = timer_get_ticks();
+    uint32_t submitted = 0;
+    uint32_t completed = 0;
+    for (uint32_t i = 0; rc == 0 && i < depth && submitted < ops; ++i, ++submitted) {
+        bench_submit(dev, &bios[i], &seed, span, per);
+    }
+    /* Bios complete roughly in submission order, so always wait on the oldest. */
+    while (completed < submitted) {
+        struct bio *bio = &bios[completed % depth];
+        if (block_wait(bio) != 0) {
+            rc = -1;
+        }
+        ++completed;
+        if (rc == 0 && submitted < ops) {
+            bench_submit(dev, bio, &seed, span, per);
+            ++submitted;
+        }
+    }
+    *ticks_out = timer_get_ticks() - start;
+
+    for (uint32_t i = 0; i < pages; ++i) {
+        pmm_free_page(hhdm_to_phys((uint64_t)vecs[i].buf));
+    }
+    kfree(vecs);
+    kfree(bios);
+    return rc;
+}
@@ -8,23 +8,23 @@ static spinlock_t console_lock;
 
 void console_backspace(void)
 {
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_backspace();
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
 void console_clear(uint8_t color)
 {
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_clear(color);
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
 void console_set_color(uint8_t color)
 {
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_set_color(color);
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
 void console_write(const char *msg)
@@ -32,17 +32,17 @@ void console_write(const char *msg)
     size_t len = 0;
     while (msg[len]) len++;
     
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_write(msg, len);
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
 void console_write_len(const char *msg, uint64_t len)
 {
     if (!msg || len == 0) return;
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_write(msg, (size_t)len);
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
 static char hex_digit(uint8_t value)
@@ -61,8 +61,8 @@ void console_write_hex(uint64_t value)
         buf[pos++] = hex_digit(nibble);
     }
     
-    spinlock_acquire_irqsave(&console_lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&console_lock);
     arch_console_write(buf, pos);
-    spinlock_release_irqrestore(&console_lock);
+    spinlock_release_irqrestore(&console_lock, flags);
 }
 
@@ -0,0 +1,224 @@
+#include "drivers/edu.h"
+#include "kernel/irq.h"
+#include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/pci.h"
+#include <arch/processor.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define EDU_VENDOR_ID 0x1234
+#define EDU_DEVICE_ID 0x11E8
+
+#define EDU_REG_IDENT      0x00
+#define EDU_REG_LIVENESS   0x04
+#define EDU_REG_IRQ_STATUS 0x24
+#define EDU_REG_IRQ_RAISE  0x60
+#define EDU_REG_IRQ_ACK    0x64
+#define EDU_REG_DMA_SRC    0x80
+#define EDU_REG_DMA_DST    0x88
+#define EDU_REG_DMA_COUNT  0x90
+#define EDU_REG_DMA_CMD    0x98
+
+#define EDU_IDENT_MAGIC 0xED
+
+#define EDU_DMA_CMD_START  0x1
+#define EDU_DMA_CMD_TO_RAM 0x2
+#define EDU_DMA_CMD_IRQ    0x4
+#define EDU_DMA_IRQ_STATUS 0x100
+
+/* The device's internal DMA window, and its default 28-bit address mask. */
+#define EDU_DMA_BUFFER 0x40000
+#define EDU_DMA_SIZE 4096
+#define EDU_DMA_LIMIT (1ULL << 28)
+
+#define EDU_TEST_IRQ_VALUE 0x5A5A0001u
+#define EDU_WAIT_SPINS 10000000
+
+struct edu_state {
+    struct pci_device *pci;
+    volatile uint8_t *regs;
+    int vector;
+    volatile uint32_t irq_count;
+    volatile uint32_t last_status;
+};
+
+static struct edu_state edu;
+
+static inline uint32_t edu_read32(uint32_t reg)
+{
+    return *(volatile uint32_t *)(edu.regs + reg);
+}
+
+static inline void edu_write32(uint32_t reg, uint32_t value)
+{
+    *(volatile uint32_t *)(edu.regs + reg) = value;
+}
+
+static inline void edu_write64(uint32_t reg, uint64_t value)
+{
+    *(volatile uint64_t *)(edu.regs + reg) = value;
+}
+
+static inline uint64_t edu_read64(uint32_t reg)
+{
+    return *(volatile uint64_t *)(edu.regs + reg);
+}
+
+static void edu_irq(void *ctx)
+{
+    (void)ctx;
+    uint32_t status = edu_read32(EDU_REG_IRQ_STATUS);
+    edu_write32(EDU_REG_IRQ_ACK, status);
+    edu.last_status = status;
+    edu.irq_count = edu.irq_count + 1;
+}
+
+static int edu_wait_irq(uint32_t seen)
+{
+    for (int i = 0; i < EDU_WAIT_SPINS; ++i) {
+        if (edu.irq_count != seen) {
+            return 0;
+        }
+        arch_cpu_relax();
+    }
+    return -1;
+}
+
+static int edu_wait_dma_idle(void)
+{
+    for (int i = 0; i < EDU_WAIT_SPINS; ++i) {
+        if (!(edu_read64(EDU_REG_DMA_CMD) & EDU_DMA_CMD_START)) {
+            return 0;
+        }
+        arch_cpu_relax();
+    }
+    return -1;
+}
+
+static int edu_dma(uint64_t src, uint64_t dst, uint32_t len, uint32_t cmd)
+{
+    uint32_t seen = edu.irq_count;
+    edu_write64(EDU_REG_DMA_SRC, src);
+    edu_write64(EDU_REG_DMA_DST, dst);
+    edu_write64(EDU_REG_DMA_COUNT, len);
+    if (edu.vector >= 0) {
+        cmd |= EDU_DMA_CMD_IRQ;
+    }
+    edu_write64(EDU_REG_DMA_CMD, cmd | EDU_DMA_CMD_START);
+    if (edu.vector >= 0) {
+        if (edu_wait_irq(seen) != 0 || !(edu.last_status & EDU_DMA_IRQ_STATUS)) {
+            return -1;
+        }
+    }
+    return edu_wait_dma_idle();
+}
+
+static void edu_dma_selftest(void)
+{
+    uint64_t src_phys = pmm_alloc_page();
+    uint64_t dst_phys = pmm_alloc_page();
+    if (!src_phys || !dst_phys) {
+        log_warn("edu: DMA test skipped (no pages)");
+        goto out;
+    }
+    if (src_phys + EDU_DMA_SIZE > EDU_DMA_LIMIT || dst_phys + EDU_DMA_SIZE > EDU_DMA_LIMIT) {
+        log_warn("edu: DMA test skipped (pages above 28-bit DMA mask)");
+        goto out;
+    }
+
+    uint8_t *src = (uint8_t *)phys_to_hhdm(src_phys);
+    uint8_t *dst = (uint8_t *)phys_to_hhdm(dst_phys);
+    for (uint32_t i = 0; i < EDU_DMA_SIZE; ++i) {
+        src[i] = (uint8_t)(i * 7 + 3);
+        dst[i] = 0;
+    }
+
+    if (edu_dma(src_phys, EDU_DMA_BUFFER, EDU_DMA_SIZE, 0) != 0 ||
+        edu_dma(EDU_DMA_BUFFER, dst_phys, EDU_DMA_SIZE, EDU_DMA_CMD_TO_RAM) != 0) {
+        log_warn("edu: DMA transfer timed out");
+        goto out;
+    }
+    for (uint32_t i = 0; i < EDU_DMA_SIZE; ++i) {
+        if (dst[i] != src[i]) {
+            log_info_hex("edu: DMA mismatch at", i);
+            goto out;
+        }
+    }
+    log_info("edu: DMA round trip OK");
+
+out:
+    if (src_phys) {
+        pmm_free_page(src_phys);
+    }
+    if (dst_phys) {
+        pmm_free_page(dst_phys);
+    }
+}
+
+static int edu_probe(struct pci_device *dev, const struct pci_device_id *id)
+{
+    (void)id;
+    edu.pci = dev;
+    edu.vector = -1;
+    edu.regs = (volatile uint8_t *)pci_map_bar(dev, 0);
+    if (!edu.regs) {
+        log_warn("edu: BAR0 not mapped");
+        return -1;
+    }
+    pci_enable_device(dev, 1);
+
+    uint32_t ident = edu_read32(EDU_REG_IDENT);
+    if ((ident & 0xFF) != EDU_IDENT_MAGIC) {
+        log_info_hex("edu: unexpected ident", ident);
+        return -1;
+    }
+    edu_write32(EDU_REG_LIVENESS, 0x12345678);
+    if (edu_read32(EDU_REG_LIVENESS) != ~0x12345678u) {
+        log_warn("edu: liveness check failed");
+        return -1;
+    }
+    log_info_hex("edu: device revision", ident >> 16);
+
+    int vector = irq_alloc_vector(edu_irq, &edu);
+    if (vector >= 0 && pci_enable_msi(dev, (uint8_t)vector) == 0) {
+        edu.vector = vector;
+        uint32_t seen = edu.irq_count;
+        edu_write32(EDU_REG_IRQ_RAISE, EDU_TEST_IRQ_VALUE);
+        if (edu_wait_irq(seen) == 0 && edu.last_status == EDU_TEST_IRQ_VALUE) {
+            log_info_hex("edu: MSI delivered on vector", (uint64_t)vector);
+        } else {
+            log_warn("edu: MSI did not arrive, falling back to polling");
+            pci_disable_msi(dev);
+            irq_free_vector(vector);
+            edu.vector = -1;
+        }
+    } else {
+        if (vector >= 0) {
+            irq_free_vector(vector);
+        }
+        log_warn("edu: MSI unavailable, polling");
+    }
+
+    edu_dma_selftest();
+    dev->driver_data = &edu;
+    return 0;
+}
+
+static const struct pci_device_id edu_ids[] = {
+    { EDU_VENDOR_ID, EDU_DEVICE_ID, PCI_ANY_ID, PCI_ANY_ID },
+    { 0, 0, 0, 0 },
+};
+
+static struct pci_driver edu_driver = {
+    .name = "edu",
+    .ids = edu_ids,
+    .probe = edu_probe,
+};
+
+void edu_driver_init(void)
+{
+    pci_register_driver(&edu_driver);
+}
@@ -1,11 +1,118 @@
 #include "kernel/fat.h"
 #include "kernel/block.h"
+#include "kernel/console.h"
+#include "kernel/heap.h"
+#include "kernel/pagecache.h"
+#include "kernel/timer.h"
 
 #include <stdint.h>
 #include <stddef.h>
 
 #define FAT16_MIN_CLUSTERS 4085
+#define FAT32_MIN_CLUSTERS 65525
 #define FAT16_EOC 0xFFF8
+#define FAT32_EOC 0x0FFFFFF8
+#define FAT32_MASK 0x0FFFFFFF
+#define FSINFO_LEAD_SIG 0x41615252
+#define FSINFO_STRUCT_SIG 0x61417272
+#define FSINFO_UNKNOWN 0xFFFFFFFF
+/* FAT sectors read from disk at a time when the table is loaded on demand. */
+#define FAT_TABLE_CHUNK 8
+#define FAT_NAME_MAX 255       /* UCS-2 units in a long name */
+#define FAT_COMP_MAX 256       /* bytes in one UTF-8 path component, with NUL */
+#define FAT_LFN_CHARS 13
+#define FAT_LFN_SLOTS_MAX 20
+#define FAT_LFN_LAST 0x40
+#define FAT_ATTR_LFN 0x0F
+#define FAT_CASE_LOWER_BASE 0x08
+#define FAT_CASE_LOWER_EXT 0x10
+#define FAT_DIR_INDEX_MAX 16
+#define FAT_DCACHE_ENTRIES 256
+#define FAT_DCACHE_BUCKETS 128
+/* Dirty directory entries older than this are written back by the next write. */
+#define FAT_INODE_WRITEBACK_TICKS (5 * TIMER_HZ)
+
+/* File clusters [index, index + length) are the disk clusters starting at cluster. */
+struct fat_extent {
+    uint32_t index;
+    uint32_t cluster;
+    uint32_t length;
+};
+
+/*
+ * One per open directory entry, shared by every handle on it. Size and
+ * start cluster changes stay here (dirty) until close, fsync or age-based
+ * writeback, instead of rewriting the directory sector on each write.
+ */
+struct fat_inode {
+    uint32_t dir_sector;
+    uint16_t dir_offset;
+    uint32_t start_cluster;
+    uint32_t size;
+    uint32_t refs;
+    int dirty;
+    uint8_t attr;
+    int preallocated; /* chain may run past size; trimmed at last close */
+    uint64_t dirtied_at;
+    struct fat_inode *next;       /* open inodes */
+    struct fat_inode *dirty_next; /* dirty inodes, oldest first */
+    /* Cluster chain cache: extents for the first `mapped` clusters, grown on demand. */
+    struct fat_extent *extents;
+    uint32_t extent_count;
+    uint32_t extent_cap;
+    uint32_t mapped;
+    uint32_t cursor; /* extent that served the last lookup */
+};
+
+/*
+ * Cached result of looking name up in the directory starting at parent.
+ * Negative entries record that the name is absent.
+ */
+struct fat_dentry {
+    uint32_t parent;
+    char name[11];
+    uint8_t used;
+    uint8_t negative;
+    uint8_t referenced; /* second chance for the replacement clock */
+    uint8_t is_dir;
+    uint8_t attr;
+    uint16_t dir_offset;
+    uint32_t dir_sector;
+    uint32_t start_cluster;
+    uint32_t size;
+    struct fat_dentry *hash_next;
+};
+
+/* One live entry of an indexed directory. */
+struct fat_dir_name {
+    uint8_t short_name[11];
+    uint8_t attr;
+    uint8_t case_flags;  /* NT lowercase bits from byte 12 */
+    uint16_t dir_offset;
+    uint16_t long_len;   /* UCS-2 units at long_off in the pool; 0 without a long name */
+    uint32_t long_off;
+    uint32_t dir_sector;
+    uint32_t start_cluster;
+    uint32_t size;
+    int32_t next[2];     /* hash chains of the long (0) and short (1) name keys */
+};
+
+/*
+ * Name index of one directory, built by a single scan on first access and
+ * kept current by creates, so long-name lookups hash instead of rescanning.
+ */
+struct fat_dir_index {
+    uint32_t dir_cluster;
+    struct fat_dir_name *names;
+    uint32_t count;
+    uint32_t cap;
+    uint16_t *pool;      /* long names, back to back */
+    uint32_t pool_len;
+    uint32_t pool_cap;
+    int32_t *heads;      /* key ids (name << 1 | kind), chains end at -1 */
+    uint32_t bucket_count;
+    struct fat_dir_index *next; /* most recently used first */
+};
 
 struct fat_state {
     struct block_device *dev;
@@ -14,18 +121,46 @@ struct fat_state {
     uint16_t reserved_sectors;
     uint8_t fat_count;
     uint16_t root_entries;
-    uint16_t fat_size;
+    uint32_t fat_size;
     uint32_t total_sectors;
+    int fat32;
+    uint32_t root_cluster; /* FAT32 root directory chain; 0 is the fixed FAT16 root region */
+    uint32_t fsinfo_sector; /* 0 when the volume has no usable FSInfo */
+    int fsinfo_dirty;
     uint32_t root_dir_sectors;
     uint32_t fat_start;
     uint32_t root_start;
     uint32_t data_start;
     uint32_t cluster_count;
+    /*
+     * The first FAT copy lives in memory for the life of the mount. Changes
+     * mark their sector dirty and reach every on-disk copy at fat_sync().
+     * When FSInfo supplies the free count, chunks are read on first use and
+     * free_map only covers loaded chunks.
+     */
+    uint8_t *table;
+    uint8_t *table_loaded; /* one bit per FAT_TABLE_CHUNK sectors */
+    uint8_t *table_dirty;  /* one bit per FAT sector */
+    uint32_t table_dirty_count;
+    uint64_t *free_map;    /* one bit per cluster, set when free */
+    /* Exact once every chunk is loaded; until then FSInfo's hint, kept only for reporting. */
+    uint32_t free_count;
+    uint32_t table_chunks_left; /* chunks not loaded yet */
+    uint32_t next_free;    /* allocation resumes scanning here */
+    struct fat_inode *inodes;
+    struct fat_dir_index *dir_indexes;
+    uint32_t dir_index_count;
+    struct fat_inode *dirty_head;
+    struct fat_inode *dirty_tail;
     int ready;
 };
 
 static struct fat_state fat;
 
+static struct fat_dentry dcache[FAT_DCACHE_ENTRIES];
+static struct fat_dentry *dcache_hash[FAT_DCACHE_BUCKETS];
+static uint32_t dcache_hand;
+
 static uint16_t read_u16(const uint8_t *p)
 {
     return (uint16_t)p[0] | ((uint16_t)p[1] << 8);
@@ -42,102 +177,495 @@ static int read_sector(uint32_t lba, uint8_t *buf)
     return block_read(fat.dev, lba, 1, buf);
 }
 
-static int is_end_cluster(uint16_t value)
+static void write_u16(uint8_t *p, uint16_t value)
 {
-    return value >= FAT16_EOC;
+    p[0] = (uint8_t)(value & 0xFF);
+    p[1] = (uint8_t)(value >> 8);
 }
 
-static uint16_t fat_next_cluster(uint16_t cluster)
+static void write_u32(uint8_t *p, uint32_t value)
 {
-    uint32_t offset = (uint32_t)cluster * 2u;
-    uint32_t sector = fat.fat_start + (offset / fat.bytes_per_sector);
-    uint32_t off = offset % fat.bytes_per_sector;
-    uint8_t buf[512];
-    if (read_sector(sector, buf) != 0) {
+    write_u16(p, (uint16_t)(value & 0xFFFF));
+    write_u16(p + 2, (uint16_t)(value >> 16));
+}
+
+static int is_end_cluster(uint32_t value)
+{
+    return value >= (fat.fat32 ? FAT32_EOC : FAT16_EOC);
+}
+
+static uint32_t entry_cluster(const uint8_t *ent)
+{
+    uint32_t cluster = read_u16(&ent[26]);
+    if (fat.fat32) {
+        cluster |= (uint32_t)read_u16(&ent[20]) << 16;
+    }
+    return cluster;
+}
+
+static void free_map_set(uint32_t cluster, int is_free)
+{
+    uint64_t bit = 1ULL << (cluster % 64);
+    if (is_free) {
+        fat.free_map[cluster / 64] |= bit;
+    } else {
+        fat.free_map[cluster / 64] &= ~bit;
+    }
+}
+
+static uint32_t table_get(uint32_t cluster)
+{
+    if (fat.fat32) {
+        return read_u32(&fat.table[cluster * 4u]) & FAT32_MASK;
+    }
+    return read_u16(&fat.table[cluster * 2u]);
+}
+
+/* Make sure the FAT sector holding cluster's entry is in memory. */
+static int table_load(uint32_t cluster)
+{
+    uint32_t entry_size = fat.fat32 ? 4u : 2u;
+    uint32_t chunk = (uint32_t)((uint64_t)cluster * entry_size / fat.bytes_per_sector) / FAT_TABLE_CHUNK;
+    uint8_t mask = (uint8_t)(1u << (chunk % 8));
+    if (fat.table_loaded[chunk / 8] & mask) {
+        return 0;
+    }
+    uint32_t first = chunk * FAT_TABLE_CHUNK;
+    uint32_t count = fat.fat_size - first;
+    if (count > FAT_TABLE_CHUNK) {
+        count = FAT_TABLE_CHUNK;
+    }
+    if (block_read(fat.dev, fat.fat_start + first, count, &fat.table[first * fat.bytes_per_sector]) != 0) {
+        return -1;
+    }
+    fat.table_loaded[chunk / 8] |= mask;
+    uint32_t per_sector = fat.bytes_per_sector / entry_size;
+    uint32_t lo = first * per_sector;
+    uint32_t hi = (first + count) * per_sector;
+    if (lo < 2) {
+        lo = 2;
+    }
+    if (hi > fat.cluster_count + 2) {
+        hi = fat.cluster_count + 2;
+    }
+    for (uint32_t c = lo; c < hi; ++c) {
+        if (table_get(c) == 0) {
+            free_map_set(c, 1);
+        }
+    }
+    if (--fat.table_chunks_left == 0) {
+        /* The whole table is in memory now: replace the FSInfo hint with the real count. */
+        uint32_t words = (fat.cluster_count + 2 + 63) / 64;
+        uint32_t free_count = 0;
+        for (uint32_t w = 0; w < words; ++w) {
+            free_count += (uint32_t)__builtin_popcountll(fat.free_map[w]);
+        }
+        if (free_count != fat.free_count) {
+            fat.free_count = free_count;
+            fat.fsinfo_dirty = 1;
+        }
+    }
+    return 0;
+}
+
+static uint32_t fat_next_cluster(uint32_t cluster)
+{
+    if (cluster >= fat.cluster_count + 2 || table_load(cluster) != 0) {
         return 0;
     }
-    return read_u16(&buf[off]);
+    return table_get(cluster);
 }
 
-static int fat_set_cluster(uint16_t cluster, uint16_t value)
+static int fat_set_cluster(uint32_t cluster, uint32_t value)
 {
-    uint32_t offset = (uint32_t)cluster * 2u;
-    uint32_t sector = fat.fat_start + (offset / fat.bytes_per_sector);
-    uint32_t off = offset % fat.bytes_per_sector;
-    uint8_t buf[512];
-    if (read_sector(sector, buf) != 0) {
+    if (cluster < 2 || cluster >= fat.cluster_count + 2 || table_load(cluster) != 0) {
         return -1;
     }
-    buf[off] = (uint8_t)(value & 0xFF);
-    buf[off + 1] = (uint8_t)(value >> 8);
-    return block_write(fat.dev, sector, 1, buf);
+    uint32_t old = table_get(cluster);
+    uint32_t offset;
+    if (fat.fat32) {
+        offset = cluster * 4u;
+        /* The top four bits are reserved and must be preserved. */
+        uint32_t raw = read_u32(&fat.table[offset]);
+        write_u32(&fat.table[offset], (raw & ~FAT32_MASK) | (value & FAT32_MASK));
+    } else {
+        offset = cluster * 2u;
+        write_u16(&fat.table[offset], (uint16_t)value);
+    }
+
+    uint32_t sector = offset / fat.bytes_per_sector;
+    uint8_t mask = (uint8_t)(1u << (sector % 8));
+    if (!(fat.table_dirty[sector / 8] & mask)) {
+        fat.table_dirty[sector / 8] |= mask;
+        fat.table_dirty_count++;
+    }
+    if (old == 0 && value != 0) {
+        free_map_set(cluster, 0);
+        if (fat.free_count) {
+            fat.free_count--;
+        }
+        fat.fsinfo_dirty = 1;
+    } else if (old != 0 && value == 0) {
+        free_map_set(cluster, 1);
+        if (fat.free_count < fat.cluster_count) {
+            fat.free_count++;
+        }
+        fat.fsinfo_dirty = 1;
+        if (cluster < fat.next_free) {
+            fat.next_free = cluster;
+        }
+    }
+    return 0;
+}
+
+static uint32_t fat_eoc(void)
+{
+    return fat.fat32 ? FAT32_MASK : FAT16_EOC;
+}
+
+/*
+ * Claim the first free cluster at or after from, wrapping once; 0 if the
+ * volume is full. Only the bitmap decides: the free count may be a stale
+ * FSInfo hint.
+ */
+static uint32_t fat_alloc_from(uint32_t from)
+{
+    /* Scan a word (64 clusters) at a time, wrapping once. */
+    uint32_t words = (fat.cluster_count + 2 + 63) / 64;
+    uint32_t start = from / 64;
+    for (uint32_t i = 0; i <= words; ++i) {
+        uint32_t w = (start + i) % words;
+        /* Entries of a word never straddle a chunk, so its first cluster decides. */
+        if (table_load(w * 64) != 0) {
+            return 0;
+        }
+        uint64_t bits = fat.free_map[w];
+        if (i == 0) {
+            bits &= ~0ULL << (from % 64);
+        }
+        if (!bits) {
+            continue;
+        }
+        uint32_t cluster = w * 64 + (uint32_t)__builtin_ctzll(bits);
+        if (fat_set_cluster(cluster, fat_eoc()) != 0) {
+            return 0;
+        }
+        return cluster;
+    }
+    return 0;
+}
+
+static uint32_t fat_alloc_cluster(void)
+{
+    uint32_t cluster = fat_alloc_from(fat.next_free);
+    if (cluster) {
+        fat.next_free = cluster + 1;
+    }
+    return cluster;
+}
+
+/*
+ * Allocation for a growing chain: the cluster right after its tail when
+ * free, else the next free one beyond it, so that concurrent writers do not
+ * interleave one cluster at a time.
+ */
+static uint32_t fat_alloc_cluster_after(uint32_t tail)
+{
+    if (tail < 2 || tail + 1 >= fat.cluster_count + 2) {
+        return fat_alloc_cluster();
+    }
+    return fat_alloc_from(tail + 1);
 }
 
-static uint16_t fat_alloc_cluster(void)
+/* First cluster of a free run of count clusters at or after from (then from 2); 0 if none. */
+static uint32_t fat_find_free_run(uint32_t count, uint32_t from)
 {
-    uint32_t total = fat.cluster_count + 2;
-    for (uint32_t cluster = 2; cluster < total; ++cluster) {
-        uint16_t val = fat_next_cluster((uint16_t)cluster);
-        if (val == 0x0000) {
-            if (fat_set_cluster((uint16_t)cluster, FAT16_EOC) != 0) {
+    uint32_t limit = fat.cluster_count + 2;
+    if (from < 2 || from >= limit) {
+        from = 2;
+    }
+    for (int pass = 0; pass < 2; ++pass) {
+        uint32_t c = pass == 0 ? from : 2;
+        uint32_t end = pass == 0 ? limit : from + count - 1;
+        if (end > limit) {
+            end = limit;
+        }
+        uint32_t start = 0;
+        uint32_t len = 0;
+        while (c < end) {
+            if (table_load(c) != 0) {
                 return 0;
             }
-            return (uint16_t)cluster;
+            uint64_t word = fat.free_map[c / 64];
+            if (c % 64 == 0 && (word == 0 || word == ~0ULL) && c + 64 <= end) {
+                /* Whole words at a time through long used or free stretches. */
+                if (word == 0) {
+                    len = 0;
+                } else {
+                    if (len == 0) {
+                        start = c;
+                    }
+                    len += 64;
+                    if (len >= count) {
+                        return start;
+                    }
+                }
+                c += 64;
+                continue;
+            }
+            if (word & (1ULL << (c % 64))) {
+                if (len == 0) {
+                    start = c;
+                }
+                if (++len >= count) {
+                    return start;
+                }
+            } else {
+                len = 0;
+            }
+            ++c;
         }
     }
     return 0;
 }
 
-static int upper_char(int c)
+/* Write each run of dirty FAT sectors to every FAT copy. */
+static int fat_flush_table(void)
 {
-    if (c >= 'a' && c <= 'z') {
-        return c - ('a' - 'A');
+    int rc = 0;
+    uint32_t s = 0;
+    while (fat.table_dirty_count && s < fat.fat_size) {
+        if (!(fat.table_dirty[s / 8] & (1u << (s % 8)))) {
+            ++s;
+            continue;
+        }
+        uint32_t run = 0;
+        while (s + run < fat.fat_size && (fat.table_dirty[(s + run) / 8] & (1u << ((s + run) % 8)))) {
+            ++run;
+        }
+        int failed = 0;
+        for (uint32_t copy = 0; copy < fat.fat_count; ++copy) {
+            uint32_t lba = fat.fat_start + copy * fat.fat_size + s;
+            if (block_write(fat.dev, lba, run, &fat.table[s * fat.bytes_per_sector]) != 0) {
+                failed = 1;
+            }
+        }
+        if (failed) {
+            /* Leave the run dirty so the next sync writes every copy again. */
+            rc = -1;
+        } else {
+            for (uint32_t i = s; i < s + run; ++i) {
+                fat.table_dirty[i / 8] &= (uint8_t)~(1u << (i % 8));
+                fat.table_dirty_count--;
+            }
+        }
+        s += run;
     }
-    return c;
+    return rc;
 }
 
-static int build_short_name(const char *path, char out[11])
+/* Record the current free count and allocation hint in the FSInfo sector. */
+static int fat_flush_fsinfo(void)
 {
-    for (int i = 0; i < 11; ++i) {
-        out[i] = ' ';
+    if (!fat.fsinfo_sector || !fat.fsinfo_dirty) {
+        return 0;
     }
-    if (!path || path[0] == '\0') {
+    uint8_t sector[512];
+    if (read_sector(fat.fsinfo_sector, sector) != 0) {
         return -1;
     }
-    int name_len = 0;
-    int ext_len = 0;
-    int in_ext = 0;
-    while (*path) {
-        char c = *path;
-        if (c == '/') {
-            break;
+    write_u32(&sector[488], fat.free_count);
+    write_u32(&sector[492], fat.next_free);
+    if (block_write(fat.dev, fat.fsinfo_sector, 1, sector) != 0) {
+        return -1;
+    }
+    fat.fsinfo_dirty = 0;
+    return 0;
+}
+
+/*
+ * FAT32 volumes keep a free count and next-free hint in FSInfo. When they
+ * are present and sane, take them as starting hints; the caller then loads
+ * the FAT lazily and the count becomes exact once all of it has been seen.
+ */
+static int fat_read_fsinfo(uint16_t sector_num)
+{
+    fat.fsinfo_sector = 0;
+    if (sector_num == 0 || sector_num == 0xFFFF || sector_num >= fat.reserved_sectors) {
+        return -1;
+    }
+    uint8_t sector[512];
+    if (read_sector(sector_num, sector) != 0) {
+        return -1;
+    }
+    if (read_u32(&sector[0]) != FSINFO_LEAD_SIG || read_u32(&sector[484]) != FSINFO_STRUCT_SIG) {
+        return -1;
+    }
+    fat.fsinfo_sector = sector_num;
+    uint32_t free_count = read_u32(&sector[488]);
+    uint32_t next_free = read_u32(&sector[492]);
+    if (next_free < 2 || next_free >= fat.cluster_count + 2) {
+        next_free = 2;
+    }
+    fat.next_free = next_free;
+    if (free_count == FSINFO_UNKNOWN || free_count > fat.cluster_count) {
+        return -1;
+    }
+    fat.free_count = free_count;
+    return 0;
+}
+
+static int fat_load_table(int lazy)
+{
+    kfree(fat.table);
+    kfree(fat.table_loaded);
+    kfree(fat.table_dirty);
+    kfree(fat.free_map);
+    uint32_t words = (fat.cluster_count + 2 + 63) / 64;
+    uint32_t chunks = (fat.fat_size + FAT_TABLE_CHUNK - 1) / FAT_TABLE_CHUNK;
+    fat.table = (uint8_t *)kalloc((uint64_t)fat.fat_size * fat.bytes_per_sector, 16);
+    fat.table_loaded = (uint8_t *)kalloc_zero((chunks + 7) / 8, 8);
+    fat.table_dirty = (uint8_t *)kalloc_zero((fat.fat_size + 7) / 8, 8);
+    fat.free_map = (uint64_t *)kalloc_zero((uint64_t)words * sizeof(uint64_t), 16);
+    fat.table_dirty_count = 0;
+    fat.table_chunks_left = 0;
+    if (!fat.table || !fat.table_loaded || !fat.table_dirty || !fat.free_map) {
+        return -1;
+    }
+    if (lazy) {
+        fat.table_chunks_left = chunks;
+        return 0;
+    }
+    if (block_read(fat.dev, fat.fat_start, fat.fat_size, fat.table) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < chunks; ++i) {
+        fat.table_loaded[i / 8] |= (uint8_t)(1u << (i % 8));
+    }
+    fat.free_count = 0;
+    for (uint32_t cluster = 2; cluster < fat.cluster_count + 2; ++cluster) {
+        if (table_get(cluster) == 0) {
+            free_map_set(cluster, 1);
+            fat.free_count++;
         }
-        if (c == '.') {
-            if (in_ext) {
-                return -1;
-            }
-            in_ext = 1;
-            ++path;
-            continue;
+    }
+    return 0;
+}
+
+/* Record cluster as file cluster number ino->mapped. */
+static int extent_append(struct fat_inode *ino, uint32_t cluster)
+{
+    if (ino->extent_count) {
+        struct fat_extent *last = &ino->extents[ino->extent_count - 1];
+        if (last->cluster + last->length == cluster) {
+            last->length++;
+            ino->mapped++;
+            return 0;
         }
-        c = (char)upper_char((int)c);
-        if (!in_ext) {
-            if (name_len >= 8) {
-                return -1;
+    }
+    if (ino->extent_count == ino->extent_cap) {
+        uint32_t cap = ino->extent_cap ? ino->extent_cap * 2 : 4;
+        struct fat_extent *grown = (struct fat_extent *)kalloc(sizeof(struct fat_extent) * cap, 16);
+        if (!grown) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < ino->extent_count; ++i) {
+            grown[i] = ino->extents[i];
+        }
+        kfree(ino->extents);
+        ino->extents = grown;
+        ino->extent_cap = cap;
+    }
+    struct fat_extent *e = &ino->extents[ino->extent_count++];
+    e->index = ino->mapped;
+    e->cluster = cluster;
+    e->length = 1;
+    ino->mapped++;
+    return 0;
+}
+
+/*
+ * Disk cluster holding file cluster `index`, or 0 past the end of the chain.
+ * With extend, the chain is grown with fresh clusters up to index. Lookups
+ * go through the inode's extent map, so the chain is only walked once.
+ */
+static uint32_t fat_inode_cluster(struct fat_inode *ino, uint32_t index, int extend)
+{
+    if (ino->start_cluster == 0) {
+        return 0;
+    }
+    if (ino->mapped == 0 && extent_append(ino, ino->start_cluster) != 0) {
+        return 0;
+    }
+    while (index >= ino->mapped) {
+        const struct fat_extent *last = &ino->extents[ino->extent_count - 1];
+        uint32_t tail = last->cluster + last->length - 1;
+        uint32_t next = fat_next_cluster(tail);
+        if (next < 2 || is_end_cluster(next)) {
+            if (!extend) {
+                return 0;
             }
-            out[name_len++] = c;
-        } else {
-            if (ext_len >= 3) {
-                return -1;
+            next = fat_alloc_cluster_after(tail);
+            if (!next || fat_set_cluster(tail, next) != 0) {
+                return 0;
+            }
+        }
+        if (extent_append(ino, next) != 0) {
+            return 0;
+        }
+    }
+    const struct fat_extent *e = &ino->extents[ino->cursor < ino->extent_count ? ino->cursor : 0];
+    if (index < e->index || index >= e->index + e->length) {
+        uint32_t lo = 0;
+        uint32_t hi = ino->extent_count;
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (ino->extents[mid].index <= index) {
+                lo = mid;
+            } else {
+                hi = mid;
             }
-            out[8 + ext_len++] = c;
         }
-        ++path;
+        ino->cursor = lo;
+        e = &ino->extents[lo];
+    }
+    return e->cluster + (index - e->index);
+}
+
+/*
+ * Like fat_inode_cluster, but also report how many of the want clusters from
+ * index onward are contiguous on disk, so they can move in one request.
+ */
+static uint32_t fat_inode_run(struct fat_inode *ino, uint32_t index, uint32_t want, int extend, uint32_t *run)
+{
+    /* Map (or allocate) the whole span first so the extent below is as long as possible. */
+    (void)fat_inode_cluster(ino, index + want - 1, extend);
+    uint32_t cluster = fat_inode_cluster(ino, index, extend);
+    if (cluster == 0) {
+        return 0;
+    }
+    const struct fat_extent *e = &ino->extents[ino->cursor];
+    uint32_t avail = e->index + e->length - index;
+    *run = avail < want ? avail : want;
+    return cluster;
+}
+
+static void copy_bytes(uint8_t *dst, const uint8_t *src, uint64_t len)
+{
+    for (uint64_t i = 0; i < len; ++i) {
+        dst[i] = src[i];
+    }
+}
+
+static int upper_char(int c)
+{
+    if (c >= 'a' && c <= 'z') {
+        return c - ('a' - 'A');
     }
-    return name_len > 0 ? 0 : -1;
+    return c;
 }
 
-static uint32_t cluster_to_sector(uint16_t cluster)
+static uint32_t cluster_to_sector(uint32_t cluster)
 {
     return fat.data_start + ((uint32_t)(cluster - 2) * fat.sectors_per_cluster);
 }
@@ -157,127 +685,996 @@ static int dir_write_sector(uint32_t lba, const uint8_t *buf)
     return block_write(fat.dev, lba, 1, buf);
 }
 
-static int dir_find_entry(uint16_t dir_cluster, const char name[11], int want_dir,
-                          struct fat_file *out, struct dir_loc *loc, int allow_free)
+static int dir_write_entry(const struct dir_loc *loc, const uint8_t *entry)
 {
+    if (!loc || !entry) {
+        return -1;
+    }
     uint8_t sector[512];
-    uint32_t entries_per_sector = fat.bytes_per_sector / 32;
-    uint32_t total_entries = (dir_cluster == 0) ? fat.root_entries : 0xFFFFFFFFu;
-    uint32_t seen = 0;
-    uint16_t cluster = dir_cluster;
-    int saw_free = 0;
-    struct dir_loc free_loc = {0};
-    while (1) {
-        uint32_t sector_start = (dir_cluster == 0) ? fat.root_start :
-            cluster_to_sector(cluster);
-        uint32_t sector_count = (dir_cluster == 0) ? fat.root_dir_sectors : fat.sectors_per_cluster;
-        for (uint32_t s = 0; s < sector_count; ++s) {
-            if (dir_read_sector(sector_start + s, sector) != 0) {
-                return -1;
+    if (dir_read_sector(loc->sector, sector) != 0) {
+        return -1;
+    }
+    for (uint32_t i = 0; i < 32; ++i) {
+        sector[loc->offset + i] = entry[i];
+    }
+    return dir_write_sector(loc->sector, sector);
+}
+
+static void dir_entry_init(uint8_t *entry, const char name[11], uint8_t attr, uint32_t cluster, uint32_t size)
+{
+    for (int i = 0; i < 32; ++i) {
+        entry[i] = 0;
+    }
+    for (int i = 0; i < 11; ++i) {
+        entry[i] = (uint8_t)name[i];
+    }
+    entry[11] = attr;
+    write_u16(&entry[20], (uint16_t)(cluster >> 16));
+    write_u16(&entry[26], (uint16_t)(cluster & 0xFFFF));
+    write_u32(&entry[28], size);
+}
+
+static int zero_cluster(uint32_t cluster)
+{
+    static const uint8_t zeros[4096];
+    uint32_t per_write = (uint32_t)(sizeof(zeros) / fat.bytes_per_sector);
+    uint32_t start = cluster_to_sector(cluster);
+    for (uint32_t s = 0; s < fat.sectors_per_cluster; s += per_write) {
+        uint32_t count = fat.sectors_per_cluster - s;
+        if (count > per_write) {
+            count = per_write;
+        }
+        if (block_write(fat.dev, start + s, count, zeros) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Walks the 32-byte slots of a directory in order, one sector in memory at a time. */
+struct dir_iter {
+    uint32_t dir_cluster; /* 0: the fixed FAT16 root region */
+    uint32_t cluster;     /* current cluster; the last one once the chain ends */
+    uint32_t sector;      /* within the cluster or root region */
+    uint32_t entry;       /* next slot within buf */
+    uint32_t seen;
+    uint32_t lba;
+    int loaded;
+    int error;
+    uint8_t buf[512];
+};
+
+static void dir_iter_start(struct dir_iter *it, uint32_t dir_cluster)
+{
+    it->dir_cluster = dir_cluster;
+    it->cluster = dir_cluster;
+    it->sector = 0;
+    it->entry = 0;
+    it->seen = 0;
+    it->loaded = 0;
+    it->error = 0;
+}
+
+/* Next slot of the directory, or NULL at its end (or on error, with it->error set). */
+static uint8_t *dir_iter_next(struct dir_iter *it, struct dir_loc *loc)
+{
+    uint32_t per_sector = fat.bytes_per_sector / 32;
+    for (;;) {
+        if (it->dir_cluster == 0 && it->seen >= fat.root_entries) {
+            return NULL;
+        }
+        if (it->loaded && it->entry < per_sector) {
+            break;
+        }
+        if (it->loaded) {
+            it->loaded = 0;
+            it->sector++;
+        }
+        uint32_t count = it->dir_cluster == 0 ? fat.root_dir_sectors : fat.sectors_per_cluster;
+        if (it->sector >= count) {
+            if (it->dir_cluster == 0) {
+                return NULL;
             }
-            for (uint32_t e = 0; e < entries_per_sector; ++e) {
-                if (dir_cluster == 0 && seen >= total_entries) {
-                    if (allow_free && saw_free) {
-                        if (loc) {
-                            *loc = free_loc;
-                        }
-                        return 1;
-                    }
-                    return -1;
-                }
-                uint32_t idx = e * 32;
-                uint8_t first = sector[idx];
-                if (dir_cluster == 0) {
-                    ++seen;
-                }
-                if (first == 0x00) {
-                    if (allow_free && !saw_free) {
-                        free_loc.sector = sector_start + s;
-                        free_loc.offset = (uint16_t)idx;
-                        saw_free = 1;
-                    }
-                    if (allow_free && saw_free) {
-                        if (loc) {
-                            *loc = free_loc;
-                        }
-                        return 1;
-                    }
-                    return -1;
-                }
-                if (first == 0xE5) {
-                    if (allow_free && !saw_free) {
-                        free_loc.sector = sector_start + s;
-                        free_loc.offset = (uint16_t)idx;
-                        saw_free = 1;
-                    }
-                    continue;
-                }
-                if (sector[idx + 11] == 0x0F) {
-                    continue;
-                }
-                int is_dir = (sector[idx + 11] & 0x10) != 0;
-                if (want_dir == 1 && !is_dir) {
-                    continue;
-                }
-                if (want_dir == 0 && is_dir) {
-                    continue;
-                }
-                int match = 1;
-                for (int i = 0; i < 11; ++i) {
-                    if ((char)sector[idx + i] != name[i]) {
-                        match = 0;
-                        break;
-                    }
-                }
-                if (match) {
-                    if (out) {
-                        out->start_cluster = read_u16(&sector[idx + 26]);
-                        out->size = read_u32(&sector[idx + 28]);
-                        out->dir_sector = sector_start + s;
-                        out->dir_offset = (uint16_t)idx;
-                        out->is_dir = is_dir ? 1 : 0;
-                        out->attr = sector[idx + 11];
-                    }
-                    if (loc) {
-                        loc->sector = sector_start + s;
-                        loc->offset = (uint16_t)idx;
-                    }
-                    return 0;
-                }
+            uint32_t next = fat_next_cluster(it->cluster);
+            if (next < 2 || is_end_cluster(next)) {
+                return NULL;
             }
+            it->cluster = next;
+            it->sector = 0;
         }
-        if (dir_cluster == 0) {
-            break;
+        uint32_t start = it->dir_cluster == 0 ? fat.root_start : cluster_to_sector(it->cluster);
+        it->lba = start + it->sector;
+        if (dir_read_sector(it->lba, it->buf) != 0) {
+            it->error = 1;
+            return NULL;
+        }
+        it->loaded = 1;
+        it->entry = 0;
+    }
+    uint32_t offset = it->entry * 32;
+    it->entry++;
+    it->seen++;
+    if (loc) {
+        loc->sector = it->lba;
+        loc->offset = (uint16_t)offset;
+    }
+    return &it->buf[offset];
+}
+
+/*
+ * Simple case folding for Latin-1, Latin Extended-A, Greek and Cyrillic;
+ * long names compare case-insensitively after it, as other FAT
+ * implementations do.
+ */
+static uint16_t ucs2_fold(uint16_t c)
+{
+    if (c >= 'a' && c <= 'z') {
+        return (uint16_t)(c - 0x20);
+    }
+    if (c >= 0xE0 && c <= 0xFE && c != 0xF7) {
+        return (uint16_t)(c - 0x20);
+    }
+    if (c == 0xFF) {
+        return 0x178;
+    }
+    if (((c >= 0x100 && c <= 0x137) || (c >= 0x14A && c <= 0x177)) && (c & 1)) {
+        return (uint16_t)(c - 1);
+    }
+    if (((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E)) && !(c & 1)) {
+        return (uint16_t)(c - 1);
+    }
+    if (c >= 0x3B1 && c <= 0x3C9 && c != 0x3C2) {
+        return (uint16_t)(c - 0x20);
+    }
+    if (c >= 0x430 && c <= 0x44F) {
+        return (uint16_t)(c - 0x20);
+    }
+    if (c >= 0x450 && c <= 0x45F) {
+        return (uint16_t)(c - 0x50);
+    }
+    return c;
+}
+
+/* Decode a UTF-8 name into at most max UCS-2 units; -1 if malformed or too long. */
+static int utf8_to_ucs2(const char *s, uint16_t *out, uint32_t max)
+{
+    uint32_t n = 0;
+    while (*s) {
+        uint8_t c = (uint8_t)*s++;
+        uint32_t cp = c;
+        uint32_t extra = 0;
+        if ((c & 0xE0) == 0xC0) {
+            cp = c & 0x1F;
+            extra = 1;
+        } else if ((c & 0xF0) == 0xE0) {
+            cp = c & 0x0F;
+            extra = 2;
+        } else if (c >= 0x80) {
+            return -1; /* continuation byte or outside the BMP */
+        }
+        for (uint32_t i = 0; i < extra; ++i) {
+            uint8_t b = (uint8_t)*s;
+            if ((b & 0xC0) != 0x80) {
+                return -1;
+            }
+            cp = (cp << 6) | (b & 0x3F);
+            ++s;
+        }
+        if ((cp >= 0xD800 && cp <= 0xDFFF) || n >= max) {
+            return -1;
+        }
+        out[n++] = (uint16_t)cp;
+    }
+    return (int)n;
+}
+
+/* Encode n UCS-2 units as NUL-terminated UTF-8, dropping whole characters that do not fit. */
+static void ucs2_to_utf8(const uint16_t *s, uint32_t n, char *out, uint64_t max)
+{
+    uint64_t pos = 0;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t c = s[i];
+        uint64_t need = c < 0x80 ? 1 : (c < 0x800 ? 2 : 3);
+        if (pos + need + 1 > max) {
+            break;
+        }
+        if (need == 1) {
+            out[pos++] = (char)c;
+        } else if (need == 2) {
+            out[pos++] = (char)(0xC0 | (c >> 6));
+            out[pos++] = (char)(0x80 | (c & 0x3F));
+        } else {
+            out[pos++] = (char)(0xE0 | (c >> 12));
+            out[pos++] = (char)(0x80 | ((c >> 6) & 0x3F));
+            out[pos++] = (char)(0x80 | (c & 0x3F));
+        }
+    }
+    out[pos] = '\0';
+}
+
+static uint32_t name_hash(const uint16_t *s, uint32_t n)
+{
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t c = ucs2_fold(s[i]);
+        h = (h ^ (c & 0xFF)) * 16777619u;
+        h = (h ^ (c >> 8)) * 16777619u;
+    }
+    return h;
+}
+
+static int names_equal(const uint16_t *a, uint32_t an, const uint16_t *b, uint32_t bn)
+{
+    if (an != bn) {
+        return 0;
+    }
+    for (uint32_t i = 0; i < an; ++i) {
+        if (ucs2_fold(a[i]) != ucs2_fold(b[i])) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* "NAME.EXT" form of a short entry, lowercased per the NT case bits in byte 12. */
+static uint32_t short_display(const uint8_t name[11], uint8_t case_flags, uint16_t out[12])
+{
+    uint32_t n = 0;
+    for (int i = 0; i < 8 && name[i] != ' '; ++i) {
+        uint16_t c = (i == 0 && name[i] == 0x05) ? 0xE5 : name[i];
+        if ((case_flags & FAT_CASE_LOWER_BASE) && c >= 'A' && c <= 'Z') {
+            c = (uint16_t)(c + 0x20);
+        }
+        out[n++] = c;
+    }
+    if (name[8] != ' ') {
+        out[n++] = '.';
+        for (int i = 8; i < 11 && name[i] != ' '; ++i) {
+            uint16_t c = name[i];
+            if ((case_flags & FAT_CASE_LOWER_EXT) && c >= 'A' && c <= 'Z') {
+                c = (uint16_t)(c + 0x20);
+            }
+            out[n++] = c;
+        }
+    }
+    return n;
+}
+
+static uint8_t lfn_checksum(const uint8_t name[11])
+{
+    uint8_t sum = 0;
+    for (int i = 0; i < 11; ++i) {
+        sum = (uint8_t)(((sum & 1) << 7) + (sum >> 1) + name[i]);
+    }
+    return sum;
+}
+
+/* Byte offsets of the 13 UCS-2 characters carried by one LFN slot. */
+static const uint8_t lfn_offsets[FAT_LFN_CHARS] = {1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30};
+
+/* Fill slot with piece ord (1-based) of name; the piece written first carries the last flag. */
+static void lfn_build(uint8_t *slot, const uint16_t *name, uint32_t n, uint32_t ord, int last, uint8_t sum)
+{
+    for (int i = 0; i < 32; ++i) {
+        slot[i] = 0;
+    }
+    slot[0] = (uint8_t)(ord | (last ? FAT_LFN_LAST : 0));
+    slot[11] = FAT_ATTR_LFN;
+    slot[13] = sum;
+    for (uint32_t k = 0; k < FAT_LFN_CHARS; ++k) {
+        uint32_t pos = (ord - 1) * FAT_LFN_CHARS + k;
+        uint16_t c = pos < n ? name[pos] : (pos == n ? 0x0000 : 0xFFFF);
+        write_u16(&slot[lfn_offsets[k]], c);
+    }
+}
+
+static int short_char_ok(int c)
+{
+    if ((c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return 1;
+    }
+    const char *extra = "$%'-_@~`!(){}^#&";
+    for (; *extra; ++extra) {
+        if (c == *extra) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Short entry for comp when it is a plain 8.3 name: valid characters and a
+ * single case within each of base and extension, which the NT case bits
+ * can record. Anything else needs long-name slots. Returns 1, with out
+ * still filled in, when comp only fails on mixed case: it folds to the
+ * same 8.3 key that case-insensitive lookups of it use.
+ */
+static int short_name_exact(const char *comp, char out[11], uint8_t *case_flags)
+{
+    for (int i = 0; i < 11; ++i) {
+        out[i] = ' ';
+    }
+    int len[2] = {0, 0};
+    int lower[2] = {0, 0};
+    int upper[2] = {0, 0};
+    int part = 0;
+    for (; *comp; ++comp) {
+        int c = (uint8_t)*comp;
+        if (c == '.') {
+            if (part == 1) {
+                return -1;
+            }
+            part = 1;
+            continue;
+        }
+        if (c >= 'a' && c <= 'z') {
+            lower[part] = 1;
+        } else if (c >= 'A' && c <= 'Z') {
+            upper[part] = 1;
+        }
+        c = upper_char(c);
+        if (!short_char_ok(c) || len[part] >= (part ? 3 : 8)) {
+            return -1;
+        }
+        out[(part ? 8 : 0) + len[part]++] = (char)c;
+    }
+    if (len[0] == 0 || (part == 1 && len[1] == 0)) {
+        return -1;
+    }
+    if ((lower[0] && upper[0]) || (lower[1] && upper[1])) {
+        return 1;
+    }
+    *case_flags = (uint8_t)((lower[0] ? FAT_CASE_LOWER_BASE : 0) | (lower[1] ? FAT_CASE_LOWER_EXT : 0));
+    return 0;
+}
+
+static int long_name_ok(const uint16_t *name, uint32_t n)
+{
+    if (n == 0 || name[n - 1] == ' ' || name[n - 1] == '.') {
+        return 0;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t c = name[i];
+        if (c < 0x20 || c == '"' || c == '*' || c == '/' || c == ':' || c == '<' ||
+            c == '>' || c == '?' || c == '\\' || c == '|') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void dir_index_free(struct fat_dir_index *idx)
+{
+    kfree(idx->names);
+    kfree(idx->pool);
+    kfree(idx->heads);
+    kfree(idx);
+}
+
+static uint32_t dir_index_key_hash(const struct fat_dir_index *idx, uint32_t i, uint32_t kind)
+{
+    const struct fat_dir_name *e = &idx->names[i];
+    if (kind == 0) {
+        return name_hash(&idx->pool[e->long_off], e->long_len);
+    }
+    uint16_t disp[12];
+    uint32_t n = short_display(e->short_name, 0, disp);
+    return name_hash(disp, n);
+}
+
+static void dir_index_link(struct fat_dir_index *idx, uint32_t i)
+{
+    for (uint32_t kind = 0; kind < 2; ++kind) {
+        if (kind == 0 && idx->names[i].long_len == 0) {
+            idx->names[i].next[0] = -1;
+            continue;
+        }
+        uint32_t b = dir_index_key_hash(idx, i, kind) % idx->bucket_count;
+        idx->names[i].next[kind] = idx->heads[b];
+        idx->heads[b] = (int32_t)(i << 1 | kind);
+    }
+}
+
+static int dir_index_rehash(struct fat_dir_index *idx, uint32_t buckets)
+{
+    int32_t *heads = (int32_t *)kalloc(sizeof(int32_t) * buckets, 16);
+    if (!heads) {
+        return -1;
+    }
+    for (uint32_t b = 0; b < buckets; ++b) {
+        heads[b] = -1;
+    }
+    kfree(idx->heads);
+    idx->heads = heads;
+    idx->bucket_count = buckets;
+    for (uint32_t i = 0; i < idx->count; ++i) {
+        dir_index_link(idx, i);
+    }
+    return 0;
+}
+
+/* Append the live entry ent (with its long name, if any) found at loc. */
+static int dir_index_add(struct fat_dir_index *idx, const uint8_t *ent, const struct dir_loc *loc,
+                         const uint16_t *long_name, uint32_t long_len)
+{
+    if (idx->count == idx->cap) {
+        uint32_t cap = idx->cap ? idx->cap * 2 : 16;
+        struct fat_dir_name *grown = (struct fat_dir_name *)kalloc(sizeof(struct fat_dir_name) * cap, 16);
+        if (!grown) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < idx->count; ++i) {
+            grown[i] = idx->names[i];
+        }
+        kfree(idx->names);
+        idx->names = grown;
+        idx->cap = cap;
+    }
+    if (idx->pool_len + long_len > idx->pool_cap) {
+        uint32_t cap = idx->pool_cap ? idx->pool_cap : 256;
+        while (cap < idx->pool_len + long_len) {
+            cap *= 2;
+        }
+        uint16_t *grown = (uint16_t *)kalloc(sizeof(uint16_t) * cap, 16);
+        if (!grown) {
+            return -1;
+        }
+        for (uint32_t i = 0; i < idx->pool_len; ++i) {
+            grown[i] = idx->pool[i];
+        }
+        kfree(idx->pool);
+        idx->pool = grown;
+        idx->pool_cap = cap;
+    }
+    struct fat_dir_name *e = &idx->names[idx->count];
+    for (int i = 0; i < 11; ++i) {
+        e->short_name[i] = ent[i];
+    }
+    e->attr = ent[11];
+    e->case_flags = ent[12];
+    e->dir_sector = loc->sector;
+    e->dir_offset = loc->offset;
+    e->start_cluster = entry_cluster(ent);
+    e->size = read_u32(&ent[28]);
+    e->long_off = idx->pool_len;
+    e->long_len = (uint16_t)long_len;
+    for (uint32_t i = 0; i < long_len; ++i) {
+        idx->pool[idx->pool_len++] = long_name[i];
+    }
+    idx->count++;
+    if (idx->count > idx->bucket_count) {
+        /* Keep chains short as the directory grows; relinks everything. */
+        return dir_index_rehash(idx, idx->bucket_count * 2);
+    }
+    dir_index_link(idx, idx->count - 1);
+    return 0;
+}
+
+/* One pass over the directory, pairing each short entry with its checksummed LFN slots. */
+static struct fat_dir_index *dir_index_build(uint32_t dir_cluster)
+{
+    struct fat_dir_index *idx = (struct fat_dir_index *)kalloc_zero(sizeof(*idx), 16);
+    if (!idx) {
+        return NULL;
+    }
+    idx->dir_cluster = dir_cluster;
+    if (dir_index_rehash(idx, 32) != 0) {
+        dir_index_free(idx);
+        return NULL;
+    }
+    struct dir_iter it;
+    struct dir_loc loc;
+    uint16_t lname[FAT_LFN_SLOTS_MAX * FAT_LFN_CHARS];
+    uint32_t lfn_total = 0;
+    uint32_t lfn_next = 0;
+    uint8_t lfn_sum = 0;
+    int lfn_valid = 0;
+    uint8_t *ent;
+    dir_iter_start(&it, dir_cluster);
+    while ((ent = dir_iter_next(&it, &loc)) != NULL) {
+        if (ent[0] == 0x00) {
+            break;
+        }
+        if (ent[0] == 0xE5) {
+            lfn_valid = 0;
+            continue;
+        }
+        if (ent[11] == FAT_ATTR_LFN) {
+            uint32_t ord = ent[0] & 0x1F;
+            if (ent[0] & FAT_LFN_LAST) {
+                lfn_valid = ord != 0 && ord <= FAT_LFN_SLOTS_MAX;
+                lfn_total = ord;
+                lfn_next = ord;
+                lfn_sum = ent[13];
+            }
+            if (!lfn_valid || ord != lfn_next || ent[13] != lfn_sum) {
+                lfn_valid = 0;
+                continue;
+            }
+            for (uint32_t k = 0; k < FAT_LFN_CHARS; ++k) {
+                lname[(ord - 1) * FAT_LFN_CHARS + k] = read_u16(&ent[lfn_offsets[k]]);
+            }
+            lfn_next--;
+            continue;
+        }
+        uint32_t llen = 0;
+        if (lfn_valid && lfn_next == 0 && lfn_checksum(ent) == lfn_sum) {
+            llen = lfn_total * FAT_LFN_CHARS;
+            for (uint32_t i = 0; i < llen; ++i) {
+                if (lname[i] == 0x0000) {
+                    llen = i;
+                    break;
+                }
+            }
+        }
+        lfn_valid = 0;
+        if ((ent[11] & 0x08) || (ent[0] == '.' && (ent[1] == ' ' || ent[1] == '.'))) {
+            continue; /* volume label, "." and ".." */
+        }
+        if (dir_index_add(idx, ent, &loc, lname, llen) != 0) {
+            dir_index_free(idx);
+            return NULL;
+        }
+    }
+    if (it.error) {
+        dir_index_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+/* Index for dir_cluster, building it on first use and evicting the least recently used. */
+static struct fat_dir_index *dir_index_get(uint32_t dir_cluster)
+{
+    struct fat_dir_index **link = &fat.dir_indexes;
+    while (*link && (*link)->dir_cluster != dir_cluster) {
+        link = &(*link)->next;
+    }
+    struct fat_dir_index *idx = *link;
+    if (idx) {
+        *link = idx->next;
+    } else {
+        idx = dir_index_build(dir_cluster);
+        if (!idx) {
+            return NULL;
+        }
+        fat.dir_index_count++;
+    }
+    idx->next = fat.dir_indexes;
+    fat.dir_indexes = idx;
+    if (fat.dir_index_count > FAT_DIR_INDEX_MAX) {
+        link = &fat.dir_indexes;
+        while ((*link)->next) {
+            link = &(*link)->next;
+        }
+        dir_index_free(*link);
+        *link = NULL;
+        fat.dir_index_count--;
+    }
+    return idx;
+}
+
+/* Entry whose long or short name matches name case-insensitively, or -1. */
+static int32_t dir_index_find(const struct fat_dir_index *idx, const uint16_t *name, uint32_t n)
+{
+    int32_t key = idx->heads[name_hash(name, n) % idx->bucket_count];
+    while (key >= 0) {
+        uint32_t i = (uint32_t)key >> 1;
+        uint32_t kind = (uint32_t)key & 1;
+        const struct fat_dir_name *e = &idx->names[i];
+        if (kind == 0) {
+            if (names_equal(&idx->pool[e->long_off], e->long_len, name, n)) {
+                return (int32_t)i;
+            }
+        } else {
+            uint16_t disp[12];
+            uint32_t dn = short_display(e->short_name, 0, disp);
+            if (names_equal(disp, dn, name, n)) {
+                return (int32_t)i;
+            }
+        }
+        key = e->next[kind];
+    }
+    return -1;
+}
+
+static int dir_index_has_short(const struct fat_dir_index *idx, const char name[11])
+{
+    uint16_t disp[12];
+    uint32_t n = short_display((const uint8_t *)name, 0, disp);
+    int32_t key = idx->heads[name_hash(disp, n) % idx->bucket_count];
+    while (key >= 0) {
+        const struct fat_dir_name *e = &idx->names[(uint32_t)key >> 1];
+        int same = key & 1;
+        for (int i = 0; same && i < 11; ++i) {
+            same = e->short_name[i] == (uint8_t)name[i];
+        }
+        if (same) {
+            return 1;
+        }
+        key = e->next[key & 1];
+    }
+    return 0;
+}
+
+static void dir_index_update(uint32_t dir_sector, uint16_t dir_offset, uint32_t start_cluster, uint32_t size)
+{
+    for (struct fat_dir_index *idx = fat.dir_indexes; idx; idx = idx->next) {
+        for (uint32_t i = 0; i < idx->count; ++i) {
+            struct fat_dir_name *e = &idx->names[i];
+            if (e->dir_sector == dir_sector && e->dir_offset == dir_offset) {
+                e->start_cluster = start_cluster;
+                e->size = size;
+                return;
+            }
+        }
+    }
+}
+
+static void dir_index_reset(void)
+{
+    while (fat.dir_indexes) {
+        struct fat_dir_index *idx = fat.dir_indexes;
+        fat.dir_indexes = idx->next;
+        dir_index_free(idx);
+    }
+    fat.dir_index_count = 0;
+}
+
+/*
+ * Unique "BASIS~N" alias for a long name: invalid characters become '_',
+ * spaces and extra dots are dropped, and N grows until no entry uses it.
+ */
+static int make_short_alias(const struct fat_dir_index *idx, const uint16_t *name, uint32_t n, char out[11])
+{
+    int32_t dot = -1;
+    for (uint32_t i = 1; i < n; ++i) {
+        if (name[i] == '.') {
+            dot = (int32_t)i;
+        }
+    }
+    char base[8];
+    char ext[3];
+    uint32_t blen = 0;
+    uint32_t elen = 0;
+    uint32_t base_end = dot >= 0 ? (uint32_t)dot : n;
+    for (uint32_t i = 0; i < n; ++i) {
+        uint16_t c = name[i];
+        if (c == ' ' || c == '.') {
+            continue;
+        }
+        char s = '_';
+        if (c < 0x80 && short_char_ok(upper_char(c))) {
+            s = (char)upper_char(c);
+        }
+        if (i < base_end && blen < sizeof(base)) {
+            base[blen++] = s;
+        } else if (i > base_end && elen < sizeof(ext)) {
+            ext[elen++] = s;
+        }
+    }
+    if (blen == 0) {
+        base[blen++] = '_';
+    }
+    for (uint32_t num = 1; num < 1000000; ++num) {
+        char tail[8];
+        uint32_t tlen = 0;
+        for (uint32_t v = num; v; v /= 10) {
+            tail[tlen++] = (char)('0' + v % 10);
+        }
+        tail[tlen++] = '~';
+        uint32_t keep = blen + tlen > 8 ? 8 - tlen : blen;
+        for (int i = 0; i < 11; ++i) {
+            out[i] = ' ';
+        }
+        for (uint32_t i = 0; i < keep; ++i) {
+            out[i] = base[i];
+        }
+        for (uint32_t i = 0; i < tlen; ++i) {
+            out[keep + i] = tail[tlen - 1 - i];
+        }
+        for (uint32_t i = 0; i < elen; ++i) {
+            out[8 + i] = ext[i];
+        }
+        if (!dir_index_has_short(idx, out)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Find count consecutive free slots, growing a cluster-chained directory
+ * with zeroed clusters when it has too few.
+ */
+static int dir_alloc_slots(uint32_t dir_cluster, uint32_t count, struct dir_loc *locs)
+{
+    struct dir_iter it;
+    struct dir_loc loc;
+    uint32_t run = 0;
+    uint8_t *ent;
+    dir_iter_start(&it, dir_cluster);
+    while ((ent = dir_iter_next(&it, &loc)) != NULL) {
+        if (ent[0] != 0x00 && ent[0] != 0xE5) {
+            run = 0;
+            continue;
+        }
+        locs[run++] = loc;
+        if (run == count) {
+            return 0;
+        }
+    }
+    if (it.error || dir_cluster == 0) {
+        return -1;
+    }
+    uint32_t tail = it.cluster;
+    while (run < count) {
+        uint32_t cluster = fat_alloc_cluster();
+        if (!cluster || zero_cluster(cluster) != 0 || fat_set_cluster(tail, cluster) != 0) {
+            return -1;
+        }
+        for (uint32_t s = 0; s < fat.sectors_per_cluster && run < count; ++s) {
+            for (uint32_t e = 0; e < fat.bytes_per_sector / 32 && run < count; ++e) {
+                locs[run].sector = cluster_to_sector(cluster) + s;
+                locs[run].offset = (uint16_t)(e * 32);
+                ++run;
+            }
+        }
+        tail = cluster;
+    }
+    return 0;
+}
+
+static uint32_t dcache_bucket(uint32_t parent, const char name[11])
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 4; ++i) {
+        h = (h ^ ((parent >> (i * 8)) & 0xFF)) * 16777619u;
+    }
+    for (int i = 0; i < 11; ++i) {
+        h = (h ^ (uint8_t)name[i]) * 16777619u;
+    }
+    return h % FAT_DCACHE_BUCKETS;
+}
+
+static int dcache_name_eq(const char *a, const char *b)
+{
+    for (int i = 0; i < 11; ++i) {
+        if (a[i] != b[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static struct fat_dentry *dcache_lookup(uint32_t parent, const char name[11])
+{
+    struct fat_dentry *d = dcache_hash[dcache_bucket(parent, name)];
+    while (d && (d->parent != parent || !dcache_name_eq(d->name, name))) {
+        d = d->hash_next;
+    }
+    return d;
+}
+
+static void dcache_unlink(struct fat_dentry *d)
+{
+    struct fat_dentry **link = &dcache_hash[dcache_bucket(d->parent, d->name)];
+    while (*link && *link != d) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) {
+        *link = d->hash_next;
+    }
+    d->used = 0;
+}
+
+/* Cache found (or, with found NULL, the name's absence) under (parent, name). */
+static void dcache_insert(uint32_t parent, const char name[11], const struct fat_file *found)
+{
+    struct fat_dentry *d = dcache_lookup(parent, name);
+    if (!d) {
+        /* Clock replacement: skip slots hit since the hand last passed. */
+        for (;;) {
+            d = &dcache[dcache_hand];
+            dcache_hand = (dcache_hand + 1) % FAT_DCACHE_ENTRIES;
+            if (!d->used || !d->referenced) {
+                break;
+            }
+            d->referenced = 0;
+        }
+        if (d->used) {
+            dcache_unlink(d);
+        }
+        d->parent = parent;
+        for (int i = 0; i < 11; ++i) {
+            d->name[i] = name[i];
+        }
+        uint32_t b = dcache_bucket(parent, name);
+        d->hash_next = dcache_hash[b];
+        dcache_hash[b] = d;
+        d->used = 1;
+    }
+    d->referenced = 0;
+    d->negative = found ? 0 : 1;
+    if (found) {
+        d->is_dir = found->is_dir;
+        d->attr = found->attr;
+        d->dir_sector = found->dir_sector;
+        d->dir_offset = found->dir_offset;
+        d->start_cluster = found->start_cluster;
+        d->size = found->size;
+    }
+}
+
+static void dcache_invalidate(uint32_t parent, const char name[11])
+{
+    struct fat_dentry *d = dcache_lookup(parent, name);
+    if (d) {
+        dcache_unlink(d);
+    }
+}
+
+/* Keep cached copies in step with a directory entry rewritten in place. */
+static void dcache_update(uint32_t dir_sector, uint16_t dir_offset, uint32_t start_cluster, uint32_t size)
+{
+    for (uint32_t i = 0; i < FAT_DCACHE_ENTRIES; ++i) {
+        struct fat_dentry *d = &dcache[i];
+        if (d->used && !d->negative && d->dir_sector == dir_sector && d->dir_offset == dir_offset) {
+            d->start_cluster = start_cluster;
+            d->size = size;
+        }
+    }
+}
+
+static void dcache_reset(void)
+{
+    for (uint32_t i = 0; i < FAT_DCACHE_ENTRIES; ++i) {
+        dcache[i].used = 0;
+    }
+    for (uint32_t i = 0; i < FAT_DCACHE_BUCKETS; ++i) {
+        dcache_hash[i] = NULL;
+    }
+    dcache_hand = 0;
+}
+
+/*
+ * Look comp up in the directory starting at dir_cluster. Plain 8.3
+ * components go through the dentry cache, keyed by their short form;
+ * everything else, and cache misses, probe the directory's name index.
+ */
+static int dir_find_entry(uint32_t dir_cluster, const char *comp, int want_dir, struct fat_file *out)
+{
+    struct fat_file found = {0};
+    char key[11];
+    uint8_t case_flags = 0;
+    int cacheable = short_name_exact(comp, key, &case_flags) == 0;
+    struct fat_dentry *d = cacheable ? dcache_lookup(dir_cluster, key) : NULL;
+    if (d) {
+        d->referenced = 1;
+        if (d->negative) {
+            return -1;
+        }
+        found.start_cluster = d->start_cluster;
+        found.size = d->size;
+        found.dir_sector = d->dir_sector;
+        found.dir_offset = d->dir_offset;
+        found.is_dir = d->is_dir;
+        found.attr = d->attr;
+    } else {
+        uint16_t name[FAT_NAME_MAX];
+        int n = utf8_to_ucs2(comp, name, FAT_NAME_MAX);
+        if (n <= 0) {
+            return -1;
+        }
+        struct fat_dir_index *idx = dir_index_get(dir_cluster);
+        if (!idx) {
+            return -1;
+        }
+        int32_t i = dir_index_find(idx, name, (uint32_t)n);
+        if (i < 0) {
+            if (cacheable) {
+                dcache_insert(dir_cluster, key, NULL);
+            }
+            return -1;
         }
-        uint16_t next = fat_next_cluster(cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            break;
+        const struct fat_dir_name *e = &idx->names[i];
+        found.start_cluster = e->start_cluster;
+        found.size = e->size;
+        found.dir_sector = e->dir_sector;
+        found.dir_offset = e->dir_offset;
+        found.is_dir = (e->attr & 0x10) ? 1 : 0;
+        found.attr = e->attr;
+        if (cacheable) {
+            dcache_insert(dir_cluster, key, &found);
         }
-        cluster = next;
-        seen = 0;
     }
-    if (allow_free && saw_free) {
-        if (loc) {
-            *loc = free_loc;
-        }
-        return 1;
+    if ((want_dir == 1 && !found.is_dir) || (want_dir == 0 && found.is_dir)) {
+        return -1;
     }
-    return -1;
+    if (out) {
+        *out = found;
+    }
+    return 0;
 }
 
-static int dir_write_entry(const struct dir_loc *loc, const uint8_t *entry)
+/*
+ * Add comp to the directory. A plain 8.3 name gets a single short entry;
+ * anything else is stored as checksummed LFN slots ahead of a generated
+ * "BASIS~N" alias.
+ */
+static int dir_create_entry(uint32_t dir_cluster, const char *comp, uint8_t attr, uint32_t cluster,
+                            struct fat_file *out)
 {
-    if (!loc || !entry) {
+    uint16_t name[FAT_NAME_MAX];
+    int n = utf8_to_ucs2(comp, name, FAT_NAME_MAX);
+    if (n <= 0 || !long_name_ok(name, (uint32_t)n)) {
         return -1;
     }
-    uint8_t sector[512];
-    if (dir_read_sector(loc->sector, sector) != 0) {
+    struct fat_dir_index *idx = dir_index_get(dir_cluster);
+    if (!idx || dir_index_find(idx, name, (uint32_t)n) >= 0) {
         return -1;
     }
-    for (uint32_t i = 0; i < 32; ++i) {
-        sector[loc->offset + i] = entry[i];
+    char key[11];
+    char short_name[11];
+    uint8_t case_flags = 0;
+    uint32_t slots = 1;
+    int foldable = short_name_exact(comp, key, &case_flags);
+    int exact = foldable == 0;
+    if (exact && !dir_index_has_short(idx, key)) {
+        for (int i = 0; i < 11; ++i) {
+            short_name[i] = key[i];
+        }
+    } else {
+        if (make_short_alias(idx, name, (uint32_t)n, short_name) != 0) {
+            return -1;
+        }
+        case_flags = 0;
+        slots += ((uint32_t)n + FAT_LFN_CHARS - 1) / FAT_LFN_CHARS;
     }
-    return dir_write_sector(loc->sector, sector);
+    struct dir_loc locs[FAT_LFN_SLOTS_MAX + 1];
+    if (dir_alloc_slots(dir_cluster, slots, locs) != 0) {
+        return -1;
+    }
+    uint8_t entry[32];
+    uint8_t sum = lfn_checksum((const uint8_t *)short_name);
+    for (uint32_t s = 0; s + 1 < slots; ++s) {
+        uint32_t ord = slots - 1 - s;
+        lfn_build(entry, name, (uint32_t)n, ord, s == 0, sum);
+        if (dir_write_entry(&locs[s], entry) != 0) {
+            return -1;
+        }
+    }
+    dir_entry_init(entry, short_name, attr, cluster, 0);
+    entry[12] = case_flags;
+    if (foldable >= 0) {
+        /* Drops a negative entry left by looking up any case of the name. */
+        dcache_invalidate(dir_cluster, key);
+    }
+    dcache_invalidate(dir_cluster, short_name);
+    if (dir_write_entry(&locs[slots - 1], entry) != 0) {
+        return -1;
+    }
+    const uint16_t *long_name = slots > 1 ? name : NULL;
+    if (dir_index_add(idx, entry, &locs[slots - 1], long_name, long_name ? (uint32_t)n : 0) != 0) {
+        /* The entry is on disk; rebuild the index from it on next use. */
+        struct fat_dir_index **link = &fat.dir_indexes;
+        while (*link != idx) {
+            link = &(*link)->next;
+        }
+        *link = idx->next;
+        dir_index_free(idx);
+        fat.dir_index_count--;
+    }
+    struct fat_file created = {0};
+    created.start_cluster = cluster;
+    created.dir_sector = locs[slots - 1].sector;
+    created.dir_offset = locs[slots - 1].offset;
+    created.is_dir = (attr & 0x10) ? 1 : 0;
+    created.attr = attr;
+    if (out) {
+        *out = created;
+    }
+    return 0;
 }
 
 static int fat_traverse_path(const char *path, int create, int want_dir_last, struct fat_file *out)
@@ -285,18 +1682,17 @@ static int fat_traverse_path(const char *path, int create, int want_dir_last, st
     if (!path || !out) {
         return -1;
     }
-    uint16_t dir_cluster = 0;
+    uint32_t dir_cluster = fat.root_cluster;
     const char *p = path;
     if (*p == '/') {
         ++p;
     }
-    char name[11];
     while (*p) {
         const char *start = p;
         while (*p && *p != '/') {
             ++p;
         }
-        char comp[16];
+        char comp[FAT_COMP_MAX];
         uint64_t len = (uint64_t)(p - start);
         if (len == 0 || len >= sizeof(comp)) {
             return -1;
@@ -306,40 +1702,18 @@ static int fat_traverse_path(const char *path, int create, int want_dir_last, st
         }
         comp[len] = '\0';
         int last = (*p == '\0');
-        if (build_short_name(comp, name) != 0) {
-            return -1;
-        }
         struct fat_file found = {0};
-        struct dir_loc loc = {0};
         int want_dir = last ? want_dir_last : 1;
-        int allow_free = last && create && want_dir_last == 0;
-        int res = dir_find_entry(dir_cluster, name, want_dir, &found, &loc, allow_free);
-        if (res == 0) {
+        if (dir_find_entry(dir_cluster, comp, want_dir, &found) == 0) {
             if (!last) {
-                dir_cluster = (uint16_t)found.start_cluster;
+                /* ".." naming the root records cluster 0 even on FAT32. */
+                dir_cluster = found.start_cluster ? found.start_cluster : fat.root_cluster;
             } else {
                 *out = found;
                 return 0;
             }
-        } else if (res == 1 && allow_free) {
-            uint8_t entry[32];
-            for (int i = 0; i < 32; ++i) {
-                entry[i] = 0;
-            }
-            for (int i = 0; i < 11; ++i) {
-                entry[i] = (uint8_t)name[i];
-            }
-            entry[11] = 0x20;
-            if (dir_write_entry(&loc, entry) != 0) {
-                return -1;
-            }
-            out->start_cluster = 0;
-            out->size = 0;
-            out->dir_sector = loc.sector;
-            out->dir_offset = loc.offset;
-            out->is_dir = 0;
-            out->attr = 0x20;
-            return 0;
+        } else if (last && create && want_dir_last == 0) {
+            return dir_create_entry(dir_cluster, comp, 0x20, 0, out);
         } else {
             return -1;
         }
@@ -350,9 +1724,96 @@ static int fat_traverse_path(const char *path, int create, int want_dir_last, st
     return -1;
 }
 
+static int fat_inode_writeback(struct fat_inode *ino)
+{
+    uint8_t sector[512];
+    if (dir_read_sector(ino->dir_sector, sector) != 0) {
+        return -1;
+    }
+    uint8_t *ent = &sector[ino->dir_offset];
+    write_u16(&ent[20], (uint16_t)(ino->start_cluster >> 16));
+    write_u16(&ent[26], (uint16_t)(ino->start_cluster & 0xFFFF));
+    write_u32(&ent[28], ino->size);
+    dcache_update(ino->dir_sector, ino->dir_offset, ino->start_cluster, ino->size);
+    dir_index_update(ino->dir_sector, ino->dir_offset, ino->start_cluster, ino->size);
+    return dir_write_sector(ino->dir_sector, sector);
+}
+
+static void fat_inode_mark_dirty(struct fat_inode *ino)
+{
+    if (ino->dirty) {
+        return;
+    }
+    ino->dirty = 1;
+    ino->dirtied_at = timer_get_ticks();
+    ino->dirty_next = NULL;
+    if (fat.dirty_tail) {
+        fat.dirty_tail->dirty_next = ino;
+    } else {
+        fat.dirty_head = ino;
+    }
+    fat.dirty_tail = ino;
+}
+
+/* Write back dirty inodes dirtied at least min_age ticks ago (0: all of them). */
+static int fat_flush_inodes(uint64_t min_age)
+{
+    int rc = 0;
+    uint64_t now = timer_get_ticks();
+    struct fat_inode **link = &fat.dirty_head;
+    struct fat_inode *prev = NULL;
+    while (*link) {
+        struct fat_inode *ino = *link;
+        if (min_age && now - ino->dirtied_at < min_age) {
+            break; /* the list is in dirtying order */
+        }
+        if (fat_inode_writeback(ino) != 0) {
+            rc = -1;
+            prev = ino;
+            link = &ino->dirty_next;
+            continue;
+        }
+        ino->dirty = 0;
+        *link = ino->dirty_next;
+        if (fat.dirty_tail == ino) {
+            fat.dirty_tail = prev;
+        }
+    }
+    return rc;
+}
+
+/* Find or create the shared inode for the entry file was opened from. */
+static int fat_attach_inode(struct fat_file *file)
+{
+    struct fat_inode *ino = fat.inodes;
+    while (ino && (ino->dir_sector != file->dir_sector || ino->dir_offset != file->dir_offset)) {
+        ino = ino->next;
+    }
+    if (!ino) {
+        ino = (struct fat_inode *)kalloc_zero(sizeof(*ino), 16);
+        if (!ino) {
+            return -1;
+        }
+        ino->dir_sector = file->dir_sector;
+        ino->dir_offset = file->dir_offset;
+        ino->start_cluster = file->start_cluster;
+        ino->size = file->size;
+        ino->attr = file->attr;
+        ino->next = fat.inodes;
+        fat.inodes = ino;
+    }
+    ino->refs++;
+    file->inode = ino;
+    file->start_cluster = ino->start_cluster;
+    file->size = ino->size;
+    return 0;
+}
+
 int fat_init(struct block_device *dev)
 {
     fat.ready = 0;
+    dcache_reset();
+    dir_index_reset();
     if (!dev) {
         return -1;
     }
@@ -368,7 +1829,9 @@ int fat_init(struct block_device *dev)
     fat.root_entries = read_u16(&buf[17]);
     uint16_t total16 = read_u16(&buf[19]);
     fat.total_sectors = total16 ? total16 : read_u32(&buf[32]);
-    fat.fat_size = read_u16(&buf[22]);
+    uint16_t fat_size16 = read_u16(&buf[22]);
+    /* BPB_FATSz16 is zero on FAT32, which keeps the size in the extended BPB. */
+    fat.fat_size = fat_size16 ? fat_size16 : read_u32(&buf[36]);
     if (fat.bytes_per_sector != 512 || fat.sectors_per_cluster == 0 || fat.fat_size == 0) {
         return -1;
     }
@@ -376,11 +1839,39 @@ int fat_init(struct block_device *dev)
     fat.fat_start = fat.reserved_sectors;
     fat.root_start = fat.fat_start + (uint32_t)fat.fat_count * fat.fat_size;
     fat.data_start = fat.root_start + fat.root_dir_sectors;
+    if (fat.data_start >= fat.total_sectors) {
+        return -1;
+    }
     uint32_t data_sectors = fat.total_sectors - fat.data_start;
     fat.cluster_count = data_sectors / fat.sectors_per_cluster;
     if (fat.cluster_count < FAT16_MIN_CLUSTERS) {
         return -1;
     }
+    /* The cluster count alone decides the FAT type. */
+    fat.fat32 = fat.cluster_count >= FAT32_MIN_CLUSTERS;
+    if (fat.fat32 && (fat_size16 != 0 || fat.root_entries != 0)) {
+        return -1;
+    }
+    /* The FAT must describe every cluster; clamp rather than index past it. */
+    uint32_t entries = (uint32_t)((uint64_t)fat.fat_size * fat.bytes_per_sector / (fat.fat32 ? 4u : 2u));
+    if (fat.cluster_count + 2 > entries) {
+        fat.cluster_count = entries - 2;
+    }
+    fat.root_cluster = 0;
+    fat.fsinfo_sector = 0;
+    fat.fsinfo_dirty = 0;
+    fat.next_free = 2;
+    int lazy = 0;
+    if (fat.fat32) {
+        fat.root_cluster = read_u32(&buf[44]) & FAT32_MASK;
+        if (fat.root_cluster < 2 || fat.root_cluster >= fat.cluster_count + 2) {
+            return -1;
+        }
+        lazy = fat_read_fsinfo(read_u16(&buf[48])) == 0;
+    }
+    if (fat_load_table(lazy) != 0) {
+        return -1;
+    }
     fat.ready = 1;
     return 0;
 }
@@ -390,7 +1881,10 @@ int fat_open(const char *path, struct fat_file *out)
     if (!fat.ready || !path || !out) {
         return -1;
     }
-    return fat_traverse_path(path, 0, 0, out);
+    if (fat_traverse_path(path, 0, 0, out) != 0) {
+        return -1;
+    }
+    return fat_attach_inode(out);
 }
 
 int fat_open_dir(const char *path, struct fat_file *out)
@@ -398,7 +1892,23 @@ int fat_open_dir(const char *path, struct fat_file *out)
     if (!fat.ready || !path || !out) {
         return -1;
     }
-    return fat_traverse_path(path, 0, 1, out);
+    const char *p = path;
+    while (*p == '/') {
+        ++p;
+    }
+    if (*p == '\0') {
+        /* The root has no entry of its own; location 0:0 keys its inode. */
+        struct fat_file root = {0};
+        root.start_cluster = fat.root_cluster;
+        root.is_dir = 1;
+        root.attr = 0x10;
+        *out = root;
+        return fat_attach_inode(out);
+    }
+    if (fat_traverse_path(path, 0, 1, out) != 0) {
+        return -1;
+    }
+    return fat_attach_inode(out);
 }
 
 int fat_create(const char *path, struct fat_file *out)
@@ -406,218 +1916,298 @@ int fat_create(const char *path, struct fat_file *out)
     if (!fat.ready || !path || !out) {
         return -1;
     }
-    return fat_traverse_path(path, 1, 0, out);
+    if (fat_traverse_path(path, 1, 0, out) != 0) {
+        return -1;
+    }
+    return fat_attach_inode(out);
 }
 
-int64_t fat_read(struct fat_file *file, uint64_t *offset, void *buf, uint64_t len)
+/* Start pulling the clusters behind count pages from index into the block cache. */
+static void fat_readahead(void *host, uint64_t index, uint64_t count)
 {
-    if (!fat.ready || !file || !offset || !buf) {
-        return -1;
+    struct fat_inode *ino = (struct fat_inode *)host;
+    if (!fat.ready || ino->start_cluster == 0) {
+        return;
     }
-    if (file->start_cluster == 0 || *offset >= file->size || len == 0) {
-        return 0;
+    uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
+    uint64_t first = index * PAGE_CACHE_SIZE / cluster_size;
+    uint64_t end = ((index + count) * PAGE_CACHE_SIZE + cluster_size - 1) / cluster_size;
+    uint64_t last = ((uint64_t)ino->size + cluster_size - 1) / cluster_size;
+    if (end > last) {
+        end = last;
+    }
+    while (first < end) {
+        uint32_t run = 0;
+        uint32_t cluster = fat_inode_run(ino, (uint32_t)first, (uint32_t)(end - first), 0, &run);
+        if (cluster == 0) {
+            break;
+        }
+        block_readahead(fat.dev, cluster_to_sector(cluster), (uint64_t)run * fat.sectors_per_cluster);
+        first += run;
     }
-    uint64_t remaining = file->size - *offset;
-    if (len > remaining) {
-        len = remaining;
+}
+
+static int fat_readpage(void *host, uint64_t index, void *page)
+{
+    struct fat_inode *ino = (struct fat_inode *)host;
+    if (!fat.ready) {
+        return -1;
     }
-    uint32_t cluster = (uint16_t)file->start_cluster;
-    uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
-    uint64_t skip = *offset;
-    while (skip >= cluster_size && cluster >= 2) {
-        uint16_t next = fat_next_cluster((uint16_t)cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            return 0;
+    uint8_t *dst = (uint8_t *)page;
+    uint64_t offset = index * PAGE_CACHE_SIZE;
+    uint64_t len = 0;
+    if (ino->start_cluster != 0 && offset < ino->size) {
+        len = ino->size - offset;
+        if (len > PAGE_CACHE_SIZE) {
+            len = PAGE_CACHE_SIZE;
         }
-        cluster = next;
-        skip -= cluster_size;
     }
+    uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
     uint8_t sector_buf[512];
     uint64_t copied = 0;
-    while (len > 0 && cluster >= 2) {
-        uint32_t base_sector = cluster_to_sector((uint16_t)cluster);
-        uint64_t cluster_off = skip;
-        while (cluster_off < cluster_size && len > 0) {
-            uint32_t sector = base_sector + (uint32_t)(cluster_off / fat.bytes_per_sector);
-            uint32_t off = (uint32_t)(cluster_off % fat.bytes_per_sector);
-            if (read_sector(sector, sector_buf) != 0) {
+    while (copied < len) {
+        uint64_t pos = offset + copied;
+        uint32_t index_in_chain = (uint32_t)(pos / cluster_size);
+        uint64_t skip = pos % cluster_size;
+        uint32_t want = (uint32_t)((skip + len - copied + cluster_size - 1) / cluster_size);
+        uint32_t run = 0;
+        uint32_t cluster = fat_inode_run(ino, index_in_chain, want, 0, &run);
+        if (cluster == 0) {
+            return -1;
+        }
+        uint32_t lba = cluster_to_sector(cluster) + (uint32_t)(skip / fat.bytes_per_sector);
+        uint32_t off = (uint32_t)(skip % fat.bytes_per_sector);
+        uint64_t span = (uint64_t)run * cluster_size - skip;
+        uint64_t chunk = len - copied < span ? len - copied : span;
+        if (off == 0 && chunk >= fat.bytes_per_sector) {
+            /* Whole sectors across the contiguous run go straight into the page. */
+            uint64_t count = chunk / fat.bytes_per_sector;
+            if (block_read(fat.dev, lba, count, dst + copied) != 0) {
                 return -1;
             }
-            uint64_t chunk = fat.bytes_per_sector - off;
-            if (chunk > len) {
-                chunk = len;
-            }
-            uint8_t *dst = (uint8_t *)buf;
-            for (uint64_t i = 0; i < chunk; ++i) {
-                dst[copied + i] = sector_buf[off + i];
+            chunk = count * fat.bytes_per_sector;
+        } else {
+            if (read_sector(lba, sector_buf) != 0) {
+                return -1;
             }
-            copied += chunk;
-            len -= chunk;
-            cluster_off += chunk;
-            if (len == 0) {
-                break;
+            if (chunk > fat.bytes_per_sector - off) {
+                chunk = fat.bytes_per_sector - off;
             }
+            copy_bytes(dst + copied, sector_buf + off, chunk);
         }
-        skip = 0;
-        if (len == 0) {
-            break;
-        }
-        uint16_t next = fat_next_cluster((uint16_t)cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            break;
-        }
-        cluster = next;
+        copied += chunk;
+    }
+    for (uint64_t i = copied; i < PAGE_CACHE_SIZE; ++i) {
+        dst[i] = 0;
     }
-    *offset += copied;
-    return (int64_t)copied;
+    return 0;
 }
 
-int64_t fat_write(struct fat_file *file, uint64_t *offset, const void *buf, uint64_t len)
+static int fat_writepage(void *host, uint64_t index, const void *page, uint64_t len)
 {
-    if (!fat.ready || !file || !offset || !buf) {
-        return -1;
-    }
-    if (file->is_dir) {
-        return -1;
-    }
-    if (file->attr & 0x01) {
+    struct fat_inode *ino = (struct fat_inode *)host;
+    if (!fat.ready || (ino->attr & 0x11)) {
         return -1;
     }
     if (len == 0) {
         return 0;
     }
-    uint64_t end = *offset + len;
-    if (end < *offset) {
+    uint64_t offset = index * PAGE_CACHE_SIZE;
+    if (offset + len > 0xFFFFFFFFull) {
         return -1;
     }
-    if (file->start_cluster == 0) {
-        uint16_t first = fat_alloc_cluster();
+    if (ino->start_cluster == 0) {
+        uint32_t first = fat_alloc_cluster();
         if (!first) {
             return -1;
         }
-        file->start_cluster = first;
-        uint8_t sector[512];
-        if (dir_read_sector(file->dir_sector, sector) != 0) {
-            return -1;
-        }
-        sector[file->dir_offset + 26] = (uint8_t)(first & 0xFF);
-        sector[file->dir_offset + 27] = (uint8_t)(first >> 8);
-        if (dir_write_sector(file->dir_sector, sector) != 0) {
-            return -1;
-        }
+        ino->start_cluster = first;
+        fat_inode_mark_dirty(ino);
     }
-    uint16_t cluster = (uint16_t)file->start_cluster;
     uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
-    uint64_t skip = *offset;
-    while (skip >= cluster_size) {
-        uint16_t next = fat_next_cluster(cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            uint16_t new_cluster = fat_alloc_cluster();
-            if (!new_cluster) {
-                return -1;
-            }
-            if (fat_set_cluster(cluster, new_cluster) != 0) {
-                return -1;
-            }
-            cluster = new_cluster;
-        } else {
-            cluster = next;
-        }
-        skip -= cluster_size;
-    }
-    const uint8_t *src = (const uint8_t *)buf;
+    const uint8_t *src = (const uint8_t *)page;
     uint8_t sector_buf[512];
     uint64_t written = 0;
-    while (len > 0) {
-        uint32_t base_sector = cluster_to_sector(cluster);
-        uint64_t cluster_off = skip;
-        while (cluster_off < cluster_size && len > 0) {
-            uint32_t sector = base_sector + (uint32_t)(cluster_off / fat.bytes_per_sector);
-            uint32_t off = (uint32_t)(cluster_off % fat.bytes_per_sector);
-            if (dir_read_sector(sector, sector_buf) != 0) {
-                return -1;
-            }
-            uint64_t chunk = fat.bytes_per_sector - off;
-            if (chunk > len) {
-                chunk = len;
-            }
-            for (uint64_t i = 0; i < chunk; ++i) {
-                sector_buf[off + i] = src[written + i];
+    while (written < len) {
+        uint64_t pos = offset + written;
+        uint32_t index_in_chain = (uint32_t)(pos / cluster_size);
+        uint64_t skip = pos % cluster_size;
+        uint32_t want = (uint32_t)((skip + len - written + cluster_size - 1) / cluster_size);
+        uint32_t run = 0;
+        uint32_t cluster = fat_inode_run(ino, index_in_chain, want, 1, &run);
+        if (cluster == 0) {
+            break; /* volume full: keep what was written */
+        }
+        uint32_t lba = cluster_to_sector(cluster) + (uint32_t)(skip / fat.bytes_per_sector);
+        uint32_t off = (uint32_t)(skip % fat.bytes_per_sector);
+        uint64_t span = (uint64_t)run * cluster_size - skip;
+        uint64_t chunk = len - written < span ? len - written : span;
+        if (off == 0 && chunk >= fat.bytes_per_sector) {
+            /* Fully overwritten sectors need no read; write the run in one request. */
+            uint64_t count = chunk / fat.bytes_per_sector;
+            if (block_write(fat.dev, lba, count, src + written) != 0) {
+                break;
             }
-            if (dir_write_sector(sector, sector_buf) != 0) {
-                return -1;
+            chunk = count * fat.bytes_per_sector;
+        } else {
+            if (chunk > fat.bytes_per_sector - off) {
+                chunk = fat.bytes_per_sector - off;
             }
-            written += chunk;
-            len -= chunk;
-            cluster_off += chunk;
-        }
-        skip = 0;
-        if (len == 0) {
-            break;
-        }
-        uint16_t next = fat_next_cluster(cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            uint16_t new_cluster = fat_alloc_cluster();
-            if (!new_cluster) {
-                return (int64_t)written;
+            /* A sector wholly past the old end of file holds nothing worth reading. */
+            if (pos - off >= ino->size) {
+                for (uint32_t i = 0; i < fat.bytes_per_sector; ++i) {
+                    sector_buf[i] = 0;
+                }
+            } else if (dir_read_sector(lba, sector_buf) != 0) {
+                break;
             }
-            if (fat_set_cluster(cluster, new_cluster) != 0) {
-                return (int64_t)written;
+            copy_bytes(sector_buf + off, src + written, chunk);
+            if (dir_write_sector(lba, sector_buf) != 0) {
+                break;
             }
-            cluster = new_cluster;
-        } else {
-            cluster = next;
         }
+        written += chunk;
     }
-    if (end > file->size) {
-        file->size = (uint32_t)end;
-        uint8_t sector[512];
-        if (dir_read_sector(file->dir_sector, sector) == 0) {
-            uint32_t off = file->dir_offset + 28;
-            sector[off + 0] = (uint8_t)(file->size & 0xFF);
-            sector[off + 1] = (uint8_t)((file->size >> 8) & 0xFF);
-            sector[off + 2] = (uint8_t)((file->size >> 16) & 0xFF);
-            sector[off + 3] = (uint8_t)((file->size >> 24) & 0xFF);
-            (void)dir_write_sector(file->dir_sector, sector);
-        }
+    uint64_t end = offset + written;
+    if (end > ino->size) {
+        ino->size = (uint32_t)end;
+        fat_inode_mark_dirty(ino);
     }
-    *offset += written;
-    return (int64_t)written;
+    (void)fat_flush_inodes(FAT_INODE_WRITEBACK_TICKS);
+    return written == len ? 0 : -1;
 }
 
-static void dir_entry_init(uint8_t *entry, const char name[11], uint8_t attr, uint16_t cluster, uint32_t size)
+const struct page_cache_ops fat_page_ops = {
+    .readpage = fat_readpage,
+    .writepage = fat_writepage,
+    .readahead = fat_readahead,
+};
+
+/* Clusters in the inode's chain, mapping all of it. */
+static uint32_t fat_inode_length(struct fat_inode *ino)
 {
-    for (int i = 0; i < 32; ++i) {
-        entry[i] = 0;
-    }
-    for (int i = 0; i < 11; ++i) {
-        entry[i] = (uint8_t)name[i];
+    (void)fat_inode_cluster(ino, 0xFFFFFFFFu, 0);
+    return ino->mapped;
+}
+
+/* Give back clusters past the end of file, i.e. preallocation that was never written. */
+static void fat_inode_trim(struct fat_inode *ino)
+{
+    uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
+    uint32_t keep = (uint32_t)(((uint64_t)ino->size + cluster_size - 1) / cluster_size);
+    if (fat_inode_length(ino) <= keep) {
+        return;
+    }
+    uint32_t cluster = fat_inode_cluster(ino, keep, 0);
+    if (keep == 0) {
+        ino->start_cluster = 0;
+        fat_inode_mark_dirty(ino);
+    } else if (fat_set_cluster(fat_inode_cluster(ino, keep - 1, 0), fat_eoc()) != 0) {
+        return;
+    }
+    while (cluster >= 2 && !is_end_cluster(cluster)) {
+        uint32_t next = fat_next_cluster(cluster);
+        (void)fat_set_cluster(cluster, 0);
+        cluster = next;
     }
-    entry[11] = attr;
-    entry[26] = (uint8_t)(cluster & 0xFF);
-    entry[27] = (uint8_t)(cluster >> 8);
-    entry[28] = (uint8_t)(size & 0xFF);
-    entry[29] = (uint8_t)((size >> 8) & 0xFF);
-    entry[30] = (uint8_t)((size >> 16) & 0xFF);
-    entry[31] = (uint8_t)((size >> 24) & 0xFF);
+    ino->extent_count = 0;
+    ino->mapped = 0;
+    ino->cursor = 0;
 }
 
-static int zero_cluster(uint16_t cluster)
+int fat_fallocate(struct fat_file *file, uint64_t size)
 {
-    uint8_t sector[512];
-    for (uint32_t i = 0; i < fat.bytes_per_sector; ++i) {
-        sector[i] = 0;
+    if (!fat.ready || !file || !file->inode || file->is_dir || (file->attr & 0x01)) {
+        return -1;
     }
-    uint32_t start = cluster_to_sector(cluster);
-    for (uint32_t s = 0; s < fat.sectors_per_cluster; ++s) {
-        if (dir_write_sector(start + s, sector) != 0) {
+    if (size > 0xFFFFFFFFull) {
+        return -1;
+    }
+    struct fat_inode *ino = file->inode;
+    uint64_t cluster_size = (uint64_t)fat.sectors_per_cluster * fat.bytes_per_sector;
+    uint32_t want = (uint32_t)((size + cluster_size - 1) / cluster_size);
+    uint32_t have = fat_inode_length(ino);
+    if (want <= have) {
+        return 0;
+    }
+    uint32_t need = want - have;
+    ino->preallocated = 1;
+    uint32_t tail = have ? fat_inode_cluster(ino, have - 1, 0) : 0;
+    uint32_t start = fat_find_free_run(need, tail ? tail + 1 : fat.next_free);
+    if (start == 0) {
+        /* No single run is long enough; fall back to growing near the tail. */
+        if (ino->start_cluster == 0) {
+            uint32_t first = fat_alloc_cluster();
+            if (!first) {
+                return -1;
+            }
+            ino->start_cluster = first;
+            fat_inode_mark_dirty(ino);
+        }
+        return fat_inode_cluster(ino, want - 1, 1) ? 0 : -1;
+    }
+    for (uint32_t i = 0; i < need; ++i) {
+        if (fat_set_cluster(start + i, i + 1 < need ? start + i + 1 : fat_eoc()) != 0) {
+            return -1;
+        }
+    }
+    if (tail) {
+        if (fat_set_cluster(tail, start) != 0) {
             return -1;
         }
+    } else {
+        ino->start_cluster = start;
+        fat_inode_mark_dirty(ino);
+        fat.next_free = start + need;
     }
     return 0;
 }
 
-static int init_dir_cluster(uint16_t cluster, uint16_t parent_cluster)
+void fat_close(struct fat_file *file)
+{
+    if (!file || !file->inode) {
+        return;
+    }
+    struct fat_inode *ino = file->inode;
+    file->inode = NULL;
+    if (ino->refs == 1 && ino->preallocated) {
+        fat_inode_trim(ino);
+        ino->preallocated = 0;
+    }
+    file->start_cluster = ino->start_cluster;
+    file->size = ino->size;
+    if (ino->dirty) {
+        /* Unlink from the dirty list and write the entry now. */
+        struct fat_inode **link = &fat.dirty_head;
+        struct fat_inode *prev = NULL;
+        while (*link && *link != ino) {
+            prev = *link;
+            link = &(*link)->dirty_next;
+        }
+        if (*link) {
+            *link = ino->dirty_next;
+            if (fat.dirty_tail == ino) {
+                fat.dirty_tail = prev;
+            }
+        }
+        ino->dirty = 0;
+        (void)fat_inode_writeback(ino);
+    }
+    if (--ino->refs > 0) {
+        return;
+    }
+    struct fat_inode **link = &fat.inodes;
+    while (*link && *link != ino) {
+        link = &(*link)->next;
+    }
+    if (*link) {
+        *link = ino->next;
+    }
+    kfree(ino->extents);
+    kfree(ino);
+}
+
+static int init_dir_cluster(uint32_t cluster, uint32_t parent_cluster)
 {
     if (zero_cluster(cluster) != 0) {
         return -1;
@@ -640,7 +2230,7 @@ static int init_dir_cluster(uint16_t cluster, uint16_t parent_cluster)
     return dir_write_sector(cluster_to_sector(cluster), sector);
 }
 
-static int fat_find_parent(const char *path, uint16_t *out_dir_cluster, char name[11])
+static int fat_find_parent(const char *path, uint32_t *out_dir_cluster, char *name, uint64_t name_len)
 {
     if (!path || !out_dir_cluster || !name) {
         return -1;
@@ -652,7 +2242,7 @@ static int fat_find_parent(const char *path, uint16_t *out_dir_cluster, char nam
     if (*p == '\0') {
         return -1;
     }
-    uint16_t dir_cluster = 0;
+    uint32_t dir_cluster = fat.root_cluster;
     while (*p) {
         while (*p == '/') {
             ++p;
@@ -665,10 +2255,10 @@ static int fat_find_parent(const char *path, uint16_t *out_dir_cluster, char nam
             ++p;
         }
         uint64_t len = (uint64_t)(p - start);
-        if (len == 0 || len >= 16) {
+        if (len == 0 || len >= FAT_COMP_MAX || len >= name_len) {
             return -1;
         }
-        char comp[16];
+        char comp[FAT_COMP_MAX];
         for (uint64_t i = 0; i < len; ++i) {
             comp[i] = start[i];
         }
@@ -678,22 +2268,18 @@ static int fat_find_parent(const char *path, uint16_t *out_dir_cluster, char nam
             ++next;
         }
         int last = (*next == '\0');
-        char tmp_name[11];
-        if (build_short_name(comp, tmp_name) != 0) {
-            return -1;
-        }
         if (last) {
-            for (int i = 0; i < 11; ++i) {
-                name[i] = tmp_name[i];
+            for (uint64_t i = 0; i <= len; ++i) {
+                name[i] = comp[i];
             }
             *out_dir_cluster = dir_cluster;
             return 0;
         }
         struct fat_file found = {0};
-        if (dir_find_entry(dir_cluster, tmp_name, 1, &found, NULL, 0) != 0) {
+        if (dir_find_entry(dir_cluster, comp, 1, &found) != 0) {
             return -1;
         }
-        dir_cluster = (uint16_t)found.start_cluster;
+        dir_cluster = found.start_cluster ? found.start_cluster : fat.root_cluster;
         p = next;
     }
     return -1;
@@ -704,205 +2290,186 @@ int fat_mkdir(const char *path)
     if (!fat.ready || !path) {
         return -1;
     }
-    uint16_t dir_cluster = 0;
-    char name[11];
-    if (fat_find_parent(path, &dir_cluster, name) != 0) {
+    uint32_t dir_cluster = 0;
+    char name[FAT_COMP_MAX];
+    if (fat_find_parent(path, &dir_cluster, name, sizeof(name)) != 0) {
         return -1;
     }
     struct fat_file found = {0};
-    struct dir_loc loc = {0};
-    int res = dir_find_entry(dir_cluster, name, -1, &found, &loc, 1);
-    if (res == 0) {
+    if (dir_find_entry(dir_cluster, name, -1, &found) == 0) {
         return found.is_dir ? 0 : -1;
     }
-    if (res != 1) {
-        return -1;
-    }
-    uint16_t cluster = fat_alloc_cluster();
+    uint32_t cluster = fat_alloc_cluster();
     if (!cluster) {
         return -1;
     }
-    uint8_t entry[32];
-    dir_entry_init(entry, name, 0x10, cluster, 0);
-    if (dir_write_entry(&loc, entry) != 0) {
+    if (dir_create_entry(dir_cluster, name, 0x10, cluster, NULL) != 0) {
+        (void)fat_set_cluster(cluster, 0);
         return -1;
     }
-    if (init_dir_cluster(cluster, dir_cluster) != 0) {
+    /* ".." records the root as cluster 0 on every FAT type. */
+    if (init_dir_cluster(cluster, dir_cluster == fat.root_cluster ? 0 : dir_cluster) != 0) {
         return -1;
     }
     return 0;
 }
 
-static uint64_t append_str(char *buf, uint64_t len, uint64_t written, const char *s)
+int fat_readdir(struct fat_file *dir, uint64_t *cursor, char *name, uint64_t name_len, uint8_t *is_dir,
+                uint32_t *size)
 {
-    for (uint64_t i = 0; s[i] != '\0'; ++i) {
-        if (written + 1 >= len) {
-            return written;
+    if (!fat.ready || !dir || !dir->is_dir || !cursor || !name || name_len == 0) {
+        return -1;
+    }
+    uint32_t dir_cluster = dir->inode ? dir->inode->start_cluster : dir->start_cluster;
+    struct fat_dir_index *idx = dir_index_get(dir_cluster);
+    if (!idx) {
+        return -1;
+    }
+    while (*cursor < idx->count) {
+        const struct fat_dir_name *e = &idx->names[(*cursor)++];
+        if (e->short_name[0] == '.' || (e->attr & 0x08)) {
+            continue;
+        }
+        if (e->long_len) {
+            ucs2_to_utf8(&idx->pool[e->long_off], e->long_len, name, name_len);
+        } else {
+            uint16_t disp[12];
+            uint32_t n = short_display(e->short_name, e->case_flags, disp);
+            ucs2_to_utf8(disp, n, name, name_len);
         }
-        buf[written++] = s[i];
+        if (is_dir) {
+            *is_dir = (e->attr & 0x10) ? 1 : 0;
+        }
+        if (size) {
+            *size = e->size;
+        }
+        return 1;
     }
-    return written;
+    return 0;
 }
 
-static void format_name(const uint8_t *ent, char *out, uint64_t out_len)
+#define FAT_DUMP_DEPTH 8
+
+struct fat_dump_totals {
+    uint64_t files;
+    uint64_t fragmented;
+    uint64_t extents;
+};
+
+/* Print each regular file under dir_cluster with its cluster count and extents. */
+static void dump_dir(uint32_t dir_cluster, char *path, uint64_t path_len, uint32_t depth,
+                     struct fat_dump_totals *totals)
 {
-    uint64_t idx = 0;
-    for (int i = 0; i < 8 && idx + 1 < out_len; ++i) {
-        if (ent[i] == ' ') {
-            break;
+    char name[FAT_NAME_MAX * 3 + 1];
+    for (uint32_t i = 0;; ++i) {
+        /* Recursing can evict this directory's index; fetch it again each time. */
+        struct fat_dir_index *idx = dir_index_get(dir_cluster);
+        if (!idx || i >= idx->count) {
+            return;
         }
-        out[idx++] = (char)ent[i];
-    }
-    int has_ext = 0;
-    for (int i = 8; i < 11; ++i) {
-        if (ent[i] != ' ') {
-            has_ext = 1;
-            break;
+        struct fat_dir_name e = idx->names[i];
+        if (e.short_name[0] == '.' || (e.attr & 0x08)) {
+            continue;
         }
-    }
-    if (has_ext && idx + 1 < out_len) {
-        out[idx++] = '.';
-        for (int i = 8; i < 11 && idx + 1 < out_len; ++i) {
-            if (ent[i] == ' ') {
-                break;
+        if (e.long_len) {
+            ucs2_to_utf8(&idx->pool[e.long_off], e.long_len, name, sizeof(name));
+        } else {
+            uint16_t disp[12];
+            uint32_t n = short_display(e.short_name, e.case_flags, disp);
+            ucs2_to_utf8(disp, n, name, sizeof(name));
+        }
+        uint64_t len = path_len;
+        for (uint64_t k = 0; name[k] != '\0' && len + 2 < FAT_COMP_MAX; ++k) {
+            path[len++] = name[k];
+        }
+        path[len] = '\0';
+        if (e.attr & 0x10) {
+            if (depth + 1 < FAT_DUMP_DEPTH && e.start_cluster >= 2) {
+                path[len] = '/';
+                path[len + 1] = '\0';
+                dump_dir(e.start_cluster, path, len + 1, depth + 1, totals);
             }
-            out[idx++] = (char)ent[i];
+            continue;
         }
-    }
-    out[idx] = '\0';
-}
-
-static uint64_t list_dir(uint16_t dir_cluster, const char *prefix, char *buf, uint64_t len)
-{
-    if (!buf || len == 0 || !prefix) {
-        return 0;
-    }
-    uint8_t sector[512];
-    uint32_t entries_per_sector = fat.bytes_per_sector / 32;
-    uint32_t total_entries = (dir_cluster == 0) ? (uint32_t)fat.root_entries : 0xFFFFFFFFu;
-    uint32_t seen = 0;
-    uint64_t written = 0;
-    char name[16];
-    uint16_t cluster = dir_cluster;
-    while (1) {
-        uint32_t sector_start = (dir_cluster == 0) ? fat.root_start : cluster_to_sector(cluster);
-        uint32_t sector_count = (dir_cluster == 0) ? fat.root_dir_sectors : fat.sectors_per_cluster;
-        for (uint32_t s = 0; s < sector_count; ++s) {
-            if (read_sector(sector_start + s, sector) != 0) {
-                return written;
-            }
-            for (uint32_t e = 0; e < entries_per_sector; ++e) {
-                if (dir_cluster == 0 && seen >= total_entries) {
-                    return written;
-                }
-                const uint8_t *ent = &sector[e * 32];
-                if (dir_cluster == 0) {
-                    ++seen;
-                }
-                if (ent[0] == 0x00) {
-                    return written;
-                }
-                if (ent[0] == 0xE5 || ent[11] == 0x0F || (ent[11] & 0x08)) {
-                    continue;
-                }
-                if (ent[0] == '.' && (ent[1] == ' ' || ent[1] == '.')) {
-                    continue;
-                }
-                if (ent[11] & 0x10) {
-                    format_name(ent, name, sizeof(name));
-                    written = append_str(buf, len, written, prefix);
-                    written = append_str(buf, len, written, name);
-                    if (written + 2 >= len) {
-                        return written;
-                    }
-                    buf[written++] = '/';
-                    buf[written++] = '\n';
-                    continue;
-                }
-                format_name(ent, name, sizeof(name));
-                written = append_str(buf, len, written, prefix);
-                written = append_str(buf, len, written, name);
-                if (written + 1 >= len) {
-                    return written;
-                }
-                buf[written++] = '\n';
+        /* An open file's inode may be ahead of its directory entry. */
+        for (struct fat_inode *ino = fat.inodes; ino; ino = ino->next) {
+            if (ino->dir_sector == e.dir_sector && ino->dir_offset == e.dir_offset) {
+                e.start_cluster = ino->start_cluster;
+                e.size = ino->size;
+                break;
             }
         }
-        if (dir_cluster == 0) {
-            break;
+        uint32_t clusters = 0;
+        uint32_t extents = 0;
+        uint32_t prev = 0;
+        uint32_t cluster = e.start_cluster;
+        while (cluster >= 2 && !is_end_cluster(cluster) && clusters < fat.cluster_count) {
+            if (cluster != prev + 1) {
+                ++extents;
+            }
+            ++clusters;
+            prev = cluster;
+            cluster = fat_next_cluster(cluster);
         }
-        uint16_t next = fat_next_cluster(cluster);
-        if (next == 0 || is_end_cluster(next)) {
-            break;
+        totals->files++;
+        totals->extents += extents;
+        if (extents > 1) {
+            totals->fragmented++;
         }
-        cluster = next;
+        console_write("  ");
+        console_write(path);
+        console_write(" size=");
+        console_write_hex(e.size);
+        console_write(" clusters=");
+        console_write_hex(clusters);
+        console_write(" extents=");
+        console_write_hex(extents);
+        console_write("\n");
     }
-    return written;
 }
 
-static int normalize_path(const char *path, char *out, uint64_t out_len)
+void fat_dump(void)
 {
-    if (!out || out_len == 0) {
-        return -1;
-    }
-    if (!path) {
-        out[0] = '\0';
-        return 0;
-    }
-    const char *p = path;
-    while (*p == '/') {
-        ++p;
-    }
-    uint64_t len = 0;
-    while (*p && len + 1 < out_len) {
-        out[len++] = *p++;
-    }
-    out[len] = '\0';
-    while (len > 0 && out[len - 1] == '/') {
-        out[--len] = '\0';
-    }
-    if (*p) {
-        return -1;
-    }
-    return 0;
+    if (!fat.ready) {
+        console_write("FAT: not mounted\n");
+        return;
+    }
+    console_write(fat.fat32 ? "FAT32:" : "FAT16:");
+    console_write(" clusters=");
+    console_write_hex(fat.cluster_count);
+    console_write(" free=");
+    console_write_hex(fat.free_count);
+    console_write(" next_free=");
+    console_write_hex(fat.next_free);
+    console_write("\n");
+    char path[FAT_COMP_MAX];
+    path[0] = '/';
+    path[1] = '\0';
+    struct fat_dump_totals totals = {0};
+    dump_dir(fat.root_cluster, path, 1, 0, &totals);
+    console_write("  files=");
+    console_write_hex(totals.files);
+    console_write(" fragmented=");
+    console_write_hex(totals.fragmented);
+    console_write(" extents=");
+    console_write_hex(totals.extents);
+    console_write("\n");
 }
 
-uint64_t fat_list_dir(const char *path, char *buf, uint64_t len)
+int fat_sync(void)
 {
-    if (!fat.ready || !buf || len == 0) {
-        return 0;
-    }
-    char trimmed[64];
-    if (normalize_path(path, trimmed, sizeof(trimmed)) != 0) {
-        return 0;
+    if (!fat.ready) {
+        return -1;
     }
-    uint16_t dir_cluster = 0;
-    if (trimmed[0]) {
-        struct fat_file dir = {0};
-        if (fat_open_dir(trimmed, &dir) != 0 || !dir.is_dir) {
-            return 0;
-        }
-        dir_cluster = (uint16_t)dir.start_cluster;
+    int rc = fat_flush_inodes(0);
+    if (fat_flush_table() != 0) {
+        rc = -1;
     }
-    char prefix[96];
-    uint64_t pos = 0;
-    const char base[] = "/disk/";
-    for (uint64_t i = 0; base[i] != '\0' && pos + 1 < sizeof(prefix); ++i) {
-        prefix[pos++] = base[i];
+    if (fat_flush_fsinfo() != 0) {
+        rc = -1;
     }
-    if (trimmed[0]) {
-        for (uint64_t i = 0; trimmed[i] != '\0' && pos + 1 < sizeof(prefix); ++i) {
-            prefix[pos++] = trimmed[i];
-        }
-        if (pos + 1 < sizeof(prefix)) {
-            prefix[pos++] = '/';
-        }
+    if (block_sync(fat.dev) != 0) {
+        rc = -1;
     }
-    prefix[pos] = '\0';
-    return list_dir(dir_cluster, prefix, buf, len);
-}
-
-uint64_t fat_list(char *buf, uint64_t len)
-{
-    return fat_list_dir(NULL, buf, len);
+    return rc;
 }
@@ -1,5 +1,6 @@
 #include "kernel/fs.h"
 #include "kernel/log.h"
+#include "kernel/pagecache.h"
 
 #include <stddef.h>
 
@@ -79,49 +80,33 @@ const struct memfs_file *memfs_lookup(const char *path)
     return NULL;
 }
 
-uint64_t memfs_read(const struct memfs_file *file, uint64_t offset, void *buf, uint64_t len)
+static int memfs_readpage(void *host, uint64_t index, void *page)
 {
-    if (!file || !buf || len == 0) {
-        return 0;
-    }
-    memfs_init();
-    if (offset >= file->size) {
-        return 0;
+    const struct memfs_file *file = (const struct memfs_file *)host;
+    uint64_t offset = index * PAGE_CACHE_SIZE;
+    uint8_t *dst = (uint8_t *)page;
+    for (uint64_t i = 0; i < PAGE_CACHE_SIZE; ++i) {
+        dst[i] = offset + i < file->size ? file->data[offset + i] : 0;
     }
-    uint64_t remaining = file->size - offset;
-    if (len > remaining) {
-        len = remaining;
-    }
-    const uint8_t *src = file->data + offset;
-    uint8_t *dst = (uint8_t *)buf;
-    for (uint64_t i = 0; i < len; ++i) {
-        dst[i] = src[i];
-    }
-    return len;
+    return 0;
 }
 
-uint64_t memfs_list(char *buf, uint64_t len)
+/* Read-only: no writepage. */
+const struct page_cache_ops memfs_page_ops = {
+    .readpage = memfs_readpage,
+};
+
+const struct memfs_file *memfs_next(uint64_t *cursor)
 {
-    if (!buf || len == 0) {
-        return 0;
+    if (!cursor) {
+        return NULL;
     }
     memfs_init();
-    uint64_t written = 0;
-    for (size_t i = 0; i < sizeof(memfs_files) / sizeof(memfs_files[0]); ++i) {
-        const char *path = memfs_files[i].path;
-        if (!path) {
-            continue;
+    while (*cursor < sizeof(memfs_files) / sizeof(memfs_files[0])) {
+        const struct memfs_file *file = &memfs_files[(*cursor)++];
+        if (file->path) {
+            return file;
         }
-        for (uint64_t j = 0; path[j] != '\0'; ++j) {
-            if (written + 1 >= len) {
-                return written;
-            }
-            buf[written++] = path[j];
-        }
-        if (written + 1 >= len) {
-            return written;
-        }
-        buf[written++] = '\n';
     }
-    return written;
+    return NULL;
 }
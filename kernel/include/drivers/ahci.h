@@ -0,0 +1,9 @@
+#pragma once
+
+/* Driver for AHCI SATA controllers (PCI class 01/06), e.g. QEMU's "ahci"
+   device. Each attached disk becomes a block device that queues up to 32
+   commands per port with NCQ; the first one replaces the ramdisk as the
+   default device. */
+void ahci_driver_init(void);
+/* Print per-port state, including the deepest queue observed. */
+void ahci_dump(void);
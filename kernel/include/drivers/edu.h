@@ -0,0 +1,6 @@
+#pragma once
+
+/* Driver for QEMU's "edu" educational PCI device (1234:11e8). It is used to
+   exercise BAR mapping, MSI delivery and bus-master DMA. Call with
+   interrupts enabled: the probe runs a short interrupt and DMA self-test. */
+void edu_driver_init(void);
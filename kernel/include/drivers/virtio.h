@@ -35,6 +35,55 @@
 #define VIRTIO_REG_QUEUE_USED_LOW   0x0a0
 #define VIRTIO_REG_QUEUE_USED_HIGH  0x0a4
 
+/* PCI transport */
+#define VIRTIO_PCI_VENDOR           0x1AF4
+#define VIRTIO_PCI_DEVICE_BLK_LEGACY 0x1001
+#define VIRTIO_PCI_DEVICE_BLK       0x1042
+
+/* Legacy (0.9.5) register block in I/O BAR0 */
+#define VIRTIO_PCI_HOST_FEATURES    0x00
+#define VIRTIO_PCI_GUEST_FEATURES   0x04
+#define VIRTIO_PCI_QUEUE_PFN        0x08
+#define VIRTIO_PCI_QUEUE_NUM        0x0c
+#define VIRTIO_PCI_QUEUE_SEL        0x0e
+#define VIRTIO_PCI_QUEUE_NOTIFY     0x10
+#define VIRTIO_PCI_STATUS           0x12
+#define VIRTIO_PCI_ISR              0x13
+#define VIRTIO_PCI_MSIX_CONFIG      0x14
+#define VIRTIO_PCI_MSIX_QUEUE       0x16
+#define VIRTIO_PCI_CONFIG           0x14 /* device config without MSI-X */
+#define VIRTIO_PCI_CONFIG_MSIX      0x18 /* ... and with MSI-X enabled */
+#define VIRTIO_PCI_LEGACY_ALIGN     4096
+
+/* Modern (1.0) vendor capability types */
+#define VIRTIO_PCI_CAP_COMMON_CFG   1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG   2
+#define VIRTIO_PCI_CAP_ISR_CFG      3
+#define VIRTIO_PCI_CAP_DEVICE_CFG   4
+
+/* Modern common configuration structure offsets */
+#define VIRTIO_COMMON_DFSELECT      0x00
+#define VIRTIO_COMMON_DF            0x04
+#define VIRTIO_COMMON_GFSELECT      0x08
+#define VIRTIO_COMMON_GF            0x0c
+#define VIRTIO_COMMON_MSIX          0x10
+#define VIRTIO_COMMON_NUMQ          0x12
+#define VIRTIO_COMMON_STATUS        0x14
+#define VIRTIO_COMMON_CFGGENERATION 0x15
+#define VIRTIO_COMMON_Q_SELECT      0x16
+#define VIRTIO_COMMON_Q_SIZE        0x18
+#define VIRTIO_COMMON_Q_MSIX        0x1a
+#define VIRTIO_COMMON_Q_ENABLE      0x1c
+#define VIRTIO_COMMON_Q_NOFF        0x1e
+#define VIRTIO_COMMON_Q_DESCLO      0x20
+#define VIRTIO_COMMON_Q_DESCHI      0x24
+#define VIRTIO_COMMON_Q_AVAILLO     0x28
+#define VIRTIO_COMMON_Q_AVAILHI     0x2c
+#define VIRTIO_COMMON_Q_USEDLO      0x30
+#define VIRTIO_COMMON_Q_USEDHI      0x34
+
+#define VIRTIO_MSI_NO_VECTOR        0xFFFF
+
 /* Status Bits */
 #define VIRTIO_STATUS_ACKNOWLEDGE   1
 #define VIRTIO_STATUS_DRIVER        2
@@ -52,11 +101,19 @@
 #define VIRTIO_BLK_F_FLUSH          9
 #define VIRTIO_BLK_F_TOPOLOGY       10
 #define VIRTIO_BLK_F_CONFIG_WCE     11
+#define VIRTIO_BLK_F_MQ             12
+
+/* Transport feature bits */
+#define VIRTIO_F_RING_INDIRECT_DESC 28
+#define VIRTIO_F_RING_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1          32
 
 /* Virtqueues */
 #define VIRTQ_DESC_F_NEXT           1
 #define VIRTQ_DESC_F_WRITE          2
 #define VIRTQ_DESC_F_INDIRECT       4
+#define VIRTQ_AVAIL_F_NO_INTERRUPT  1
+#define VIRTQ_USED_F_NO_NOTIFY      1
 
 struct virtq_desc {
     uint64_t addr;
@@ -86,6 +143,7 @@ struct virtq_used {
 #define VIRTIO_BLK_T_IN           0
 #define VIRTIO_BLK_T_OUT          1
 #define VIRTIO_BLK_T_FLUSH        4
+#define VIRTIO_BLK_S_OK           0
 
 struct virtio_blk_req_header {
     uint32_t type;
@@ -103,7 +161,18 @@ struct virtio_blk_config {
         uint8_t sectors;
     } geometry;
     uint32_t blk_size;
+    uint8_t physical_block_exp;
+    uint8_t alignment_offset;
+    uint16_t min_io_size;
+    uint32_t opt_io_size;
+    uint8_t writeback;
+    uint8_t unused0;
+    uint16_t num_queues;
     /* ... ignored rest */
 } __attribute__((packed));
 
+/* Register the virtio-blk PCI driver (legacy and modern transports). Disks
+   become block devices; the first replaces the ramdisk as the default. */
 void virtio_init(void);
+/* Print per-queue request and notification counters for each disk. */
+void virtio_blk_dump(void);
@@ -1,4 +1,21 @@
 #pragma once
 
+#include <stdint.h>
+
+/* MPS INTI flags carried by MADT interrupt source overrides. */
+#define ACPI_ISO_POLARITY_MASK 0x3
+#define ACPI_ISO_POLARITY_LOW  0x3
+#define ACPI_ISO_TRIGGER_MASK  0xC
+#define ACPI_ISO_TRIGGER_LEVEL 0xC
+
 void acpi_init(void);
 void acpi_dump(void);
+
+/* MADT accessors; valid after acpi_init(). */
+uint32_t acpi_lapic_addr(void);
+int acpi_ioapic_info(uint32_t *addr, uint8_t *id, uint32_t *gsi_base);
+uint32_t acpi_isa_irq_to_gsi(uint8_t irq, uint16_t *flags);
+/* PCIe ECAM window for segment 0 from the MCFG table. */
+int acpi_mcfg_info(uint64_t *base, uint8_t *start_bus, uint8_t *end_bus);
+uint8_t acpi_cpu_count(void);
+int acpi_cpu_apic_id(uint8_t cpu);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Vector the LAPIC raises for spurious interrupts; must have low nibble 0xF. */
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+/* Bring up the BSP's LAPIC and the IOAPIC described by the MADT, masking the
+   8259. Returns 0 on success, -1 if no usable IOAPIC was found (PIC stays). */
+int apic_init(void);
+int apic_enabled(void);
+
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+
+/* Route a legacy ISA IRQ through the IOAPIC, honouring MADT source overrides
+   for the GSI, polarity and trigger mode. cpu indexes the MADT CPU list. */
+int ioapic_route_isa_irq(uint8_t irq, uint8_t vector, uint8_t cpu);
+/* Route a GSI directly; flags are MPS INTI flags (ACPI_ISO_*). */
+int ioapic_route_gsi(uint32_t gsi, uint8_t vector, uint16_t flags, uint8_t cpu);
+int ioapic_set_affinity(uint32_t gsi, uint8_t cpu);
+void ioapic_mask_gsi(uint32_t gsi);
+void ioapic_unmask_gsi(uint32_t gsi);
+
+/* MSI/MSI-X message for a fixed, edge-triggered interrupt on the given CPU. */
+uint64_t apic_msi_address(uint8_t cpu);
+uint32_t apic_msi_data(uint8_t vector);
+
+/* Acknowledge a device IRQ at whichever controller is currently routing it. */
+void irq_send_eoi(uint8_t irq);
+
+void apic_dump(void);
@@ -3,3 +3,5 @@
 struct block_device;
 
 struct block_device *ata_init(void);
+/* Bind to the IDE controller for IRQ14 completion and bus-master DMA; call with interrupts live. */
+void ata_driver_init(void);
@@ -2,14 +2,103 @@
 
 #include <stdint.h>
 
+#include "kernel/sched.h"
+#include "kernel/spinlock.h"
+
+#define BLOCK_OP_READ 0
+#define BLOCK_OP_WRITE 1
+#define BLOCK_OP_FLUSH 2 /* barrier: no vecs, orders against everything around it */
+
+/* queue_rq return value: no free hardware slot, retry after the next completion. */
+#define BLOCK_QUEUE_BUSY 1
+
+/* Default cap on a merged request when the driver does not set max_sectors. */
+#define BLOCK_DEFAULT_MAX_SECTORS 128
+
 struct block_device;
+struct bio;
+
+/* One piece of a scatter-gather transfer; len is a multiple of the sector size. */
+struct bio_vec {
+    void *buf;
+    uint64_t len;
+};
+
+/*
+ * A single I/O submission. The caller owns the bio and its vecs until
+ * end_io runs (or block_wait returns); the queue fills in sectors, status
+ * and done.
+ */
+struct bio {
+    struct block_device *dev;
+    int op;
+    uint64_t lba;
+    struct bio_vec *vecs;
+    uint32_t vcnt;
+    void (*end_io)(struct bio *bio); /* optional; may run in interrupt context */
+    void *private;
+    uint64_t sectors;
+    volatile int status;
+    volatile int done;
+    struct bio *next; /* queue-private */
+};
+
+/* Contiguous run of same-direction bios handed to the driver as one command. */
+struct block_request {
+    int op;
+    uint64_t lba;
+    uint64_t sectors;
+    struct bio *bio_head;
+    struct bio *bio_tail;
+    struct block_request *next;
+};
+
+struct block_queue_stats {
+    uint64_t bios;
+    uint64_t requests;
+    uint64_t merges;
+    uint64_t sectors;
+    uint64_t flushes;
+};
+
+struct block_queue {
+    spinlock_t lock;
+    struct block_request *pending; /* sorted by lba */
+    struct block_request *free;
+    struct bio *flush;             /* barrier waiting for pending to drain */
+    int flush_issued;
+    struct bio *held_head;         /* bios submitted behind the barrier, FIFO */
+    struct bio *held_tail;
+    uint64_t head_lba;             /* elevator position after the last dispatch */
+    int running;
+    int rerun;                     /* work arrived while running; look again before idling */
+    int plugged;
+    uint32_t inflight;
+    uint8_t *bounce;
+    uint64_t bounce_sectors;
+    wait_queue_t done_wq;
+    struct block_queue_stats stats;
+};
 
 struct block_device {
     const char *name;
     uint64_t sector_size;
     uint64_t sectors;
+    uint64_t max_sectors; /* per request; 0 means BLOCK_DEFAULT_MAX_SECTORS */
     int (*read)(struct block_device *dev, uint64_t lba, uint64_t count, void *buf);
     int (*write)(struct block_device *dev, uint64_t lba, uint64_t count, const void *buf);
+    /* Optional scatter-gather path; without it the queue bounces merged requests. */
+    int (*submit)(struct block_device *dev, struct block_request *rq);
+    /* Optional: commit the device's volatile write cache to media. */
+    int (*flush)(struct block_device *dev);
+    /*
+     * Optional asynchronous path, used instead of all of the above: start rq
+     * (reads, writes and flushes) and return 0, then report it with
+     * block_request_done(); or return BLOCK_QUEUE_BUSY if no slot is free.
+     * May be called from interrupt context.
+     */
+    int (*queue_rq)(struct block_device *dev, struct block_request *rq);
+    struct block_queue queue;
 };
 
 void block_init(void);
@@ -18,3 +107,37 @@ struct block_device *block_get_ramdisk(void);
 void block_set_default(struct block_device *dev);
 int block_read(struct block_device *dev, uint64_t lba, uint64_t count, void *buf);
 int block_write(struct block_device *dev, uint64_t lba, uint64_t count, const void *buf);
+
+/* Queue bio for dev; completion is reported through end_io and bio->done. */
+void block_submit_bio(struct bio *bio);
+/* Dispatch anything pending for bio's device and sleep until bio completes. */
+int block_wait(struct bio *bio);
+/* While plugged, submissions only queue up so that neighbours can merge. */
+void block_plug(struct block_device *dev);
+void block_unplug(struct block_device *dev);
+/* Completion for requests started through queue_rq; safe in interrupt context. */
+void block_request_done(struct block_device *dev, struct block_request *rq, int status);
+/* Write barrier: everything submitted earlier is on stable media when this returns 0. */
+int block_flush(struct block_device *dev);
+/* Uncached synchronous transfer of count sectors through the request queue. */
+int block_io(struct block_device *dev, int op, uint64_t lba, uint64_t count, void *buf);
+void block_queue_get_stats(struct block_device *dev, struct block_queue_stats *out);
+/* Uncached random 4 KiB reads with depth in flight; reports the ticks taken for ops reads. */
+int block_bench(struct block_device *dev, uint32_t depth, uint32_t ops, uint64_t *ticks_out);
+
+struct block_cache_stats {
+    uint64_t buffers;
+    uint64_t dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks;
+    uint64_t evictions;
+    uint64_t readahead; /* sectors prefetched */
+};
+
+/* Start caching count sectors from lba without waiting; skips cached ones, best effort. */
+void block_readahead(struct block_device *dev, uint64_t lba, uint64_t count);
+/* Write back dirty cached sectors for dev (NULL: every device), then flush the device. */
+int block_sync(struct block_device *dev);
+void block_cache_get_stats(struct block_cache_stats *out);
+void block_cache_dump(void);
@@ -3,6 +3,9 @@
 #include <stdint.h>
 
 struct block_device;
+struct page_cache_ops;
+
+struct fat_inode;
 
 struct fat_file {
     uint32_t start_cluster;
@@ -11,14 +14,40 @@ struct fat_file {
     uint16_t dir_offset;
     uint8_t is_dir;
     uint8_t attr;
+    /*
+     * Shared state of an open file. Once attached, the inode carries the live
+     * start cluster and size; the fields above are the entry as found.
+     */
+    struct fat_inode *inode;
 };
 
+/* File data goes through the page cache with the open file's inode as host. */
+extern const struct page_cache_ops fat_page_ops;
+
 int fat_init(struct block_device *dev);
 int fat_open(const char *path, struct fat_file *out);
+/* An empty path opens the root directory. */
 int fat_open_dir(const char *path, struct fat_file *out);
 int fat_create(const char *path, struct fat_file *out);
 int fat_mkdir(const char *path);
-int64_t fat_read(struct fat_file *file, uint64_t *offset, void *buf, uint64_t len);
-int64_t fat_write(struct fat_file *file, uint64_t *offset, const void *buf, uint64_t len);
-uint64_t fat_list(char *buf, uint64_t len);
-uint64_t fat_list_dir(const char *path, char *buf, uint64_t len);
+/*
+ * Reserve clusters so the file can grow to size bytes without further
+ * allocation, preferring one contiguous run after its current tail. The
+ * file size is unchanged; clusters still past the end are freed at last close.
+ */
+int fat_fallocate(struct fat_file *file, uint64_t size);
+/* Write back the file's directory entry if dirty and drop its inode reference;
+   the caller still owns the struct itself. */
+void fat_close(struct fat_file *file);
+/* Write the in-memory FAT to every copy, then push the volume's dirty sectors
+   to disk with a cache-flush barrier. */
+int fat_sync(void);
+/*
+ * Return the entry at *cursor in dir and advance it: 1 with name (UTF-8) and
+ * the entry's type and size filled in, 0 past the last entry, -1 on error.
+ * "." and ".." are skipped.
+ */
+int fat_readdir(struct fat_file *dir, uint64_t *cursor, char *name, uint64_t name_len, uint8_t *is_dir,
+                uint32_t *size);
+/* Print volume usage and the extent count of every file. */
+void fat_dump(void);
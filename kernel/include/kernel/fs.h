@@ -2,6 +2,8 @@
 
 #include <stdint.h>
 
+struct page_cache_ops;
+
 struct memfs_file {
     const char *path;
     const uint8_t *data;
@@ -9,5 +11,7 @@ struct memfs_file {
 };
 
 const struct memfs_file *memfs_lookup(const char *path);
-uint64_t memfs_read(const struct memfs_file *file, uint64_t offset, void *buf, uint64_t len);
-uint64_t memfs_list(char *buf, uint64_t len);
+/* File data goes through the page cache with the memfs_file as host. */
+extern const struct page_cache_ops memfs_page_ops;
+/* Return the next file at or after *cursor and step past it; NULL at the end. */
+const struct memfs_file *memfs_next(uint64_t *cursor);
@@ -11,3 +11,14 @@ int irq_kb_pop(uint8_t *scancode);
 int irq_com_pop(uint8_t *ch);
 void irq_com_push(uint8_t ch);
 void irq_wait_input(void);
+
+/* Dynamically allocated vectors for MSI/MSI-X and other message interrupts. */
+#define IRQ_VECTOR_BASE 0x30
+#define IRQ_VECTOR_COUNT 32
+
+typedef void (*irq_handler_t)(void *ctx);
+
+/* Reserve a vector and bind handler to it. Returns the vector or -1. */
+int irq_alloc_vector(irq_handler_t handler, void *ctx);
+void irq_free_vector(int vector);
+void irq_dispatch_vector(uint8_t vector);
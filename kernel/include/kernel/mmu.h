@@ -69,6 +69,8 @@ void mmu_map_hhdm_2m(uint64_t phys_start, uint64_t phys_end);
 /* Map/unmap a single 4 KiB page. Flags use MMU_FLAG_* above (present is implied). */
 void mmu_map_page(uint64_t virt, uint64_t phys, uint64_t flags);
 void mmu_unmap_page(uint64_t virt);
+/* Walk the kernel page tables; returns 0 and the physical address if virt is mapped. */
+int mmu_translate(uint64_t virt, uint64_t *phys_out);
 
 /* Reload CR3 to flush TLB entries after page table changes. */
 static inline void mmu_reload_cr3(void) {
@@ -84,6 +86,17 @@ void mmu_protect_kernel_sections(void);
 /* Map a 4 KiB page in a specific PML4 (used for user address spaces). */
 int mmu_map_page_in(uint64_t pml4_phys, uint64_t virt, uint64_t phys, uint64_t flags);
 
+/* Map an uncached device MMIO range into the HHDM; returns the virtual address of phys. */
+static inline void *mmu_map_mmio(uint64_t phys, uint64_t size)
+{
+    uint64_t start = phys & ~0xFFFULL;
+    uint64_t end = (phys + size + 0xFFFULL) & ~0xFFFULL;
+    for (uint64_t page = start; page < end; page += 0x1000) {
+        mmu_map_page(phys_to_hhdm(page), page, MMU_FLAG_WRITE | MMU_FLAG_NOEXEC | MMU_FLAG_DEVICE);
+    }
+    return (void *)phys_to_hhdm(phys);
+}
+
 /* Map a kernel linear address in the higher half for a given phys; allocates tables as needed. */
 static inline void *mmu_kmap(uint64_t phys, uint64_t flags)
 {
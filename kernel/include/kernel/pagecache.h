@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stdint.h>
+
+#define PAGE_CACHE_SIZE 4096
+
+/*
+ * What a file system provides to have its files cached. host is the object
+ * the mapping was created for and stays valid until the last put.
+ */
+struct page_cache_ops {
+    /* Fill page with the data at index; bytes past the end of file read as zero. */
+    int (*readpage)(void *host, uint64_t index, void *page);
+    /* Store the first len bytes of page at index, growing the file as needed. */
+    int (*writepage)(void *host, uint64_t index, const void *page, uint64_t len);
+    /* Optional: start fetching count pages from index without waiting. */
+    void (*readahead)(void *host, uint64_t index, uint64_t count);
+};
+
+/* Cached pages of one file, shared by every open of it. */
+struct page_mapping;
+
+/* Sequential readahead for one open file. */
+struct page_cache_ra {
+    uint64_t next;   /* offset a sequential read would start at */
+    uint64_t mark;   /* pages below this index have been prefetched */
+    uint32_t window; /* pages kept ahead of the reader; 0 after a random read */
+};
+
+struct page_cache_stats {
+    uint64_t pages; /* frames holding file data */
+    uint64_t dirty;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t writebacks;
+    uint64_t evictions;
+    uint64_t readahead; /* pages hinted to the backend */
+    uint64_t lost;      /* dirty pages dropped at last put after writeback failed */
+};
+
+/* Find or create the mapping for host; size is only used when creating it. */
+struct page_mapping *page_cache_get(void *host, const struct page_cache_ops *ops, uint64_t size);
+/*
+ * Drop a reference; the last one writes dirty pages back and frees them all.
+ * Pages whose writeback failed cannot outlive the host, so they are dropped,
+ * counted in lost, and the put returns -1.
+ */
+int page_cache_put(struct page_mapping *mapping);
+int64_t page_cache_read(struct page_mapping *mapping, struct page_cache_ra *ra, uint64_t *offset, void *buf,
+                        uint64_t len);
+int64_t page_cache_write(struct page_mapping *mapping, uint64_t *offset, const void *buf, uint64_t len);
+/* File size as the cache sees it, including writes not yet written back. */
+uint64_t page_cache_size(struct page_mapping *mapping);
+/* Write back the mapping's dirty pages through its backend. */
+int page_cache_flush(struct page_mapping *mapping);
+/* Write back every mapping's dirty pages. */
+int page_cache_sync(void);
+void page_cache_get_stats(struct page_cache_stats *out);
+void page_cache_dump(void);
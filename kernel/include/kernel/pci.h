@@ -1,4 +1,114 @@
 #pragma once
 
+#include <stdint.h>
+
+#define PCI_MAX_BARS 6
+#define PCI_ANY_ID 0xFFFF
+
+/* Standard configuration header offsets. */
+#define PCI_CFG_VENDOR   0x00
+#define PCI_CFG_DEVICE   0x02
+#define PCI_CFG_COMMAND  0x04
+#define PCI_CFG_STATUS   0x06
+#define PCI_CFG_PROG_IF  0x09
+#define PCI_CFG_SUBCLASS 0x0A
+#define PCI_CFG_CLASS    0x0B
+#define PCI_CFG_HEADER   0x0E
+#define PCI_CFG_BAR0     0x10
+#define PCI_CFG_CAP_PTR  0x34
+#define PCI_CFG_IRQ_LINE 0x3C
+#define PCI_CFG_IRQ_PIN  0x3D
+
+#define PCI_COMMAND_IO           0x0001
+#define PCI_COMMAND_MEMORY       0x0002
+#define PCI_COMMAND_BUS_MASTER   0x0004
+#define PCI_COMMAND_INTX_DISABLE 0x0400
+
+#define PCI_STATUS_CAP_LIST 0x0010
+
+#define PCI_CAP_ID_MSI     0x05
+#define PCI_CAP_ID_VENDOR  0x09
+#define PCI_CAP_ID_PCIE    0x10
+#define PCI_CAP_ID_MSIX    0x11
+
+enum pci_bar_type {
+    PCI_BAR_NONE = 0,
+    PCI_BAR_IO,
+    PCI_BAR_MEM32,
+    PCI_BAR_MEM64,
+};
+
+struct pci_bar {
+    uint64_t base;
+    uint64_t size;
+    enum pci_bar_type type;
+    uint8_t prefetchable;
+};
+
+struct pci_driver;
+
+struct pci_device {
+    struct pci_device *next;
+    uint8_t bus;
+    uint8_t dev;
+    uint8_t func;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint8_t header_type;
+    uint8_t irq_line;
+    uint8_t irq_pin;
+    struct pci_bar bars[PCI_MAX_BARS];
+    uint8_t msi_cap;   /* config offset of the MSI capability, 0 if absent */
+    uint8_t msix_cap;  /* config offset of the MSI-X capability, 0 if absent */
+    uint16_t msix_entries;
+    volatile uint32_t *msix_table;
+    const struct pci_driver *driver;
+    void *driver_data;
+};
+
+/* Match entry; PCI_ANY_ID in any field is a wildcard. Tables end with a zeroed entry. */
+struct pci_device_id {
+    uint16_t vendor;
+    uint16_t device;
+    uint16_t class_code;
+    uint16_t subclass;
+};
+
+struct pci_driver {
+    const char *name;
+    const struct pci_device_id *ids;
+    /* Return 0 to claim the device. */
+    int (*probe)(struct pci_device *dev, const struct pci_device_id *id);
+    struct pci_driver *next;
+};
+
 void pci_init(void);
 void pci_dump(void);
+
+/* Bind drv to every matching unclaimed device. Returns the number bound. */
+int pci_register_driver(struct pci_driver *drv);
+
+uint32_t pci_read32(const struct pci_device *dev, uint16_t offset);
+uint16_t pci_read16(const struct pci_device *dev, uint16_t offset);
+uint8_t pci_read8(const struct pci_device *dev, uint16_t offset);
+void pci_write32(const struct pci_device *dev, uint16_t offset, uint32_t value);
+void pci_write16(const struct pci_device *dev, uint16_t offset, uint16_t value);
+void pci_write8(const struct pci_device *dev, uint16_t offset, uint8_t value);
+
+/* Enable decoding of the device's BARs and, if bus_master, DMA. */
+void pci_enable_device(struct pci_device *dev, int bus_master);
+/* Return the config offset of capability id, or 0. */
+uint8_t pci_find_capability(const struct pci_device *dev, uint8_t id);
+/* Map a memory BAR uncached; returns NULL for I/O or absent BARs. */
+void *pci_map_bar(struct pci_device *dev, int bar);
+
+/* Single-vector MSI aimed at the boot CPU. Returns 0 on success. */
+int pci_enable_msi(struct pci_device *dev, uint8_t vector);
+void pci_disable_msi(struct pci_device *dev);
+/* Enable MSI-X with every entry masked; program entries with pci_msix_set_vector. */
+int pci_enable_msix(struct pci_device *dev);
+int pci_msix_set_vector(struct pci_device *dev, uint16_t entry, uint8_t vector, uint8_t cpu);
+void pci_disable_msix(struct pci_device *dev);
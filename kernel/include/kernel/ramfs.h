@@ -3,8 +3,12 @@
 #include <stdint.h>
 
 struct ramfs_file;
+struct page_cache_ops;
 
 int ramfs_open(const char *path, struct ramfs_file **out);
-int64_t ramfs_read(struct ramfs_file *file, uint64_t *offset, void *buf, uint64_t len);
-int64_t ramfs_write(struct ramfs_file *file, uint64_t *offset, const void *buf, uint64_t len);
-uint64_t ramfs_list(char *buf, uint64_t len);
+uint64_t ramfs_size(const struct ramfs_file *file);
+/* File data goes through the page cache with the ramfs_file as host. */
+extern const struct page_cache_ops ramfs_page_ops;
+/* Return the next file at or after *cursor and step past it; NULL at the end. */
+struct ramfs_file *ramfs_next(uint64_t *cursor);
+const char *ramfs_path(const struct ramfs_file *file);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Lock-free single-producer/single-consumer byte ring.
+ *
+ * head and tail run freely and are masked on access, so all SIZE slots
+ * are usable. The producer (typically an IRQ handler) publishes a byte
+ * with a release store of head; the consumer observes it with an acquire
+ * load, and hands the slot back the same way through tail. Exactly one
+ * context may push and exactly one may pop at a time.
+ */
+struct spsc_ring {
+    uint8_t *buf;
+    uint32_t mask;
+    uint32_t head;    /* written by producer only */
+    uint32_t tail;    /* written by consumer only */
+    uint64_t dropped; /* bytes rejected because the ring was full */
+};
+
+/* Define a static ring named NAME with SIZE (a power of two) bytes. */
+#define SPSC_RING_DEFINE(name, size)                                        \
+    _Static_assert((size) > 0 && ((size) & ((size) - 1)) == 0,              \
+                   #name " size must be a power of two");                   \
+    static uint8_t name##_storage[(size)];                                  \
+    static struct spsc_ring name = { .buf = name##_storage, .mask = (size) - 1 }
+
+static inline int spsc_ring_push(struct spsc_ring *r, uint8_t byte)
+{
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail > r->mask) {
+        r->dropped++;
+        return 0;
+    }
+    r->buf[head & r->mask] = byte;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int spsc_ring_pop(struct spsc_ring *r, uint8_t *byte)
+{
+    uint32_t tail = __atomic_load_n(&r->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    if (head == tail) {
+        return 0;
+    }
+    *byte = r->buf[tail & r->mask];
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static inline int spsc_ring_empty(const struct spsc_ring *r)
+{
+    return __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+}
@@ -0,0 +1,31 @@
+#ifndef NEPTUNE_RWLOCK_H
+#define NEPTUNE_RWLOCK_H
+
+#include <stdint.h>
+#include <arch/processor.h>
+
+/*
+ * Spinning reader-writer lock. Readers share the lock; a waiting writer
+ * blocks new readers so it cannot be starved by a stream of them.
+ */
+typedef struct {
+    volatile uint32_t state; /* reader count | RWLOCK_* bits */
+} rwlock_t;
+
+#define RWLOCK_WRITER  0x80000000u
+#define RWLOCK_WAITING 0x40000000u
+
+#define RWLOCK_INIT { .state = 0 }
+
+void rwlock_init(rwlock_t *lock);
+void rwlock_read_acquire(rwlock_t *lock);
+void rwlock_read_release(rwlock_t *lock);
+void rwlock_write_acquire(rwlock_t *lock);
+void rwlock_write_release(rwlock_t *lock);
+
+arch_flags_t rwlock_read_acquire_irqsave(rwlock_t *lock);
+void rwlock_read_release_irqrestore(rwlock_t *lock, arch_flags_t flags);
+arch_flags_t rwlock_write_acquire_irqsave(rwlock_t *lock);
+void rwlock_write_release_irqrestore(rwlock_t *lock, arch_flags_t flags);
+
+#endif
@@ -3,6 +3,7 @@
 #include <stdint.h>
 
 #include <arch/context.h>
+#include <kernel/seqlock.h>
 #include <stddef.h>
 
 struct interrupt_frame;
@@ -57,6 +58,7 @@ struct thread {
     int exit_code;
     uint8_t is_user;
     uint8_t reaped;
+    seqlock_t fs_seq; /* guards cwd and fds; readers are lock-free */
     char cwd[256];
     int fds[16];
 };
@@ -68,6 +70,8 @@ typedef struct wait_queue {
 void wait_queue_init(wait_queue_t *wq);
 void sched_sleep(wait_queue_t *wq);
 void sched_sleep_cond(wait_queue_t *wq, int (*cond)(void));
+/* Like sched_sleep_cond, for conditions that need a context pointer. */
+void sched_sleep_until(wait_queue_t *wq, int (*cond)(void *arg), void *arg);
 void sched_wake_one(wait_queue_t *wq);
 void sched_wake_all(wait_queue_t *wq);
 int sched_wait_child(int parent_pid, int *out_code);
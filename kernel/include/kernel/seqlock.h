@@ -0,0 +1,62 @@
+#ifndef NEPTUNE_SEQLOCK_H
+#define NEPTUNE_SEQLOCK_H
+
+#include <stdint.h>
+#include <arch/processor.h>
+#include "kernel/spinlock.h"
+
+/*
+ * Sequence lock for small, read-mostly data. Writers serialize on a
+ * spinlock and bump the sequence to odd while updating; readers never
+ * write shared state and simply retry if the sequence moved:
+ *
+ *     do {
+ *         seq = read_seqbegin(&sl);
+ *         ...copy protected data...
+ *     } while (read_seqretry(&sl, seq));
+ *
+ * Read sections must not have side effects, since they may run twice.
+ */
+typedef struct {
+    volatile uint32_t sequence;
+    spinlock_t lock;
+} seqlock_t;
+
+#define SEQLOCK_INIT { .sequence = 0, .lock = { 0 } }
+
+static inline void seqlock_init(seqlock_t *sl)
+{
+    sl->sequence = 0;
+    spinlock_init(&sl->lock);
+}
+
+static inline uint32_t read_seqbegin(const seqlock_t *sl)
+{
+    uint32_t seq;
+    while ((seq = __atomic_load_n(&sl->sequence, __ATOMIC_ACQUIRE)) & 1) {
+        arch_cpu_relax();
+    }
+    return seq;
+}
+
+static inline int read_seqretry(const seqlock_t *sl, uint32_t start)
+{
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&sl->sequence, __ATOMIC_RELAXED) != start;
+}
+
+static inline arch_flags_t write_seqlock_irqsave(seqlock_t *sl)
+{
+    arch_flags_t flags = spinlock_acquire_irqsave(&sl->lock);
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    return flags;
+}
+
+static inline void write_sequnlock_irqrestore(seqlock_t *sl, arch_flags_t flags)
+{
+    __atomic_store_n(&sl->sequence, sl->sequence + 1, __ATOMIC_RELEASE);
+    spinlock_release_irqrestore(&sl->lock, flags);
+}
+
+#endif
@@ -4,18 +4,77 @@
 #include <stdint.h>
 #include <arch/processor.h>
 
+/* Set to 0 to compile out per-lock contention statistics. */
+#ifndef ENABLE_LOCKSTAT
+#define ENABLE_LOCKSTAT 1
+#endif
+
+/* Per-lock contention statistics (ticket and MCS locks only). */
+struct lockstat {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t max_hold_cycles;
+    uint64_t hold_start;
+    struct lockstat *next;
+    uint8_t registered;
+};
+
+#define LOCKSTAT_INIT(lock_name) { .name = (lock_name) }
+
+/* Plain test-and-test-and-set lock for short, uncontended sections. */
 typedef struct {
     volatile uint32_t lock;
-    arch_flags_t flags; // for interrupt saving
 } spinlock_t;
 
 void spinlock_init(spinlock_t *lock);
 void spinlock_acquire(spinlock_t *lock);
 void spinlock_release(spinlock_t *lock);
 
-// Acquires lock and disables interrupts, saving RFLAGS
-void spinlock_acquire_irqsave(spinlock_t *lock);
-// Releases lock and restores RFLAGS
-void spinlock_release_irqrestore(spinlock_t *lock);
+// Disables interrupts, acquires lock and returns the previous RFLAGS
+arch_flags_t spinlock_acquire_irqsave(spinlock_t *lock);
+// Releases lock and restores the RFLAGS returned by the acquire
+void spinlock_release_irqrestore(spinlock_t *lock, arch_flags_t flags);
+
+/* FIFO ticket lock: waiters are served in arrival order. */
+typedef struct {
+    volatile uint32_t next;  /* next ticket handed out */
+    volatile uint32_t owner; /* ticket currently holding the lock */
+    struct lockstat stat;
+} ticket_lock_t;
+
+#define TICKET_LOCK_INIT(lock_name) { .next = 0, .owner = 0, .stat = LOCKSTAT_INIT(lock_name) }
+
+void ticket_lock_init(ticket_lock_t *lock, const char *name);
+void ticket_lock_acquire(ticket_lock_t *lock);
+void ticket_lock_release(ticket_lock_t *lock);
+arch_flags_t ticket_lock_acquire_irqsave(ticket_lock_t *lock);
+void ticket_lock_release_irqrestore(ticket_lock_t *lock, arch_flags_t flags);
+
+/*
+ * MCS queued lock: each waiter spins on its own node, so a release touches
+ * only the next waiter's cache line. The node must stay live (usually on the
+ * caller's stack) until the matching release.
+ */
+struct mcs_node {
+    struct mcs_node *volatile next;
+    volatile uint32_t locked;
+};
+
+typedef struct {
+    struct mcs_node *volatile tail;
+    struct lockstat stat;
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(lock_name) { .tail = 0, .stat = LOCKSTAT_INIT(lock_name) }
+
+void mcs_lock_init(mcs_lock_t *lock, const char *name);
+void mcs_lock_acquire(mcs_lock_t *lock, struct mcs_node *node);
+void mcs_lock_release(mcs_lock_t *lock, struct mcs_node *node);
+arch_flags_t mcs_lock_acquire_irqsave(mcs_lock_t *lock, struct mcs_node *node);
+void mcs_lock_release_irqrestore(mcs_lock_t *lock, struct mcs_node *node, arch_flags_t flags);
+
+/* Log statistics for every instrumented lock acquired so far. */
+void lockstat_dump(void);
 
 #endif
@@ -19,8 +19,14 @@ enum {
     SYSCALL_PIPE = 12,
     SYSCALL_CHDIR = 13,
     SYSCALL_GETCWD = 14,
+    SYSCALL_FSYNC = 15,
+    SYSCALL_GETDENTS = 16,
+    SYSCALL_FALLOCATE = 17,
 };
 
+/* SYSCALL_OPEN flags (rsi). */
+#define SYSCALL_OPEN_DIRECTORY 0x1 /* only open an existing directory, for SYSCALL_GETDENTS */
+
 enum syscall_error {
     SYSCALL_OK = 0,
     SYSCALL_EINVAL = 1,
@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 
+/* Tick rate the PIT is programmed for. */
+#define TIMER_HZ 100
+
 typedef void (*timer_callback_t)(uint64_t ticks, void *user);
 
 /* Called from the PIT IRQ handler to advance time and run callbacks. */
@@ -4,8 +4,34 @@
 
 struct vfs_file;
 
+#define VFS_NAME_MAX 255
+#define VFS_DIRENT_FILE 1
+#define VFS_DIRENT_DIR 2
+
+/* Fixed-size record filled in by SYSCALL_GETDENTS; user/syscall.h has the same layout. */
+struct vfs_dirent {
+    uint64_t size;
+    uint32_t type;               /* VFS_DIRENT_* */
+    uint32_t name_len;
+    char name[VFS_NAME_MAX + 1]; /* NUL-terminated */
+};
+
+struct vfs_stat {
+    uint64_t size;
+    uint8_t is_dir;
+};
+
 int vfs_open(const char *path, struct vfs_file **out);
+/* Open an existing directory for vfs_getdents; never creates anything. */
+int vfs_opendir(const char *path, struct vfs_file **out);
+/* Read up to count entries from the directory's cursor; returns how many, 0 at the end. */
+int64_t vfs_getdents(struct vfs_file *file, struct vfs_dirent *out, uint64_t count);
 int64_t vfs_read(struct vfs_file *file, void *buf, uint64_t len);
 int64_t vfs_write(struct vfs_file *file, const void *buf, uint64_t len);
 void vfs_close(struct vfs_file *file);
+/* Write back the file system's cached data and flush the device cache. */
+int64_t vfs_fsync(struct vfs_file *file);
+int64_t vfs_stat(struct vfs_file *file, struct vfs_stat *out);
+/* Reserve space so the file can grow to size bytes; the file size is unchanged. */
+int64_t vfs_fallocate(struct vfs_file *file, uint64_t size);
 struct vfs_file *vfs_dup(struct vfs_file *file);
@@ -1,18 +1,26 @@
 #include "kernel/irq.h"
 #include "kernel/log.h"
 #include "kernel/io.h"
+#include "kernel/ring.h"
+#include "kernel/spinlock.h"
 
 #define KB_DATA_PORT 0x60
 #define COM1_PORT 0x3F8
 
-#define KB_BUF_SIZE 64
-#define COM_BUF_SIZE 128
+#define KB_STATUS_PORT 0x64
+#define KB_STATUS_OUTPUT_FULL 0x01
+#define KB_STATUS_AUX_DATA 0x20
+#define COM_LSR_DATA_READY 0x01
 
-static uint8_t kb_buf[KB_BUF_SIZE];
-static uint32_t kb_head = 0, kb_tail = 0;
+/* Bounds how many bytes one IRQ may drain before returning. */
+#define IRQ_DRAIN_MAX 64
 
-static uint8_t com_buf[COM_BUF_SIZE];
-static uint32_t com_head = 0, com_tail = 0;
+/* Ring sizes must be powers of two; the serial ring absorbs pasted input. */
+#define KB_BUF_SIZE 256
+#define COM_BUF_SIZE 4096
+
+SPSC_RING_DEFINE(kb_ring, KB_BUF_SIZE);
+SPSC_RING_DEFINE(com_ring, COM_BUF_SIZE);
 
 #include "kernel/sched.h"
 
@@ -27,43 +35,46 @@ static void ensure_wq_init(void)
     }
 }
 
-static void kb_push(uint8_t sc)
+static void wake_input_reader(void)
 {
-    uint32_t next = (kb_head + 1) % KB_BUF_SIZE;
-    if (next != kb_tail) {
-        kb_buf[kb_head] = sc;
-        kb_head = next;
-        ensure_wq_init();
-        sched_wake_one(&input_wq);
-    }
+    ensure_wq_init();
+    sched_wake_one(&input_wq);
 }
 
 void irq_com_push(uint8_t ch)
 {
-    uint32_t next = (com_head + 1) % COM_BUF_SIZE;
-    if (next != com_tail) {
-        com_buf[com_head] = ch;
-        com_head = next;
-        ensure_wq_init();
-        sched_wake_one(&input_wq);
+    if (spsc_ring_push(&com_ring, ch)) {
+        wake_input_reader();
     }
 }
 
 void irq_dispatch(uint8_t irq)
 {
+    /* Drain everything the device has queued, then wake the reader once. */
+    int pushed = 0;
     switch (irq) {
     case IRQ_KEYBOARD: {
-        uint8_t sc = inb(KB_DATA_PORT);
-        kb_push(sc);
+        pushed |= spsc_ring_push(&kb_ring, inb(KB_DATA_PORT));
+        for (int i = 1; i < IRQ_DRAIN_MAX; ++i) {
+            uint8_t status = inb(KB_STATUS_PORT);
+            if (!(status & KB_STATUS_OUTPUT_FULL) || (status & KB_STATUS_AUX_DATA)) {
+                break;
+            }
+            pushed |= spsc_ring_push(&kb_ring, inb(KB_DATA_PORT));
+        }
         break;
     }
     case IRQ_SERIAL_COM1: {
-        /* Check Line Status Register: bit 0 == data ready */
-        uint8_t lsr = inb(COM1_PORT + 5);
-        if (lsr & 0x01) {
-            uint8_t ch = inb(COM1_PORT);
-            irq_com_push(ch);
-        } else {
+        /* Line Status Register bit 0 == data ready; empty the whole FIFO. */
+        int drained = 0;
+        for (int i = 0; i < IRQ_DRAIN_MAX; ++i) {
+            if (!(inb(COM1_PORT + 5) & COM_LSR_DATA_READY)) {
+                break;
+            }
+            pushed |= spsc_ring_push(&com_ring, inb(COM1_PORT));
+            drained = 1;
+        }
+        if (!drained) {
             /* read IIR to clear pending */
             (void)inb(COM1_PORT + 2);
         }
@@ -72,6 +83,9 @@ void irq_dispatch(uint8_t irq)
     default:
         break;
     }
+    if (pushed) {
+        wake_input_reader();
+    }
 }
 
 int irq_kb_pop(uint8_t *scancode)
@@ -79,12 +93,7 @@ int irq_kb_pop(uint8_t *scancode)
     if (!scancode) {
         return 0;
     }
-    if (kb_tail == kb_head) {
-        return 0;
-    }
-    *scancode = kb_buf[kb_tail];
-    kb_tail = (kb_tail + 1) % KB_BUF_SIZE;
-    return 1;
+    return spsc_ring_pop(&kb_ring, scancode);
 }
 
 int irq_com_pop(uint8_t *ch)
@@ -92,19 +101,12 @@ int irq_com_pop(uint8_t *ch)
     if (!ch) {
         return 0;
     }
-    if (com_tail == com_head) {
-        return 0;
-    }
-    *ch = com_buf[com_tail];
-    com_tail = (com_tail + 1) % COM_BUF_SIZE;
-    return 1;
+    return spsc_ring_pop(&com_ring, ch);
 }
 
 static int irq_has_input(void)
 {
-    if (kb_head != kb_tail) return 1;
-    if (com_head != com_tail) return 1;
-    return 0;
+    return !spsc_ring_empty(&kb_ring) || !spsc_ring_empty(&com_ring);
 }
 
 void irq_wait_input(void)
@@ -112,3 +114,53 @@ void irq_wait_input(void)
     ensure_wq_init();
     sched_sleep_cond(&input_wq, irq_has_input);
 }
+
+struct irq_vector_slot {
+    irq_handler_t handler;
+    void *ctx;
+};
+
+static struct irq_vector_slot irq_vectors[IRQ_VECTOR_COUNT];
+static spinlock_t irq_vector_lock;
+
+int irq_alloc_vector(irq_handler_t handler, void *ctx)
+{
+    if (!handler) {
+        return -1;
+    }
+    int vector = -1;
+    arch_flags_t flags = spinlock_acquire_irqsave(&irq_vector_lock);
+    for (int i = 0; i < IRQ_VECTOR_COUNT; ++i) {
+        if (!irq_vectors[i].handler) {
+            irq_vectors[i].ctx = ctx;
+            irq_vectors[i].handler = handler;
+            vector = IRQ_VECTOR_BASE + i;
+            break;
+        }
+    }
+    spinlock_release_irqrestore(&irq_vector_lock, flags);
+    return vector;
+}
+
+void irq_free_vector(int vector)
+{
+    if (vector < IRQ_VECTOR_BASE || vector >= IRQ_VECTOR_BASE + IRQ_VECTOR_COUNT) {
+        return;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&irq_vector_lock);
+    irq_vectors[vector - IRQ_VECTOR_BASE].handler = NULL;
+    irq_vectors[vector - IRQ_VECTOR_BASE].ctx = NULL;
+    spinlock_release_irqrestore(&irq_vector_lock, flags);
+}
+
+void irq_dispatch_vector(uint8_t vector)
+{
+    if (vector < IRQ_VECTOR_BASE || vector >= IRQ_VECTOR_BASE + IRQ_VECTOR_COUNT) {
+        return;
+    }
+    struct irq_vector_slot *slot = &irq_vectors[vector - IRQ_VECTOR_BASE];
+    irq_handler_t handler = slot->handler;
+    if (handler) {
+        handler(slot->ctx);
+    }
+}
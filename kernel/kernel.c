@@ -8,9 +8,14 @@
 #include "kernel/mmu.h"
 #include "kernel/heap.h"
 #include "kernel/pci.h"
+#include "drivers/edu.h"
+#include "kernel/ata.h"
+#include "drivers/ahci.h"
+#include "drivers/virtio.h"
 #include "kernel/acpi.h"
 #include "kernel/gdt.h"
 #include "kernel/pic.h"
+#include "kernel/apic.h"
 #include "kernel/pit.h"
 #include "kernel/timer.h"
 #include "kernel/sched.h"
@@ -24,6 +29,7 @@ extern void *memset(void *s, int c, size_t n);
 #define ENABLE_NX_TEST 1
 #define ENABLE_TEXT_WP_TEST 1
 #define ENABLE_SECTION_PROTECT 1
+#define ENABLE_APIC 1
 
 #define ENABLE_USER_SMOKE 1
 #define ENABLE_KERNEL_TERMINAL 0
@@ -200,8 +206,8 @@ void kernel_main(uint64_t magic, uint64_t multiboot_info)
     log_info("Kernel heap free tracking enabled.");
     heap_verify_checkpoint("Heap verified after heap init");
 
+    acpi_init(); /* before PCI: MCFG selects ECAM config access */
     pci_init();
-    acpi_init();
 
     log_info("Relocating GDT...");
     gdt_relocate_heap();
@@ -213,10 +219,21 @@ void kernel_main(uint64_t magic, uint64_t multiboot_info)
     heap_verify_checkpoint("Heap verified after IDT relocation");
     log_info("Remapping PIC and enabling timer...");
     pic_remap(0x20, 0x28);
-    pic_enable_irq(0); /* PIT */
-    pic_enable_irq(1); /* Keyboard */
-    pic_enable_irq(4); /* COM1 */
-    pit_init(100); /* 100 Hz */
+    int use_apic = 0;
+#if ENABLE_APIC
+    use_apic = (apic_init() == 0);
+#endif
+    if (use_apic) {
+        /* Same vectors as the PIC layout; the IOAPIC resolves ISA overrides. */
+        ioapic_route_isa_irq(0, 0x20, 0); /* PIT */
+        ioapic_route_isa_irq(1, 0x21, 0); /* Keyboard */
+        ioapic_route_isa_irq(4, 0x24, 0); /* COM1 */
+    } else {
+        pic_enable_irq(0); /* PIT */
+        pic_enable_irq(1); /* Keyboard */
+        pic_enable_irq(4); /* COM1 */
+    }
+    pit_init(TIMER_HZ);
     heartbeat_state.next_tick = 100;
     heartbeat_state.interval = 100;
     if (timer_register_callback(heartbeat_cb, &heartbeat_state) != 0) {
@@ -239,6 +256,11 @@ void kernel_main(uint64_t magic, uint64_t multiboot_info)
         ++wait_loops;
     }
     log_info_hex("Timer ticks observed", idt_get_timer_ticks());
+    /* PCI drivers bind once interrupts are live so probes can self-test. */
+    edu_driver_init();
+    ata_driver_init();
+    ahci_driver_init();
+    virtio_init();
     heap_verify_checkpoint("Heap verified after initial timer ticks");
     /* heap smoke test with frees */
     void *h1 = kalloc(40, 8);
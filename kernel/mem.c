@@ -38,7 +38,7 @@ static uint64_t managed_pages = 0;      /* allocatable pages (excludes metadata)
 static uint64_t reserved_pages = 0;     /* pages consumed by allocator metadata */
 static uint64_t used_pages = 0;         /* includes reserved + allocations */
 static uint64_t max_phys_end = 0;       /* highest address of any managed region */
-static spinlock_t pmm_lock;
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT("pmm");
 
 static uint64_t align_up(uint64_t value, uint64_t align)
 {
@@ -224,7 +224,8 @@ static uint64_t pmm_cursor_page_idx = 0;
 
 uint64_t pmm_alloc_page(void)
 {
-    spinlock_acquire_irqsave(&pmm_lock);
+    struct mcs_node lock_node;
+    arch_flags_t flags = mcs_lock_acquire_irqsave(&pmm_lock, &lock_node);
     
     uint32_t start_r = pmm_cursor_region;
     uint64_t start_p = pmm_cursor_page_idx;
@@ -251,7 +252,7 @@ uint64_t pmm_alloc_page(void)
                 pmm_cursor_region = r;
                 pmm_cursor_page_idx = page + 1;
                 
-                spinlock_release_irqrestore(&pmm_lock);
+                mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
                 return region->phys_start + (page * 4096);
             }
         }
@@ -265,14 +266,14 @@ uint64_t pmm_alloc_page(void)
                     pmm_cursor_region = r;
                     pmm_cursor_page_idx = page + 1;
                     
-                    spinlock_release_irqrestore(&pmm_lock);
+                    mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
                     return region->phys_start + (page * 4096);
                 }
              }
         }
     }
     
-    spinlock_release_irqrestore(&pmm_lock);
+    mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
     panic("Out of physical memory", 0);
     return 0;
 }
@@ -282,7 +283,8 @@ uint64_t pmm_alloc_pages(size_t n)
     if (n == 0) return 0;
     if (n == 1) return pmm_alloc_page();
     
-    spinlock_acquire_irqsave(&pmm_lock);
+    struct mcs_node lock_node;
+    arch_flags_t flags = mcs_lock_acquire_irqsave(&pmm_lock, &lock_node);
     
     for (uint32_t i = 0; i < region_count; ++i) {
         struct pmm_region *region = &regions[i];
@@ -300,7 +302,7 @@ uint64_t pmm_alloc_pages(size_t n)
                         set_bit(region, start_run + k);
                     }
                     used_pages += n;
-                    spinlock_release_irqrestore(&pmm_lock);
+                    mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
                     return region->phys_start + (start_run * 4096);
                 }
             } else {
@@ -309,36 +311,37 @@ uint64_t pmm_alloc_pages(size_t n)
         }
     }
     
-    spinlock_release_irqrestore(&pmm_lock);
+    mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
     panic("Out of contiguous physical memory", n);
     return 0;
 }
 
 void pmm_free_page(uint64_t addr)
 {
-    spinlock_acquire_irqsave(&pmm_lock);
+    struct mcs_node lock_node;
+    arch_flags_t flags = mcs_lock_acquire_irqsave(&pmm_lock, &lock_node);
     struct pmm_region *region = find_region(addr);
     if (!region) {
-        spinlock_release_irqrestore(&pmm_lock);
+        mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
         panic("Attempt to free non-managed page", addr);
     }
 
     uint64_t idx = (addr - region->phys_start) / 4096;
     if (idx >= region->total_pages) {
-        spinlock_release_irqrestore(&pmm_lock);
+        mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
         panic("Attempt to free outside region bounds", addr);
     }
     if (idx < region->reserved_pages) {
-        spinlock_release_irqrestore(&pmm_lock);
+        mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
         panic("Attempt to free allocator metadata page", addr);
     }
     if (!test_bit(region, idx)) {
-        spinlock_release_irqrestore(&pmm_lock);
+        mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
         panic("Double free detected", addr);
     }
     clear_bit(region, idx);
     --used_pages;
-    spinlock_release_irqrestore(&pmm_lock);
+    mcs_lock_release_irqrestore(&pmm_lock, &lock_node, flags);
 }
 
 uint64_t pmm_total_bytes(void)
@@ -0,0 +1,558 @@
+#include "kernel/pagecache.h"
+#include "kernel/console.h"
+#include "kernel/heap.h"
+#include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/sched.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Page frames come from the PMM on demand, up to a RAM-proportional cap. */
+#define PAGE_CACHE_RAM_SHIFT 5 /* use up to 1/32 of RAM */
+#define PAGE_CACHE_MIN_PAGES 64
+#define PAGE_CACHE_MAX_PAGES 4096
+/* Readahead window bounds for sequential reads; a maximum of 0 disables it. */
+#ifndef PAGE_CACHE_READAHEAD_MAX_KB
+#define PAGE_CACHE_READAHEAD_MAX_KB 128
+#endif
+#define PAGE_CACHE_READAHEAD_MIN_KB 16
+
+struct cache_page {
+    struct page_mapping *mapping; /* NULL while free */
+    uint64_t index;
+    uint8_t *data;
+    struct cache_page *hash_next; /* also links the free list */
+    struct cache_page *map_prev;
+    struct cache_page *map_next;
+    uint8_t dirty;
+    uint8_t referenced;
+};
+
+struct page_mapping {
+    void *host;
+    const struct page_cache_ops *ops;
+    uint64_t size;
+    uint32_t refs;
+    struct cache_page *pages;
+    struct page_mapping *next;
+};
+
+struct page_cache {
+    struct cache_page *pages;
+    struct cache_page **hash;
+    struct cache_page *free;
+    struct page_mapping *mappings;
+    uint64_t npages;
+    uint64_t used;      /* descriptors that have been given a frame */
+    uint64_t hash_mask;
+    uint64_t clock_hand;
+    int frames_exhausted;
+    struct page_cache_stats stats;
+    int ready;
+};
+
+static struct page_cache pcache;
+
+/* Sleeping lock: backends may block in I/O from readpage and writepage. */
+static volatile int pcache_busy = 0;
+static wait_queue_t pcache_wq;
+
+static int pcache_idle(void)
+{
+    return !pcache_busy;
+}
+
+static void pcache_lock(void)
+{
+    while (__atomic_exchange_n(&pcache_busy, 1, __ATOMIC_ACQUIRE)) {
+        sched_sleep_cond(&pcache_wq, pcache_idle);
+    }
+}
+
+static void pcache_unlock(void)
+{
+    __atomic_store_n(&pcache_busy, 0, __ATOMIC_RELEASE);
+    sched_wake_one(&pcache_wq);
+}
+
+static uint64_t pcache_hash(const struct page_mapping *mapping, uint64_t index)
+{
+    uint64_t key = index ^ ((uint64_t)(uintptr_t)mapping >> 4);
+    return (key * 0x9E3779B97F4A7C15ULL) >> 20 & pcache.hash_mask;
+}
+
+static int pcache_init(void)
+{
+    if (pcache.ready) {
+        return 0;
+    }
+    wait_queue_init(&pcache_wq);
+    uint64_t npages = (pmm_total_bytes() >> PAGE_CACHE_RAM_SHIFT) / PAGE_CACHE_SIZE;
+    if (npages < PAGE_CACHE_MIN_PAGES) {
+        npages = PAGE_CACHE_MIN_PAGES;
+    }
+    if (npages > PAGE_CACHE_MAX_PAGES) {
+        npages = PAGE_CACHE_MAX_PAGES;
+    }
+    uint64_t buckets = 1;
+    while (buckets < npages) {
+        buckets <<= 1;
+    }
+    pcache.pages = (struct cache_page *)kalloc_zero(npages * sizeof(struct cache_page), 16);
+    pcache.hash = (struct cache_page **)kalloc_zero(buckets * sizeof(struct cache_page *), 16);
+    if (!pcache.pages || !pcache.hash) {
+        log_warn("pagecache: descriptor allocation failed");
+        return -1;
+    }
+    pcache.npages = npages;
+    pcache.hash_mask = buckets - 1;
+    pcache.ready = 1;
+    log_info_hex("pagecache: max pages", npages);
+    return 0;
+}
+
+static struct cache_page *pcache_lookup(struct page_mapping *mapping, uint64_t index)
+{
+    struct cache_page *p = pcache.hash[pcache_hash(mapping, index)];
+    while (p) {
+        if (p->mapping == mapping && p->index == index) {
+            return p;
+        }
+        p = p->hash_next;
+    }
+    return NULL;
+}
+
+/* Unhash p, take it off its mapping and put it on the free list. */
+static void pcache_release(struct cache_page *p)
+{
+    struct cache_page **link = &pcache.hash[pcache_hash(p->mapping, p->index)];
+    while (*link) {
+        if (*link == p) {
+            *link = p->hash_next;
+            break;
+        }
+        link = &(*link)->hash_next;
+    }
+    if (p->map_prev) {
+        p->map_prev->map_next = p->map_next;
+    } else {
+        p->mapping->pages = p->map_next;
+    }
+    if (p->map_next) {
+        p->map_next->map_prev = p->map_prev;
+    }
+    p->mapping = NULL;
+    p->dirty = 0;
+    p->map_prev = NULL;
+    p->map_next = NULL;
+    p->hash_next = pcache.free;
+    pcache.free = p;
+    pcache.stats.pages--;
+}
+
+static int pcache_writeback(struct cache_page *p)
+{
+    if (!p->dirty) {
+        return 0;
+    }
+    struct page_mapping *mapping = p->mapping;
+    uint64_t start = p->index * PAGE_CACHE_SIZE;
+    if (start >= mapping->size) {
+        p->dirty = 0;
+        return 0;
+    }
+    uint64_t len = mapping->size - start;
+    if (len > PAGE_CACHE_SIZE) {
+        len = PAGE_CACHE_SIZE;
+    }
+    if (mapping->ops->writepage(mapping->host, p->index, p->data, len) != 0) {
+        return -1;
+    }
+    p->dirty = 0;
+    pcache.stats.writebacks++;
+    return 0;
+}
+
+/* CLOCK over cached pages, writing a dirty victim back before reusing it. */
+static struct cache_page *pcache_evict(void)
+{
+    for (uint64_t scanned = 0; scanned < pcache.used * 3; ++scanned) {
+        struct cache_page *p = &pcache.pages[pcache.clock_hand];
+        pcache.clock_hand = (pcache.clock_hand + 1) % pcache.used;
+        if (!p->mapping) {
+            continue;
+        }
+        if (p->referenced) {
+            p->referenced = 0;
+            continue;
+        }
+        if (pcache_writeback(p) != 0) {
+            continue;
+        }
+        pcache_release(p);
+        pcache.stats.evictions++;
+        break;
+    }
+    return pcache.free;
+}
+
+static struct cache_page *pcache_alloc(void)
+{
+    if (!pcache.free && pcache.used < pcache.npages && !pcache.frames_exhausted) {
+        uint64_t phys = pmm_alloc_page();
+        if (phys) {
+            struct cache_page *p = &pcache.pages[pcache.used++];
+            p->data = (uint8_t *)phys_to_hhdm(phys);
+            p->hash_next = NULL;
+            pcache.free = p;
+        } else {
+            /* Out of memory: from now on make room by evicting. */
+            pcache.frames_exhausted = 1;
+        }
+    }
+    if (!pcache.free && pcache.used > 0) {
+        (void)pcache_evict();
+    }
+    struct cache_page *p = pcache.free;
+    if (p) {
+        pcache.free = p->hash_next;
+        p->hash_next = NULL;
+    }
+    return p;
+}
+
+/*
+ * Return the page at index, reading it through the backend on a miss
+ * unless fill is 0, in which case a new page starts out zeroed.
+ */
+static struct cache_page *pcache_page(struct page_mapping *mapping, uint64_t index, int fill)
+{
+    struct cache_page *p = pcache_lookup(mapping, index);
+    if (p) {
+        p->referenced = 1;
+        pcache.stats.hits++;
+        return p;
+    }
+    pcache.stats.misses++;
+    p = pcache_alloc();
+    if (!p) {
+        return NULL;
+    }
+    if (fill && index * PAGE_CACHE_SIZE < mapping->size) {
+        if (mapping->ops->readpage(mapping->host, index, p->data) != 0) {
+            p->hash_next = pcache.free;
+            pcache.free = p;
+            return NULL;
+        }
+    } else {
+        for (uint64_t i = 0; i < PAGE_CACHE_SIZE; ++i) {
+            p->data[i] = 0;
+        }
+    }
+    uint64_t bucket = pcache_hash(mapping, index);
+    p->mapping = mapping;
+    p->index = index;
+    p->dirty = 0;
+    p->referenced = 1;
+    p->hash_next = pcache.hash[bucket];
+    pcache.hash[bucket] = p;
+    p->map_prev = NULL;
+    p->map_next = mapping->pages;
+    if (mapping->pages) {
+        mapping->pages->map_prev = p;
+    }
+    mapping->pages = p;
+    pcache.stats.pages++;
+    return p;
+}
+
+static int pcache_flush_locked(struct page_mapping *mapping)
+{
+    int rc = 0;
+    for (struct cache_page *p = mapping->pages; p; p = p->map_next) {
+        if (pcache_writeback(p) != 0) {
+            rc = -1;
+        }
+    }
+    return rc;
+}
+
+/*
+ * Grow the window while reads stay sequential and hint the backend to
+ * fetch ahead; the window restarts at the minimum after a seek.
+ */
+static void pcache_readahead(struct page_mapping *mapping, struct page_cache_ra *ra, uint64_t pos,
+                             uint64_t len)
+{
+    uint32_t max = (uint32_t)((uint64_t)PAGE_CACHE_READAHEAD_MAX_KB * 1024 / PAGE_CACHE_SIZE);
+    uint32_t min = (uint32_t)((uint64_t)PAGE_CACHE_READAHEAD_MIN_KB * 1024 / PAGE_CACHE_SIZE);
+    int sequential = pos == ra->next;
+    ra->next = pos + len;
+    if (!sequential || max == 0 || !mapping->ops->readahead) {
+        ra->window = 0;
+        ra->mark = 0;
+        return;
+    }
+    if (min == 0) {
+        min = 1;
+    }
+    if (min > max) {
+        min = max;
+    }
+    uint64_t end = (pos + len + PAGE_CACHE_SIZE - 1) / PAGE_CACHE_SIZE;
+    uint64_t last = (mapping->size + PAGE_CACHE_SIZE - 1) / PAGE_CACHE_SIZE;
+    if (ra->window == 0) {
+        ra->window = min;
+        ra->mark = end;
+    } else {
+        /* Refill once the reader has used up half of what is ahead of it. */
+        if (ra->mark > end && ra->mark - end > ra->window / 2) {
+            return;
+        }
+        ra->window = ra->window * 2 > max ? max : ra->window * 2;
+        if (ra->mark < end) {
+            ra->mark = end;
+        }
+    }
+    uint64_t target = end + ra->window;
+    if (target > last) {
+        target = last;
+    }
+    /* Pages already cached need nothing from the backend. */
+    while (ra->mark < target && pcache_lookup(mapping, ra->mark)) {
+        ra->mark++;
+    }
+    if (ra->mark < target) {
+        mapping->ops->readahead(mapping->host, ra->mark, target - ra->mark);
+        pcache.stats.readahead += target - ra->mark;
+        ra->mark = target;
+    }
+}
+
+struct page_mapping *page_cache_get(void *host, const struct page_cache_ops *ops, uint64_t size)
+{
+    if (!host || !ops || !ops->readpage) {
+        return NULL;
+    }
+    if (pcache_init() != 0) {
+        return NULL;
+    }
+    pcache_lock();
+    struct page_mapping *mapping = pcache.mappings;
+    while (mapping && mapping->host != host) {
+        mapping = mapping->next;
+    }
+    if (mapping) {
+        mapping->refs++;
+    } else {
+        mapping = (struct page_mapping *)kalloc_zero(sizeof(*mapping), 16);
+        if (mapping) {
+            mapping->host = host;
+            mapping->ops = ops;
+            mapping->size = size;
+            mapping->refs = 1;
+            mapping->next = pcache.mappings;
+            pcache.mappings = mapping;
+        }
+    }
+    pcache_unlock();
+    return mapping;
+}
+
+int page_cache_put(struct page_mapping *mapping)
+{
+    if (!mapping) {
+        return -1;
+    }
+    pcache_lock();
+    if (--mapping->refs > 0) {
+        pcache_unlock();
+        return 0;
+    }
+    int rc = pcache_flush_locked(mapping);
+    uint64_t lost = 0;
+    while (mapping->pages) {
+        lost += mapping->pages->dirty;
+        pcache_release(mapping->pages);
+    }
+    pcache.stats.lost += lost;
+    struct page_mapping **link = &pcache.mappings;
+    while (*link != mapping) {
+        link = &(*link)->next;
+    }
+    *link = mapping->next;
+    pcache_unlock();
+    kfree(mapping);
+    return rc;
+}
+
+int64_t page_cache_read(struct page_mapping *mapping, struct page_cache_ra *ra, uint64_t *offset, void *buf,
+                        uint64_t len)
+{
+    if (!mapping || !offset || !buf) {
+        return -1;
+    }
+    pcache_lock();
+    if (*offset >= mapping->size || len == 0) {
+        pcache_unlock();
+        return 0;
+    }
+    uint64_t remaining = mapping->size - *offset;
+    if (len > remaining) {
+        len = remaining;
+    }
+    uint8_t *dst = (uint8_t *)buf;
+    uint64_t copied = 0;
+    while (copied < len) {
+        uint64_t pos = *offset + copied;
+        uint64_t skip = pos % PAGE_CACHE_SIZE;
+        uint64_t chunk = PAGE_CACHE_SIZE - skip;
+        if (chunk > len - copied) {
+            chunk = len - copied;
+        }
+        struct cache_page *p = pcache_page(mapping, pos / PAGE_CACHE_SIZE, 1);
+        if (!p) {
+            break;
+        }
+        for (uint64_t i = 0; i < chunk; ++i) {
+            dst[copied + i] = p->data[skip + i];
+        }
+        copied += chunk;
+    }
+    if (copied == 0) {
+        pcache_unlock();
+        return -1;
+    }
+    /* Hint after the demand read so it never waits behind the window. */
+    if (ra) {
+        pcache_readahead(mapping, ra, *offset, copied);
+    }
+    pcache_unlock();
+    *offset += copied;
+    return (int64_t)copied;
+}
+
+int64_t page_cache_write(struct page_mapping *mapping, uint64_t *offset, const void *buf, uint64_t len)
+{
+    if (!mapping || !offset || !buf) {
+        return -1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    if (*offset + len < *offset || !mapping->ops->writepage) {
+        return -1;
+    }
+    pcache_lock();
+    const uint8_t *src = (const uint8_t *)buf;
+    uint64_t written = 0;
+    while (written < len) {
+        uint64_t pos = *offset + written;
+        uint64_t skip = pos % PAGE_CACHE_SIZE;
+        uint64_t chunk = PAGE_CACHE_SIZE - skip;
+        if (chunk > len - written) {
+            chunk = len - written;
+        }
+        /* A page the write covers completely needs nothing read first. */
+        struct cache_page *p = pcache_page(mapping, pos / PAGE_CACHE_SIZE, chunk < PAGE_CACHE_SIZE);
+        if (!p) {
+            break;
+        }
+        for (uint64_t i = 0; i < chunk; ++i) {
+            p->data[skip + i] = src[written + i];
+        }
+        p->dirty = 1;
+        written += chunk;
+        if (pos + chunk > mapping->size) {
+            mapping->size = pos + chunk;
+        }
+    }
+    pcache_unlock();
+    if (written == 0) {
+        return -1;
+    }
+    *offset += written;
+    return (int64_t)written;
+}
+
+uint64_t page_cache_size(struct page_mapping *mapping)
+{
+    return mapping ? mapping->size : 0;
+}
+
+int page_cache_flush(struct page_mapping *mapping)
+{
+    if (!mapping) {
+        return -1;
+    }
+    pcache_lock();
+    int rc = pcache_flush_locked(mapping);
+    pcache_unlock();
+    return rc;
+}
+
+int page_cache_sync(void)
+{
+    if (!pcache.ready) {
+        return 0;
+    }
+    int rc = 0;
+    pcache_lock();
+    for (struct page_mapping *mapping = pcache.mappings; mapping; mapping = mapping->next) {
+        if (pcache_flush_locked(mapping) != 0) {
+            rc = -1;
+        }
+    }
+    pcache_unlock();
+    return rc;
+}
+
+void page_cache_get_stats(struct page_cache_stats *out)
+{
+    if (!out) {
+        return;
+    }
+    *out = pcache.stats;
+    out->dirty = 0;
+    for (uint64_t i = 0; i < pcache.used; ++i) {
+        if (pcache.pages[i].mapping && pcache.pages[i].dirty) {
+            out->dirty++;
+        }
+    }
+}
+
+void page_cache_dump(void)
+{
+    struct page_cache_stats st;
+    page_cache_get_stats(&st);
+    uint64_t mappings = 0;
+    for (struct page_mapping *mapping = pcache.mappings; mapping; mapping = mapping->next) {
+        ++mappings;
+    }
+    console_write("Page cache:\n  pages=");
+    console_write_hex(st.pages);
+    console_write(" frames=");
+    console_write_hex(pcache.used);
+    console_write(" max=");
+    console_write_hex(pcache.npages);
+    console_write(" dirty=");
+    console_write_hex(st.dirty);
+    console_write(" mappings=");
+    console_write_hex(mappings);
+    console_write("\n  hits=");
+    console_write_hex(st.hits);
+    console_write(" misses=");
+    console_write_hex(st.misses);
+    console_write("\n  writebacks=");
+    console_write_hex(st.writebacks);
+    console_write(" evictions=");
+    console_write_hex(st.evictions);
+    console_write(" readahead=");
+    console_write_hex(st.readahead);
+    console_write(" lost=");
+    console_write_hex(st.lost);
+    console_write("\n");
+}
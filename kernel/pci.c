@@ -1,105 +1,528 @@
 #include "kernel/pci.h"
+#include "kernel/acpi.h"
+#include "kernel/apic.h"
 #include "kernel/console.h"
+#include "kernel/heap.h"
 #include "kernel/io.h"
 #include "kernel/log.h"
+#include "kernel/mmu.h"
+#include "kernel/spinlock.h"
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define PCI_CONFIG_ADDR 0xCF8
 #define PCI_CONFIG_DATA 0xCFC
 
-#define PCI_MAX_DEVICES 64
-
-struct pci_device {
-    uint8_t bus;
-    uint8_t dev;
-    uint8_t func;
-    uint16_t vendor;
-    uint16_t device;
-    uint8_t class_code;
-    uint8_t subclass;
-    uint8_t prog_if;
-    uint8_t header_type;
-    uint8_t irq_line;
-    uint8_t irq_pin;
-};
-
-static struct pci_device pci_devices[PCI_MAX_DEVICES];
+#define PCI_MAX_BUSES 256
+#define PCI_ECAM_BUS_SIZE (1ULL << 20)
+
+#define PCI_CFG_REVISION_CLASS 0x08
+#define PCI_CFG_HEADER_DWORD   0x0C
+#define PCI_CFG_IRQ_DWORD      0x3C
+#define PCI_CFG_SECONDARY_BUS  0x19
+
+#define PCI_CLASS_BRIDGE 0x06
+#define PCI_SUBCLASS_PCI_BRIDGE 0x04
+#define PCI_HEADER_LAYOUT_BRIDGE 0x01
+
+#define PCI_MSI_CTRL_ENABLE   0x0001
+#define PCI_MSI_CTRL_MME_MASK 0x0070
+#define PCI_MSI_CTRL_64BIT    0x0080
+
+#define PCI_MSIX_CTRL_SIZE_MASK 0x07FF
+#define PCI_MSIX_CTRL_FUNC_MASK 0x4000
+#define PCI_MSIX_CTRL_ENABLE    0x8000
+#define PCI_MSIX_ENTRY_WORDS    4
+#define PCI_MSIX_VECTOR_MASKED  0x1
+
+static struct pci_device *pci_devices_head = NULL;
+static struct pci_device *pci_devices_tail = NULL;
 static uint32_t pci_device_count = 0;
+static struct pci_driver *pci_drivers = NULL;
+
+/* 0xCF8/0xCFC is an address/data pair; accesses must not interleave. */
+static spinlock_t pci_config_lock;
+
+/* ECAM (PCIe memory-mapped config), mapped one bus at a time as buses are visited. */
+static uint64_t ecam_phys = 0;
+static uint8_t ecam_start_bus = 0;
+static uint8_t ecam_end_bus = 0;
+static volatile uint8_t *ecam_bus_map[PCI_MAX_BUSES];
+static uint8_t bus_visited[PCI_MAX_BUSES];
+
+static volatile uint8_t *pci_ecam_ptr(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    if (!ecam_phys || bus < ecam_start_bus || bus > ecam_end_bus) {
+        return NULL;
+    }
+    if (!ecam_bus_map[bus]) {
+        uint64_t phys = ecam_phys + (uint64_t)(bus - ecam_start_bus) * PCI_ECAM_BUS_SIZE;
+        ecam_bus_map[bus] = (volatile uint8_t *)mmu_map_mmio(phys, PCI_ECAM_BUS_SIZE);
+    }
+    return ecam_bus_map[bus] + (((uint32_t)dev << 15) | ((uint32_t)func << 12) | (offset & 0xFFF));
+}
+
+static uint32_t pci_config_address(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
+{
+    return (1u << 31) |
+           ((uint32_t)bus << 16) |
+           ((uint32_t)dev << 11) |
+           ((uint32_t)func << 8) |
+           (offset & 0xFC);
+}
 
-static uint32_t pci_config_read32(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset)
+static uint32_t pci_config_read32(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
 {
-    uint32_t address = (1u << 31) |
-                       ((uint32_t)bus << 16) |
-                       ((uint32_t)dev << 11) |
-                       ((uint32_t)func << 8) |
-                       (offset & 0xFC);
-    outl(PCI_CONFIG_ADDR, address);
-    return inl(PCI_CONFIG_DATA);
+    volatile uint8_t *ecam = pci_ecam_ptr(bus, dev, func, (uint16_t)(offset & ~0x3u));
+    if (ecam) {
+        return *(volatile uint32_t *)ecam;
+    }
+    if (offset >= 0x100) {
+        return 0xFFFFFFFF;
+    }
+    arch_flags_t flags = spinlock_acquire_irqsave(&pci_config_lock);
+    outl(PCI_CONFIG_ADDR, pci_config_address(bus, dev, func, offset));
+    uint32_t val = inl(PCI_CONFIG_DATA);
+    spinlock_release_irqrestore(&pci_config_lock, flags);
+    return val;
 }
 
-static uint16_t pci_config_read16(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset)
+static uint16_t pci_config_read16(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
 {
     uint32_t val = pci_config_read32(bus, dev, func, offset);
     uint8_t shift = (offset & 2) * 8;
     return (uint16_t)((val >> shift) & 0xFFFF);
 }
 
-static uint8_t pci_config_read8(uint8_t bus, uint8_t dev, uint8_t func, uint8_t offset)
+static uint8_t pci_config_read8(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset)
 {
     uint32_t val = pci_config_read32(bus, dev, func, offset);
     uint8_t shift = (offset & 3) * 8;
     return (uint8_t)((val >> shift) & 0xFF);
 }
 
-static void pci_record_device(uint8_t bus, uint8_t dev, uint8_t func)
+static void pci_config_write(uint8_t bus, uint8_t dev, uint8_t func, uint16_t offset,
+                             uint32_t value, uint8_t width)
 {
-    if (pci_device_count >= PCI_MAX_DEVICES) {
+    volatile uint8_t *ecam = pci_ecam_ptr(bus, dev, func, offset);
+    if (ecam) {
+        if (width == 4) {
+            *(volatile uint32_t *)((uintptr_t)ecam & ~(uintptr_t)0x3) = value;
+        } else if (width == 2) {
+            *(volatile uint16_t *)((uintptr_t)ecam & ~(uintptr_t)0x1) = (uint16_t)value;
+        } else {
+            *ecam = (uint8_t)value;
+        }
+        return;
+    }
+    if (offset >= 0x100) {
         return;
     }
-    struct pci_device *entry = &pci_devices[pci_device_count++];
+    arch_flags_t flags = spinlock_acquire_irqsave(&pci_config_lock);
+    outl(PCI_CONFIG_ADDR, pci_config_address(bus, dev, func, offset));
+    if (width == 4) {
+        outl(PCI_CONFIG_DATA, value);
+    } else if (width == 2) {
+        outw((uint16_t)(PCI_CONFIG_DATA + (offset & 2)), (uint16_t)value);
+    } else {
+        outb((uint16_t)(PCI_CONFIG_DATA + (offset & 3)), (uint8_t)value);
+    }
+    spinlock_release_irqrestore(&pci_config_lock, flags);
+}
+
+uint32_t pci_read32(const struct pci_device *dev, uint16_t offset)
+{
+    return pci_config_read32(dev->bus, dev->dev, dev->func, offset);
+}
+
+uint16_t pci_read16(const struct pci_device *dev, uint16_t offset)
+{
+    return pci_config_read16(dev->bus, dev->dev, dev->func, offset);
+}
+
+uint8_t pci_read8(const struct pci_device *dev, uint16_t offset)
+{
+    return pci_config_read8(dev->bus, dev->dev, dev->func, offset);
+}
+
+void pci_write32(const struct pci_device *dev, uint16_t offset, uint32_t value)
+{
+    pci_config_write(dev->bus, dev->dev, dev->func, offset, value, 4);
+}
+
+void pci_write16(const struct pci_device *dev, uint16_t offset, uint16_t value)
+{
+    pci_config_write(dev->bus, dev->dev, dev->func, offset, value, 2);
+}
+
+void pci_write8(const struct pci_device *dev, uint16_t offset, uint8_t value)
+{
+    pci_config_write(dev->bus, dev->dev, dev->func, offset, value, 1);
+}
+
+uint8_t pci_find_capability(const struct pci_device *dev, uint8_t id)
+{
+    if (!(pci_read16(dev, PCI_CFG_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+    uint8_t ptr = pci_read8(dev, PCI_CFG_CAP_PTR) & 0xFC;
+    /* Bound the walk so a malformed (looping) list cannot hang the scan. */
+    for (int guard = 0; ptr >= 0x40 && guard < 48; ++guard) {
+        if (pci_read8(dev, ptr) == id) {
+            return ptr;
+        }
+        ptr = pci_read8(dev, (uint16_t)(ptr + 1)) & 0xFC;
+    }
+    return 0;
+}
+
+static void pci_decode_bars(struct pci_device *d)
+{
+    uint8_t layout = d->header_type & 0x7F;
+    int count = (layout == 0) ? 6 : (layout == 1) ? 2 : 0;
+    if (count == 0) {
+        return;
+    }
+
+    /* Sizing writes all-ones to each BAR, so stop decoding while we probe. */
+    uint16_t cmd = pci_read16(d, PCI_CFG_COMMAND);
+    pci_write16(d, PCI_CFG_COMMAND, cmd & ~(PCI_COMMAND_IO | PCI_COMMAND_MEMORY));
+
+    for (int i = 0; i < count; ++i) {
+        uint16_t off = (uint16_t)(PCI_CFG_BAR0 + i * 4);
+        uint32_t orig = pci_read32(d, off);
+        pci_write32(d, off, 0xFFFFFFFF);
+        uint32_t mask = pci_read32(d, off);
+        pci_write32(d, off, orig);
+        if (mask == 0 || mask == 0xFFFFFFFF) {
+            continue;
+        }
+
+        struct pci_bar *bar = &d->bars[i];
+        if (orig & 0x1) {
+            uint32_t io_mask = mask & ~0x3u;
+            if (!(io_mask & 0xFFFF0000)) {
+                io_mask |= 0xFFFF0000;
+            }
+            bar->type = PCI_BAR_IO;
+            bar->base = orig & ~0x3u;
+            bar->size = (uint32_t)(~io_mask + 1);
+            continue;
+        }
+
+        bar->prefetchable = (orig >> 3) & 0x1;
+        uint64_t base = orig & ~0xFu;
+        uint64_t size_mask = 0xFFFFFFFF00000000ULL | (mask & ~0xFu);
+        if (((orig >> 1) & 0x3) == 0x2 && i + 1 < count) {
+            uint16_t hi = (uint16_t)(off + 4);
+            uint32_t orig_hi = pci_read32(d, hi);
+            pci_write32(d, hi, 0xFFFFFFFF);
+            uint32_t mask_hi = pci_read32(d, hi);
+            pci_write32(d, hi, orig_hi);
+            base |= (uint64_t)orig_hi << 32;
+            size_mask = ((uint64_t)mask_hi << 32) | (mask & ~0xFu);
+            bar->type = PCI_BAR_MEM64;
+            ++i; /* upper half consumed */
+        } else {
+            bar->type = PCI_BAR_MEM32;
+        }
+        bar->base = base;
+        bar->size = ~size_mask + 1;
+    }
+
+    pci_write16(d, PCI_CFG_COMMAND, cmd);
+}
+
+static struct pci_device *pci_record_device(uint8_t bus, uint8_t dev, uint8_t func, uint32_t id)
+{
+    struct pci_device *entry = (struct pci_device *)kalloc_zero(sizeof(*entry), 8);
+    if (!entry) {
+        log_warn("PCI: out of memory recording device");
+        return NULL;
+    }
     entry->bus = bus;
     entry->dev = dev;
     entry->func = func;
-    entry->vendor = pci_config_read16(bus, dev, func, 0x00);
-    entry->device = pci_config_read16(bus, dev, func, 0x02);
-    entry->prog_if = pci_config_read8(bus, dev, func, 0x09);
-    entry->subclass = pci_config_read8(bus, dev, func, 0x0A);
-    entry->class_code = pci_config_read8(bus, dev, func, 0x0B);
-    entry->header_type = pci_config_read8(bus, dev, func, 0x0E);
-    entry->irq_line = pci_config_read8(bus, dev, func, 0x3C);
-    entry->irq_pin = pci_config_read8(bus, dev, func, 0x3D);
+    entry->vendor = (uint16_t)(id & 0xFFFF);
+    entry->device = (uint16_t)(id >> 16);
+
+    /* Whole dwords: one config access per group of fields. */
+    uint32_t class_rev = pci_config_read32(bus, dev, func, PCI_CFG_REVISION_CLASS);
+    entry->prog_if = (uint8_t)(class_rev >> 8);
+    entry->subclass = (uint8_t)(class_rev >> 16);
+    entry->class_code = (uint8_t)(class_rev >> 24);
+    entry->header_type = (uint8_t)(pci_config_read32(bus, dev, func, PCI_CFG_HEADER_DWORD) >> 16);
+    uint32_t irq = pci_config_read32(bus, dev, func, PCI_CFG_IRQ_DWORD);
+    entry->irq_line = (uint8_t)irq;
+    entry->irq_pin = (uint8_t)(irq >> 8);
+
+    pci_decode_bars(entry);
+    entry->msi_cap = pci_find_capability(entry, PCI_CAP_ID_MSI);
+    entry->msix_cap = pci_find_capability(entry, PCI_CAP_ID_MSIX);
+    if (entry->msix_cap) {
+        uint16_t ctrl = pci_read16(entry, (uint16_t)(entry->msix_cap + 2));
+        entry->msix_entries = (uint16_t)((ctrl & PCI_MSIX_CTRL_SIZE_MASK) + 1);
+    }
+
+    if (pci_devices_tail) {
+        pci_devices_tail->next = entry;
+    } else {
+        pci_devices_head = entry;
+    }
+    pci_devices_tail = entry;
+    ++pci_device_count;
+    return entry;
 }
 
-void pci_init(void)
+static void pci_scan_bus(uint8_t bus);
+
+static void pci_scan_function(uint8_t bus, uint8_t dev, uint8_t func, uint32_t id)
 {
-    pci_device_count = 0;
-    for (uint16_t bus = 0; bus < 32; ++bus) {
-        for (uint8_t dev = 0; dev < 32; ++dev) {
-            uint16_t vendor = pci_config_read16((uint8_t)bus, dev, 0, 0x00);
-            if (vendor == 0xFFFF) {
+    struct pci_device *entry = pci_record_device(bus, dev, func, id);
+    if (!entry) {
+        return;
+    }
+    int is_bridge = (entry->header_type & 0x7F) == PCI_HEADER_LAYOUT_BRIDGE ||
+                    (entry->class_code == PCI_CLASS_BRIDGE && entry->subclass == PCI_SUBCLASS_PCI_BRIDGE);
+    if (is_bridge) {
+        uint8_t secondary = pci_read8(entry, PCI_CFG_SECONDARY_BUS);
+        /* Firmware assigns bus numbers; an unconfigured bridge reports 0. */
+        if (secondary != 0 && secondary != bus) {
+            pci_scan_bus(secondary);
+        }
+    }
+}
+
+static void pci_scan_bus(uint8_t bus)
+{
+    if (bus_visited[bus]) {
+        return;
+    }
+    bus_visited[bus] = 1;
+    for (uint8_t dev = 0; dev < 32; ++dev) {
+        uint32_t id = pci_config_read32(bus, dev, 0, PCI_CFG_VENDOR);
+        if ((id & 0xFFFF) == 0xFFFF) {
+            continue;
+        }
+        uint8_t header = (uint8_t)(pci_config_read32(bus, dev, 0, PCI_CFG_HEADER_DWORD) >> 16);
+        pci_scan_function(bus, dev, 0, id);
+        if (!(header & 0x80)) {
+            continue;
+        }
+        for (uint8_t func = 1; func < 8; ++func) {
+            id = pci_config_read32(bus, dev, func, PCI_CFG_VENDOR);
+            if ((id & 0xFFFF) == 0xFFFF) {
                 continue;
             }
-            uint8_t header = pci_config_read8((uint8_t)bus, dev, 0, 0x0E);
-            uint8_t functions = (header & 0x80) ? 8 : 1;
-            for (uint8_t func = 0; func < functions; ++func) {
-                vendor = pci_config_read16((uint8_t)bus, dev, func, 0x00);
-                if (vendor == 0xFFFF) {
-                    continue;
-                }
-                pci_record_device((uint8_t)bus, dev, func);
+            pci_scan_function(bus, dev, func, id);
+        }
+    }
+}
+
+void pci_init(void)
+{
+    spinlock_init(&pci_config_lock);
+    pci_device_count = 0;
+    pci_devices_head = NULL;
+    pci_devices_tail = NULL;
+    for (int i = 0; i < PCI_MAX_BUSES; ++i) {
+        bus_visited[i] = 0;
+    }
+
+    if (acpi_mcfg_info(&ecam_phys, &ecam_start_bus, &ecam_end_bus) == 0) {
+        log_info_hex("PCI: using ECAM at", ecam_phys);
+    } else {
+        ecam_phys = 0;
+        log_info("PCI: no MCFG, using port I/O config access");
+    }
+
+    /* A multi-function host bridge means one root bus per function. */
+    uint8_t host_header = (uint8_t)(pci_config_read32(0, 0, 0, PCI_CFG_HEADER_DWORD) >> 16);
+    if (host_header & 0x80) {
+        for (uint8_t func = 0; func < 8; ++func) {
+            uint32_t id = pci_config_read32(0, 0, func, PCI_CFG_VENDOR);
+            if ((id & 0xFFFF) != 0xFFFF) {
+                pci_scan_bus(func);
             }
         }
+    } else {
+        pci_scan_bus(0);
     }
     log_info("PCI enumeration complete");
     log_info_hex("PCI devices found", pci_device_count);
 }
 
+void pci_enable_device(struct pci_device *dev, int bus_master)
+{
+    uint16_t cmd = pci_read16(dev, PCI_CFG_COMMAND);
+    for (int i = 0; i < PCI_MAX_BARS; ++i) {
+        if (dev->bars[i].type == PCI_BAR_IO) {
+            cmd |= PCI_COMMAND_IO;
+        } else if (dev->bars[i].type != PCI_BAR_NONE) {
+            cmd |= PCI_COMMAND_MEMORY;
+        }
+    }
+    if (bus_master) {
+        cmd |= PCI_COMMAND_BUS_MASTER;
+    }
+    pci_write16(dev, PCI_CFG_COMMAND, cmd);
+}
+
+void *pci_map_bar(struct pci_device *dev, int bar)
+{
+    if (bar < 0 || bar >= PCI_MAX_BARS) {
+        return NULL;
+    }
+    const struct pci_bar *b = &dev->bars[bar];
+    if ((b->type != PCI_BAR_MEM32 && b->type != PCI_BAR_MEM64) || b->base == 0 || b->size == 0) {
+        return NULL;
+    }
+    return mmu_map_mmio(b->base, b->size);
+}
+
+static void pci_set_intx(struct pci_device *dev, int enable)
+{
+    uint16_t cmd = pci_read16(dev, PCI_CFG_COMMAND);
+    if (enable) {
+        cmd &= ~PCI_COMMAND_INTX_DISABLE;
+    } else {
+        cmd |= PCI_COMMAND_INTX_DISABLE;
+    }
+    pci_write16(dev, PCI_CFG_COMMAND, cmd);
+}
+
+int pci_enable_msi(struct pci_device *dev, uint8_t vector)
+{
+    /* MSI is delivered to the LAPIC; without it there is nowhere to send. */
+    if (!dev->msi_cap || !apic_enabled()) {
+        return -1;
+    }
+    uint8_t cap = dev->msi_cap;
+    uint16_t ctrl = pci_read16(dev, (uint16_t)(cap + 2));
+    uint64_t addr = apic_msi_address(0);
+    pci_write32(dev, (uint16_t)(cap + 4), (uint32_t)addr);
+    if (ctrl & PCI_MSI_CTRL_64BIT) {
+        pci_write32(dev, (uint16_t)(cap + 8), (uint32_t)(addr >> 32));
+        pci_write16(dev, (uint16_t)(cap + 12), (uint16_t)apic_msi_data(vector));
+    } else {
+        pci_write16(dev, (uint16_t)(cap + 8), (uint16_t)apic_msi_data(vector));
+    }
+    ctrl &= ~PCI_MSI_CTRL_MME_MASK; /* one vector */
+    ctrl |= PCI_MSI_CTRL_ENABLE;
+    pci_write16(dev, (uint16_t)(cap + 2), ctrl);
+    pci_set_intx(dev, 0);
+    return 0;
+}
+
+void pci_disable_msi(struct pci_device *dev)
+{
+    if (!dev->msi_cap) {
+        return;
+    }
+    uint16_t ctrl = pci_read16(dev, (uint16_t)(dev->msi_cap + 2));
+    pci_write16(dev, (uint16_t)(dev->msi_cap + 2), ctrl & ~PCI_MSI_CTRL_ENABLE);
+    pci_set_intx(dev, 1);
+}
+
+int pci_enable_msix(struct pci_device *dev)
+{
+    if (!dev->msix_cap || !apic_enabled()) {
+        return -1;
+    }
+    uint8_t cap = dev->msix_cap;
+    uint32_t table = pci_read32(dev, (uint16_t)(cap + 4));
+    uint8_t *base = (uint8_t *)pci_map_bar(dev, (int)(table & 0x7));
+    if (!base) {
+        return -1;
+    }
+    dev->msix_table = (volatile uint32_t *)(base + (table & ~0x7u));
+
+    /* Enable with the function masked so no entry fires half-programmed. */
+    uint16_t ctrl = pci_read16(dev, (uint16_t)(cap + 2));
+    pci_write16(dev, (uint16_t)(cap + 2), ctrl | PCI_MSIX_CTRL_ENABLE | PCI_MSIX_CTRL_FUNC_MASK);
+    for (uint16_t i = 0; i < dev->msix_entries; ++i) {
+        dev->msix_table[i * PCI_MSIX_ENTRY_WORDS + 3] = PCI_MSIX_VECTOR_MASKED;
+    }
+    pci_set_intx(dev, 0);
+    ctrl = pci_read16(dev, (uint16_t)(cap + 2));
+    pci_write16(dev, (uint16_t)(cap + 2), ctrl & ~PCI_MSIX_CTRL_FUNC_MASK);
+    return 0;
+}
+
+int pci_msix_set_vector(struct pci_device *dev, uint16_t entry, uint8_t vector, uint8_t cpu)
+{
+    if (!dev->msix_table || entry >= dev->msix_entries) {
+        return -1;
+    }
+    volatile uint32_t *slot = dev->msix_table + entry * PCI_MSIX_ENTRY_WORDS;
+    uint64_t addr = apic_msi_address(cpu);
+    slot[3] = PCI_MSIX_VECTOR_MASKED;
+    slot[0] = (uint32_t)addr;
+    slot[1] = (uint32_t)(addr >> 32);
+    slot[2] = apic_msi_data(vector);
+    slot[3] = 0;
+    return 0;
+}
+
+void pci_disable_msix(struct pci_device *dev)
+{
+    if (!dev->msix_cap) {
+        return;
+    }
+    uint16_t ctrl = pci_read16(dev, (uint16_t)(dev->msix_cap + 2));
+    pci_write16(dev, (uint16_t)(dev->msix_cap + 2), ctrl & ~PCI_MSIX_CTRL_ENABLE);
+    pci_set_intx(dev, 1);
+}
+
+static int pci_id_field_matches(uint16_t want, uint16_t have)
+{
+    return want == PCI_ANY_ID || want == have;
+}
+
+static const struct pci_device_id *pci_match(const struct pci_driver *drv, const struct pci_device *dev)
+{
+    for (const struct pci_device_id *id = drv->ids;
+         id->vendor || id->device || id->class_code || id->subclass; ++id) {
+        if (pci_id_field_matches(id->vendor, dev->vendor) &&
+            pci_id_field_matches(id->device, dev->device) &&
+            pci_id_field_matches(id->class_code, dev->class_code) &&
+            pci_id_field_matches(id->subclass, dev->subclass)) {
+            return id;
+        }
+    }
+    return NULL;
+}
+
+int pci_register_driver(struct pci_driver *drv)
+{
+    if (!drv || !drv->ids || !drv->probe) {
+        return -1;
+    }
+    drv->next = pci_drivers;
+    pci_drivers = drv;
+
+    int bound = 0;
+    for (struct pci_device *dev = pci_devices_head; dev; dev = dev->next) {
+        if (dev->driver) {
+            continue;
+        }
+        const struct pci_device_id *id = pci_match(drv, dev);
+        if (!id) {
+            continue;
+        }
+        if (drv->probe(dev, id) == 0) {
+            dev->driver = drv;
+            ++bound;
+        }
+    }
+    return bound;
+}
+
 void pci_dump(void)
 {
     console_write("PCI devices:\n");
-    for (uint32_t i = 0; i < pci_device_count; ++i) {
-        const struct pci_device *dev = &pci_devices[i];
+    for (const struct pci_device *dev = pci_devices_head; dev; dev = dev->next) {
         console_write("bus=");
         console_write_hex(dev->bus);
         console_write(" dev=");
@@ -116,6 +539,30 @@ void pci_dump(void)
         console_write_hex(dev->subclass);
         console_write(" irq=");
         console_write_hex(dev->irq_line);
+        if (dev->msi_cap) {
+            console_write(" msi");
+        }
+        if (dev->msix_cap) {
+            console_write(" msix=");
+            console_write_hex(dev->msix_entries);
+        }
+        if (dev->driver) {
+            console_write(" drv=");
+            console_write(dev->driver->name);
+        }
         console_write("\n");
+        for (int b = 0; b < PCI_MAX_BARS; ++b) {
+            const struct pci_bar *bar = &dev->bars[b];
+            if (bar->type == PCI_BAR_NONE) {
+                continue;
+            }
+            console_write("  bar");
+            console_write_hex((uint64_t)b);
+            console_write(bar->type == PCI_BAR_IO ? " io=" : " mem=");
+            console_write_hex(bar->base);
+            console_write(" size=");
+            console_write_hex(bar->size);
+            console_write("\n");
+        }
     }
 }
@@ -47,12 +47,12 @@ int64_t pipe_read_impl(struct pipe *p, void *buf, uint64_t len)
 {
     if (!p || !buf) return -1;
     
-    spinlock_acquire_irqsave(&p->lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&p->lock);
     
     while (p->used == 0) {
         if (p->writers == 0) {
             /* EOF */
-            spinlock_release_irqrestore(&p->lock);
+            spinlock_release_irqrestore(&p->lock, flags);
             return 0; 
         }
         /* Block */
@@ -92,9 +92,9 @@ int64_t pipe_read_impl(struct pipe *p, void *buf, uint64_t len)
            
            Let's assume simple yielding for now to keep it safe.
         */
-        spinlock_release_irqrestore(&p->lock);
+        spinlock_release_irqrestore(&p->lock, flags);
         sched_yield();
-        spinlock_acquire_irqsave(&p->lock);
+        flags = spinlock_acquire_irqsave(&p->lock);
     }
     
     uint64_t read = 0;
@@ -109,7 +109,7 @@ int64_t pipe_read_impl(struct pipe *p, void *buf, uint64_t len)
     // valid? wake writers?
     // sched_wake_all(&p->write_wait); // if we had wait queues
     
-    spinlock_release_irqrestore(&p->lock);
+    spinlock_release_irqrestore(&p->lock, flags);
     return read;
 }
 
@@ -117,11 +117,11 @@ int64_t pipe_write_impl(struct pipe *p, const void *buf, uint64_t len)
 {
     if (!p || !buf) return -1;
     
-    spinlock_acquire_irqsave(&p->lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&p->lock);
     
     if (p->readers == 0) {
         // Broken pipe
-        spinlock_release_irqrestore(&p->lock);
+        spinlock_release_irqrestore(&p->lock, flags);
         return -SYSCALL_EIO; // EPIPE
     }
     
@@ -131,12 +131,12 @@ int64_t pipe_write_impl(struct pipe *p, const void *buf, uint64_t len)
     while (written < len) {
         while (p->used == PIPE_SIZE) {
             if (p->readers == 0) {
-                spinlock_release_irqrestore(&p->lock);
+                spinlock_release_irqrestore(&p->lock, flags);
                 return -SYSCALL_EIO;
             }
-            spinlock_release_irqrestore(&p->lock);
+            spinlock_release_irqrestore(&p->lock, flags);
             sched_yield();
-            spinlock_acquire_irqsave(&p->lock);
+            flags = spinlock_acquire_irqsave(&p->lock);
         }
         
         while (written < len && p->used < PIPE_SIZE) {
@@ -146,21 +146,21 @@ int64_t pipe_write_impl(struct pipe *p, const void *buf, uint64_t len)
         }
     }
     
-    spinlock_release_irqrestore(&p->lock);
+    spinlock_release_irqrestore(&p->lock, flags);
     return written;
 }
 
 void pipe_close_impl(struct pipe *p, int is_writer)
 {
     if (!p) return;
-    spinlock_acquire_irqsave(&p->lock);
+    arch_flags_t flags = spinlock_acquire_irqsave(&p->lock);
     if (is_writer) {
         p->writers--;
     } else {
         p->readers--;
     }
     int loose = (p->readers == 0 && p->writers == 0);
-    spinlock_release_irqrestore(&p->lock);
+    spinlock_release_irqrestore(&p->lock, flags);
     
     if (loose) {
         kfree(p);
@@ -1,5 +1,6 @@
 #include "kernel/ramfs.h"
 #include "kernel/heap.h"
+#include "kernel/pagecache.h"
 
 #include <stdint.h>
 
@@ -114,70 +115,60 @@ int ramfs_open(const char *path, struct ramfs_file **out)
     return -1;
 }
 
-int64_t ramfs_read(struct ramfs_file *file, uint64_t *offset, void *buf, uint64_t len)
+uint64_t ramfs_size(const struct ramfs_file *file)
 {
-    if (!file || !offset || !buf || len == 0) {
-        return 0;
-    }
-    if (*offset >= file->size) {
-        return 0;
-    }
-    uint64_t remaining = file->size - *offset;
-    if (len > remaining) {
-        len = remaining;
-    }
-    uint8_t *dst = (uint8_t *)buf;
-    for (uint64_t i = 0; i < len; ++i) {
-        dst[i] = file->data[*offset + i];
-    }
-    *offset += len;
-    return (int64_t)len;
+    return file ? file->size : 0;
 }
 
-int64_t ramfs_write(struct ramfs_file *file, uint64_t *offset, const void *buf, uint64_t len)
+static int ramfs_readpage(void *host, uint64_t index, void *page)
 {
-    if (!file || !offset || !buf || len == 0) {
-        return 0;
-    }
-    uint64_t end = *offset + len;
-    if (end < *offset) {
-        return -1;
+    struct ramfs_file *file = (struct ramfs_file *)host;
+    uint64_t offset = index * PAGE_CACHE_SIZE;
+    uint8_t *dst = (uint8_t *)page;
+    for (uint64_t i = 0; i < PAGE_CACHE_SIZE; ++i) {
+        dst[i] = offset + i < file->size ? file->data[offset + i] : 0;
     }
+    return 0;
+}
+
+static int ramfs_writepage(void *host, uint64_t index, const void *page, uint64_t len)
+{
+    struct ramfs_file *file = (struct ramfs_file *)host;
+    uint64_t offset = index * PAGE_CACHE_SIZE;
+    uint64_t end = offset + len;
     if (ramfs_expand(file, end) != 0) {
         return -1;
     }
-    const uint8_t *src = (const uint8_t *)buf;
+    const uint8_t *src = (const uint8_t *)page;
     for (uint64_t i = 0; i < len; ++i) {
-        file->data[*offset + i] = src[i];
+        file->data[offset + i] = src[i];
     }
     if (end > file->size) {
         file->size = end;
     }
-    *offset = end;
-    return (int64_t)len;
+    return 0;
 }
 
-uint64_t ramfs_list(char *buf, uint64_t len)
+const struct page_cache_ops ramfs_page_ops = {
+    .readpage = ramfs_readpage,
+    .writepage = ramfs_writepage,
+};
+
+struct ramfs_file *ramfs_next(uint64_t *cursor)
 {
-    if (!buf || len == 0) {
-        return 0;
+    if (!cursor) {
+        return NULL;
     }
-    uint64_t written = 0;
-    for (uint64_t i = 0; i < RAMFS_MAX_FILES; ++i) {
-        if (!ramfs_files[i].used) {
-            continue;
-        }
-        const char *path = ramfs_files[i].path;
-        for (uint64_t j = 0; path[j] != '\0'; ++j) {
-            if (written + 1 >= len) {
-                return written;
-            }
-            buf[written++] = path[j];
-        }
-        if (written + 1 >= len) {
-            return written;
+    while (*cursor < RAMFS_MAX_FILES) {
+        struct ramfs_file *file = &ramfs_files[(*cursor)++];
+        if (file->used) {
+            return file;
         }
-        buf[written++] = '\n';
     }
-    return written;
+    return NULL;
+}
+
+const char *ramfs_path(const struct ramfs_file *file)
+{
+    return file ? file->path : NULL;
 }
@@ -0,0 +1,79 @@
+#include "kernel/rwlock.h"
+#include <stdbool.h>
+
+void rwlock_init(rwlock_t *lock)
+{
+    lock->state = 0;
+}
+
+void rwlock_read_acquire(rwlock_t *lock)
+{
+    for (;;) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (!(state & (RWLOCK_WRITER | RWLOCK_WAITING))) {
+            if (__atomic_compare_exchange_n(&lock->state, &state, state + 1, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        }
+        arch_cpu_relax();
+    }
+}
+
+void rwlock_read_release(rwlock_t *lock)
+{
+    __atomic_fetch_sub(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+void rwlock_write_acquire(rwlock_t *lock)
+{
+    for (;;) {
+        uint32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if ((state & ~RWLOCK_WAITING) == 0) {
+            if (__atomic_compare_exchange_n(&lock->state, &state, RWLOCK_WRITER, false,
+                                            __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return;
+            }
+            continue;
+        }
+        if (!(state & RWLOCK_WAITING)) {
+            /* Hold off new readers until the current ones drain. */
+            __atomic_compare_exchange_n(&lock->state, &state, state | RWLOCK_WAITING, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+        arch_cpu_relax();
+    }
+}
+
+void rwlock_write_release(rwlock_t *lock)
+{
+    /* Leave RWLOCK_WAITING alone: another writer may have announced itself. */
+    __atomic_fetch_and(&lock->state, ~RWLOCK_WRITER, __ATOMIC_RELEASE);
+}
+
+arch_flags_t rwlock_read_acquire_irqsave(rwlock_t *lock)
+{
+    arch_flags_t flags = arch_irq_save();
+    rwlock_read_acquire(lock);
+    return flags;
+}
+
+void rwlock_read_release_irqrestore(rwlock_t *lock, arch_flags_t flags)
+{
+    rwlock_read_release(lock);
+    arch_irq_restore(flags);
+}
+
+arch_flags_t rwlock_write_acquire_irqsave(rwlock_t *lock)
+{
+    arch_flags_t flags = arch_irq_save();
+    rwlock_write_acquire(lock);
+    return flags;
+}
+
+void rwlock_write_release_irqrestore(rwlock_t *lock, arch_flags_t flags)
+{
+    rwlock_write_release(lock);
+    arch_irq_restore(flags);
+}
@@ -18,7 +18,8 @@ static struct thread *threads_tail = NULL;
 static size_t thread_count = 0;
 // current_thread is already defined below but we need valid pointer or NULL
 static struct thread *current_thread = NULL;
-static volatile uint64_t sched_ticks = 0;
+/* Bumped from the tick IRQ and read under sched_lock; plain atomics suffice. */
+static uint64_t sched_ticks = 0;
 static volatile uint8_t need_resched = 0;
 static uint64_t last_switch_tick = 0;
 static uint64_t time_slice_ticks = 5;
@@ -26,7 +27,7 @@ static int sched_ready = 0;
 volatile uint8_t sched_preempt_pending = 0;
 uint64_t sched_preempt_target = 0;
 static int next_pid = 1;
-static spinlock_t sched_lock;
+static ticket_lock_t sched_lock = TICKET_LOCK_INIT("sched");
 
 static void list_append(struct thread *t)
 {
@@ -75,7 +76,9 @@ static void sched_exit(void);
 
 static void thread_trampoline(void)
 {
-    spinlock_release_irqrestore(&sched_lock);
+    /* New threads start here holding the lock taken by whoever switched to them. */
+    ticket_lock_release(&sched_lock);
+    arch_irq_enable();
     struct thread *thread = current_thread;
     if (thread && thread->entry) {
         thread->entry(thread->arg);
@@ -101,7 +104,7 @@ void sched_init(void)
     boot->reaped = 1; /* Dummy, don't care */
     current_thread = boot;
     
-    sched_ticks = 0;
+    __atomic_store_n(&sched_ticks, 0, __ATOMIC_RELAXED);
     need_resched = 0;
     last_switch_tick = 0;
     sched_ready = 1;
@@ -113,10 +116,10 @@ int sched_create(void (*entry)(void *), void *arg)
         return -1;
     }
 
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *thread = thread_alloc();
     if (!thread) {
-        spinlock_release_irqrestore(&sched_lock);
+        ticket_lock_release_irqrestore(&sched_lock, flags);
         return -1;
     }
     // thread is already zeroed by kalloc_zero and appended to list
@@ -146,13 +149,13 @@ int sched_create(void (*entry)(void *), void *arg)
         log_error("sched_create: stack alloc failed");
         list_remove(thread);
         kfree(thread);
-        spinlock_release_irqrestore(&sched_lock);
+        ticket_lock_release_irqrestore(&sched_lock, flags);
         return -1;
     }
 
     arch_thread_setup(thread, thread_trampoline);
 
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
     return 0;
 }
 
@@ -162,10 +165,10 @@ int sched_create_user(void (*entry)(void *), void *arg, int parent_pid, int *out
         return -1;
     }
 
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *thread = thread_alloc();
     if (!thread) {
-        spinlock_release_irqrestore(&sched_lock);
+        ticket_lock_release_irqrestore(&sched_lock, flags);
         return -1;
     }
     // thread is already appended
@@ -194,11 +197,17 @@ int sched_create_user(void (*entry)(void *), void *arg, int parent_pid, int *out
         }
     }
     if (parent) {
-        for (int i = 0; i < 256; ++i) {
-            thread->cwd[i] = parent->cwd[i];
-        }
+        uint32_t seq;
+        do {
+            seq = read_seqbegin(&parent->fs_seq);
+            for (int i = 0; i < 256; ++i) {
+                thread->cwd[i] = parent->cwd[i];
+            }
+            for (int i = 0; i < 16; ++i) {
+                thread->fds[i] = parent->fds[i];
+            }
+        } while (read_seqretry(&parent->fs_seq, seq));
         for (int i = 0; i < 16; ++i) {
-            thread->fds[i] = parent->fds[i];
             if (thread->fds[i] >= 0) {
                 syscall_acquire_handle(thread->fds[i]);
             }
@@ -217,7 +226,7 @@ int sched_create_user(void (*entry)(void *), void *arg, int parent_pid, int *out
         log_error("sched_create_user: stack alloc failed");
         list_remove(thread);
         kfree(thread);
-        spinlock_release_irqrestore(&sched_lock);
+        ticket_lock_release_irqrestore(&sched_lock, flags);
         return -1;
     }
 
@@ -226,7 +235,7 @@ int sched_create_user(void (*entry)(void *), void *arg, int parent_pid, int *out
     if (out_pid) {
         *out_pid = thread->pid;
     }
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
     return 0;
 }
 
@@ -262,7 +271,8 @@ static void sched_resched_locked(void)
             return;
         }
         if (current_thread->state == THREAD_DEAD) {
-             spinlock_release_irqrestore(&sched_lock);
+             ticket_lock_release(&sched_lock);
+             arch_irq_enable();
              for (;;) arch_halt();
         }
         return;
@@ -279,7 +289,7 @@ static void sched_resched_locked(void)
     next_thread->state = THREAD_RUNNING;
     
     current_thread = next_thread;
-    last_switch_tick = sched_ticks;
+    last_switch_tick = __atomic_load_n(&sched_ticks, __ATOMIC_RELAXED);
     need_resched = 0;
     
     if (next_thread->aspace) {
@@ -293,9 +303,9 @@ static void sched_resched_locked(void)
 
 void sched_yield(void)
 {
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     sched_resched_locked();
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
 
 void sched_start(void)
@@ -305,14 +315,20 @@ void sched_start(void)
 
 static void sched_exit(void)
 {
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     if (current_thread) {
         current_thread->state = THREAD_DEAD;
         /* Release held handles */
+        int held[16];
+        arch_flags_t fs_flags = write_seqlock_irqsave(&current_thread->fs_seq);
         for (int i = 0; i < 16; ++i) {
-            if (current_thread->fds[i] >= 0) {
-                syscall_release_handle(current_thread->fds[i]);
-                current_thread->fds[i] = -1;
+            held[i] = current_thread->fds[i];
+            current_thread->fds[i] = -1;
+        }
+        write_sequnlock_irqrestore(&current_thread->fs_seq, fs_flags);
+        for (int i = 0; i < 16; ++i) {
+            if (held[i] >= 0) {
+                syscall_release_handle(held[i]);
             }
         }
     }
@@ -320,7 +336,7 @@ static void sched_exit(void)
     /* Should not return if we successfully switched away from a DEAD thread */
     /* If we returned, it means no other thread was found.
        We release lock and loop? */
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
     for (;;) {
         arch_halt();
     }
@@ -373,7 +389,7 @@ int sched_current_pid(void)
 int sched_get_ppid(int pid)
 {
     if (pid <= 0) return 0;
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *t = threads_head;
     int ppid = 0;
     while (t) {
@@ -383,7 +399,7 @@ int sched_get_ppid(int pid)
         }
         t = t->next;
     }
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
     return ppid;
 }
 
@@ -397,71 +413,77 @@ void sched_set_current_exit_code(int code)
 void sched_get_cwd(char *buf, size_t size)
 {
     if (!buf || size == 0) return;
-    spinlock_acquire_irqsave(&sched_lock);
-    if (current_thread) {
+    struct thread *t = current_thread;
+    if (!t) {
+        buf[0] = '/';
+        if (size > 1) buf[1] = '\0';
+        return;
+    }
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&t->fs_seq);
         size_t i;
-        for (i = 0; i < size - 1 && current_thread->cwd[i]; ++i) {
-            buf[i] = current_thread->cwd[i];
+        for (i = 0; i < size - 1 && t->cwd[i]; ++i) {
+            buf[i] = t->cwd[i];
         }
         buf[i] = '\0';
-    } else {
-        buf[0] = '/';
-        buf[1] = '\0';
-    }
-    spinlock_release_irqrestore(&sched_lock);
+    } while (read_seqretry(&t->fs_seq, seq));
 }
 
 void sched_set_cwd(const char *buf)
 {
     if (!buf) return;
-    spinlock_acquire_irqsave(&sched_lock);
-    if (current_thread) {
-        size_t i;
-        for (i = 0; i < 255 && buf[i]; ++i) {
-            current_thread->cwd[i] = buf[i];
-        }
-        current_thread->cwd[i] = '\0';
+    struct thread *t = current_thread;
+    if (!t) return;
+    arch_flags_t flags = write_seqlock_irqsave(&t->fs_seq);
+    size_t i;
+    for (i = 0; i < 255 && buf[i]; ++i) {
+        t->cwd[i] = buf[i];
     }
-    spinlock_release_irqrestore(&sched_lock);
+    t->cwd[i] = '\0';
+    write_sequnlock_irqrestore(&t->fs_seq, flags);
 }
 
 int sched_get_fd(int fd)
 {
     if (fd < 0 || fd >= 16) return -1;
-    int global_handle = -1;
-    spinlock_acquire_irqsave(&sched_lock);
-    if (current_thread) {
-        global_handle = current_thread->fds[fd];
-    }
-    spinlock_release_irqrestore(&sched_lock);
+    struct thread *t = current_thread;
+    if (!t) return -1;
+    int global_handle;
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&t->fs_seq);
+        global_handle = t->fds[fd];
+    } while (read_seqretry(&t->fs_seq, seq));
     return global_handle;
 }
 
 void sched_set_fd(int fd, int global_handle)
 {
     if (fd < 0 || fd >= 16) return;
-    spinlock_acquire_irqsave(&sched_lock);
-    if (current_thread) {
-        current_thread->fds[fd] = global_handle;
-    }
-    spinlock_release_irqrestore(&sched_lock);
+    struct thread *t = current_thread;
+    if (!t) return;
+    arch_flags_t flags = write_seqlock_irqsave(&t->fs_seq);
+    t->fds[fd] = global_handle;
+    write_sequnlock_irqrestore(&t->fs_seq, flags);
 }
 
 int sched_allocate_fd(int global_handle)
 {
     if (global_handle < 0) return -1;
-    spinlock_acquire_irqsave(&sched_lock);
-    if (current_thread) {
-        for (int i = 0; i < 16; ++i) {
-            if (current_thread->fds[i] == -1) {
-                current_thread->fds[i] = global_handle;
-                spinlock_release_irqrestore(&sched_lock);
-                return i;
-            }
+    struct thread *t = current_thread;
+    if (!t) return -1;
+    int fd = -1;
+    arch_flags_t flags = write_seqlock_irqsave(&t->fs_seq);
+    for (int i = 0; i < 16; ++i) {
+        if (t->fds[i] == -1) {
+            t->fds[i] = global_handle;
+            fd = i;
+            break;
         }
     }
-    spinlock_release_irqrestore(&sched_lock);
-    return -1;
+    write_sequnlock_irqrestore(&t->fs_seq, flags);
+    return fd;
 }
 
 int sched_wait_child(int parent_pid, int *out_code)
@@ -471,7 +493,7 @@ int sched_wait_child(int parent_pid, int *out_code)
     }
     for (;;) {
         int has_child = 0;
-        spinlock_acquire_irqsave(&sched_lock);
+        arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
         
         struct thread *t = threads_head;
         while (t) {
@@ -490,14 +512,14 @@ int sched_wait_child(int parent_pid, int *out_code)
                        kfree(t->stack);
                     }
                     kfree(t);
-                    spinlock_release_irqrestore(&sched_lock);
+                    ticket_lock_release_irqrestore(&sched_lock, flags);
                     return pid;
                 }
             }
             t = next;
         }
         
-        spinlock_release_irqrestore(&sched_lock);
+        ticket_lock_release_irqrestore(&sched_lock, flags);
 
         if (!has_child) {
             return -1;
@@ -508,7 +530,7 @@ int sched_wait_child(int parent_pid, int *out_code)
 
 void sched_kill_user_threads(void)
 {
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *t = threads_head;
     while (t) {
         if (t->aspace) {
@@ -518,16 +540,16 @@ void sched_kill_user_threads(void)
         }
         t = t->next;
     }
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
 
 void sched_on_tick(void)
 {
-    sched_ticks++;
+    uint64_t now = __atomic_add_fetch(&sched_ticks, 1, __ATOMIC_RELAXED);
     if (!sched_ready) {
         return;
     }
-    if (sched_ticks - last_switch_tick >= time_slice_ticks) {
+    if (now - last_switch_tick >= time_slice_ticks) {
         need_resched = 1;
     }
 }
@@ -574,7 +596,7 @@ void sched_sleep(wait_queue_t *wq)
 {
     if (!wq) return;
     
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     if (current_thread) {
         current_thread->state = THREAD_BLOCKED;
         current_thread->wait_next = NULL;
@@ -588,20 +610,11 @@ void sched_sleep(wait_queue_t *wq)
         
         sched_resched_locked();
     }
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
 
-void sched_sleep_cond(wait_queue_t *wq, int (*cond)(void))
+static void sched_block_on_locked(wait_queue_t *wq)
 {
-    if (!wq) return;
-    
-    spinlock_acquire_irqsave(&sched_lock);
-    
-    if (cond && cond()) {
-        spinlock_release_irqrestore(&sched_lock);
-        return;
-    }
-
     if (current_thread) {
         current_thread->state = THREAD_BLOCKED;
         current_thread->wait_next = NULL;
@@ -615,14 +628,41 @@ void sched_sleep_cond(wait_queue_t *wq, int (*cond)(void))
         
         sched_resched_locked();
     }
-    spinlock_release_irqrestore(&sched_lock);
+}
+
+void sched_sleep_cond(wait_queue_t *wq, int (*cond)(void))
+{
+    if (!wq) return;
+    
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
+    
+    if (cond && cond()) {
+        ticket_lock_release_irqrestore(&sched_lock, flags);
+        return;
+    }
+
+    sched_block_on_locked(wq);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
+}
+
+void sched_sleep_until(wait_queue_t *wq, int (*cond)(void *arg), void *arg)
+{
+    if (!wq) return;
+
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
+    if (cond && cond(arg)) {
+        ticket_lock_release_irqrestore(&sched_lock, flags);
+        return;
+    }
+    sched_block_on_locked(wq);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
 
 void sched_wake_one(wait_queue_t *wq)
 {
     if (!wq) return;
     
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *t = wq->head;
     if (t) {
         wq->head = t->wait_next;
@@ -632,14 +672,14 @@ void sched_wake_one(wait_queue_t *wq)
         t->wait_next = NULL;
         t->state = THREAD_RUNNABLE;
     }
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
 
 void sched_wake_all(wait_queue_t *wq)
 {
     if (!wq) return;
     
-    spinlock_acquire_irqsave(&sched_lock);
+    arch_flags_t flags = ticket_lock_acquire_irqsave(&sched_lock);
     struct thread *t = wq->head;
     while (t) {
         struct thread *next = t->wait_next;
@@ -649,5 +689,5 @@ void sched_wake_all(wait_queue_t *wq)
     }
     wq->head = NULL;
     wq->tail = NULL;
-    spinlock_release_irqrestore(&sched_lock);
+    ticket_lock_release_irqrestore(&sched_lock, flags);
 }
@@ -1,16 +1,22 @@
 #include "kernel/spinlock.h"
+#include "kernel/log.h"
 #include <stdbool.h>
+#include <stddef.h>
+
+static struct lockstat *lockstat_head = NULL;
 
 void spinlock_init(spinlock_t *lock)
 {
     lock->lock = 0;
-    lock->flags = 0;
 }
 
 void spinlock_acquire(spinlock_t *lock)
 {
     while (__atomic_test_and_set(&lock->lock, __ATOMIC_ACQUIRE)) {
-        arch_cpu_relax();
+        /* Spin on a plain load so waiters share the line until release. */
+        while (__atomic_load_n(&lock->lock, __ATOMIC_RELAXED)) {
+            arch_cpu_relax();
+        }
     }
 }
 
@@ -19,19 +25,174 @@ void spinlock_release(spinlock_t *lock)
     __atomic_clear(&lock->lock, __ATOMIC_RELEASE);
 }
 
-void spinlock_acquire_irqsave(spinlock_t *lock)
+arch_flags_t spinlock_acquire_irqsave(spinlock_t *lock)
 {
     arch_flags_t flags = arch_irq_save();
-    lock->flags = flags;
-    
-    while (__atomic_test_and_set(&lock->lock, __ATOMIC_ACQUIRE)) {
+    spinlock_acquire(lock);
+    return flags;
+}
+
+void spinlock_release_irqrestore(spinlock_t *lock, arch_flags_t flags)
+{
+    spinlock_release(lock);
+    arch_irq_restore(flags);
+}
+
+static void lockstat_register(struct lockstat *stat)
+{
+    if (__atomic_exchange_n(&stat->registered, 1, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    struct lockstat *head = __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+    do {
+        stat->next = head;
+    } while (!__atomic_compare_exchange_n(&lockstat_head, &head, stat, false,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+/* Called with the lock held. */
+static inline void lockstat_acquired(struct lockstat *stat, int contended)
+{
+#if ENABLE_LOCKSTAT
+    if (!stat->registered) {
+        lockstat_register(stat);
+    }
+    ++stat->acquisitions;
+    if (contended) {
+        ++stat->contended;
+    }
+    stat->hold_start = arch_read_cycles();
+#else
+    (void)stat;
+    (void)contended;
+#endif
+}
+
+/* Called with the lock still held, just before handing it off. */
+static inline void lockstat_released(struct lockstat *stat)
+{
+#if ENABLE_LOCKSTAT
+    uint64_t held = arch_read_cycles() - stat->hold_start;
+    if (held > stat->max_hold_cycles) {
+        stat->max_hold_cycles = held;
+    }
+#else
+    (void)stat;
+#endif
+}
+
+static void lockstat_init(struct lockstat *stat, const char *name)
+{
+    stat->name = name;
+    stat->acquisitions = 0;
+    stat->contended = 0;
+    stat->max_hold_cycles = 0;
+    stat->hold_start = 0;
+}
+
+void ticket_lock_init(ticket_lock_t *lock, const char *name)
+{
+    lock->next = 0;
+    lock->owner = 0;
+    lockstat_init(&lock->stat, name);
+}
+
+void ticket_lock_acquire(ticket_lock_t *lock)
+{
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    int contended = 0;
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        contended = 1;
         arch_cpu_relax();
     }
+    lockstat_acquired(&lock->stat, contended);
 }
 
-void spinlock_release_irqrestore(spinlock_t *lock)
+void ticket_lock_release(ticket_lock_t *lock)
 {
-    arch_flags_t flags = lock->flags;
-    __atomic_clear(&lock->lock, __ATOMIC_RELEASE);
+    lockstat_released(&lock->stat);
+    /* Only the holder writes owner, so a plain increment is race-free. */
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+arch_flags_t ticket_lock_acquire_irqsave(ticket_lock_t *lock)
+{
+    arch_flags_t flags = arch_irq_save();
+    ticket_lock_acquire(lock);
+    return flags;
+}
+
+void ticket_lock_release_irqrestore(ticket_lock_t *lock, arch_flags_t flags)
+{
+    ticket_lock_release(lock);
+    arch_irq_restore(flags);
+}
+
+void mcs_lock_init(mcs_lock_t *lock, const char *name)
+{
+    lock->tail = NULL;
+    lockstat_init(&lock->stat, name);
+}
+
+void mcs_lock_acquire(mcs_lock_t *lock, struct mcs_node *node)
+{
+    node->next = NULL;
+    node->locked = 1;
+    struct mcs_node *prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    int contended = 0;
+    if (prev) {
+        contended = 1;
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            arch_cpu_relax();
+        }
+    }
+    lockstat_acquired(&lock->stat, contended);
+}
+
+void mcs_lock_release(mcs_lock_t *lock, struct mcs_node *node)
+{
+    lockstat_released(&lock->stat);
+    struct mcs_node *next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    if (!next) {
+        struct mcs_node *expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, NULL, false,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        /* A waiter swapped in behind us but has not linked itself yet. */
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+            arch_cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+arch_flags_t mcs_lock_acquire_irqsave(mcs_lock_t *lock, struct mcs_node *node)
+{
+    arch_flags_t flags = arch_irq_save();
+    mcs_lock_acquire(lock, node);
+    return flags;
+}
+
+void mcs_lock_release_irqrestore(mcs_lock_t *lock, struct mcs_node *node, arch_flags_t flags)
+{
+    mcs_lock_release(lock, node);
     arch_irq_restore(flags);
 }
+
+void lockstat_dump(void)
+{
+#if ENABLE_LOCKSTAT
+    struct lockstat *stat = __atomic_load_n(&lockstat_head, __ATOMIC_ACQUIRE);
+    while (stat) {
+        log_info(stat->name ? stat->name : "(unnamed lock)");
+        log_info_hex("  acquisitions", stat->acquisitions);
+        log_info_hex("  contended", stat->contended);
+        log_info_hex("  max hold cycles", stat->max_hold_cycles);
+        stat = stat->next;
+    }
+#else
+    log_info("Lock statistics disabled");
+#endif
+}
@@ -2,6 +2,7 @@
 #include "kernel/heap.h"
 #include "kernel/log.h"
 #include "kernel/mmu.h"
+#include "kernel/rwlock.h"
 #include "kernel/sched.h"
 #include "kernel/tty.h"
 #include "kernel/user.h"
@@ -27,32 +28,55 @@ struct handle {
 
 #define HANDLE_MAX 128
 
+/* Readers (every read/write syscall) share handles_lock; open/close/dup take it exclusively. */
 static struct handle handles[HANDLE_MAX];
+static rwlock_t handles_lock = RWLOCK_INIT;
 static int handles_ready = 0;
 
 void syscall_acquire_handle(int id)
 {
     if (id < 0 || id >= HANDLE_MAX) return;
+    arch_flags_t flags = rwlock_write_acquire_irqsave(&handles_lock);
     if (handles[id].type != HANDLE_FREE) {
         handles[id].refcount++;
     }
+    rwlock_write_release_irqrestore(&handles_lock, flags);
 }
 
 void syscall_release_handle(int id)
 {
     if (id < 0 || id >= HANDLE_MAX) return;
-    if (handles[id].type == HANDLE_FREE) return;
-    
+    struct vfs_file *to_close = NULL;
+    arch_flags_t flags = rwlock_write_acquire_irqsave(&handles_lock);
+    if (handles[id].type == HANDLE_FREE) {
+        rwlock_write_release_irqrestore(&handles_lock, flags);
+        return;
+    }
+
     handles[id].refcount--;
     if (handles[id].refcount <= 0) {
         if (handles[id].type == HANDLE_VFS) {
-            vfs_close(handles[id].file);
+            to_close = handles[id].file;
         }
         handles[id].type = HANDLE_FREE;
         handles[id].file = NULL;
         handles[id].owner_pid = 0;
         handles[id].refcount = 0;
     }
+    rwlock_write_release_irqrestore(&handles_lock, flags);
+    if (to_close) {
+        vfs_close(to_close);
+    }
+}
+
+/* Snapshot a handle under the read lock. Returns -1 if the slot is free. */
+static int handle_lookup(int id, struct handle *out)
+{
+    if (id < 0 || id >= HANDLE_MAX) return -1;
+    arch_flags_t flags = rwlock_read_acquire_irqsave(&handles_lock);
+    *out = handles[id];
+    rwlock_read_release_irqrestore(&handles_lock, flags);
+    return out->type == HANDLE_FREE ? -1 : 0;
 }
 
 /* Re-evaluating fork logic below */
@@ -65,6 +89,11 @@ static uint64_t syscall_error(enum syscall_error err)
 
 static void handles_init(void)
 {
+    arch_flags_t flags = rwlock_write_acquire_irqsave(&handles_lock);
+    if (handles_ready) {
+        rwlock_write_release_irqrestore(&handles_lock, flags);
+        return;
+    }
     for (int i = 0; i < HANDLE_MAX; ++i) {
         handles[i].type = HANDLE_FREE;
         handles[i].file = NULL;
@@ -77,20 +106,25 @@ static void handles_init(void)
     handles[1].owner_pid = 0;
     handles[2].owner_pid = 0;
     handles_ready = 1;
+    rwlock_write_release_irqrestore(&handles_lock, flags);
 }
 
 static int handle_alloc(enum handle_type type, struct vfs_file *file, int owner_pid)
 {
+    int id = -1;
+    arch_flags_t flags = rwlock_write_acquire_irqsave(&handles_lock);
     for (int i = 0; i < HANDLE_MAX; ++i) {
         if (handles[i].type == HANDLE_FREE) {
             handles[i].type = type;
             handles[i].file = file;
             handles[i].owner_pid = owner_pid;
             handles[i].refcount = 1;
-            return i;
+            id = i;
+            break;
         }
     }
-    return -1;
+    rwlock_write_release_irqrestore(&handles_lock, flags);
+    return id;
 }
 
 static int handle_valid(int fd)
@@ -400,10 +434,11 @@ uint64_t syscall_handle(struct syscall_regs *regs, struct interrupt_frame *frame
             return syscall_error(SYSCALL_EINVAL);
         }
         int global = sched_get_fd(fd);
-        if (global < 0) {
+        struct handle hs;
+        if (global < 0 || handle_lookup(global, &hs) != 0) {
             return syscall_error(SYSCALL_EBADF);
         }
-        struct handle *h = &handles[global];
+        struct handle *h = &hs;
         if (h->type == HANDLE_TTY) {
             return tty_read(buf, len);
         }
@@ -420,11 +455,11 @@ uint64_t syscall_handle(struct syscall_regs *regs, struct interrupt_frame *frame
         int fd = (int)regs->rdi;
         // log_info_hex("SYSCALL_WRITE fd", fd);
         int global = sched_get_fd(fd);
-        if (global < 0) {
+        struct handle hs;
+        if (global < 0 || handle_lookup(global, &hs) != 0) {
             return syscall_error(SYSCALL_EBADF);
         }
-        struct handle *h = &handles[global];
-        if (h->type == HANDLE_FREE) return syscall_error(SYSCALL_EBADF);
+        struct handle *h = &hs;
 
         const void *buf = (const void *)regs->rsi;
         uint64_t len = regs->rdx;
@@ -462,7 +497,7 @@ uint64_t syscall_handle(struct syscall_regs *regs, struct interrupt_frame *frame
             return (uint64_t)local_fd;
         }
         struct vfs_file *file = NULL;
-        int vfs_err = vfs_open(path_buf, &file);
+        int vfs_err = (regs->rsi & SYSCALL_OPEN_DIRECTORY) ? vfs_opendir(path_buf, &file) : vfs_open(path_buf, &file);
         if (vfs_err != SYSCALL_OK) {
             return syscall_error((enum syscall_error)vfs_err);
         }
@@ -587,7 +622,7 @@ uint64_t syscall_handle(struct syscall_regs *regs, struct interrupt_frame *frame
         }
         /* Verify directory exists by opening it */
         struct vfs_file *f = NULL;
-        int err = vfs_open(resolved, &f);
+        int err = vfs_opendir(resolved, &f);
         if (err != SYSCALL_OK) {
             return syscall_error((enum syscall_error)err);
         }
@@ -609,6 +644,62 @@ uint64_t syscall_handle(struct syscall_regs *regs, struct interrupt_frame *frame
         for(uint64_t i=0; i<=len; ++i) buf[i] = cwd[i];
         return 0;
     }
+    case SYSCALL_FSYNC: {
+        int fd = (int)regs->rdi;
+        int global = sched_get_fd(fd);
+        struct handle hs;
+        if (global < 0 || handle_lookup(global, &hs) != 0) {
+            return syscall_error(SYSCALL_EBADF);
+        }
+        if (hs.type != HANDLE_VFS) {
+            return 0;
+        }
+        int64_t rc = vfs_fsync(hs.file);
+        if (rc < 0) {
+            return syscall_error((enum syscall_error)(-rc));
+        }
+        return 0;
+    }
+    case SYSCALL_FALLOCATE: {
+        int fd = (int)regs->rdi;
+        int global = sched_get_fd(fd);
+        struct handle hs;
+        if (global < 0 || handle_lookup(global, &hs) != 0) {
+            return syscall_error(SYSCALL_EBADF);
+        }
+        if (hs.type != HANDLE_VFS) {
+            return syscall_error(SYSCALL_EINVAL);
+        }
+        int64_t rc = vfs_fallocate(hs.file, regs->rsi);
+        if (rc < 0) {
+            return syscall_error((enum syscall_error)(-rc));
+        }
+        return 0;
+    }
+    case SYSCALL_GETDENTS: {
+        int fd = (int)regs->rdi;
+        struct vfs_dirent *buf = (struct vfs_dirent *)regs->rsi;
+        uint64_t len = regs->rdx;
+        if (!buf || len < sizeof(struct vfs_dirent)) {
+            return syscall_error(SYSCALL_EINVAL);
+        }
+        if (!user_ptr_range((uint64_t)buf, len)) {
+            return syscall_error(SYSCALL_EINVAL);
+        }
+        int global = sched_get_fd(fd);
+        struct handle hs;
+        if (global < 0 || handle_lookup(global, &hs) != 0) {
+            return syscall_error(SYSCALL_EBADF);
+        }
+        if (hs.type != HANDLE_VFS) {
+            return syscall_error(SYSCALL_EINVAL);
+        }
+        int64_t n = vfs_getdents(hs.file, buf, len / sizeof(struct vfs_dirent));
+        if (n < 0) {
+            return syscall_error((enum syscall_error)(-n));
+        }
+        return (uint64_t)n * sizeof(struct vfs_dirent);
+    }
     case SYSCALL_DUP2: {
         int oldfd = (int)regs->rdi;
         int newfd = (int)regs->rsi;
@@ -1,12 +1,19 @@
 #include "kernel/terminal.h"
+#include "drivers/ahci.h"
+#include "drivers/virtio.h"
+#include "kernel/block.h"
 #include "kernel/console.h"
+#include "kernel/fat.h"
 #include "kernel/irq.h"
 #include "kernel/heap.h"
 #include "kernel/log.h"
+#include "kernel/pagecache.h"
 #include "kernel/pci.h"
 #include "kernel/sched.h"
+#include "kernel/spinlock.h"
 #include "kernel/timer.h"
 #include "kernel/acpi.h"
+#include "kernel/apic.h"
 
 #include <stdint.h>
 #include <arch/processor.h>
@@ -69,6 +76,31 @@ static int streq(const char *a, const char *b)
     return *a == *b;
 }
 
+/* IOPS of uncached 4 KiB random reads on the default device at rising queue depths. */
+static void terminal_blkbench(void)
+{
+    static const uint32_t depths[] = { 1, 2, 4, 8, 16, 32, 64 };
+    const uint32_t ops = 2048;
+    struct block_device *dev = block_get_default();
+    console_write("blkbench on ");
+    console_write(dev ? dev->name : "none");
+    console_write(", 4 KiB random reads\n");
+    for (uint32_t i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i) {
+        uint64_t ticks = 0;
+        if (block_bench(dev, depths[i], ops, &ticks) != 0) {
+            console_write("  benchmark failed\n");
+            return;
+        }
+        console_write("  qd=");
+        console_write_hex(depths[i]);
+        console_write(" ticks=");
+        console_write_hex(ticks);
+        console_write(" iops=");
+        console_write_hex((uint64_t)ops * TIMER_HZ / (ticks ? ticks : 1));
+        console_write("\n");
+    }
+}
+
 static void terminal_execute(const char *line)
 {
     if (!line || line[0] == '\0') {
@@ -76,7 +108,7 @@ static void terminal_execute(const char *line)
         return;
     }
     if (streq(line, "help")) {
-        console_write("Commands: help, clear, ticks, lspci, acpi, heap, logdebug, loginfo, logwarn, logerror\n");
+        console_write("Commands: help, clear, ticks, lspci, acpi, heap, locks, bcache, pcache, sync, fat, ahci, virtio, blkbench, logdebug, loginfo, logwarn, logerror\n");
         terminal_prompt();
         return;
     }
@@ -99,6 +131,7 @@ static void terminal_execute(const char *line)
     }
     if (streq(line, "acpi")) {
         acpi_dump();
+        apic_dump();
         terminal_prompt();
         return;
     }
@@ -107,6 +140,52 @@ static void terminal_execute(const char *line)
         terminal_prompt();
         return;
     }
+    if (streq(line, "locks")) {
+        lockstat_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "bcache")) {
+        block_cache_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "pcache")) {
+        page_cache_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "sync")) {
+        if (page_cache_sync() != 0) {
+            console_write("sync: page write-back failed\n");
+        }
+        (void)fat_sync(); /* fails harmlessly when no volume is mounted */
+        if (block_sync(NULL) != 0) {
+            console_write("sync: write-back failed\n");
+        }
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "fat")) {
+        fat_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "ahci")) {
+        ahci_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "virtio")) {
+        virtio_blk_dump();
+        terminal_prompt();
+        return;
+    }
+    if (streq(line, "blkbench")) {
+        terminal_blkbench();
+        terminal_prompt();
+        return;
+    }
     if (streq(line, "logdebug")) {
         log_set_level(LOG_LEVEL_DEBUG);
         console_write("Log level set to debug\n");
@@ -1,5 +1,6 @@
 #include "kernel/timer.h"
 #include "kernel/sched.h"
+#include "kernel/seqlock.h"
 
 #define MAX_TIMER_CALLBACKS 8
 
@@ -10,15 +11,19 @@ struct timer_cb {
 };
 
 static struct timer_cb callbacks[MAX_TIMER_CALLBACKS];
+/* Written only from the tick IRQ; readers go through timer_seq and never lock. */
 static uint64_t timer_ticks = 0;
+static seqlock_t timer_seq = SEQLOCK_INIT;
 
 void timer_on_tick(void)
 {
-    ++timer_ticks;
+    arch_flags_t flags = write_seqlock_irqsave(&timer_seq);
+    uint64_t now = ++timer_ticks;
+    write_sequnlock_irqrestore(&timer_seq, flags);
     sched_on_tick();
     for (int i = 0; i < MAX_TIMER_CALLBACKS; ++i) {
         if (callbacks[i].cb) {
-            callbacks[i].cb(timer_ticks, callbacks[i].user);
+            callbacks[i].cb(now, callbacks[i].user);
         }
     }
 }
@@ -40,5 +45,11 @@ int timer_register_callback(timer_callback_t cb, void *user)
 
 uint64_t timer_get_ticks(void)
 {
-    return timer_ticks;
+    uint64_t ticks;
+    uint32_t seq;
+    do {
+        seq = read_seqbegin(&timer_seq);
+        ticks = timer_ticks;
+    } while (read_seqretry(&timer_seq, seq));
+    return ticks;
 }
@@ -1,23 +1,22 @@
 #include "kernel/vfs.h"
 #include "kernel/fat.h"
 #include "kernel/fs.h"
+#include "kernel/pagecache.h"
 #include "kernel/ramfs.h"
 #include "kernel/syscall.h"
 
 #include "kernel/heap.h"
+#include "kernel/log.h"
 
 #include <stdint.h>
 
-enum vfs_backend {
-    VFS_BACKEND_MEMFS = 0,
-    VFS_BACKEND_RAMFS,
-    VFS_BACKEND_LIST,
-    VFS_BACKEND_FAT,
-    VFS_BACKEND_PIPE,
-};
-
-#define VFS_LIST_PATH_MAX 64
 #define VFS_PATH_MAX 128
+#define VFS_MOUNT_MAX 8
+#define VFS_MOUNT_PATH_MAX 32
+
+/* ops->open flags */
+#define VFS_OPEN_DIR 0x1    /* the path names a directory */
+#define VFS_OPEN_CREATE 0x2 /* create what does not exist yet */
 
 // Internal pipe definition from pipe.c
 struct pipe;
@@ -26,32 +25,70 @@ extern int64_t pipe_read_impl(struct pipe *p, void *buf, uint64_t len);
 extern int64_t pipe_write_impl(struct pipe *p, const void *buf, uint64_t len);
 extern void pipe_close_impl(struct pipe *p, int is_writer);
 
+struct vfs_inode;
+struct vfs_mount;
+
+/*
+ * One file system type. An open file keeps a pointer to its inode's ops, so
+ * read and write reach the backend without any lookup. Errors are SYSCALL_*
+ * codes, negated where the return value is otherwise a count.
+ */
+struct vfs_ops {
+    /* path is relative to the mount point, without a leading slash; "" names its root. */
+    int (*open)(const struct vfs_mount *mnt, const char *path, int flags, struct vfs_inode **out);
+    int64_t (*read)(struct vfs_file *file, void *buf, uint64_t len);
+    int64_t (*write)(struct vfs_file *file, const void *buf, uint64_t len);
+    /* Fill out from the entry at *cursor and advance it; 1 on success, 0 at the end. */
+    int (*readdir)(struct vfs_inode *dir, uint64_t *cursor, struct vfs_dirent *out);
+    int (*stat)(struct vfs_inode *ino, struct vfs_stat *out);
+    /* Optional: commit the file system's own metadata after its pages went back. */
+    int (*fsync)(struct vfs_inode *ino);
+    /* Optional: reserve space for size bytes without changing the file size. */
+    int (*fallocate)(struct vfs_inode *ino, uint64_t size);
+    /* Release priv once the last reference to the inode is gone. */
+    void (*close)(struct vfs_inode *ino);
+};
+
+/*
+ * In-memory inode. Opens that resolve to the same backend object (key)
+ * share one inode, and with it one page cache mapping.
+ */
+struct vfs_inode {
+    const struct vfs_ops *ops;
+    const void *key;              /* NULL: never shared */
+    void *priv;                   /* backend object */
+    struct page_mapping *mapping; /* file data; NULL for directories and devices */
+    uint32_t refs;
+    uint8_t is_dir;
+    uint8_t readonly;
+    struct vfs_inode *next;
+};
+
+struct vfs_mount {
+    char path[VFS_MOUNT_PATH_MAX]; /* normalized; "/" for the root */
+    uint64_t len;
+    const struct vfs_ops *ops;
+};
+
 struct vfs_file {
-    enum vfs_backend backend;
+    const struct vfs_ops *ops;
+    struct vfs_inode *inode;
     uint64_t offset;
-    const struct memfs_file *mem;
-    struct ramfs_file *ram;
-    struct fat_file *fat;
-    struct pipe *pipe; /* For pipe backend */
-    int is_pipe_writer; /* To track close */
-    char list_path[VFS_LIST_PATH_MAX];
+    struct page_cache_ra ra;
+    /* getdents position: the backend's cursor, then the mount points below. */
+    uint64_t dir_cursor;
+    uint32_t dir_mounts;    /* bit i: vfs_mounts[i] lies below this directory */
+    uint32_t dir_mount_pos; /* next mount to report once the backend is done */
+    uint32_t dir_path_len;
+    uint8_t dir_backend_done;
     int refcount;
 };
 
-static int starts_with(const char *s, const char *prefix)
-{
-    if (!s || !prefix) {
-        return 0;
-    }
-    while (*prefix) {
-        if (*s != *prefix) {
-            return 0;
-        }
-        ++s;
-        ++prefix;
-    }
-    return 1;
-}
+/* Kept longest path first, so the first match is the longest prefix. */
+static struct vfs_mount vfs_mounts[VFS_MOUNT_MAX];
+static uint64_t vfs_mount_count = 0;
+static int vfs_mounts_ready = 0;
+static struct vfs_inode *vfs_inodes = NULL;
 
 static uint64_t str_len(const char *s)
 {
@@ -62,25 +99,6 @@ static uint64_t str_len(const char *s)
     return len;
 }
 
-static int copy_trimmed(const char *src, char *dst, uint64_t dst_len)
-{
-    if (!src || !dst || dst_len == 0) {
-        return -1;
-    }
-    uint64_t len = str_len(src);
-    while (len > 0 && src[len - 1] == '/') {
-        --len;
-    }
-    if (len == 0 || len + 1 > dst_len) {
-        return -1;
-    }
-    for (uint64_t i = 0; i < len; ++i) {
-        dst[i] = src[i];
-    }
-    dst[len] = '\0';
-    return 0;
-}
-
 static int normalize_path(const char *path, char *out, uint64_t out_len, int *out_dir)
 {
     if (!path || !out || out_len < 2) {
@@ -143,19 +161,465 @@ static int normalize_path(const char *path, char *out, uint64_t out_len, int *ou
     return 0;
 }
 
-static struct vfs_file *vfs_alloc(enum vfs_backend backend)
+/* Write a, a slash unless a already ends in one, and b; b may be empty. */
+static int join_path(char *out, uint64_t out_len, const char *a, const char *b)
+{
+    uint64_t pos = 0;
+    for (uint64_t i = 0; a[i]; ++i) {
+        if (pos + 1 >= out_len) {
+            return -1;
+        }
+        out[pos++] = a[i];
+    }
+    if (*b && (pos == 0 || out[pos - 1] != '/')) {
+        if (pos + 1 >= out_len) {
+            return -1;
+        }
+        out[pos++] = '/';
+    }
+    for (uint64_t i = 0; b[i]; ++i) {
+        if (pos + 1 >= out_len) {
+            return -1;
+        }
+        out[pos++] = b[i];
+    }
+    out[pos] = '\0';
+    return 0;
+}
+
+static void copy_name(char *dst, const char *src)
+{
+    uint64_t i = 0;
+    for (; src[i] && i < VFS_NAME_MAX; ++i) {
+        dst[i] = src[i];
+    }
+    dst[i] = '\0';
+}
+
+static int vfs_mount(const char *path, const struct vfs_ops *ops)
+{
+    uint64_t len = str_len(path);
+    if (vfs_mount_count >= VFS_MOUNT_MAX || len == 0 || len >= VFS_MOUNT_PATH_MAX || path[0] != '/') {
+        return -1;
+    }
+    uint64_t at = 0;
+    while (at < vfs_mount_count && vfs_mounts[at].len >= len) {
+        ++at;
+    }
+    for (uint64_t i = vfs_mount_count; i > at; --i) {
+        vfs_mounts[i] = vfs_mounts[i - 1];
+    }
+    for (uint64_t i = 0; i <= len; ++i) {
+        vfs_mounts[at].path[i] = path[i];
+    }
+    vfs_mounts[at].len = len;
+    vfs_mounts[at].ops = ops;
+    vfs_mount_count++;
+    return 0;
+}
+
+/* Longest mount covering the normalized path; *rel gets the rest without its slash. */
+static const struct vfs_mount *vfs_find_mount(const char *path, const char **rel)
+{
+    for (uint64_t i = 0; i < vfs_mount_count; ++i) {
+        const struct vfs_mount *mnt = &vfs_mounts[i];
+        if (mnt->len == 1) {
+            *rel = path + 1;
+            return mnt;
+        }
+        uint64_t j = 0;
+        while (j < mnt->len && path[j] == mnt->path[j]) {
+            ++j;
+        }
+        if (j == mnt->len && (path[j] == '/' || path[j] == '\0')) {
+            *rel = path[j] == '/' ? path + j + 1 : path + j;
+            return mnt;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Return the inode for key, or make one around priv. *fresh tells the
+ * caller whether priv was taken; if not, the caller releases it.
+ */
+static struct vfs_inode *vfs_inode_get(const struct vfs_ops *ops, const void *key, void *priv, int is_dir,
+                                       int *fresh)
+{
+    *fresh = 0;
+    if (key) {
+        for (struct vfs_inode *ino = vfs_inodes; ino; ino = ino->next) {
+            if (ino->ops == ops && ino->key == key) {
+                ino->refs++;
+                return ino;
+            }
+        }
+    }
+    struct vfs_inode *ino = (struct vfs_inode *)kalloc_zero(sizeof(*ino), 16);
+    if (!ino) {
+        return NULL;
+    }
+    ino->ops = ops;
+    ino->key = key;
+    ino->priv = priv;
+    ino->is_dir = is_dir ? 1 : 0;
+    ino->refs = 1;
+    if (key) {
+        ino->next = vfs_inodes;
+        vfs_inodes = ino;
+    }
+    *fresh = 1;
+    return ino;
+}
+
+static void vfs_inode_put(struct vfs_inode *ino)
+{
+    if (!ino || --ino->refs > 0) {
+        return;
+    }
+    if (ino->key) {
+        struct vfs_inode **link = &vfs_inodes;
+        while (*link && *link != ino) {
+            link = &(*link)->next;
+        }
+        if (*link) {
+            *link = ino->next;
+        }
+    }
+    /* Dirty pages go back to the backend before it lets go of the host. */
+    if (ino->mapping && page_cache_put(ino->mapping) != 0) {
+        log_warn("vfs: writeback failed at last close, dirty pages lost");
+    }
+    if (ino->ops->close) {
+        ino->ops->close(ino);
+    }
+    kfree(ino);
+}
+
+/* Give a new inode its page cache mapping; on failure the inode is dropped. */
+static int vfs_inode_map(struct vfs_inode *ino, const struct page_cache_ops *page_ops, void *host, uint64_t size,
+                         struct vfs_inode **out)
+{
+    ino->mapping = page_cache_get(host, page_ops, size);
+    if (!ino->mapping) {
+        vfs_inode_put(ino);
+        return SYSCALL_ENOMEM;
+    }
+    *out = ino;
+    return SYSCALL_OK;
+}
+
+/* read and write for file systems whose data lives in the page cache. */
+static int64_t vfs_page_read(struct vfs_file *file, void *buf, uint64_t len)
+{
+    struct vfs_inode *ino = file->inode;
+    if (!ino->mapping) {
+        return 0;
+    }
+    int64_t read = page_cache_read(ino->mapping, &file->ra, &file->offset, buf, len);
+    if (read < 0) {
+        return -SYSCALL_EIO;
+    }
+    return read;
+}
+
+static int64_t vfs_page_write(struct vfs_file *file, const void *buf, uint64_t len)
+{
+    struct vfs_inode *ino = file->inode;
+    if (!ino->mapping || ino->readonly) {
+        return -SYSCALL_EIO;
+    }
+    int64_t wrote = page_cache_write(ino->mapping, &file->offset, buf, len);
+    if (wrote < 0) {
+        return -SYSCALL_EIO;
+    }
+    return wrote;
+}
+
+static int vfs_generic_stat(struct vfs_inode *ino, struct vfs_stat *out)
+{
+    out->size = ino->mapping ? page_cache_size(ino->mapping) : 0;
+    out->is_dir = ino->is_dir;
+    return SYSCALL_OK;
+}
+
+/* memfs: the read-only images built into the kernel, mounted on /bin. */
+static const struct vfs_ops memfs_vfs_ops;
+
+static int memfs_vfs_open(const struct vfs_mount *mnt, const char *path, int flags, struct vfs_inode **out)
+{
+    (void)flags;
+    const struct memfs_file *mem = NULL;
+    if (*path) {
+        char full[VFS_PATH_MAX];
+        if (join_path(full, sizeof(full), mnt->path, path) != 0) {
+            return SYSCALL_EINVAL;
+        }
+        mem = memfs_lookup(full);
+        if (!mem) {
+            return SYSCALL_ENOENT;
+        }
+    }
+    int fresh = 0;
+    struct vfs_inode *ino = vfs_inode_get(&memfs_vfs_ops, mem, (void *)mem, mem == NULL, &fresh);
+    if (!ino) {
+        return SYSCALL_ENOMEM;
+    }
+    ino->readonly = 1;
+    if (!mem || !fresh) {
+        *out = ino;
+        return SYSCALL_OK;
+    }
+    return vfs_inode_map(ino, &memfs_page_ops, (void *)mem, mem->size, out);
+}
+
+static int memfs_vfs_readdir(struct vfs_inode *dir, uint64_t *cursor, struct vfs_dirent *out)
+{
+    (void)dir;
+    const struct memfs_file *mem = memfs_next(cursor);
+    if (!mem) {
+        return 0;
+    }
+    const char *name = mem->path;
+    for (const char *p = mem->path; *p; ++p) {
+        if (*p == '/') {
+            name = p + 1;
+        }
+    }
+    copy_name(out->name, name);
+    out->type = VFS_DIRENT_FILE;
+    out->size = mem->size;
+    return 1;
+}
+
+static const struct vfs_ops memfs_vfs_ops = {
+    .open = memfs_vfs_open,
+    .read = vfs_page_read,
+    .write = vfs_page_write,
+    .readdir = memfs_vfs_readdir,
+    .stat = vfs_generic_stat,
+};
+
+/* ramfs: flat in-memory files, mounted on / to catch every other path. */
+static const struct vfs_ops ramfs_vfs_ops;
+
+static int ramfs_vfs_open(const struct vfs_mount *mnt, const char *path, int flags, struct vfs_inode **out)
+{
+    int fresh = 0;
+    struct vfs_inode *ino = NULL;
+    if (*path == '\0') {
+        ino = vfs_inode_get(&ramfs_vfs_ops, NULL, NULL, 1, &fresh);
+        if (!ino) {
+            return SYSCALL_ENOMEM;
+        }
+        *out = ino;
+        return SYSCALL_OK;
+    }
+    if (flags & VFS_OPEN_DIR) {
+        return SYSCALL_ENOENT; /* no subdirectories */
+    }
+    char full[VFS_PATH_MAX];
+    if (join_path(full, sizeof(full), mnt->path, path) != 0) {
+        return SYSCALL_EINVAL;
+    }
+    struct ramfs_file *ram = NULL;
+    if (ramfs_open(full, &ram) != 0) {
+        return SYSCALL_ENOMEM;
+    }
+    ino = vfs_inode_get(&ramfs_vfs_ops, ram, ram, 0, &fresh);
+    if (!ino) {
+        return SYSCALL_ENOMEM;
+    }
+    if (!fresh) {
+        *out = ino;
+        return SYSCALL_OK;
+    }
+    return vfs_inode_map(ino, &ramfs_page_ops, ram, ramfs_size(ram), out);
+}
+
+static int ramfs_vfs_readdir(struct vfs_inode *dir, uint64_t *cursor, struct vfs_dirent *out)
+{
+    (void)dir;
+    struct ramfs_file *ram;
+    while ((ram = ramfs_next(cursor)) != NULL) {
+        const char *name = ramfs_path(ram) + 1;
+        int nested = 0;
+        for (const char *p = name; *p; ++p) {
+            if (*p == '/') {
+                nested = 1;
+            }
+        }
+        if (nested || *name == '\0') {
+            continue;
+        }
+        copy_name(out->name, name);
+        out->type = VFS_DIRENT_FILE;
+        out->size = ramfs_size(ram);
+        return 1;
+    }
+    return 0;
+}
+
+static const struct vfs_ops ramfs_vfs_ops = {
+    .open = ramfs_vfs_open,
+    .read = vfs_page_read,
+    .write = vfs_page_write,
+    .readdir = ramfs_vfs_readdir,
+    .stat = vfs_generic_stat,
+};
+
+/* FAT volume on /disk. Opening a missing file creates it; a trailing slash makes a directory. */
+static const struct vfs_ops fat_vfs_ops;
+
+static int fat_vfs_open(const struct vfs_mount *mnt, const char *path, int flags, struct vfs_inode **out)
+{
+    (void)mnt;
+    struct fat_file *fat_file = (struct fat_file *)kalloc_zero(sizeof(*fat_file), 16);
+    if (!fat_file) {
+        return SYSCALL_ENOMEM;
+    }
+    if (*path == '\0' || (flags & VFS_OPEN_DIR)) {
+        if (*path && (flags & VFS_OPEN_CREATE) && fat_mkdir(path) != 0) {
+            kfree(fat_file);
+            return SYSCALL_ENOENT;
+        }
+        if (fat_open_dir(path, fat_file) != 0) {
+            kfree(fat_file);
+            return SYSCALL_ENOENT;
+        }
+    } else if (fat_open(path, fat_file) != 0) {
+        if (!(flags & VFS_OPEN_CREATE) || fat_create(path, fat_file) != 0) {
+            kfree(fat_file);
+            return SYSCALL_ENOENT;
+        }
+    }
+    int fresh = 0;
+    struct vfs_inode *ino = vfs_inode_get(&fat_vfs_ops, fat_file->inode, fat_file, fat_file->is_dir, &fresh);
+    if (!ino || !fresh) {
+        fat_close(fat_file);
+        kfree(fat_file);
+        if (!ino) {
+            return SYSCALL_ENOMEM;
+        }
+        *out = ino;
+        return SYSCALL_OK;
+    }
+    ino->readonly = (fat_file->attr & 0x01) ? 1 : 0;
+    if (fat_file->is_dir) {
+        *out = ino;
+        return SYSCALL_OK;
+    }
+    return vfs_inode_map(ino, &fat_page_ops, fat_file->inode, fat_file->size, out);
+}
+
+static int fat_vfs_readdir(struct vfs_inode *dir, uint64_t *cursor, struct vfs_dirent *out)
+{
+    uint32_t size = 0;
+    uint8_t is_dir = 0;
+    int rc = fat_readdir((struct fat_file *)dir->priv, cursor, out->name, sizeof(out->name), &is_dir, &size);
+    if (rc < 0) {
+        return -SYSCALL_EIO;
+    }
+    out->type = is_dir ? VFS_DIRENT_DIR : VFS_DIRENT_FILE;
+    out->size = size;
+    return rc;
+}
+
+static int fat_vfs_fsync(struct vfs_inode *ino)
+{
+    (void)ino;
+    return fat_sync() == 0 ? SYSCALL_OK : SYSCALL_EIO;
+}
+
+static int fat_vfs_fallocate(struct vfs_inode *ino, uint64_t size)
+{
+    return fat_fallocate((struct fat_file *)ino->priv, size) == 0 ? SYSCALL_OK : SYSCALL_EIO;
+}
+
+static void fat_vfs_close(struct vfs_inode *ino)
+{
+    fat_close((struct fat_file *)ino->priv);
+    kfree(ino->priv);
+}
+
+static const struct vfs_ops fat_vfs_ops = {
+    .open = fat_vfs_open,
+    .read = vfs_page_read,
+    .write = vfs_page_write,
+    .readdir = fat_vfs_readdir,
+    .stat = vfs_generic_stat,
+    .fsync = fat_vfs_fsync,
+    .fallocate = fat_vfs_fallocate,
+    .close = fat_vfs_close,
+};
+
+/* A directory that exists only because something is mounted below it. */
+static int bare_dir_readdir(struct vfs_inode *dir, uint64_t *cursor, struct vfs_dirent *out)
+{
+    (void)dir;
+    (void)cursor;
+    (void)out;
+    return 0;
+}
+
+static const struct vfs_ops bare_dir_ops = {
+    .readdir = bare_dir_readdir,
+    .stat = vfs_generic_stat,
+};
+
+/* Pipes are not mounted anywhere; each end gets its own inode around the shared pipe. */
+static int64_t pipe_vfs_read(struct vfs_file *file, void *buf, uint64_t len)
+{
+    return pipe_read_impl((struct pipe *)file->inode->priv, buf, len);
+}
+
+static int64_t pipe_vfs_write(struct vfs_file *file, const void *buf, uint64_t len)
+{
+    return pipe_write_impl((struct pipe *)file->inode->priv, buf, len);
+}
+
+static void pipe_vfs_close_reader(struct vfs_inode *ino)
+{
+    pipe_close_impl((struct pipe *)ino->priv, 0);
+}
+
+static void pipe_vfs_close_writer(struct vfs_inode *ino)
+{
+    pipe_close_impl((struct pipe *)ino->priv, 1);
+}
+
+static const struct vfs_ops pipe_reader_ops = {
+    .read = pipe_vfs_read,
+    .stat = vfs_generic_stat,
+    .close = pipe_vfs_close_reader,
+};
+
+static const struct vfs_ops pipe_writer_ops = {
+    .write = pipe_vfs_write,
+    .stat = vfs_generic_stat,
+    .close = pipe_vfs_close_writer,
+};
+
+static void vfs_mount_defaults(void)
+{
+    if (vfs_mounts_ready) {
+        return;
+    }
+    vfs_mounts_ready = 1;
+    (void)vfs_mount("/", &ramfs_vfs_ops);
+    (void)vfs_mount("/bin", &memfs_vfs_ops);
+    (void)vfs_mount("/disk", &fat_vfs_ops);
+}
+
+static struct vfs_file *vfs_alloc(struct vfs_inode *ino)
 {
     struct vfs_file *file = (struct vfs_file *)kalloc_zero(sizeof(*file), 16);
     if (!file) {
         return NULL;
     }
-    file->backend = backend;
+    file->ops = ino->ops;
+    file->inode = ino;
     file->offset = 0;
-    file->mem = NULL;
-    file->ram = NULL;
-    file->fat = NULL;
-    file->list_path[0] = '\0';
-    file->list_path[0] = '\0';
     file->refcount = 1;
     return file;
 }
@@ -167,29 +631,90 @@ int pipe_create(struct vfs_file **reader, struct vfs_file **writer)
     struct pipe *p = pipe_alloc_struct();
     if (!p) return SYSCALL_ENOMEM;
     
-    struct vfs_file *r = vfs_alloc(VFS_BACKEND_PIPE);
-    struct vfs_file *w = vfs_alloc(VFS_BACKEND_PIPE);
+    int fresh = 0;
+    struct vfs_inode *ri = vfs_inode_get(&pipe_reader_ops, NULL, p, 0, &fresh);
+    struct vfs_inode *wi = vfs_inode_get(&pipe_writer_ops, NULL, p, 0, &fresh);
+    struct vfs_file *r = ri ? vfs_alloc(ri) : NULL;
+    struct vfs_file *w = wi ? vfs_alloc(wi) : NULL;
     
     if (!r || !w) {
         /* cleanup */
         if (r) kfree(r);
         if (w) kfree(w);
+        if (ri) kfree(ri);
+        if (wi) kfree(wi);
         kfree(p); /* assumes pipe_alloc returns fresh alloc with no refs */
         return SYSCALL_ENOMEM;
     }
     
-    r->pipe = p;
-    r->is_pipe_writer = 0;
-    
-    w->pipe = p;
-    w->is_pipe_writer = 1;
-    
     *reader = r;
     *writer = w;
     return 0;
 }
 
-int vfs_open(const char *path, struct vfs_file **out)
+/* Bitmask of the mounts strictly below the normalized path. */
+static uint32_t vfs_mounts_below(const char *path)
+{
+    uint64_t len = str_len(path);
+    uint32_t mask = 0;
+    for (uint64_t i = 0; i < vfs_mount_count; ++i) {
+        const struct vfs_mount *mnt = &vfs_mounts[i];
+        if (mnt->len <= len || (len > 1 && mnt->path[len] != '/')) {
+            continue;
+        }
+        uint64_t j = 0;
+        while (j < len && mnt->path[j] == path[j]) {
+            ++j;
+        }
+        if (j == len) {
+            mask |= 1u << i;
+        }
+    }
+    return mask;
+}
+
+/*
+ * Name the component of mount i right below a directory whose path is
+ * dir_len long, e.g. "dev" for /dev/pts under "/". Returns 0 if a mount
+ * in earlier already produced the same name.
+ */
+static int vfs_mount_child(uint32_t i, uint32_t dir_len, uint32_t earlier, struct vfs_dirent *out)
+{
+    const char *path = vfs_mounts[i].path;
+    uint64_t start = dir_len > 1 ? dir_len + 1 : 1;
+    uint64_t end = start;
+    while (path[end] && path[end] != '/') {
+        ++end;
+    }
+    for (uint32_t j = 0; j < i; ++j) {
+        const char *other = vfs_mounts[j].path;
+        if (!(earlier & (1u << j))) {
+            continue;
+        }
+        uint64_t k = start;
+        while (k < end && other[k] == path[k]) {
+            ++k;
+        }
+        if (k == end && (other[k] == '/' || other[k] == '\0')) {
+            return 0;
+        }
+    }
+    uint64_t n = 0;
+    for (uint64_t k = start; k < end && n < VFS_NAME_MAX; ++k) {
+        out->name[n++] = path[k];
+    }
+    out->name[n] = '\0';
+    out->type = VFS_DIRENT_DIR;
+    out->size = 0;
+    return 1;
+}
+
+/*
+ * Without dir_only, missing files are created (and a trailing slash makes
+ * a directory), as open has always done; with it, only an existing
+ * directory opens.
+ */
+static int vfs_open_path(const char *path, int dir_only, struct vfs_file **out)
 {
     if (!path || !out) {
         return SYSCALL_EINVAL;
@@ -197,97 +722,57 @@ int vfs_open(const char *path, struct vfs_file **out)
     if (path[0] != '/') {
         return SYSCALL_EINVAL;
     }
+    vfs_mount_defaults();
 
     char norm_path[VFS_PATH_MAX];
     int want_dir = 0;
-    const char *use_path = path;
-
-    if (starts_with(path, "/dev/ls")) {
-        const char *suffix = path + 7;
-        if (*suffix && *suffix != '/') {
-            return SYSCALL_EINVAL;
-        }
-        struct vfs_file *file = vfs_alloc(VFS_BACKEND_LIST);
-        if (!file) {
-            return SYSCALL_ENOMEM;
-        }
-        if (*suffix == '/' && suffix[1] != '\0') {
-            if (normalize_path(suffix, file->list_path, sizeof(file->list_path), NULL) != 0) {
-                vfs_close(file);
-                return SYSCALL_EINVAL;
-            }
-        }
-        *out = file;
-        return SYSCALL_OK;
-    }
-
     if (normalize_path(path, norm_path, sizeof(norm_path), &want_dir) != 0) {
         return SYSCALL_EINVAL;
     }
-    use_path = norm_path;
-
-    const struct memfs_file *mem = memfs_lookup(use_path);
-    if (mem) {
-        struct vfs_file *file = vfs_alloc(VFS_BACKEND_MEMFS);
-        if (!file) {
-            return SYSCALL_ENOMEM;
-        }
-        file->mem = mem;
-        *out = file;
-        return SYSCALL_OK;
+    const char *rel = NULL;
+    const struct vfs_mount *mnt = vfs_find_mount(norm_path, &rel);
+    if (!mnt) {
+        return SYSCALL_ENOENT;
     }
-
-    if (starts_with(use_path, "/disk/")) {
-        const char *fat_path = use_path + 6;
-        struct fat_file *fat_file = (struct fat_file *)kalloc_zero(sizeof(*fat_file), 16);
-        if (!fat_file) {
-            return SYSCALL_ENOMEM;
-        }
-        if (want_dir) {
-            char trimmed[VFS_LIST_PATH_MAX];
-            if (copy_trimmed(fat_path, trimmed, sizeof(trimmed)) != 0) {
-                kfree(fat_file);
-                return SYSCALL_EINVAL;
-            }
-            if (fat_mkdir(trimmed) != 0 || fat_open_dir(trimmed, fat_file) != 0) {
-                kfree(fat_file);
-                return SYSCALL_ENOENT;
-            }
-        } else {
-            if (fat_open(fat_path, fat_file) != 0) {
-                if (fat_create(fat_path, fat_file) != 0) {
-                    kfree(fat_file);
-                    return SYSCALL_ENOENT;
-                }
-            }
-        }
-        struct vfs_file *file = vfs_alloc(VFS_BACKEND_FAT);
-        if (!file) {
-            kfree(fat_file);
-            return SYSCALL_ENOMEM;
-        }
-        file->fat = fat_file;
-        *out = file;
-        return SYSCALL_OK;
+    int flags = dir_only ? VFS_OPEN_DIR : VFS_OPEN_CREATE | (want_dir ? VFS_OPEN_DIR : 0);
+    uint32_t below = vfs_mounts_below(norm_path);
+    struct vfs_inode *ino = NULL;
+    int err = mnt->ops->open(mnt, rel, flags, &ino);
+    if (err == SYSCALL_ENOENT && (flags & VFS_OPEN_DIR) && below) {
+        int fresh = 0;
+        ino = vfs_inode_get(&bare_dir_ops, NULL, NULL, 1, &fresh);
+        err = ino ? SYSCALL_OK : SYSCALL_ENOMEM;
     }
-
-    if (starts_with(use_path, "/bin")) {
-        return SYSCALL_ENOENT;
+    if (err != SYSCALL_OK) {
+        return err;
     }
-
-    struct ramfs_file *ram = NULL;
-    if (ramfs_open(use_path, &ram) != 0) {
-        return SYSCALL_ENOMEM;
+    if (dir_only && !ino->is_dir) {
+        vfs_inode_put(ino);
+        return SYSCALL_EINVAL;
     }
-    struct vfs_file *file = vfs_alloc(VFS_BACKEND_RAMFS);
+    struct vfs_file *file = vfs_alloc(ino);
     if (!file) {
+        vfs_inode_put(ino);
         return SYSCALL_ENOMEM;
     }
-    file->ram = ram;
+    if (ino->is_dir) {
+        file->dir_mounts = below;
+        file->dir_path_len = (uint32_t)str_len(norm_path);
+    }
     *out = file;
     return SYSCALL_OK;
 }
 
+int vfs_open(const char *path, struct vfs_file **out)
+{
+    return vfs_open_path(path, 0, out);
+}
+
+int vfs_opendir(const char *path, struct vfs_file **out)
+{
+    return vfs_open_path(path, 1, out);
+}
+
 int64_t vfs_read(struct vfs_file *file, void *buf, uint64_t len)
 {
     if (!file || !buf) {
@@ -296,53 +781,10 @@ int64_t vfs_read(struct vfs_file *file, void *buf, uint64_t len)
     if (len == 0) {
         return 0;
     }
-    if (file->backend == VFS_BACKEND_MEMFS) {
-        uint64_t read = memfs_read(file->mem, file->offset, buf, len);
-        file->offset += read;
-        return (int64_t)read;
-    }
-    if (file->backend == VFS_BACKEND_RAMFS) {
-        return ramfs_read(file->ram, &file->offset, buf, len);
-    }
-    if (file->backend == VFS_BACKEND_LIST) {
-        char listing[4096];
-        uint64_t total = 0;
-        if (file->list_path[0] != '\0' && starts_with(file->list_path, "/disk")) {
-            const char *fat_path = file->list_path + 5;
-            if (*fat_path == '/') {
-                fat_path++;
-            }
-            total += fat_list_dir(fat_path, listing + total, sizeof(listing) - total);
-        } else {
-            total += memfs_list(listing + total, sizeof(listing) - total);
-            // total += ramfs_list(listing + total, sizeof(listing) - total);
-            // total += fat_list(listing + total, sizeof(listing) - total);
-        }
-        if (file->offset >= total) {
-            return 0;
-        }
-        uint64_t remaining = total - file->offset;
-        if (len > remaining) {
-            len = remaining;
-        }
-        uint8_t *dst = (uint8_t *)buf;
-        for (uint64_t i = 0; i < len; ++i) {
-            dst[i] = (uint8_t)listing[file->offset + i];
-        }
-        file->offset += len;
-        return (int64_t)len;
-    }
-    if (file->backend == VFS_BACKEND_FAT) {
-        int64_t read = fat_read(file->fat, &file->offset, buf, len);
-        if (read < 0) {
-            return -SYSCALL_EIO;
-        }
-        return read;
-    }
-    if (file->backend == VFS_BACKEND_PIPE) {
-        return pipe_read_impl(file->pipe, buf, len);
+    if (!file->ops->read) {
+        return -SYSCALL_EBADF;
     }
-    return -SYSCALL_EBADF;
+    return file->ops->read(file, buf, len);
 }
 
 int64_t vfs_write(struct vfs_file *file, const void *buf, uint64_t len)
@@ -353,23 +795,81 @@ int64_t vfs_write(struct vfs_file *file, const void *buf, uint64_t len)
     if (len == 0) {
         return 0;
     }
-    if (file->backend == VFS_BACKEND_MEMFS) {
+    if (!file->ops->write) {
+        return -SYSCALL_EBADF;
+    }
+    return file->ops->write(file, buf, len);
+}
+
+int64_t vfs_fsync(struct vfs_file *file)
+{
+    if (!file) {
+        return -SYSCALL_EINVAL;
+    }
+    if (file->inode->mapping && page_cache_flush(file->inode->mapping) != 0) {
         return -SYSCALL_EIO;
     }
-    if (file->backend == VFS_BACKEND_RAMFS) {
-        return ramfs_write(file->ram, &file->offset, buf, len);
+    if (file->ops->fsync) {
+        return -(int64_t)file->ops->fsync(file->inode);
+    }
+    return 0;
+}
+
+int64_t vfs_fallocate(struct vfs_file *file, uint64_t size)
+{
+    if (!file || !file->inode || file->inode->is_dir || file->inode->readonly) {
+        return -SYSCALL_EINVAL;
+    }
+    if (!file->ops->fallocate) {
+        return 0; /* nothing to reserve ahead of time; writes allocate as they go */
+    }
+    return -(int64_t)file->ops->fallocate(file->inode, size);
+}
+
+int64_t vfs_getdents(struct vfs_file *file, struct vfs_dirent *out, uint64_t count)
+{
+    if (!file || !out) {
+        return -SYSCALL_EINVAL;
+    }
+    if (!file->inode || !file->inode->is_dir) {
+        return -SYSCALL_EINVAL;
+    }
+    uint64_t n = 0;
+    struct vfs_dirent ent;
+    while (n < count && !file->dir_backend_done) {
+        int rc = file->ops->readdir ? file->ops->readdir(file->inode, &file->dir_cursor, &ent) : 0;
+        if (rc < 0) {
+            return n ? (int64_t)n : rc;
+        }
+        if (rc == 0) {
+            file->dir_backend_done = 1;
+            break;
+        }
+        ent.name_len = (uint32_t)str_len(ent.name);
+        out[n++] = ent;
     }
-    if (file->backend == VFS_BACKEND_FAT) {
-        int64_t wrote = fat_write(file->fat, &file->offset, buf, len);
-        if (wrote < 0) {
-            return -SYSCALL_EIO;
+    while (n < count && file->dir_mount_pos < vfs_mount_count) {
+        uint32_t i = file->dir_mount_pos++;
+        if (!(file->dir_mounts & (1u << i))) {
+            continue;
+        }
+        if (vfs_mount_child(i, file->dir_path_len, file->dir_mounts, &ent)) {
+            ent.name_len = (uint32_t)str_len(ent.name);
+            out[n++] = ent;
         }
-        return wrote;
     }
-    if (file->backend == VFS_BACKEND_PIPE) {
-        return pipe_write_impl(file->pipe, buf, len);
+    return (int64_t)n;
+}
+
+int64_t vfs_stat(struct vfs_file *file, struct vfs_stat *out)
+{
+    if (!file || !out) {
+        return -SYSCALL_EINVAL;
+    }
+    if (!file->ops->stat) {
+        return -SYSCALL_EBADF;
     }
-    return -SYSCALL_EBADF;
+    return -(int64_t)file->ops->stat(file->inode, out);
 }
 
 void vfs_close(struct vfs_file *file)
@@ -381,12 +881,7 @@ void vfs_close(struct vfs_file *file)
         file->refcount--;
         return;
     }
-    if (file->backend == VFS_BACKEND_FAT && file->fat) {
-        kfree(file->fat);
-    }
-    if (file->backend == VFS_BACKEND_PIPE && file->pipe) {
-        pipe_close_impl(file->pipe, file->is_pipe_writer);
-    }
+    vfs_inode_put(file->inode);
     kfree(file);
 }
 
@@ -0,0 +1,906 @@
+#include "drivers/virtio.h"
+#include "kernel/acpi.h"
+#include "kernel/apic.h"
+#include "kernel/block.h"
+#include "kernel/console.h"
+#include "kernel/heap.h"
+#include "kernel/io.h"
+#include "kernel/irq.h"
+#include "kernel/log.h"
+#include "kernel/mem.h"
+#include "kernel/mmu.h"
+#include "kernel/pci.h"
+#include "kernel/spinlock.h"
+#include <arch/processor.h>
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define VIRTIO_BLK_MAX_DEVICES 4
+#define VIRTIO_BLK_MAX_QUEUE 256
+/* Hardware queues per disk with VIRTIO_BLK_F_MQ; each gets its own MSI-X vector. */
+#define VIRTIO_BLK_MAX_VQS 8
+/* Requests in flight per queue; each owns a slot with its header, status and indirect table. */
+#define VIRTIO_BLK_SLOTS 64
+#define VIRTIO_BLK_INDIRECT 126
+/* Header and status take two descriptors, the rest carry data. */
+#define VIRTIO_BLK_MAX_SEGS (VIRTIO_BLK_INDIRECT - 2)
+#define VIRTIO_BLK_POLL_TIMEOUT 100000000
+
+/* Two slots per page: hdr at 0, status at 16, indirect table at 32. */
+struct virtio_blk_slot {
+    struct virtio_blk_req_header hdr;
+    volatile uint8_t status;
+    uint8_t reserved[15];
+    struct virtq_desc table[VIRTIO_BLK_INDIRECT];
+};
+
+_Static_assert(sizeof(struct virtio_blk_slot) == 2048, "virtio-blk slot must be half a page");
+
+struct virtio_blk;
+
+struct virtio_vq {
+    struct virtio_blk *owner;
+    uint16_t index;
+    uint16_t size;
+    struct virtq_desc *desc;
+    struct virtq_avail *avail;
+    struct virtq_used *used;
+    uint64_t ring_phys;
+    uint64_t ring_pages;
+    uint16_t free_head;
+    uint16_t num_free;
+    uint16_t last_used;
+    uint16_t notify_off;
+    uint64_t slot_free; /* bitmap of idle slots */
+    struct virtio_blk_slot *slots;
+    uint64_t slots_phys;
+    uint64_t slot_pages;
+    uint8_t *head_slot; /* ring head descriptor -> slot */
+    struct block_request *slot_rq[VIRTIO_BLK_SLOTS];
+    int vector;
+    uint64_t requests;
+    uint64_t notifies;
+    uint64_t notifies_suppressed;
+    spinlock_t lock;
+};
+
+struct virtio_blk {
+    struct block_device dev; /* first: block callbacks cast back to the disk */
+    struct pci_device *pci;
+    int modern;
+    uint16_t io_base;
+    volatile uint8_t *common;
+    volatile uint8_t *isr;
+    volatile uint8_t *devcfg;
+    volatile uint8_t *notify_base;
+    uint32_t notify_mult;
+    void *bars[PCI_MAX_BARS];
+    uint64_t features;
+    uint32_t size_max;
+    int msix;
+    int irq_mode;
+    struct virtio_vq *vqs;
+    uint16_t nvqs;
+    char name[8];
+};
+
+static struct virtio_blk *vblk_devices[VIRTIO_BLK_MAX_DEVICES];
+static int vblk_count;
+
+static inline int vblk_has(const struct virtio_blk *vb, uint32_t bit)
+{
+    return (vb->features >> bit) & 1;
+}
+
+static inline uint8_t mmio_read8(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint8_t *)(base + off);
+}
+
+static inline uint16_t mmio_read16(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint16_t *)(base + off);
+}
+
+static inline uint32_t mmio_read32(volatile uint8_t *base, uint32_t off)
+{
+    return *(volatile uint32_t *)(base + off);
+}
+
+static inline void mmio_write8(volatile uint8_t *base, uint32_t off, uint8_t v)
+{
+    *(volatile uint8_t *)(base + off) = v;
+}
+
+static inline void mmio_write16(volatile uint8_t *base, uint32_t off, uint16_t v)
+{
+    *(volatile uint16_t *)(base + off) = v;
+}
+
+static inline void mmio_write32(volatile uint8_t *base, uint32_t off, uint32_t v)
+{
+    *(volatile uint32_t *)(base + off) = v;
+}
+
+/* ---- transport: the legacy I/O block and the modern capabilities behind one interface ---- */
+
+static uint8_t vp_get_status(struct virtio_blk *vb)
+{
+    return vb->modern ? mmio_read8(vb->common, VIRTIO_COMMON_STATUS)
+                      : inb((uint16_t)(vb->io_base + VIRTIO_PCI_STATUS));
+}
+
+static void vp_set_status(struct virtio_blk *vb, uint8_t status)
+{
+    if (vb->modern) {
+        mmio_write8(vb->common, VIRTIO_COMMON_STATUS, status);
+    } else {
+        outb((uint16_t)(vb->io_base + VIRTIO_PCI_STATUS), status);
+    }
+}
+
+static void vp_reset(struct virtio_blk *vb)
+{
+    vp_set_status(vb, 0);
+    /* Modern devices finish the reset when status reads back as zero. */
+    for (uint32_t i = 0; i < 1000000 && vp_get_status(vb) != 0; ++i) {
+        arch_cpu_relax();
+    }
+}
+
+static uint64_t vp_get_features(struct virtio_blk *vb)
+{
+    if (!vb->modern) {
+        return inl((uint16_t)(vb->io_base + VIRTIO_PCI_HOST_FEATURES));
+    }
+    mmio_write32(vb->common, VIRTIO_COMMON_DFSELECT, 0);
+    uint64_t lo = mmio_read32(vb->common, VIRTIO_COMMON_DF);
+    mmio_write32(vb->common, VIRTIO_COMMON_DFSELECT, 1);
+    uint64_t hi = mmio_read32(vb->common, VIRTIO_COMMON_DF);
+    return lo | (hi << 32);
+}
+
+static void vp_set_features(struct virtio_blk *vb, uint64_t features)
+{
+    if (!vb->modern) {
+        outl((uint16_t)(vb->io_base + VIRTIO_PCI_GUEST_FEATURES), (uint32_t)features);
+        return;
+    }
+    mmio_write32(vb->common, VIRTIO_COMMON_GFSELECT, 0);
+    mmio_write32(vb->common, VIRTIO_COMMON_GF, (uint32_t)features);
+    mmio_write32(vb->common, VIRTIO_COMMON_GFSELECT, 1);
+    mmio_write32(vb->common, VIRTIO_COMMON_GF, (uint32_t)(features >> 32));
+}
+
+static uint32_t vp_config_read32(struct virtio_blk *vb, uint32_t off)
+{
+    if (vb->modern) {
+        return mmio_read32(vb->devcfg, off);
+    }
+    uint16_t base = (uint16_t)(vb->io_base + (vb->msix ? VIRTIO_PCI_CONFIG_MSIX : VIRTIO_PCI_CONFIG));
+    return inl((uint16_t)(base + off));
+}
+
+static uint16_t vp_config_read16(struct virtio_blk *vb, uint32_t off)
+{
+    if (vb->modern) {
+        return mmio_read16(vb->devcfg, off);
+    }
+    uint16_t base = (uint16_t)(vb->io_base + (vb->msix ? VIRTIO_PCI_CONFIG_MSIX : VIRTIO_PCI_CONFIG));
+    return inw((uint16_t)(base + off));
+}
+
+static uint64_t vp_config_read64(struct virtio_blk *vb, uint32_t off)
+{
+    /* A 64-bit field is two reads; retry if the device changed it in between. */
+    for (;;) {
+        uint8_t gen = vb->modern ? mmio_read8(vb->common, VIRTIO_COMMON_CFGGENERATION) : 0;
+        uint64_t v = vp_config_read32(vb, off) | ((uint64_t)vp_config_read32(vb, off + 4) << 32);
+        if (!vb->modern || gen == mmio_read8(vb->common, VIRTIO_COMMON_CFGGENERATION)) {
+            return v;
+        }
+    }
+}
+
+static uint16_t vp_queue_size(struct virtio_blk *vb, uint16_t index)
+{
+    if (vb->modern) {
+        mmio_write16(vb->common, VIRTIO_COMMON_Q_SELECT, index);
+        return mmio_read16(vb->common, VIRTIO_COMMON_Q_SIZE);
+    }
+    outw((uint16_t)(vb->io_base + VIRTIO_PCI_QUEUE_SEL), index);
+    return inw((uint16_t)(vb->io_base + VIRTIO_PCI_QUEUE_NUM));
+}
+
+/* Hand the rings to the device; returns -1 if it rejects the MSI-X vector. */
+static int vp_activate_queue(struct virtio_blk *vb, struct virtio_vq *vq, uint16_t msix_entry)
+{
+    uint64_t desc = vq->ring_phys;
+    uint64_t avail = desc + (uint64_t)vq->size * sizeof(struct virtq_desc);
+    uint64_t used = (uint64_t)((uint8_t *)vq->used - (uint8_t *)vq->desc) + desc;
+
+    if (!vb->modern) {
+        outw((uint16_t)(vb->io_base + VIRTIO_PCI_QUEUE_SEL), vq->index);
+        if (vb->msix) {
+            outw((uint16_t)(vb->io_base + VIRTIO_PCI_MSIX_QUEUE), msix_entry);
+            if (inw((uint16_t)(vb->io_base + VIRTIO_PCI_MSIX_QUEUE)) != msix_entry) {
+                return -1;
+            }
+        }
+        outl((uint16_t)(vb->io_base + VIRTIO_PCI_QUEUE_PFN), (uint32_t)(desc / VIRTIO_PCI_LEGACY_ALIGN));
+        return 0;
+    }
+
+    mmio_write16(vb->common, VIRTIO_COMMON_Q_SELECT, vq->index);
+    mmio_write16(vb->common, VIRTIO_COMMON_Q_SIZE, vq->size);
+    if (vb->msix) {
+        mmio_write16(vb->common, VIRTIO_COMMON_Q_MSIX, msix_entry);
+        if (mmio_read16(vb->common, VIRTIO_COMMON_Q_MSIX) != msix_entry) {
+            return -1;
+        }
+    }
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_DESCLO, (uint32_t)desc);
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_DESCHI, (uint32_t)(desc >> 32));
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_AVAILLO, (uint32_t)avail);
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_AVAILHI, (uint32_t)(avail >> 32));
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_USEDLO, (uint32_t)used);
+    mmio_write32(vb->common, VIRTIO_COMMON_Q_USEDHI, (uint32_t)(used >> 32));
+    vq->notify_off = mmio_read16(vb->common, VIRTIO_COMMON_Q_NOFF);
+    mmio_write16(vb->common, VIRTIO_COMMON_Q_ENABLE, 1);
+    return 0;
+}
+
+static void vp_notify(struct virtio_blk *vb, struct virtio_vq *vq)
+{
+    if (vb->modern) {
+        mmio_write16(vb->notify_base, (uint32_t)vq->notify_off * vb->notify_mult, vq->index);
+    } else {
+        outw((uint16_t)(vb->io_base + VIRTIO_PCI_QUEUE_NOTIFY), vq->index);
+    }
+}
+
+static volatile uint8_t *vp_map_cap(struct virtio_blk *vb, uint8_t bar, uint32_t offset)
+{
+    if (bar >= PCI_MAX_BARS) {
+        return NULL;
+    }
+    if (!vb->bars[bar]) {
+        vb->bars[bar] = pci_map_bar(vb->pci, bar);
+        if (!vb->bars[bar]) {
+            return NULL;
+        }
+    }
+    return (volatile uint8_t *)vb->bars[bar] + offset;
+}
+
+/* Locate the modern configuration structures; 0 if all four are present. */
+static int vp_find_modern(struct virtio_blk *vb)
+{
+    struct pci_device *dev = vb->pci;
+    if (!(pci_read16(dev, PCI_CFG_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return -1;
+    }
+    uint8_t off = pci_read8(dev, PCI_CFG_CAP_PTR) & 0xFC;
+    for (int guard = 0; off && guard < 48; ++guard) {
+        if (pci_read8(dev, off) == PCI_CAP_ID_VENDOR) {
+            uint8_t type = pci_read8(dev, (uint16_t)(off + 3));
+            uint8_t bar = pci_read8(dev, (uint16_t)(off + 4));
+            uint32_t offset = pci_read32(dev, (uint16_t)(off + 8));
+            /* The spec says to use the first structure of each type. */
+            if (type == VIRTIO_PCI_CAP_COMMON_CFG && !vb->common) {
+                vb->common = vp_map_cap(vb, bar, offset);
+            } else if (type == VIRTIO_PCI_CAP_NOTIFY_CFG && !vb->notify_base) {
+                vb->notify_base = vp_map_cap(vb, bar, offset);
+                vb->notify_mult = pci_read32(dev, (uint16_t)(off + 16));
+            } else if (type == VIRTIO_PCI_CAP_ISR_CFG && !vb->isr) {
+                vb->isr = vp_map_cap(vb, bar, offset);
+            } else if (type == VIRTIO_PCI_CAP_DEVICE_CFG && !vb->devcfg) {
+                vb->devcfg = vp_map_cap(vb, bar, offset);
+            }
+        }
+        off = pci_read8(dev, (uint16_t)(off + 1)) & 0xFC;
+    }
+    return (vb->common && vb->notify_base && vb->isr && vb->devcfg) ? 0 : -1;
+}
+
+/* ---- virtqueue ---- */
+
+static inline void vq_barrier(void)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+/* avail->ring[size] is used_event, used->ring[size] is avail_event (VIRTIO_F_RING_EVENT_IDX). */
+static inline volatile uint16_t *vq_used_event(struct virtio_vq *vq)
+{
+    return (volatile uint16_t *)((uint8_t *)vq->avail + 4 + 2 * (uint64_t)vq->size);
+}
+
+static inline volatile uint16_t *vq_avail_event(struct virtio_vq *vq)
+{
+    return (volatile uint16_t *)((uint8_t *)vq->used + 4 + sizeof(struct virtq_used_elem) * (uint64_t)vq->size);
+}
+
+/* True if the device's event index lies in (old, new], i.e. it wants to hear about this update. */
+static inline int vq_need_event(uint16_t event, uint16_t new_idx, uint16_t old_idx)
+{
+    return (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old_idx);
+}
+
+static void vblk_free_pages(uint64_t phys, uint64_t pages)
+{
+    for (uint64_t i = 0; i < pages; ++i) {
+        pmm_free_page(phys + i * 4096);
+    }
+}
+
+/* Release whatever vq_init and vblk_queue_vector set up; the device must no longer use the ring. */
+static void vq_free(struct virtio_vq *vq)
+{
+    if (vq->vector >= 0) {
+        irq_free_vector(vq->vector);
+        vq->vector = -1;
+    }
+    if (vq->ring_phys) {
+        vblk_free_pages(vq->ring_phys, vq->ring_pages);
+        vq->ring_phys = 0;
+    }
+    if (vq->slots_phys) {
+        vblk_free_pages(vq->slots_phys, vq->slot_pages);
+        vq->slots_phys = 0;
+    }
+    kfree(vq->head_slot);
+    vq->head_slot = NULL;
+}
+
+static int vq_init(struct virtio_vq *vq, uint16_t index, uint16_t size)
+{
+    vq->index = index;
+    vq->size = size;
+    vq->vector = -1;
+    spinlock_init(&vq->lock);
+
+    /* Legacy layout (also valid for modern): desc + avail, then used on the next page. */
+    uint64_t avail_end = (uint64_t)size * sizeof(struct virtq_desc) + 6 + 2ULL * size;
+    uint64_t used_off = (avail_end + VIRTIO_PCI_LEGACY_ALIGN - 1) & ~(uint64_t)(VIRTIO_PCI_LEGACY_ALIGN - 1);
+    uint64_t used_bytes = 6 + sizeof(struct virtq_used_elem) * (uint64_t)size;
+    uint64_t pages = (used_off + used_bytes + 4095) / 4096;
+    uint64_t ring_phys = pmm_alloc_pages(pages);
+    if (!ring_phys) {
+        return -1;
+    }
+    uint8_t *ring = (uint8_t *)phys_to_hhdm(ring_phys);
+    for (uint64_t i = 0; i < pages * 4096; ++i) {
+        ring[i] = 0;
+    }
+    vq->ring_phys = ring_phys;
+    vq->ring_pages = pages;
+    vq->desc = (struct virtq_desc *)ring;
+    vq->avail = (struct virtq_avail *)(ring + (uint64_t)size * sizeof(struct virtq_desc));
+    vq->used = (struct virtq_used *)(ring + used_off);
+
+    for (uint16_t i = 0; i < size; ++i) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->free_head = 0;
+    vq->num_free = size;
+    vq->last_used = 0;
+
+    uint32_t nslots = size < VIRTIO_BLK_SLOTS ? size : VIRTIO_BLK_SLOTS;
+    uint64_t slot_pages = (nslots * sizeof(struct virtio_blk_slot) + 4095) / 4096;
+    uint64_t slots_phys = pmm_alloc_pages(slot_pages);
+    if (slots_phys) {
+        vq->slots_phys = slots_phys;
+        vq->slot_pages = slot_pages;
+    }
+    vq->head_slot = (uint8_t *)kalloc_zero(size, 1);
+    if (!slots_phys || !vq->head_slot) {
+        vq_free(vq);
+        return -1;
+    }
+    vq->slots = (struct virtio_blk_slot *)phys_to_hhdm(slots_phys);
+    vq->slot_free = (nslots >= 64) ? ~0ULL : ((1ULL << nslots) - 1);
+    return 0;
+}
+
+static inline uint64_t vq_slot_phys(const struct virtio_vq *vq, uint32_t slot)
+{
+    return vq->slots_phys + (uint64_t)slot * sizeof(struct virtio_blk_slot);
+}
+
+/* Append a buffer to a slot's descriptor table, splitting at pages and merging contiguous runs. */
+static int vblk_add_segment(const struct virtio_blk *vb, struct virtio_blk_slot *s, uint32_t *n,
+                            const uint8_t *virt, uint64_t len, uint16_t flags)
+{
+    uint32_t seg_limit = vb->size_max ? vb->size_max : 0xFFFFFFFFu;
+    while (len) {
+        uint64_t phys = 0;
+        if (mmu_translate((uint64_t)virt, &phys) != 0) {
+            return -1;
+        }
+        uint64_t chunk = 0x1000 - ((uint64_t)virt & 0xFFF);
+        if (chunk > len) {
+            chunk = len;
+        }
+        struct virtq_desc *last = &s->table[*n - 1];
+        if (*n > 1 && last->addr + last->len == phys && last->len + chunk <= seg_limit) {
+            last->len += (uint32_t)chunk;
+        } else {
+            if (*n >= VIRTIO_BLK_INDIRECT - 1) {
+                return -1;
+            }
+            s->table[*n].addr = phys;
+            s->table[*n].len = (uint32_t)chunk;
+            s->table[*n].flags = flags;
+            ++*n;
+        }
+        virt += chunk;
+        len -= chunk;
+    }
+    return 0;
+}
+
+static void vblk_complete(struct virtio_blk *vb, struct virtio_vq *vq)
+{
+    struct block_request *done_rq[VIRTIO_BLK_SLOTS];
+    int done_status[VIRTIO_BLK_SLOTS];
+    int more = 1;
+
+    while (more) {
+        uint32_t ndone = 0;
+        more = 0;
+        arch_flags_t flags = spinlock_acquire_irqsave(&vq->lock);
+        for (;;) {
+            uint16_t used_idx = *(volatile uint16_t *)&vq->used->idx;
+            if (vq->last_used == used_idx) {
+                if (!vblk_has(vb, VIRTIO_F_RING_EVENT_IDX)) {
+                    break;
+                }
+                /*
+                 * Ask for an interrupt as soon as the device uses the next
+                 * entry, then look again: a completion that landed before
+                 * the device saw the new event index raised none.
+                 */
+                *vq_used_event(vq) = vq->last_used;
+                vq_barrier();
+                if (*(volatile uint16_t *)&vq->used->idx == vq->last_used) {
+                    break;
+                }
+                continue;
+            }
+            if (ndone == VIRTIO_BLK_SLOTS) {
+                more = 1; /* finish these first; the rest go round again */
+                break;
+            }
+            vq_barrier();
+            uint16_t head = (uint16_t)vq->used->ring[vq->last_used % vq->size].id;
+            vq->last_used++;
+            uint8_t slot = vq->head_slot[head];
+
+            /* Return the chain: one descriptor when indirect, the full chain otherwise. */
+            uint16_t tail = head;
+            uint16_t count = 1;
+            while (vq->desc[tail].flags & VIRTQ_DESC_F_NEXT) {
+                tail = vq->desc[tail].next;
+                ++count;
+            }
+            vq->desc[tail].next = vq->free_head;
+            vq->free_head = head;
+            vq->num_free = (uint16_t)(vq->num_free + count);
+
+            done_rq[ndone] = vq->slot_rq[slot];
+            done_status[ndone] = vq->slots[slot].status == VIRTIO_BLK_S_OK ? 0 : -1;
+            ++ndone;
+            vq->slot_rq[slot] = NULL;
+            vq->slot_free |= 1ULL << slot;
+        }
+        spinlock_release_irqrestore(&vq->lock, flags);
+
+        for (uint32_t i = 0; i < ndone; ++i) {
+            block_request_done(&vb->dev, done_rq[i], done_status[i]);
+        }
+    }
+}
+
+static void vblk_irq(void *ctx)
+{
+    struct virtio_vq *vq = (struct virtio_vq *)ctx;
+    vblk_complete(vq->owner, vq);
+}
+
+/* Index of the executing CPU in the ACPI processor list. */
+static uint32_t vblk_this_cpu(void)
+{
+    if (!apic_enabled()) {
+        return 0;
+    }
+    int id = (int)lapic_id();
+    uint8_t count = acpi_cpu_count();
+    for (uint8_t i = 0; i < count; ++i) {
+        if (acpi_cpu_apic_id(i) == id) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+static int vblk_queue_rq(struct block_device *bdev, struct block_request *rq)
+{
+    struct virtio_blk *vb = (struct virtio_blk *)bdev;
+    int indirect = vblk_has(vb, VIRTIO_F_RING_INDIRECT_DESC);
+
+    if (rq->op == BLOCK_OP_FLUSH && !vblk_has(vb, VIRTIO_BLK_F_FLUSH)) {
+        /* No volatile cache to commit: writes are durable once completed. */
+        block_request_done(bdev, rq, 0);
+        return 0;
+    }
+
+    /* Use the submitting CPU's queue; spill to the others rather than stall when it is full. */
+    struct virtio_vq *vq = NULL;
+    uint32_t slot = 0;
+    uint32_t first = vblk_this_cpu() % vb->nvqs;
+    arch_flags_t flags;
+    for (uint32_t i = 0; i < vb->nvqs && !vq; ++i) {
+        struct virtio_vq *cand = &vb->vqs[(first + i) % vb->nvqs];
+        flags = spinlock_acquire_irqsave(&cand->lock);
+        if (cand->slot_free) {
+            slot = (uint32_t)__builtin_ctzll(cand->slot_free);
+            cand->slot_free &= ~(1ULL << slot);
+            vq = cand;
+        }
+        spinlock_release_irqrestore(&cand->lock, flags);
+    }
+    if (!vq) {
+        return BLOCK_QUEUE_BUSY;
+    }
+
+    struct virtio_blk_slot *s = &vq->slots[slot];
+    uint64_t sp = vq_slot_phys(vq, slot);
+    s->hdr.type = rq->op == BLOCK_OP_READ    ? VIRTIO_BLK_T_IN
+                  : rq->op == BLOCK_OP_WRITE ? VIRTIO_BLK_T_OUT
+                                             : VIRTIO_BLK_T_FLUSH;
+    s->hdr.reserved = 0;
+    s->hdr.sector = rq->op == BLOCK_OP_FLUSH ? 0 : rq->lba;
+    s->status = 0xFF;
+
+    uint32_t n = 0;
+    s->table[n].addr = sp + offsetof(struct virtio_blk_slot, hdr);
+    s->table[n].len = sizeof(s->hdr);
+    s->table[n].flags = 0;
+    ++n;
+    int rc = 0;
+    uint16_t data_flags = rq->op == BLOCK_OP_READ ? VIRTQ_DESC_F_WRITE : 0;
+    for (struct bio *bio = rq->bio_head; bio && rq->op != BLOCK_OP_FLUSH && rc == 0; bio = bio->next) {
+        for (uint32_t i = 0; i < bio->vcnt && rc == 0; ++i) {
+            rc = vblk_add_segment(vb, s, &n, (const uint8_t *)bio->vecs[i].buf, bio->vecs[i].len, data_flags);
+        }
+    }
+    s->table[n].addr = sp + offsetof(struct virtio_blk_slot, status);
+    s->table[n].len = 1;
+    s->table[n].flags = VIRTQ_DESC_F_WRITE;
+    ++n;
+    for (uint32_t i = 0; i + 1 < n; ++i) {
+        s->table[i].flags |= VIRTQ_DESC_F_NEXT;
+        s->table[i].next = (uint16_t)(i + 1);
+    }
+
+    flags = spinlock_acquire_irqsave(&vq->lock);
+    uint32_t need = indirect ? 1 : n;
+    if (rc != 0 || need > vq->num_free) {
+        vq->slot_free |= 1ULL << slot;
+        spinlock_release_irqrestore(&vq->lock, flags);
+        return rc != 0 ? -1 : BLOCK_QUEUE_BUSY;
+    }
+    uint16_t head = vq->free_head;
+    if (indirect) {
+        struct virtq_desc *d = &vq->desc[head];
+        vq->free_head = d->next;
+        d->addr = sp + offsetof(struct virtio_blk_slot, table);
+        d->len = n * (uint32_t)sizeof(struct virtq_desc);
+        d->flags = VIRTQ_DESC_F_INDIRECT;
+    } else {
+        uint16_t idx = head;
+        for (uint32_t i = 0; i < n; ++i) {
+            struct virtq_desc *d = &vq->desc[idx];
+            uint16_t next = d->next;
+            d->addr = s->table[i].addr;
+            d->len = s->table[i].len;
+            d->flags = s->table[i].flags & (uint16_t)~VIRTQ_DESC_F_NEXT;
+            if (i + 1 < n) {
+                d->flags |= VIRTQ_DESC_F_NEXT;
+                d->next = next;
+            }
+            idx = next;
+        }
+        vq->free_head = idx;
+    }
+    vq->num_free = (uint16_t)(vq->num_free - need);
+    vq->requests++;
+    vq->head_slot[head] = (uint8_t)slot;
+    vq->slot_rq[slot] = rq;
+
+    uint16_t old = vq->avail->idx;
+    vq->avail->ring[old % vq->size] = head;
+    vq_barrier();
+    vq->avail->idx = (uint16_t)(old + 1);
+    vq_barrier();
+
+    int kick;
+    if (vblk_has(vb, VIRTIO_F_RING_EVENT_IDX)) {
+        kick = vq_need_event(*vq_avail_event(vq), (uint16_t)(old + 1), old);
+    } else {
+        kick = !(*(volatile uint16_t *)&vq->used->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+    if (kick) {
+        vq->notifies++;
+        vp_notify(vb, vq);
+    } else {
+        vq->notifies_suppressed++;
+    }
+    spinlock_release_irqrestore(&vq->lock, flags);
+
+    if (!vb->irq_mode) {
+        for (uint32_t i = 0; i < VIRTIO_BLK_POLL_TIMEOUT && !(vq->slot_free & (1ULL << slot)); ++i) {
+            vblk_complete(vb, vq);
+            arch_cpu_relax();
+        }
+        if (!(vq->slot_free & (1ULL << slot))) {
+            log_warn("virtio-blk: polled request timed out");
+        }
+    }
+    return 0;
+}
+
+static int vblk_setup_msix(struct virtio_blk *vb)
+{
+    if (pci_enable_msix(vb->pci) != 0) {
+        return -1;
+    }
+    vb->msix = 1;
+    /* Configuration changes are not interesting; queue n uses entry n. */
+    if (vb->modern) {
+        mmio_write16(vb->common, VIRTIO_COMMON_MSIX, VIRTIO_MSI_NO_VECTOR);
+    } else {
+        outw((uint16_t)(vb->io_base + VIRTIO_PCI_MSIX_CONFIG), VIRTIO_MSI_NO_VECTOR);
+    }
+    return 0;
+}
+
+/* Give queue vq its own vector on MSI-X entry vq->index. */
+static int vblk_queue_vector(struct virtio_blk *vb, struct virtio_vq *vq)
+{
+    int vector = irq_alloc_vector(vblk_irq, vq);
+    if (vector < 0) {
+        return -1;
+    }
+    /* Only the boot CPU takes interrupts until the APs are started, so aim every queue there. */
+    if (pci_msix_set_vector(vb->pci, vq->index, (uint8_t)vector, 0) != 0) {
+        irq_free_vector(vector);
+        return -1;
+    }
+    vq->vector = vector;
+    return 0;
+}
+
+/* Bring up queues 0..want-1; later failures just leave fewer queues. Returns the smallest ring. */
+static uint16_t vblk_setup_queues(struct virtio_blk *vb, uint16_t want)
+{
+    vb->vqs = (struct virtio_vq *)kalloc_zero(sizeof(struct virtio_vq) * want, 16);
+    if (!vb->vqs) {
+        return 0;
+    }
+    uint16_t min_size = 0;
+    for (uint16_t q = 0; q < want; ++q) {
+        struct virtio_vq *vq = &vb->vqs[q];
+        uint16_t qsize = vp_queue_size(vb, q);
+        if (vb->modern && qsize > VIRTIO_BLK_MAX_QUEUE) {
+            qsize = VIRTIO_BLK_MAX_QUEUE; /* only modern devices accept a smaller ring */
+        }
+        if (qsize == 0 || vq_init(vq, q, qsize) != 0) {
+            break;
+        }
+        vq->owner = vb;
+        if ((vb->irq_mode && vblk_queue_vector(vb, vq) != 0) ||
+            vp_activate_queue(vb, vq, vb->irq_mode ? q : VIRTIO_MSI_NO_VECTOR) != 0) {
+            vq_free(vq);
+            break;
+        }
+        if (!vb->irq_mode) {
+            vq->avail->flags = VIRTQ_AVAIL_F_NO_INTERRUPT;
+        }
+        if (!min_size || qsize < min_size) {
+            min_size = qsize;
+        }
+        vb->nvqs++;
+    }
+    return vb->nvqs ? min_size : 0;
+}
+
+static void vblk_fail(struct virtio_blk *vb, const char *msg)
+{
+    log_warn(msg);
+    vp_set_status(vb, (uint8_t)(vp_get_status(vb) | VIRTIO_STATUS_FAILED));
+}
+
+/*
+ * Give up on a device whose queues may already be live: reset it so it
+ * stops touching the rings, then free them along with their vectors and
+ * the device itself.
+ */
+static void vblk_teardown(struct virtio_blk *vb, const char *msg)
+{
+    log_warn(msg);
+    vp_reset(vb);
+    for (uint16_t q = 0; vb->vqs && q < vb->nvqs; ++q) {
+        vq_free(&vb->vqs[q]);
+    }
+    if (vb->msix) {
+        pci_disable_msix(vb->pci);
+    }
+    vp_set_status(vb, VIRTIO_STATUS_FAILED);
+    kfree(vb->vqs);
+    kfree(vb);
+}
+
+static int vblk_probe(struct pci_device *dev, const struct pci_device_id *id)
+{
+    (void)id;
+    if (vblk_count >= VIRTIO_BLK_MAX_DEVICES) {
+        return -1;
+    }
+    struct virtio_blk *vb = (struct virtio_blk *)kalloc_zero(sizeof(*vb), 16);
+    if (!vb) {
+        return -1;
+    }
+    vb->pci = dev;
+    if (vp_find_modern(vb) == 0) {
+        vb->modern = 1;
+    } else if (dev->bars[0].type == PCI_BAR_IO) {
+        vb->io_base = (uint16_t)dev->bars[0].base;
+    } else {
+        log_warn("virtio-blk: no usable transport");
+        kfree(vb);
+        return -1;
+    }
+    pci_enable_device(dev, 1);
+
+    vp_reset(vb);
+    vp_set_status(vb, VIRTIO_STATUS_ACKNOWLEDGE);
+    vp_set_status(vb, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+
+    uint64_t wanted = (1ULL << VIRTIO_BLK_F_SIZE_MAX) | (1ULL << VIRTIO_BLK_F_SEG_MAX) |
+                      (1ULL << VIRTIO_BLK_F_FLUSH) | (1ULL << VIRTIO_F_RING_INDIRECT_DESC) |
+                      (1ULL << VIRTIO_F_RING_EVENT_IDX) | (1ULL << VIRTIO_BLK_F_MQ);
+    if (vb->modern) {
+        wanted |= 1ULL << VIRTIO_F_VERSION_1;
+    }
+    vb->features = vp_get_features(vb) & wanted;
+    vp_set_features(vb, vb->features);
+    if (vb->modern) {
+        vp_set_status(vb, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER | VIRTIO_STATUS_FEATURES_OK);
+        if (!(vp_get_status(vb) & VIRTIO_STATUS_FEATURES_OK) || !vblk_has(vb, VIRTIO_F_VERSION_1)) {
+            vblk_fail(vb, "virtio-blk: feature negotiation failed");
+            kfree(vb);
+            return -1;
+        }
+    }
+
+    /* MSI-X moves the legacy config window, so decide on it before reading config. */
+    vb->irq_mode = vblk_setup_msix(vb) == 0;
+    if (!vb->irq_mode) {
+        pci_write16(dev, PCI_CFG_COMMAND, (uint16_t)(pci_read16(dev, PCI_CFG_COMMAND) | PCI_COMMAND_INTX_DISABLE));
+        log_warn("virtio-blk: MSI-X unavailable, completing by polling");
+    }
+
+    /* One queue per CPU, bounded by what the device offers and the MSI-X entries it has. */
+    uint16_t want = 1;
+    if (vb->irq_mode && vblk_has(vb, VIRTIO_BLK_F_MQ)) {
+        want = vp_config_read16(vb, offsetof(struct virtio_blk_config, num_queues));
+        uint16_t cpus = acpi_cpu_count() ? acpi_cpu_count() : 1;
+        if (want > cpus) {
+            want = cpus;
+        }
+        if (want > dev->msix_entries) {
+            want = dev->msix_entries;
+        }
+        if (want > VIRTIO_BLK_MAX_VQS) {
+            want = VIRTIO_BLK_MAX_VQS;
+        }
+        if (want == 0) {
+            want = 1;
+        }
+    }
+    uint16_t qsize = vblk_setup_queues(vb, want);
+    if (qsize == 0) {
+        vblk_teardown(vb, "virtio-blk: queue setup failed");
+        return -1;
+    }
+
+    uint64_t max_sectors = VIRTIO_BLK_MAX_SEGS / 2; /* a sector buffer may straddle a page */
+    if (vblk_has(vb, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = vp_config_read32(vb, offsetof(struct virtio_blk_config, seg_max));
+        if (seg_max && seg_max < VIRTIO_BLK_MAX_SEGS) {
+            max_sectors = seg_max / 2 ? seg_max / 2 : 1;
+        }
+    }
+    if (!vblk_has(vb, VIRTIO_F_RING_INDIRECT_DESC) && max_sectors > (uint64_t)(qsize - 2) / 2) {
+        /* Direct chains must fit in the ring or a request could never be posted. */
+        max_sectors = qsize > 3 ? (uint64_t)(qsize - 2) / 2 : 0;
+    }
+    if (vblk_has(vb, VIRTIO_BLK_F_SIZE_MAX)) {
+        vb->size_max = vp_config_read32(vb, offsetof(struct virtio_blk_config, size_max));
+        if (vb->size_max && vb->size_max < 4096) {
+            max_sectors = 1;
+        }
+    }
+
+    if (max_sectors == 0) {
+        vblk_teardown(vb, "virtio-blk: ring too small");
+        return -1;
+    }
+    vb->dev.sectors = vp_config_read64(vb, offsetof(struct virtio_blk_config, capacity));
+    vb->dev.sector_size = 512;
+    vb->dev.max_sectors = max_sectors;
+    vb->dev.queue_rq = vblk_queue_rq;
+    vb->name[0] = 'v';
+    vb->name[1] = 'b';
+    vb->name[2] = 'l';
+    vb->name[3] = 'k';
+    vb->name[4] = (char)('0' + vblk_count);
+    vb->name[5] = '\0';
+    vb->dev.name = vb->name;
+    dev->driver_data = vb;
+    vblk_devices[vblk_count++] = vb;
+
+    vp_set_status(vb, (uint8_t)(vp_get_status(vb) | VIRTIO_STATUS_DRIVER_OK));
+
+    log_info(vb->modern ? "virtio-blk: modern device" : "virtio-blk: legacy device");
+    log_info_hex("virtio-blk: sectors", vb->dev.sectors);
+    log_info_hex("virtio-blk: queue size", qsize);
+    log_info_hex("virtio-blk: queues", vb->nvqs);
+    log_info_hex("virtio-blk: features", vb->features);
+
+    if (block_get_default() == block_get_ramdisk()) {
+        block_set_default(&vb->dev);
+    }
+    return 0;
+}
+
+static const struct pci_device_id vblk_ids[] = {
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK_LEGACY, PCI_ANY_ID, PCI_ANY_ID },
+    { VIRTIO_PCI_VENDOR, VIRTIO_PCI_DEVICE_BLK, PCI_ANY_ID, PCI_ANY_ID },
+    { 0, 0, 0, 0 },
+};
+
+static struct pci_driver vblk_driver = {
+    .name = "virtio-blk",
+    .ids = vblk_ids,
+    .probe = vblk_probe,
+};
+
+void virtio_init(void)
+{
+    pci_register_driver(&vblk_driver);
+}
+
+void virtio_blk_dump(void)
+{
+    for (int d = 0; d < vblk_count; ++d) {
+        struct virtio_blk *vb = vblk_devices[d];
+        console_write(vb->name);
+        console_write(vb->modern ? " (modern):\n" : " (legacy):\n");
+        for (uint16_t q = 0; q < vb->nvqs; ++q) {
+            struct virtio_vq *vq = &vb->vqs[q];
+            console_write("  vq");
+            console_write_hex(q);
+            console_write(" requests=");
+            console_write_hex(vq->requests);
+            console_write(" notifies=");
+            console_write_hex(vq->notifies);
+            console_write(" suppressed=");
+            console_write_hex(vq->notifies_suppressed);
+            console_write("\n");
+        }
+    }
+}
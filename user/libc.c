@@ -84,3 +84,18 @@ int sys_getcwd(char *buf, size_t size)
 {
     return (int)syscall2(SYSCALL_GETCWD, (uint64_t)buf, size);
 }
+
+int sys_fsync(int fd)
+{
+    return (int)syscall1(SYSCALL_FSYNC, (uint64_t)fd);
+}
+
+int sys_opendir(const char *path)
+{
+    return (int)syscall2(SYSCALL_OPEN, (uint64_t)path, SYSCALL_OPEN_DIRECTORY);
+}
+
+long sys_getdents(int fd, struct dirent *buf, size_t len)
+{
+    return syscall3(SYSCALL_GETDENTS, (uint64_t)fd, (uint64_t)buf, len);
+}
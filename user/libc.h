@@ -15,3 +15,7 @@ int sys_pipe(int pipefd[2]);
 int sys_spawn2(const char *path, const char *const *argv, const char *const *envp, const int *fd_map);
 int sys_chdir(const char *path);
 int sys_getcwd(char *buf, size_t size);
+int sys_fsync(int fd);
+int sys_opendir(const char *path);
+/* Fills buf with whole records; returns bytes used, 0 at the end of the directory. */
+long sys_getdents(int fd, struct dirent *buf, size_t len);
@@ -3,6 +3,7 @@
 
 #define HEAP_SIZE 32768
 #define MAX_ENTRIES 512
+#define DIRENT_BATCH 8
 
 static char heap[HEAP_SIZE];
 static size_t heap_top = 0;
@@ -32,30 +33,12 @@ static void write_char(char c)
     sys_write(1, &c, 1);
 }
 
-static int startswith(const char *s, const char *prefix)
-{
-    while (*prefix) {
-        if (*s++ != *prefix++) return 0;
-    }
-    return 1;
-}
-
 static void print_entry(const char *name)
 {
     write_str(name);
     write_str("\n");
 }
 
-static char *strdup_heap(const char *s)
-{
-    size_t len = strlen(s);
-    char *d = simple_alloc(len + 1);
-    if (d) {
-        for (size_t i = 0; i <= len; ++i) d[i] = s[i];
-    }
-    return d;
-}
-
 /* Simple shell sort */
 static void sort_entries(const char **entries, int count)
 {
@@ -71,59 +54,12 @@ static void sort_entries(const char **entries, int count)
     }
 }
 
+static struct dirent batch[DIRENT_BATCH];
+
 static void list_directory(const char *target_path, int show_hidden)
 {
-    char list_req[256];
-    char *abs_path = simple_alloc(256);
-    if (!abs_path) {
-        write_str("ls: out of memory (abs_path)\n");
-        return;
-    }
-
-    /* Resolve absolute path */
-    if (target_path[0] == '/') {
-        int i = 0;
-        for (; target_path[i] && i < 255; ++i) abs_path[i] = target_path[i];
-        abs_path[i] = '\0';
-    } else {
-        char cwd[256];
-        if (sys_getcwd(cwd, 256) < 0) {
-            cwd[0] = '/';
-            cwd[1] = '\0';
-        }
-        size_t cwd_len = strlen(cwd);
-        size_t tgt_len = strlen(target_path);
-        
-        int pos = 0;
-        for (size_t k=0; k<cwd_len; ++k) abs_path[pos++] = cwd[k];
-        if (pos > 0 && abs_path[pos-1] != '/') abs_path[pos++] = '/';
-        for (size_t k=0; k<tgt_len; ++k) abs_path[pos++] = target_path[k];
-        abs_path[pos] = '\0';
-    }
-    
-    /* Canonicalize: remove /./, resolve .., remove trailing / */
-    // Simple pass for now: if ends in /., remove .
-    size_t len = strlen(abs_path);
-    if (len >= 2 && abs_path[len-1] == '.' && abs_path[len-2] == '/') {
-        abs_path[len-1] = '\0';
-        len--;
-    }
-    if (len > 1 && abs_path[len-1] == '/') {
-        abs_path[len-1] = '\0';
-        len--;
-    }
-    
-    /* Construct /dev/ls/<abs_path> */
-    {
-        const char *prefix = "/dev/ls";
-        int pos = 0;
-        for (int i=0; prefix[i]; ++i) list_req[pos++] = prefix[i];
-        if (abs_path[0] != '/') list_req[pos++] = '/';
-        for (int i=0; abs_path[i]; ++i) list_req[pos++] = abs_path[i];
-        list_req[pos] = '\0';
-    }
-
-    long fd = sys_open(list_req);
+    /* The kernel resolves relative paths against the cwd. */
+    int fd = sys_opendir(target_path);
     if (fd < 0) {
         write_str("ls: cannot access '");
         write_str(target_path);
@@ -131,108 +67,41 @@ static void list_directory(const char *target_path, int show_hidden)
         return;
     }
 
-    /* Read all listing */
-    char *buf = simple_alloc(16384);
-    if (!buf) {
-        write_str("ls: buffer allocation failed\n");
+    const char **entries = simple_alloc(MAX_ENTRIES * sizeof(char*));
+    if (!entries) {
+        write_str("ls: entries allocation failed\n");
         sys_close(fd);
         return;
     }
+    int count = 0;
 
-    long total_read = 0;
     for (;;) {
-        long n = sys_read(fd, buf + total_read, 16384 - total_read);
+        long n = sys_getdents(fd, batch, sizeof(batch));
         if (n < 0) {
-           write_str("ls: read error\n");
-           break;
+            write_str("ls: read error\n");
+            break;
         }
         if (n == 0) break;
-        total_read += n;
-        if (total_read >= 16384) break;
-    }
-    sys_close(fd);
-    buf[total_read] = '\0';
-
-    /* Parse and Filter */
-    const char **entries = simple_alloc(MAX_ENTRIES * sizeof(char*));
-    if (!entries) {
-        write_str("ls: entries allocation failed\n");
-        return;
-    }
-    int count = 0;
-    
-    char *line = buf;
-    char *next_line = buf;
-    
-    size_t prefix_len = strlen(abs_path);
-    if (prefix_len > 1 && abs_path[prefix_len-1] == '/') prefix_len--;
-    /* If root, prefix_len is 1 ('/') */
-
-    while (*line && count < MAX_ENTRIES) {
-        while (*next_line && *next_line != '\n') next_line++;
-        int had_newline = (*next_line == '\n');
-        *next_line = '\0';
-        
-        if (startswith(line, abs_path)) {
-            int match = 0;
-            const char *suffix = NULL;
-            
-            /* Logic: 
-               abs_path="/", line="/bin" -> match. suffix="bin".
-               abs_path="/bin", line="/bin/ls" -> match. suffix="ls".
-            */
-            
-            if (abs_path[1] == '\0' && abs_path[0] == '/') {
-                if (line[0] == '/') {
-                    suffix = line + 1;
-                    match = 1;
-                }
-            } else {
-                /* abs_path="/bin" */
-                if (line[prefix_len] == '/' || line[prefix_len] == '\0') {
-                    suffix = line + prefix_len;
-                    if (*suffix == '/') suffix++;
-                    match = 1;
-                }
-            }
-
-            if (match && suffix && *suffix != '\0') {
-                char *entry_name = strdup_heap(suffix);
-                if (entry_name) {
-                    /* Truncate at slash */
-                    for (int i=0; entry_name[i]; ++i) {
-                        if (entry_name[i] == '/') {
-                            entry_name[i] = '\0';
-                            break;
-                        }
-                    }
-                    
-                    int exists = 0;
-                    for (int k=0; k<count; ++k) {
-                        if (strcmp(entries[k], entry_name) == 0) {
-                            exists = 1;
-                            break;
-                        }
-                    }
-                    if (!exists) {
-                        if (show_hidden || entry_name[0] != '.') {
-                            entries[count++] = entry_name;
-                        }
-                    }
-                }
+        for (long i = 0; i < n / (long)sizeof(struct dirent) && count < MAX_ENTRIES; ++i) {
+            const char *name = batch[i].name;
+            if (!show_hidden && name[0] == '.') continue;
+            int is_dir = batch[i].type == DIRENT_DIR;
+            size_t len = strlen(name);
+            char *entry_name = simple_alloc(len + 2);
+            if (!entry_name) {
+                write_str("ls: out of memory\n");
+                break;
             }
-        }
-
-        if (had_newline) {
-            next_line++;
-            line = next_line;
-        } else {
-            break;
+            for (size_t k = 0; k < len; ++k) entry_name[k] = name[k];
+            if (is_dir) entry_name[len++] = '/';
+            entry_name[len] = '\0';
+            entries[count++] = entry_name;
         }
     }
-    
+    sys_close(fd);
+
     sort_entries(entries, count);
-    
+
     for (int i = 0; i < count; ++i) {
         print_entry(entries[i]);
     }
@@ -17,6 +17,23 @@ enum {
     SYSCALL_PIPE = 12,
     SYSCALL_CHDIR = 13,
     SYSCALL_GETCWD = 14,
+    SYSCALL_FSYNC = 15,
+    SYSCALL_GETDENTS = 16,
+    SYSCALL_FALLOCATE = 17,
+};
+
+#define SYSCALL_OPEN_DIRECTORY 0x1
+
+#define DIRENT_NAME_MAX 255
+#define DIRENT_FILE 1
+#define DIRENT_DIR 2
+
+/* Record returned by SYSCALL_GETDENTS; matches struct vfs_dirent in the kernel. */
+struct dirent {
+    uint64_t size;
+    uint32_t type;
+    uint32_t name_len;
+    char name[DIRENT_NAME_MAX + 1];
 };
 
 static inline long syscall1(long num, long a1)
@@ -163,6 +180,11 @@ static inline long sys_open(const char *path)
     return syscall3(SYSCALL_OPEN, (long)path, 0, 0);
 }
 
+static inline long sys_fallocate(long fd, unsigned long size)
+{
+    return syscall3(SYSCALL_FALLOCATE, fd, (long)size, 0);
+}
+
 static inline long sys_close(long fd)
 {
     return syscall3(SYSCALL_CLOSE, fd, 0, 0);